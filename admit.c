@@ -0,0 +1,161 @@
+/*
+ * Admission filter of new items, TinyLFU.
+ *
+ * A key's frequency is estimated by the minimum of its @ADMIT_ROWS
+ * counters in the count-min sketch. The first record of a key only
+ * sets its bits in the doorkeeper, so the keys seen once, which are
+ * the majority, do not pollute the counters. After @sample_limit
+ * records, all counters are halved and the doorkeeper is cleared,
+ * so the frequencies stay recent.
+ *
+ * Only the first HASH_ID_LEN (12) bytes of hash id are meaningful,
+ * and the 3rd 32 bits decide the shard. So the 1st and 2nd 32 bits
+ * are the base indexes of the counters and the doorkeeper, and the
+ * step between rows, the second hash, is mixed from both of them.
+ *
+ * Author: Wu Bingzheng
+ *
+ */
+
+#include "fcache.h"
+
+#define ADMIT_WIDTH_MIN		1024
+#define ADMIT_COUNTER_MAX	15
+
+/* odd, so the rows of a key differ */
+static inline uint32_t admit_hash2(uint32_t *words)
+{
+	return ((words[1] ^ (words[0] >> 16)) * 0x9e3779b1U) | 1;
+}
+
+static inline unsigned long admit_counter_index(fca_admit_t *admit,
+		uint32_t *words, int row)
+{
+	unsigned long index = (words[0] + row * admit_hash2(words)) & admit->width_mask;
+	return (admit->width_mask + 1) * row + index;
+}
+
+static inline int admit_counter_get(fca_admit_t *admit, unsigned long i)
+{
+	return (admit->counters[i >> 1] >> ((i & 1) * 4)) & ADMIT_COUNTER_MAX;
+}
+
+static inline void admit_counter_inc(fca_admit_t *admit, unsigned long i)
+{
+	if (admit_counter_get(admit, i) != ADMIT_COUNTER_MAX) {
+		admit->counters[i >> 1] += 1 << ((i & 1) * 4);
+	}
+}
+
+static inline unsigned long admit_doorkeeper_bit(fca_admit_t *admit,
+		uint32_t *words, int n)
+{
+	return (words[1] + n * admit_hash2(words)) & admit->doorkeeper_mask;
+}
+
+static int admit_doorkeeper_test(fca_admit_t *admit, uint32_t *words)
+{
+	unsigned long b0 = admit_doorkeeper_bit(admit, words, 0);
+	unsigned long b1 = admit_doorkeeper_bit(admit, words, 1);
+
+	return (admit->doorkeeper[b0 / 64] & (1UL << (b0 % 64)))
+		&& (admit->doorkeeper[b1 / 64] & (1UL << (b1 % 64)));
+}
+
+static void admit_doorkeeper_set(fca_admit_t *admit, uint32_t *words)
+{
+	unsigned long b0 = admit_doorkeeper_bit(admit, words, 0);
+	unsigned long b1 = admit_doorkeeper_bit(admit, words, 1);
+
+	admit->doorkeeper[b0 / 64] |= 1UL << (b0 % 64);
+	admit->doorkeeper[b1 / 64] |= 1UL << (b1 % 64);
+}
+
+/* the filter remembers about @keys keys */
+int admit_init(fca_admit_t *admit, long keys)
+{
+	unsigned long width = ADMIT_WIDTH_MIN;
+
+	while (width < (unsigned long)keys) {
+		width *= 2;
+	}
+
+	/* 4 bits per counter, and 8 bits per key in doorkeeper */
+	admit->counters = calloc(width * ADMIT_ROWS / 2, 1);
+	admit->doorkeeper = calloc(width / 8, sizeof(unsigned long));
+	if (admit->counters == NULL || admit->doorkeeper == NULL) {
+		admit_destroy(admit);
+		return FCA_ERROR;
+	}
+
+	admit->keys = keys;
+	admit->width_mask = width - 1;
+	admit->doorkeeper_mask = width * 8 - 1;
+	admit->samples = 0;
+	admit->sample_limit = width * 10;
+	admit->key_nr = 0;
+	return FCA_OK;
+}
+
+void admit_destroy(fca_admit_t *admit)
+{
+	free(admit->counters);
+	free(admit->doorkeeper);
+	admit->counters = NULL;
+	admit->doorkeeper = NULL;
+	admit->key_nr = 0;
+}
+
+/* return the frequency of @id before this record */
+int admit_record(fca_admit_t *admit, unsigned char *id)
+{
+	uint32_t *words = (uint32_t *)id;
+	int row, freq;
+
+	freq = admit_estimate(admit, id);
+
+	if (freq == 0) {
+		admit_doorkeeper_set(admit, words);
+		admit->key_nr++;
+	} else {
+		for (row = 0; row < ADMIT_ROWS; row++) {
+			admit_counter_inc(admit, admit_counter_index(admit, words, row));
+		}
+	}
+
+	if (++admit->samples >= admit->sample_limit) {
+		admit_age(admit);
+	}
+	return freq;
+}
+
+int admit_estimate(fca_admit_t *admit, unsigned char *id)
+{
+	uint32_t *words = (uint32_t *)id;
+	int row, count, min = ADMIT_COUNTER_MAX;
+
+	if (!admit_doorkeeper_test(admit, words)) {
+		return 0;
+	}
+
+	for (row = 0; row < ADMIT_ROWS; row++) {
+		count = admit_counter_get(admit, admit_counter_index(admit, words, row));
+		if (count < min) {
+			min = count;
+		}
+	}
+	return min + 1;
+}
+
+void admit_age(fca_admit_t *admit)
+{
+	unsigned long i, size = (admit->width_mask + 1) * ADMIT_ROWS / 2;
+
+	/* halve both counters in each byte */
+	for (i = 0; i < size; i++) {
+		admit->counters[i] = (admit->counters[i] >> 1) & 0x77;
+	}
+	bzero(admit->doorkeeper, (admit->doorkeeper_mask + 1) / 8);
+	admit->samples = 0;
+	admit->key_nr = 0;
+}
@@ -0,0 +1,60 @@
+/*
+ * Admission filter of new items, TinyLFU. It remembers approximate
+ * frequencies of keys in a count-min sketch with a doorkeeper, instead
+ * of keeping the keys themselves.
+ *
+ * Each shard of each server has its own filter, protected by the
+ * shard lock.
+ *
+ * Author: Wu Bingzheng
+ *
+ */
+
+#ifndef _FCA_ADMIT_H_
+#define _FCA_ADMIT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define ADMIT_ROWS		4
+
+typedef struct {
+	/* remembers about @keys keys */
+	long		keys;
+
+	/* @ADMIT_ROWS rows of 4-bit counters, @width_mask+1 each */
+	unsigned char	*counters;
+	unsigned long	width_mask;
+
+	/* Bloom filter of keys seen once since the last aging */
+	unsigned long	*doorkeeper;
+	unsigned long	doorkeeper_mask;
+
+	/* aged after @sample_limit records */
+	long		samples;
+	long		sample_limit;
+
+	/* keys in doorkeeper */
+	long		key_nr;
+} fca_admit_t;
+
+int admit_init(fca_admit_t *admit, long keys);
+void admit_destroy(fca_admit_t *admit);
+
+int admit_record(fca_admit_t *admit, unsigned char *id);
+int admit_estimate(fca_admit_t *admit, unsigned char *id);
+void admit_age(fca_admit_t *admit);
+
+static inline int admit_ready(fca_admit_t *admit)
+{
+	return admit->counters != NULL;
+}
+
+static inline size_t admit_memory(fca_admit_t *admit)
+{
+	return admit->counters == NULL ? 0
+		: (admit->width_mask + 1) * ADMIT_ROWS / 2
+		+ (admit->doorkeeper_mask + 1) / 8;
+}
+
+#endif
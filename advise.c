@@ -0,0 +1,114 @@
+/*
+ * Page cache advice of devices.
+ *
+ * Items not smaller than @device_fadvise_size are dropped from the
+ * page cache after being sent, so the big ones streamed once do not
+ * evict the small hot ones. So are new items written by PUT, unless
+ * the admission filter has seen the key, which means it is hit again
+ * probably.
+ *
+ * The pages being sent by sendfile(), or dirty, can not be dropped at
+ * once. So the writeback of PUT is started, and the drops are done
+ * ADVISE_DROP_DELAY seconds later.
+ *
+ * A Range request starting where the last one of the same item ends
+ * is sequential, so the next @device_readahead bytes are read ahead.
+ *
+ * Author: Wu Bingzheng
+ *
+ */
+
+#define _GNU_SOURCE /* for sync_file_range */
+#include "fcache.h"
+
+static void advise_drop(fca_advise_t *a)
+{
+	int i = a->drop_head;
+
+	if (posix_fadvise(a->drops[i].fd, a->drops[i].offset, a->drops[i].len,
+				POSIX_FADV_DONTNEED) == 0) {
+		a->dontneed_bytes += a->drops[i].len;
+	}
+	a->drop_head = (i + 1) % ADVISE_DROPS;
+	a->drop_nr--;
+}
+
+static void advise_drop_later(fca_advise_t *a, int fd, off_t offset,
+		size_t len, time_t now)
+{
+	int i;
+
+	if (a->drop_nr == ADVISE_DROPS) {
+		advise_drop(a);
+	}
+	i = (a->drop_head + a->drop_nr) % ADVISE_DROPS;
+	a->drops[i].fd = fd;
+	a->drops[i].offset = offset;
+	a->drops[i].len = len;
+	a->drops[i].time = now;
+	a->drop_nr++;
+}
+
+/* a GET sends the whole item */
+void advise_get(fca_advise_t *a, int fd, fca_item_t *item, time_t now)
+{
+	if (device_fadvise_size != 0 && item->length >= device_fadvise_size) {
+		advise_drop_later(a, fd, item->offset, item->length, now);
+	}
+}
+
+/* a GET sends [@start, @end] of the item's body */
+void advise_range(fca_advise_t *a, int fd, fca_item_t *item,
+		off_t start, off_t end, time_t now)
+{
+	off_t body = item->offset + item->headers_len;
+	off_t body_len = item->length - item->headers_len;
+	size_t len;
+	int i = ((uintptr_t)item >> 4) % ADVISE_RANGES;
+	int sequential = (a->ranges[i].item == item && a->ranges[i].next == start);
+
+	a->ranges[i].item = item;
+	a->ranges[i].next = end + 1;
+
+	if (device_fadvise_size != 0 && item->length >= device_fadvise_size) {
+		advise_drop_later(a, fd, body + start, end - start + 1, now);
+	}
+
+	if (!sequential || device_readahead == 0 || end + 1 >= body_len) {
+		return;
+	}
+	a->sequentials++;
+
+	len = body_len - (end + 1);
+	if (len > device_readahead) {
+		len = device_readahead;
+	}
+	if (posix_fadvise(fd, body + end + 1, len, POSIX_FADV_WILLNEED) == 0) {
+		a->willneed_bytes += len;
+	}
+}
+
+/* a PUT writes the whole item. @freq is the key's frequency by the
+ * admission filter. */
+void advise_put(fca_advise_t *a, int fd, fca_item_t *item, int freq,
+		time_t now)
+{
+	if (device_fadvise_size == 0 || item->length < device_fadvise_size
+			|| freq != 0) {
+		return;
+	}
+
+	if (sync_file_range(fd, item->offset, item->length,
+				SYNC_FILE_RANGE_WRITE) == 0) {
+		advise_drop_later(a, fd, item->offset, item->length, now);
+	}
+}
+
+/* worker call this in each loop */
+void advise_expire(fca_advise_t *a, time_t now)
+{
+	while (a->drop_nr != 0
+			&& a->drops[a->drop_head].time + ADVISE_DROP_DELAY < now) {
+		advise_drop(a);
+	}
+}
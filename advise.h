@@ -0,0 +1,55 @@
+/*
+ * Page cache advice of devices, by the access pattern of items.
+ *
+ * Each worker thread has its own state, so no lock.
+ *
+ * Author: Wu Bingzheng
+ *
+ */
+
+#ifndef _FCA_ADVISE_H_
+#define _FCA_ADVISE_H_
+
+#include <stddef.h>
+#include <time.h>
+#include <sys/types.h>
+
+typedef struct fca_item_s fca_item_t;
+
+#define ADVISE_RANGES		256
+#define ADVISE_DROPS		64
+#define ADVISE_DROP_DELAY	1	/* seconds */
+
+typedef struct {
+	/* where the last Range request of the item ends, direct-mapped
+	 * by item, so old ones are overwritten */
+	struct {
+		fca_item_t	*item;
+		off_t		next;
+	} ranges[ADVISE_RANGES];
+
+	/* spaces to drop from the page cache later. A ring, and the
+	 * oldest ones are dropped earlier if it's full. */
+	struct {
+		int		fd;
+		off_t		offset;
+		size_t		len;
+		time_t		time;
+	} drops[ADVISE_DROPS];
+	int		drop_head;
+	int		drop_nr;
+
+	/* statistics */
+	unsigned long	dontneed_bytes;
+	unsigned long	willneed_bytes;
+	unsigned long	sequentials;
+} fca_advise_t;
+
+void advise_get(fca_advise_t *a, int fd, fca_item_t *item, time_t now);
+void advise_range(fca_advise_t *a, int fd, fca_item_t *item,
+		off_t start, off_t end, time_t now);
+void advise_put(fca_advise_t *a, int fd, fca_item_t *item, int freq,
+		time_t now);
+void advise_expire(fca_advise_t *a, time_t now);
+
+#endif
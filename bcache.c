@@ -0,0 +1,250 @@
+/*
+ * Userspace block cache of devices in direct IO mode.
+ *
+ * The device is cached in aligned blocks of BCACHE_BLOCK_SIZE, read
+ * by O_DIRECT. Blocks are evicted by CLOCK, while each block's weight
+ * starts from the frequency of the item reading it, which is given
+ * by the admission filter, and increases on hits. The hand decreases
+ * the weight, and evicts the block at 0. So blocks of hot items
+ * survive more rounds than the ones of scans.
+ *
+ * A missing block is indexed and marked loading before being read
+ * without the lock, and others wanting it wait for the read.
+ *
+ * The cache is not written through. The writer invalidates the
+ * blocks it covers after writing, which are dropped from the index
+ * at once, even if being read by other workers, and reused after the
+ * requests using them put them.
+ *
+ * Author: Wu Bingzheng
+ *
+ */
+
+#include "fcache.h"
+
+int bcache_init(fca_bcache_t *bc, size_t size)
+{
+	unsigned long i, buckets = 64;
+
+	bzero(bc, sizeof(fca_bcache_t));
+	bc->block_max = size / BCACHE_BLOCK_SIZE;
+	if (bc->block_max == 0) {
+		bc->block_max = 1;
+	}
+	while (buckets < (unsigned long)bc->block_max) {
+		buckets *= 2;
+	}
+
+	bc->blocks = calloc(bc->block_max, sizeof(fca_bcache_block_t));
+	bc->buckets = malloc(sizeof(struct list_head) * buckets);
+	if (bc->blocks == NULL || bc->buckets == NULL) {
+		free(bc->blocks);
+		free(bc->buckets);
+		return FCA_ERROR;
+	}
+
+	bc->bucket_mask = buckets - 1;
+	for (i = 0; i < buckets; i++) {
+		INIT_LIST_HEAD(&bc->buckets[i]);
+	}
+	pthread_mutex_init(&bc->lock, NULL);
+	pthread_cond_init(&bc->loaded, NULL);
+	return FCA_OK;
+}
+
+void bcache_destroy(fca_bcache_t *bc)
+{
+	long i;
+	for (i = 0; i < bc->block_nr; i++) {
+		free(bc->blocks[i].data);
+	}
+	free(bc->blocks);
+	free(bc->buckets);
+	pthread_mutex_destroy(&bc->lock);
+	pthread_cond_destroy(&bc->loaded);
+	bc->blocks = NULL;
+	bc->buckets = NULL;
+	bc->block_nr = 0;
+}
+
+static inline struct list_head *bcache_bucket(fca_bcache_t *bc, off_t offset)
+{
+	return &bc->buckets[(offset / BCACHE_BLOCK_SIZE) & bc->bucket_mask];
+}
+
+static fca_bcache_block_t *bcache_search(fca_bcache_t *bc, off_t offset)
+{
+	struct list_head *p, *head = bcache_bucket(bc, offset);
+	fca_bcache_block_t *block;
+
+	list_for_each(p, head) {
+		block = list_entry(p, fca_bcache_block_t, hash_node);
+		if (block->offset == offset) {
+			return block;
+		}
+	}
+	return NULL;
+}
+
+/* a new block if not full, otherwise evict one by CLOCK */
+static fca_bcache_block_t *bcache_victim(fca_bcache_t *bc)
+{
+	fca_bcache_block_t *block;
+	long i;
+
+	if (bc->block_nr < bc->block_max) {
+		block = &bc->blocks[bc->block_nr];
+		if (posix_memalign((void **)&block->data, BCACHE_ALIGN,
+					BCACHE_BLOCK_SIZE) == 0) {
+			block->offset = -1;
+			INIT_LIST_HEAD(&block->hash_node);
+			bc->block_nr++;
+			return block;
+		}
+		if (bc->block_nr == 0) {
+			errno = ENOMEM;
+			return NULL;
+		}
+	}
+
+	/* the unpinned ones lose all weight in BCACHE_WEIGHT_MAX rounds */
+	for (i = 0; i < bc->block_nr * (BCACHE_WEIGHT_MAX + 1); i++) {
+		block = &bc->blocks[bc->hand];
+		if (++bc->hand == bc->block_nr) {
+			bc->hand = 0;
+		}
+		if (block->refs != 0) {
+			continue;
+		}
+		if (block->weight == 0) {
+			if (!list_empty(&block->hash_node)) {
+				list_del_init(&block->hash_node);
+				bc->evicts++;
+			}
+			block->offset = -1;
+			return block;
+		}
+		block->weight--;
+	}
+
+	/* all pinned */
+	errno = EBUSY;
+	return NULL;
+}
+
+static inline int bcache_weight(int freq)
+{
+	return freq < BCACHE_WEIGHT_MAX ? freq + 1 : BCACHE_WEIGHT_MAX;
+}
+
+/* return the block containing @offset, read from @fd if missing.
+ * @freq is the frequency of the item reading it.
+ * Return NULL with errno EBUSY or ENOMEM if no block to use, and
+ * the caller should read by other way. */
+fca_bcache_block_t *bcache_get(fca_bcache_t *bc, int fd, off_t offset, int freq)
+{
+	off_t base = offset & ~((off_t)BCACHE_BLOCK_SIZE - 1);
+	fca_bcache_block_t *block;
+	ssize_t rc;
+
+	pthread_mutex_lock(&bc->lock);
+
+	while ((block = bcache_search(bc, base)) != NULL && block->loading) {
+		pthread_cond_wait(&bc->loaded, &bc->lock);
+	}
+	if (block != NULL) {
+		bc->hits++;
+		if (block->weight < bcache_weight(freq)) {
+			block->weight = bcache_weight(freq);
+		} else if (block->weight < BCACHE_WEIGHT_MAX) {
+			block->weight++;
+		}
+		block->refs++;
+		pthread_mutex_unlock(&bc->lock);
+		return block;
+	}
+
+	bc->misses++;
+	block = bcache_victim(bc);
+	if (block == NULL) {
+		pthread_mutex_unlock(&bc->lock);
+		return NULL;
+	}
+	block->offset = base;
+	block->weight = bcache_weight(freq);
+	block->refs = 1;
+	block->loading = 1;
+	list_add(&block->hash_node, bcache_bucket(bc, base));
+	pthread_mutex_unlock(&bc->lock);
+
+	do {
+		rc = pread(fd, block->data, BCACHE_BLOCK_SIZE, base);
+	} while (rc < 0 && errno == EINTR);
+
+	pthread_mutex_lock(&bc->lock);
+	block->loading = 0;
+	block->len = rc > 0 ? rc : 0;
+	if (rc <= offset - base) {
+		list_del_init(&block->hash_node);
+		block->offset = -1;
+		block->weight = 0;
+		block->refs--;
+		block = NULL;
+		if (rc >= 0) {
+			errno = EIO;
+		}
+	}
+	pthread_cond_broadcast(&bc->loaded);
+	pthread_mutex_unlock(&bc->lock);
+	return block;
+}
+
+void bcache_put(fca_bcache_t *bc, fca_bcache_block_t *block)
+{
+	pthread_mutex_lock(&bc->lock);
+	block->refs--;
+	pthread_mutex_unlock(&bc->lock);
+}
+
+/* copy @len bytes at @offset into @buf through the cache */
+ssize_t bcache_read(fca_bcache_t *bc, int fd, void *buf, size_t len,
+		off_t offset, int freq)
+{
+	fca_bcache_block_t *block;
+	size_t done = 0, n;
+	off_t pos;
+
+	while (done < len) {
+		pos = offset + done;
+		block = bcache_get(bc, fd, pos, freq);
+		if (block == NULL) {
+			return -1;
+		}
+
+		n = block->offset + block->len - pos;
+		if (n > len - done) {
+			n = len - done;
+		}
+		memcpy((char *)buf + done, block->data + (pos - block->offset), n);
+		bcache_put(bc, block);
+		done += n;
+	}
+	return done;
+}
+
+/* drop the blocks covering [@offset, @offset+@len), after writing */
+void bcache_invalidate(fca_bcache_t *bc, off_t offset, size_t len)
+{
+	off_t base = offset & ~((off_t)BCACHE_BLOCK_SIZE - 1);
+	fca_bcache_block_t *block;
+
+	pthread_mutex_lock(&bc->lock);
+	for (; base < offset + (off_t)len; base += BCACHE_BLOCK_SIZE) {
+		block = bcache_search(bc, base);
+		if (block != NULL) {
+			list_del_init(&block->hash_node);
+			block->weight = 0;
+		}
+	}
+	pthread_mutex_unlock(&bc->lock);
+}
@@ -0,0 +1,75 @@
+/*
+ * Userspace block cache of devices in direct IO mode, which bypass
+ * the kernel page cache. Responses are sent from the blocks.
+ *
+ * Each device has its own cache, shared by its worker threads and
+ * protected by @lock. Blocks got are pinned until put.
+ *
+ * Author: Wu Bingzheng
+ *
+ */
+
+#ifndef _FCA_BCACHE_H_
+#define _FCA_BCACHE_H_
+
+#include <stddef.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include "utils/list.h"
+
+#define BCACHE_BLOCK_SIZE	(64*1024)
+#define BCACHE_ALIGN		4096
+#define BCACHE_WEIGHT_MAX	4
+
+typedef struct {
+	/* aligned by BCACHE_BLOCK_SIZE, -1 if not used */
+	off_t			offset;
+	/* less than BCACHE_BLOCK_SIZE at the end of device */
+	size_t			len;
+	/* rounds to survive in CLOCK */
+	int			weight;
+	/* requests using it, and it's not evicted while not 0 */
+	int			refs;
+	/* being read, without @lock */
+	int			loading;
+	/* empty if not indexed */
+	struct list_head	hash_node;
+	char			*data;
+} fca_bcache_block_t;
+
+typedef struct {
+	pthread_mutex_t		lock;
+	/* broadcast when blocks are loaded */
+	pthread_cond_t		loaded;
+
+	/* @block_nr of @block_max are allocated, when used firstly */
+	fca_bcache_block_t	*blocks;
+	long			block_nr;
+	long			block_max;
+	long			hand;
+
+	/* blocks indexed by offset */
+	struct list_head	*buckets;
+	unsigned long		bucket_mask;
+
+	/* statistics */
+	unsigned long		hits;
+	unsigned long		misses;
+	unsigned long		evicts;
+} fca_bcache_t;
+
+int bcache_init(fca_bcache_t *bc, size_t size);
+void bcache_destroy(fca_bcache_t *bc);
+
+fca_bcache_block_t *bcache_get(fca_bcache_t *bc, int fd, off_t offset, int freq);
+void bcache_put(fca_bcache_t *bc, fca_bcache_block_t *block);
+ssize_t bcache_read(fca_bcache_t *bc, int fd, void *buf, size_t len,
+		off_t offset, int freq);
+void bcache_invalidate(fca_bcache_t *bc, off_t offset, size_t len);
+
+static inline size_t bcache_memory(fca_bcache_t *bc)
+{
+	return bc->block_nr * BCACHE_BLOCK_SIZE;
+}
+
+#endif
@@ -0,0 +1,668 @@
+/*
+ * fcache-bench, load generator of fcache.
+ *
+ * Each thread drives its connections by its own epoll. A connection
+ * sends one request at a time, and reconnects for each request if
+ * not keepalive. There are 2 phases: fill, which PUTs each key once
+ * if -f is set, and run, which sends the mix of requests until -n
+ * requests are sent or -d seconds pass. The results are printed in
+ * JSON to stdout.
+ *
+ * Author: Wu Bingzheng
+ *
+ */
+
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <strings.h>
+#include <netdb.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "bench.h"
+
+#define BENCH_PHASE_FILL	0
+#define BENCH_PHASE_RUN		1
+
+#define BENCH_CONN_CONNECTING	0
+#define BENCH_CONN_SEND		1
+#define BENCH_CONN_RECV		2
+
+/* in-flight requests are waited for at most this, after the end */
+#define BENCH_GRACE_US		(5 * 1000000)
+
+typedef struct {
+	int		fd;
+	int		state;
+	int		op;
+	long		key;
+	size_t		size;
+	/* PUT @key next, after GET miss */
+	int		put_next;
+	time_t		start;
+
+	char		req[1024];
+	size_t		req_len;
+	size_t		req_sent;
+	size_t		body_len;
+	size_t		body_sent;
+
+	char		resp[4096];
+	size_t		resp_len;
+	long		body_left;
+	int		code;
+	int		header_done;
+	int		server_close;
+} bench_conn_t;
+
+typedef struct {
+	pthread_t	tid;
+	int		epoll_fd;
+	uint64_t	seed;
+	int		phase;
+	int		active;
+	bench_conn_t	*conns;
+	bench_stats_t	stats[BENCH_OPS];
+} bench_thread_t;
+
+bench_conf_t bench_conf = {
+	.host = "127.0.0.1",
+	.port = 8535,
+	.threads = 2,
+	.connections = 16,
+	.keepalive = 1,
+	.mix = { 100, 0, 0, 0, 0 },
+	.prefix = "/bench/",
+	.keys = 10000,
+	.zipf = 0.99,
+	.size_dist = BENCH_SIZE_FIXED,
+	.size_a = 4096,
+	.size_max = 16 << 20,
+};
+bench_trace_t bench_trace;
+
+static struct sockaddr_in bench_addr;
+static char *bench_body;
+static long bench_fill_next;
+static long bench_issued;
+static time_t bench_deadline;
+static int bench_mix_total;
+static char *bench_size_spec = "fixed:4K";
+static char *bench_mix_spec = "get:100";
+
+static const char *bench_op_methods[BENCH_OPS] = {
+	"GET", "PUT", "GET", "HEAD", "DELETE"
+};
+
+static void bench_conn_close(bench_conn_t *c)
+{
+	if (c->fd >= 0) {
+		close(c->fd);
+		c->fd = -1;
+	}
+}
+
+/* pick the next request of @c, return 0 if no more */
+static int bench_conn_pick(bench_thread_t *t, bench_conn_t *c)
+{
+	int i, w;
+
+	if (t->phase == BENCH_PHASE_FILL) {
+		c->key = __sync_fetch_and_add(&bench_fill_next, 1);
+		if (c->key >= bench_conf.keys) {
+			return 0;
+		}
+		c->op = BENCH_OP_PUT;
+		return 1;
+	}
+
+	if (bench_conf.requests != 0) {
+		if (__sync_fetch_and_add(&bench_issued, 1) >= bench_conf.requests) {
+			return 0;
+		}
+	} else if (bench_clock_us() >= bench_deadline) {
+		return 0;
+	}
+
+	if (c->put_next) {
+		c->put_next = 0;
+		c->op = BENCH_OP_PUT;
+		return 1;
+	}
+
+	w = bench_random(&t->seed) % bench_mix_total;
+	for (i = 0; w >= bench_conf.mix[i]; i++) {
+		w -= bench_conf.mix[i];
+	}
+	c->op = i;
+	c->key = bench_key_pick(&t->seed);
+	return 1;
+}
+
+static void bench_conn_build(bench_thread_t *t, bench_conn_t *c)
+{
+	char key[512];
+	size_t start, end;
+	int len;
+
+	bench_key_name(c->key, key, sizeof(key));
+	c->size = bench_key_size(c->key);
+
+	len = snprintf(c->req, sizeof(c->req), "%s %s HTTP/1.1\r\nHost: %s:%d\r\n",
+			bench_op_methods[c->op], key, bench_conf.host, bench_conf.port);
+
+	if (c->op == BENCH_OP_PUT) {
+		len += snprintf(c->req + len, sizeof(c->req) - len,
+				"Content-Length: %lu\r\n", c->size);
+	} else if (c->op == BENCH_OP_RANGE) {
+		start = bench_random(&t->seed) % c->size;
+		end = start + bench_random(&t->seed) % (c->size - start);
+		len += snprintf(c->req + len, sizeof(c->req) - len,
+				"Range: bytes=%lu-%lu\r\n", start, end);
+	}
+	if (!bench_conf.keepalive) {
+		len += snprintf(c->req + len, sizeof(c->req) - len,
+				"Connection: close\r\n");
+	}
+	len += snprintf(c->req + len, sizeof(c->req) - len, "\r\n");
+
+	c->req_len = len;
+	c->req_sent = 0;
+	c->body_len = c->op == BENCH_OP_PUT ? c->size : 0;
+	c->body_sent = 0;
+	c->resp_len = 0;
+	c->header_done = 0;
+	c->server_close = 0;
+	c->code = 0;
+}
+
+static int bench_conn_connect(bench_thread_t *t, bench_conn_t *c)
+{
+	struct epoll_event ev;
+	int one = 1;
+
+	c->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	if (c->fd < 0) {
+		return -1;
+	}
+	setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	if (connect(c->fd, (struct sockaddr *)&bench_addr, sizeof(bench_addr)) < 0
+			&& errno != EINPROGRESS) {
+		bench_conn_close(c);
+		return -1;
+	}
+
+	ev.events = EPOLLOUT;
+	ev.data.ptr = c;
+	if (epoll_ctl(t->epoll_fd, EPOLL_CTL_ADD, c->fd, &ev) < 0) {
+		bench_conn_close(c);
+		return -1;
+	}
+	c->state = BENCH_CONN_CONNECTING;
+	return 0;
+}
+
+static void bench_conn_wait(bench_thread_t *t, bench_conn_t *c, uint32_t events)
+{
+	struct epoll_event ev;
+	ev.events = events;
+	ev.data.ptr = c;
+	epoll_ctl(t->epoll_fd, EPOLL_CTL_MOD, c->fd, &ev);
+}
+
+static void bench_conn_handle(bench_thread_t *t, bench_conn_t *c);
+
+/* start the next request of @c, or finish it */
+static void bench_conn_next(bench_thread_t *t, bench_conn_t *c)
+{
+	if (!bench_conn_pick(t, c)) {
+		bench_conn_close(c);
+		t->active--;
+		return;
+	}
+
+	bench_conn_build(t, c);
+	c->start = bench_clock_us();
+
+	if (c->fd >= 0) {
+		c->state = BENCH_CONN_SEND;
+		bench_conn_handle(t, c);
+		return;
+	}
+	if (bench_conn_connect(t, c) < 0) {
+		t->stats[c->op].requests++;
+		t->stats[c->op].errors++;
+		t->active--;
+	}
+}
+
+static void bench_conn_done(bench_thread_t *t, bench_conn_t *c, int broken)
+{
+	bench_stats_t *s = &t->stats[c->op];
+
+	s->requests++;
+	bench_histogram_add(&s->latency, bench_clock_us() - c->start);
+
+	if (broken) {
+		s->errors++;
+	} else if (c->op == BENCH_OP_PUT) {
+		if (c->code != 201 && c->code != 204) {
+			s->errors++;
+		}
+	} else if (c->code == 404) {
+		s->misses++;
+		if (bench_conf.put_on_miss && c->op != BENCH_OP_DELETE) {
+			c->put_next = 1;
+		}
+	} else if (c->code == 200 || c->code == 206
+			|| (c->op == BENCH_OP_DELETE && c->code == 204)) {
+		s->hits++;
+	} else {
+		s->errors++;
+	}
+
+	if (broken || c->server_close || !bench_conf.keepalive) {
+		bench_conn_close(c);
+	}
+	bench_conn_next(t, c);
+}
+
+/* parse the response header in @c->resp, return 0 if not complete */
+static int bench_conn_parse(bench_conn_t *c)
+{
+	char *end, *p;
+	long content_length = 0;
+
+	c->resp[c->resp_len] = '\0';
+	end = strstr(c->resp, "\r\n\r\n");
+	if (end == NULL) {
+		return 0;
+	}
+	*end = '\0';
+
+	c->code = atoi(c->resp + 9);
+	p = strcasestr(c->resp, "\r\nContent-Length:");
+	if (p != NULL) {
+		content_length = atol(p + 17);
+	}
+	c->server_close = strcasestr(c->resp, "\r\nConnection: close") != NULL;
+
+	if (c->op == BENCH_OP_HEAD) {
+		content_length = 0;
+	}
+	c->body_left = content_length - (c->resp + c->resp_len - (end + 4));
+	c->header_done = 1;
+	return 1;
+}
+
+static void bench_conn_handle(bench_thread_t *t, bench_conn_t *c)
+{
+	bench_stats_t *s = &t->stats[c->op];
+	char buf[64 * 1024];
+	socklen_t len;
+	ssize_t rc;
+	int err;
+
+	if (c->state == BENCH_CONN_CONNECTING) {
+		len = sizeof(err);
+		if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0) {
+			bench_conn_done(t, c, 1);
+			return;
+		}
+		c->state = BENCH_CONN_SEND;
+	}
+
+	if (c->state == BENCH_CONN_SEND) {
+		while (c->req_sent < c->req_len) {
+			rc = send(c->fd, c->req + c->req_sent, c->req_len - c->req_sent,
+					MSG_NOSIGNAL | (c->body_len ? MSG_MORE : 0));
+			if (rc < 0) {
+				goto send_error;
+			}
+			c->req_sent += rc;
+			s->bytes_out += rc;
+		}
+		while (c->body_sent < c->body_len) {
+			rc = send(c->fd, bench_body + c->body_sent,
+					c->body_len - c->body_sent, MSG_NOSIGNAL);
+			if (rc < 0) {
+				goto send_error;
+			}
+			c->body_sent += rc;
+			s->bytes_out += rc;
+		}
+		c->state = BENCH_CONN_RECV;
+		bench_conn_wait(t, c, EPOLLIN);
+	}
+
+	/* BENCH_CONN_RECV */
+	while (1) {
+		if (!c->header_done) {
+			rc = recv(c->fd, c->resp + c->resp_len,
+					sizeof(c->resp) - 1 - c->resp_len, 0);
+		} else {
+			rc = recv(c->fd, buf, c->body_left < (long)sizeof(buf)
+					? c->body_left : (long)sizeof(buf), 0);
+		}
+		if (rc < 0) {
+			if (errno == EAGAIN || errno == EINTR) {
+				return;
+			}
+			bench_conn_done(t, c, 1);
+			return;
+		}
+		if (rc == 0) {
+			bench_conn_done(t, c, 1);
+			return;
+		}
+		s->bytes_in += rc;
+
+		if (!c->header_done) {
+			c->resp_len += rc;
+			if (!bench_conn_parse(c)) {
+				if (c->resp_len == sizeof(c->resp) - 1) {
+					bench_conn_done(t, c, 1);
+					return;
+				}
+				continue;
+			}
+		} else {
+			c->body_left -= rc;
+		}
+
+		if (c->body_left <= 0) {
+			bench_conn_done(t, c, 0);
+			return;
+		}
+	}
+
+send_error:
+	if (errno == EAGAIN || errno == EINTR) {
+		bench_conn_wait(t, c, EPOLLOUT);
+		return;
+	}
+	bench_conn_done(t, c, 1);
+}
+
+static void *bench_thread_entry(void *arg)
+{
+	bench_thread_t *t = arg;
+	struct epoll_event events[64];
+	time_t stop = 0, now;
+	int i, n;
+
+	for (i = 0; i < bench_conf.connections; i++) {
+		t->active++;
+		bench_conn_next(t, &t->conns[i]);
+	}
+
+	while (t->active > 0) {
+		n = epoll_wait(t->epoll_fd, events, 64, 100);
+		for (i = 0; i < n; i++) {
+			bench_conn_handle(t, events[i].data.ptr);
+		}
+
+		/* give up the requests in-flight too long after the end */
+		if (t->phase == BENCH_PHASE_RUN && bench_conf.requests == 0) {
+			now = bench_clock_us();
+			if (stop == 0 && now >= bench_deadline) {
+				stop = now + BENCH_GRACE_US;
+			}
+			if (stop != 0 && now >= stop) {
+				break;
+			}
+		}
+	}
+
+	for (i = 0; i < bench_conf.connections; i++) {
+		bench_conn_close(&t->conns[i]);
+	}
+	return NULL;
+}
+
+/* run a phase by all threads, and print its stats */
+static int bench_phase(int phase, const char *name)
+{
+	bench_thread_t *threads;
+	bench_stats_t *ops;
+	time_t begin;
+	int i, j;
+
+	threads = calloc(bench_conf.threads, sizeof(bench_thread_t));
+	ops = calloc(BENCH_OPS, sizeof(bench_stats_t));
+	if (threads == NULL || ops == NULL) {
+		fputs("no memory for threads\n", stderr);
+		return -1;
+	}
+
+	begin = bench_clock_us();
+	bench_deadline = begin + (time_t)bench_conf.duration * 1000000;
+
+	for (i = 0; i < bench_conf.threads; i++) {
+		threads[i].phase = phase;
+		threads[i].seed = bench_mix64(begin + i) | 1;
+		threads[i].epoll_fd = epoll_create(64);
+		threads[i].conns = calloc(bench_conf.connections, sizeof(bench_conn_t));
+		if (threads[i].epoll_fd < 0 || threads[i].conns == NULL) {
+			fputs("no memory for connections\n", stderr);
+			return -1;
+		}
+		for (j = 0; j < bench_conf.connections; j++) {
+			threads[i].conns[j].fd = -1;
+		}
+		if (pthread_create(&threads[i].tid, NULL, bench_thread_entry,
+					&threads[i]) != 0) {
+			perror("create thread");
+			return -1;
+		}
+	}
+
+	for (i = 0; i < bench_conf.threads; i++) {
+		pthread_join(threads[i].tid, NULL);
+		for (j = 0; j < BENCH_OPS; j++) {
+			bench_stats_merge(&ops[j], &threads[i].stats[j]);
+		}
+		close(threads[i].epoll_fd);
+		free(threads[i].conns);
+	}
+
+	bench_stats_json(stdout, name, (bench_clock_us() - begin) / 1e6, ops);
+	free(threads);
+	free(ops);
+	return 0;
+}
+
+static long bench_parse_size(const char *s, char **endp)
+{
+	long n = strtol(s, endp, 0);
+	switch (**endp) {
+	case 'k': case 'K': (*endp)++; return n << 10;
+	case 'm': case 'M': (*endp)++; return n << 20;
+	case 'g': case 'G': (*endp)++; return n << 30;
+	default: return n;
+	}
+}
+
+/* fixed:SIZE, uniform:MIN:MAX, or lognormal:MEDIAN:SIGMA */
+static int bench_parse_sizes(char *spec)
+{
+	char *p;
+
+	if (strncmp(spec, "fixed:", 6) == 0) {
+		bench_conf.size_dist = BENCH_SIZE_FIXED;
+		bench_conf.size_a = bench_parse_size(spec + 6, &p);
+		return *p == '\0' && bench_conf.size_a > 0 ? 0 : -1;
+	}
+	if (strncmp(spec, "uniform:", 8) == 0) {
+		bench_conf.size_dist = BENCH_SIZE_UNIFORM;
+		bench_conf.size_a = bench_parse_size(spec + 8, &p);
+		if (*p++ != ':') {
+			return -1;
+		}
+		bench_conf.size_b = bench_parse_size(p, &p);
+		return *p == '\0' && bench_conf.size_a > 0
+			&& bench_conf.size_b >= bench_conf.size_a ? 0 : -1;
+	}
+	if (strncmp(spec, "lognormal:", 10) == 0) {
+		bench_conf.size_dist = BENCH_SIZE_LOGNORMAL;
+		bench_conf.size_a = bench_parse_size(spec + 10, &p);
+		if (*p++ != ':') {
+			return -1;
+		}
+		bench_conf.size_sigma = strtod(p, &p);
+		return *p == '\0' && bench_conf.size_a > 0 ? 0 : -1;
+	}
+	return -1;
+}
+
+/* get:90,put:5,range:3,head:2,delete:0 */
+static int bench_parse_mix(char *spec)
+{
+	static const char *names[BENCH_OPS] = {
+		"get", "put", "range", "head", "delete"
+	};
+	char *copy = strdup(spec), *item, *save, *colon;
+	int i;
+
+	memset(bench_conf.mix, 0, sizeof(bench_conf.mix));
+	bench_mix_total = 0;
+	for (item = strtok_r(copy, ",", &save); item != NULL;
+			item = strtok_r(NULL, ",", &save)) {
+		colon = strchr(item, ':');
+		if (colon == NULL) {
+			free(copy);
+			return -1;
+		}
+		*colon = '\0';
+		for (i = 0; i < BENCH_OPS && strcmp(item, names[i]) != 0; i++);
+		if (i == BENCH_OPS || atoi(colon + 1) < 0) {
+			free(copy);
+			return -1;
+		}
+		bench_conf.mix[i] = atoi(colon + 1);
+		bench_mix_total += bench_conf.mix[i];
+	}
+	free(copy);
+	return bench_mix_total > 0 ? 0 : -1;
+}
+
+static void bench_usage(void)
+{
+	fputs("Usage: fcache-bench [options]\n"
+		"\t-h HOST       server host [127.0.0.1]\n"
+		"\t-p PORT       server port [8535]\n"
+		"\t-t N          threads [2]\n"
+		"\t-c N          connections of each thread [16]\n"
+		"\t-n N          requests of run phase\n"
+		"\t-d SECONDS    duration of run phase, if no -n [10]\n"
+		"\t-k N          keys [10000]\n"
+		"\t-z S          Zipf skew of keys, 0 for uniform [0.99]\n"
+		"\t-T FILE       trace of keys, 'KEY [SIZE]' per line, in order\n"
+		"\t-s SPEC       sizes: fixed:SIZE, uniform:MIN:MAX, or\n"
+		"\t              lognormal:MEDIAN:SIGMA [fixed:4K]\n"
+		"\t-S SIZE       max size [16M]\n"
+		"\t-m SPEC       mix of get,put,range,head,delete [get:100]\n"
+		"\t-f            fill phase, PUT each key once before running\n"
+		"\t-M            PUT the key after GET misses, as a proxy does\n"
+		"\t-C            short connections, not keepalive\n"
+		"\t-P PREFIX     prefix of URLs [/bench/]\n", stderr);
+}
+
+int main(int argc, char **argv)
+{
+	struct addrinfo hints, *ai;
+	char *p;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "h:p:t:c:n:d:k:z:T:s:S:m:fMCP:")) != -1) {
+		switch (opt) {
+		case 'h': bench_conf.host = optarg; break;
+		case 'p': bench_conf.port = atoi(optarg); break;
+		case 't': bench_conf.threads = atoi(optarg); break;
+		case 'c': bench_conf.connections = atoi(optarg); break;
+		case 'n': bench_conf.requests = atol(optarg); break;
+		case 'd': bench_conf.duration = atoi(optarg); break;
+		case 'k': bench_conf.keys = atol(optarg); break;
+		case 'z': bench_conf.zipf = atof(optarg); break;
+		case 'T': bench_conf.trace = optarg; break;
+		case 's': bench_size_spec = optarg; break;
+		case 'S': bench_conf.size_max = bench_parse_size(optarg, &p); break;
+		case 'm': bench_mix_spec = optarg; break;
+		case 'f': bench_conf.fill = 1; break;
+		case 'M': bench_conf.put_on_miss = 1; break;
+		case 'C': bench_conf.keepalive = 0; break;
+		case 'P': bench_conf.prefix = optarg; break;
+		default: bench_usage(); return 1;
+		}
+	}
+
+	if (bench_parse_sizes(bench_size_spec) < 0) {
+		fprintf(stderr, "invalid sizes: %s\n", bench_size_spec);
+		return 1;
+	}
+	if (bench_parse_mix(bench_mix_spec) < 0) {
+		fprintf(stderr, "invalid mix: %s\n", bench_mix_spec);
+		return 1;
+	}
+	if (bench_conf.threads < 1 || bench_conf.connections < 1
+			|| bench_conf.keys < 1 || bench_conf.size_max < 1) {
+		bench_usage();
+		return 1;
+	}
+	if (bench_conf.requests == 0 && bench_conf.duration == 0) {
+		bench_conf.duration = 10;
+	}
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(bench_conf.host, NULL, &hints, &ai) != 0) {
+		fprintf(stderr, "invalid host: %s\n", bench_conf.host);
+		return 1;
+	}
+	bench_addr = *(struct sockaddr_in *)ai->ai_addr;
+	bench_addr.sin_port = htons(bench_conf.port);
+	freeaddrinfo(ai);
+
+	if (bench_keys_init() < 0) {
+		return 1;
+	}
+	bench_body = malloc(bench_conf.size_max);
+	if (bench_body == NULL) {
+		fputs("no memory for body\n", stderr);
+		return 1;
+	}
+	for (opt = 0; opt < (int)bench_conf.size_max; opt++) {
+		bench_body[opt] = 'a' + opt % 26;
+	}
+	signal(SIGPIPE, SIG_IGN);
+
+	printf("{\n  \"target\": \"%s:%d\", \"threads\": %d, \"connections\": %d,\n"
+			"  \"keys\": %ld, \"zipf\": %.3f, \"trace\": \"%s\",\n"
+			"  \"sizes\": \"%s\", \"mix\": \"%s\", \"keepalive\": %s,"
+			" \"put_on_miss\": %s,\n  \"phases\": [\n",
+			bench_conf.host, bench_conf.port, bench_conf.threads,
+			bench_conf.connections, bench_conf.keys,
+			bench_conf.trace ? 0 : bench_conf.zipf,
+			bench_conf.trace ? bench_conf.trace : "",
+			bench_size_spec, bench_mix_spec,
+			bench_conf.keepalive ? "true" : "false",
+			bench_conf.put_on_miss ? "true" : "false");
+
+	if (bench_conf.fill) {
+		if (bench_phase(BENCH_PHASE_FILL, "fill") < 0) {
+			return 1;
+		}
+		fputs(",\n", stdout);
+	}
+	if (bench_phase(BENCH_PHASE_RUN, "run") < 0) {
+		return 1;
+	}
+	fputs("\n  ]\n}\n", stdout);
+	return 0;
+}
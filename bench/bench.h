@@ -0,0 +1,133 @@
+/*
+ * fcache-bench, load generator of fcache.
+ *
+ * Author: Wu Bingzheng
+ *
+ */
+
+#ifndef _FCA_BENCH_H_
+#define _FCA_BENCH_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/types.h>
+
+#define BENCH_OP_GET		0
+#define BENCH_OP_PUT		1
+#define BENCH_OP_RANGE		2
+#define BENCH_OP_HEAD		3
+#define BENCH_OP_DELETE		4
+#define BENCH_OPS		5
+
+#define BENCH_SIZE_FIXED	0
+#define BENCH_SIZE_UNIFORM	1
+#define BENCH_SIZE_LOGNORMAL	2
+
+/* latency histogram in microseconds, HDR-style as metrics.c of fcache,
+ * but 2^BENCH_SUB_BITS sub-buckets for about 3% error */
+#define BENCH_SUB_BITS		5
+#define BENCH_BUCKETS		(36 << BENCH_SUB_BITS)
+
+typedef struct {
+	unsigned long	counts[BENCH_BUCKETS];
+	unsigned long	sum_us;
+	unsigned long	max_us;
+} bench_histogram_t;
+
+typedef struct {
+	unsigned long	requests;
+	unsigned long	hits;		/* 200 or 206 of GET, range and HEAD */
+	unsigned long	misses;		/* 404 */
+	unsigned long	errors;		/* other codes, or broken */
+	unsigned long	bytes_in;
+	unsigned long	bytes_out;
+	bench_histogram_t	latency;
+} bench_stats_t;
+
+typedef struct {
+	/* target */
+	char		*host;
+	unsigned short	port;
+
+	/* load */
+	int		threads;
+	int		connections;	/* of each thread */
+	long		requests;	/* of the run phase, 0 if by @duration */
+	int		duration;	/* seconds */
+	int		keepalive;
+	int		fill;		/* PUT all keys before the run phase */
+	int		put_on_miss;	/* PUT after GET miss, as a proxy */
+	int		mix[BENCH_OPS];	/* weights */
+	char		*prefix;
+
+	/* popularity of keys */
+	long		keys;
+	double		zipf;		/* 0 for uniform */
+	char		*trace;
+
+	/* sizes of objects */
+	int		size_dist;
+	size_t		size_a;
+	size_t		size_b;
+	double		size_sigma;
+	size_t		size_max;
+} bench_conf_t;
+
+/* keys of a trace file, one "KEY [SIZE]" per line */
+typedef struct {
+	char		**keys;
+	size_t		*sizes;		/* 0 if not in trace */
+	long		nr;
+} bench_trace_t;
+
+extern bench_conf_t bench_conf;
+extern bench_trace_t bench_trace;
+
+static inline uint64_t bench_random(uint64_t *state)
+{
+	/* xorshift64* */
+	uint64_t x = *state;
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*state = x;
+	return x * 0x2545F4914F6CDD1DULL;
+}
+
+static inline double bench_random_double(uint64_t *state)
+{
+	return (bench_random(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static inline uint64_t bench_mix64(uint64_t x)
+{
+	/* splitmix64 finalizer */
+	x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+	return x ^ (x >> 31);
+}
+
+static inline time_t bench_clock_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* keys, in keys.c */
+int bench_keys_init(void);
+long bench_key_pick(uint64_t *seed);
+size_t bench_key_size(long key);
+int bench_key_name(long key, char *buf, size_t size);
+
+/* statistics, in stats.c */
+void bench_histogram_add(bench_histogram_t *h, time_t us);
+void bench_stats_merge(bench_stats_t *total, bench_stats_t *s);
+void bench_stats_json(FILE *filp, const char *name, double seconds,
+		bench_stats_t *ops);
+
+#endif
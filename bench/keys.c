@@ -0,0 +1,171 @@
+/*
+ * Keys of fcache-bench, and their popularity and sizes.
+ *
+ * Keys are picked uniformly, by Zipf of @bench_conf.zipf, or in the
+ * order of a trace file. Zipf is sampled by binary search in its CDF,
+ * which takes 8 bytes per key.
+ *
+ * The size of each key is decided by its hash, so the same key has
+ * the same size in all threads and runs.
+ *
+ * Author: Wu Bingzheng
+ *
+ */
+
+#include <math.h>
+#include "bench.h"
+
+static double *zipf_cdf;
+static long trace_next;
+
+static int bench_trace_load(const char *filename)
+{
+	char line[4096], *p, *size;
+	long cap = 0;
+	FILE *fp;
+
+	fp = fopen(filename, "r");
+	if (fp == NULL) {
+		perror("open trace");
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		p = line + strspn(line, " \t");
+		if (*p == '\0' || *p == '\n' || *p == '#') {
+			continue;
+		}
+		size = p + strcspn(p, " \t\r\n");
+		if (*size == ' ' || *size == '\t') {
+			*size++ = '\0';
+		} else {
+			*size = '\0';
+			size = NULL;
+		}
+
+		if (bench_trace.nr == cap) {
+			cap = cap ? cap * 2 : 1024;
+			bench_trace.keys = realloc(bench_trace.keys, cap * sizeof(char *));
+			bench_trace.sizes = realloc(bench_trace.sizes, cap * sizeof(size_t));
+			if (bench_trace.keys == NULL || bench_trace.sizes == NULL) {
+				fclose(fp);
+				fputs("no memory for trace\n", stderr);
+				return -1;
+			}
+		}
+		bench_trace.keys[bench_trace.nr] = strdup(p);
+		bench_trace.sizes[bench_trace.nr] = size ? strtoul(size, NULL, 0) : 0;
+		bench_trace.nr++;
+	}
+	fclose(fp);
+
+	if (bench_trace.nr == 0) {
+		fputs("empty trace\n", stderr);
+		return -1;
+	}
+	return 0;
+}
+
+static int bench_zipf_init(long n, double s)
+{
+	double sum = 0;
+	long i;
+
+	zipf_cdf = malloc(sizeof(double) * n);
+	if (zipf_cdf == NULL) {
+		fputs("no memory for zipf\n", stderr);
+		return -1;
+	}
+	for (i = 0; i < n; i++) {
+		sum += 1.0 / pow(i + 1, s);
+		zipf_cdf[i] = sum;
+	}
+	for (i = 0; i < n; i++) {
+		zipf_cdf[i] /= sum;
+	}
+	return 0;
+}
+
+int bench_keys_init(void)
+{
+	if (bench_conf.trace != NULL) {
+		if (bench_trace_load(bench_conf.trace) < 0) {
+			return -1;
+		}
+		bench_conf.keys = bench_trace.nr;
+		return 0;
+	}
+	if (bench_conf.zipf > 0) {
+		return bench_zipf_init(bench_conf.keys, bench_conf.zipf);
+	}
+	return 0;
+}
+
+/* key index in [0, keys) */
+long bench_key_pick(uint64_t *seed)
+{
+	long low, high, mid;
+	double u;
+
+	if (bench_conf.trace != NULL) {
+		return __sync_fetch_and_add(&trace_next, 1) % bench_trace.nr;
+	}
+	if (zipf_cdf == NULL) {
+		return bench_random(seed) % bench_conf.keys;
+	}
+
+	u = bench_random_double(seed);
+	low = 0;
+	high = bench_conf.keys - 1;
+	while (low < high) {
+		mid = (low + high) / 2;
+		if (zipf_cdf[mid] < u) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+	return low;
+}
+
+size_t bench_key_size(long key)
+{
+	uint64_t seed = bench_mix64(key + 1) | 1;
+	double u1, u2, n;
+	size_t size;
+
+	if (bench_conf.trace != NULL && bench_trace.sizes[key] != 0) {
+		return bench_trace.sizes[key] < bench_conf.size_max
+			? bench_trace.sizes[key] : bench_conf.size_max;
+	}
+
+	switch (bench_conf.size_dist) {
+	case BENCH_SIZE_UNIFORM:
+		size = bench_conf.size_a + bench_random(&seed)
+			% (bench_conf.size_b - bench_conf.size_a + 1);
+		break;
+	case BENCH_SIZE_LOGNORMAL:
+		/* Box-Muller */
+		u1 = bench_random_double(&seed);
+		u2 = bench_random_double(&seed);
+		n = sqrt(-2 * log(u1 > 0 ? u1 : 1e-300)) * cos(2 * M_PI * u2);
+		size = bench_conf.size_a * exp(bench_conf.size_sigma * n);
+		break;
+	default:
+		size = bench_conf.size_a;
+	}
+
+	if (size < 1) {
+		size = 1;
+	}
+	return size < bench_conf.size_max ? size : bench_conf.size_max;
+}
+
+int bench_key_name(long key, char *buf, size_t size)
+{
+	if (bench_conf.trace != NULL) {
+		return snprintf(buf, size, "%s%s", bench_conf.prefix,
+				bench_trace.keys[key] + (bench_trace.keys[key][0] == '/'));
+	}
+	return snprintf(buf, size, "%s%ld", bench_conf.prefix, key);
+}
@@ -0,0 +1,33 @@
+#!/bin/sh
+# Run fcache-bench against a loopback fcache, backed by a regular file.
+#
+# Usage: bench/run.sh [fcache-bench options]
+# Environment: DEVICE_SIZE (1G), DEVICE_OPTIONS, SERVER_OPTIONS,
+# PORT (18535), ADMIN (15210), and DIR (a temporary directory, which
+# is removed at exit; a given DIR is kept).
+
+set -e
+cd "$(dirname "$0")/.."
+make -s fcache fcache-bench >&2
+
+if [ -z "$DIR" ]; then
+	DIR=$(mktemp -d /tmp/fcache-bench.XXXXXX)
+	DIR_CREATED=1
+fi
+PORT=${PORT:-18535}
+ADMIN=${ADMIN:-15210}
+
+truncate -s "${DEVICE_SIZE:-1G}" "$DIR/device"
+cat > "$DIR/fcache.conf" <<CONF
+error_log $DIR/error.log
+device $DIR/device ${DEVICE_OPTIONS:-}
+listen $PORT
+    access_log $DIR/access.log
+    ${SERVER_OPTIONS:-}
+CONF
+
+./fcache -c "$DIR/fcache.conf" -a "$ADMIN" -i "$DIR/fcache.pid" >&2
+trap 'kill "$(cat "$DIR/fcache.pid")" 2>/dev/null; [ -z "$DIR_CREATED" ] || rm -rf "$DIR"' EXIT
+sleep 1
+
+./fcache-bench -p "$PORT" "$@"
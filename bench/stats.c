@@ -0,0 +1,152 @@
+/*
+ * Statistics of fcache-bench, printed in JSON.
+ *
+ * Author: Wu Bingzheng
+ *
+ */
+
+#include "bench.h"
+
+#define BENCH_SUB_COUNT		(1 << BENCH_SUB_BITS)
+
+static const char *bench_op_names[BENCH_OPS] = {
+	"get", "put", "range", "head", "delete"
+};
+
+/* the bucket @i holds (bound(i-1), bound(i)] microseconds */
+static int bench_bucket(time_t us)
+{
+	unsigned long v = us > 0 ? us - 1 : 0;
+	int shift, i;
+
+	if (v < BENCH_SUB_COUNT) {
+		return v;
+	}
+	shift = 63 - __builtin_clzl(v) - BENCH_SUB_BITS;
+	i = ((shift + 1) << BENCH_SUB_BITS) + (v >> shift) - BENCH_SUB_COUNT;
+	return i < BENCH_BUCKETS ? i : BENCH_BUCKETS - 1;
+}
+
+static unsigned long bench_bucket_bound(int i)
+{
+	int shift;
+
+	if (i < BENCH_SUB_COUNT) {
+		return i + 1;
+	}
+	shift = (i >> BENCH_SUB_BITS) - 1;
+	return (unsigned long)((i & (BENCH_SUB_COUNT - 1))
+			+ BENCH_SUB_COUNT + 1) << shift;
+}
+
+void bench_histogram_add(bench_histogram_t *h, time_t us)
+{
+	if (us < 0) {
+		us = 0;
+	}
+	h->counts[bench_bucket(us)]++;
+	h->sum_us += us;
+	if ((unsigned long)us > h->max_us) {
+		h->max_us = us;
+	}
+}
+
+static void bench_histogram_merge(bench_histogram_t *total, bench_histogram_t *h)
+{
+	int i;
+	for (i = 0; i < BENCH_BUCKETS; i++) {
+		total->counts[i] += h->counts[i];
+	}
+	total->sum_us += h->sum_us;
+	if (h->max_us > total->max_us) {
+		total->max_us = h->max_us;
+	}
+}
+
+/* the upper bound of the @q quantile, but not more than the max */
+static unsigned long bench_histogram_quantile(bench_histogram_t *h,
+		unsigned long count, double q)
+{
+	unsigned long n = 0, target = count * q, bound;
+	int i;
+
+	if (target >= count) {
+		target = count - 1;
+	}
+	for (i = 0; i < BENCH_BUCKETS; i++) {
+		n += h->counts[i];
+		if (n > target) {
+			bound = bench_bucket_bound(i);
+			return bound < h->max_us ? bound : h->max_us;
+		}
+	}
+	return h->max_us;
+}
+
+void bench_stats_merge(bench_stats_t *total, bench_stats_t *s)
+{
+	total->requests += s->requests;
+	total->hits += s->hits;
+	total->misses += s->misses;
+	total->errors += s->errors;
+	total->bytes_in += s->bytes_in;
+	total->bytes_out += s->bytes_out;
+	bench_histogram_merge(&total->latency, &s->latency);
+}
+
+static void bench_stats_json_one(FILE *filp, bench_stats_t *s, double seconds)
+{
+	bench_histogram_t *h = &s->latency;
+	unsigned long count = s->requests;
+
+	fprintf(filp, "{\"requests\": %lu, \"rps\": %.1f, "
+			"\"hits\": %lu, \"misses\": %lu, \"errors\": %lu, "
+			"\"hit_ratio\": %.4f, "
+			"\"bytes_in\": %lu, \"bytes_out\": %lu, "
+			"\"mbps_in\": %.2f, \"mbps_out\": %.2f",
+			count, seconds > 0 ? count / seconds : 0.0,
+			s->hits, s->misses, s->errors,
+			s->hits + s->misses ? (double)s->hits / (s->hits + s->misses) : 0.0,
+			s->bytes_in, s->bytes_out,
+			seconds > 0 ? s->bytes_in * 8 / seconds / 1e6 : 0.0,
+			seconds > 0 ? s->bytes_out * 8 / seconds / 1e6 : 0.0);
+
+	if (count != 0) {
+		fprintf(filp, ", \"latency_us\": {\"mean\": %.1f, \"p50\": %lu, "
+				"\"p90\": %lu, \"p99\": %lu, \"p999\": %lu, \"max\": %lu}",
+				(double)h->sum_us / count,
+				bench_histogram_quantile(h, count, 0.5),
+				bench_histogram_quantile(h, count, 0.9),
+				bench_histogram_quantile(h, count, 0.99),
+				bench_histogram_quantile(h, count, 0.999),
+				h->max_us);
+	}
+	fputs("}", filp);
+}
+
+/* a phase named @name, with the stats of each op in @ops */
+void bench_stats_json(FILE *filp, const char *name, double seconds,
+		bench_stats_t *ops)
+{
+	bench_stats_t *total = calloc(1, sizeof(bench_stats_t));
+	int i, first = 1;
+
+	for (i = 0; i < BENCH_OPS; i++) {
+		bench_stats_merge(total, &ops[i]);
+	}
+
+	fprintf(filp, "    {\"phase\": \"%s\", \"seconds\": %.3f, \"total\": ",
+			name, seconds);
+	bench_stats_json_one(filp, total, seconds);
+	fputs(", \"ops\": {", filp);
+	for (i = 0; i < BENCH_OPS; i++) {
+		if (ops[i].requests == 0) {
+			continue;
+		}
+		fprintf(filp, "%s\n      \"%s\": ", first ? "" : ",", bench_op_names[i]);
+		first = 0;
+		bench_stats_json_one(filp, &ops[i], seconds);
+	}
+	fputs("}}", filp);
+	free(total);
+}
@@ -0,0 +1,177 @@
+/*
+ * Benchmark of utils/hash.c: add, get of hit and miss, get in the
+ * middle of a resize, and delete, in scattered order.
+ *
+ * Items are in a fca_pool_t as fcache's items, and their ids are
+ * made by micro_mix64() but not hash_make_id(), which is measured
+ * alone, so the costs are of the table only.
+ *
+ * Author: Wu Bingzheng
+ *
+ */
+
+#include <sys/mman.h>
+#include "micro.h"
+#include "../../utils/pool.h"
+#include "../../utils/hash.h"
+
+/* about the size of the head of an item, whose hash node is first */
+typedef struct {
+	fca_hash_node_t		hnode;
+	uint32_t		payload[5];
+} micro_item_t;
+
+static void micro_hash_id(long i, unsigned char *id)
+{
+	uint64_t a = micro_mix64(i ^ micro_seed);
+	uint64_t b = micro_mix64(a);
+	memcpy(id, &a, 8);
+	memcpy(id + 8, &b, HASH_ID_LEN - 8);
+}
+
+/* item @i has handle i+1, since they are allocated in order */
+static inline micro_item_t *micro_hash_item(fca_pool_t *pool, long i)
+{
+	return pool_ptr(pool, i + 1);
+}
+
+/* pool never frees its chunks, so unmap them here */
+static void micro_pool_release(fca_pool_t *pool)
+{
+	int i;
+	for (i = 0; i < pool->chunk_nr; i++) {
+		munmap(pool->chunks[i] - POOL_CHUNK_HEADER, pool->chunk_size);
+	}
+	free(pool->chunks);
+}
+
+static void micro_hash_make_id(const char *name, long n)
+{
+	unsigned char key[48], id[16];
+	unsigned long sum = 0;
+	long i;
+
+	memcpy(key, "http://www.example.com/path/to/some/object/", 40);
+
+	micro_start();
+	for (i = 0; i < n; i++) {
+		memcpy(key + 40, &i, sizeof(long));
+		hash_make_id(key, sizeof(key), id);
+		sum += id[0];
+	}
+	micro_stop(name, "make_id", n);
+
+	if (sum == 0) {
+		printf("# %s: make_id gives zeros\n", name);
+	}
+}
+
+void micro_hash(long n, const char *label)
+{
+	unsigned char id[16];
+	char name[64];
+	fca_pool_t pool;
+	fca_hash_t *hash;
+	micro_item_t *item;
+	size_t memory, last;
+	long i, j, total, ops, stride, found;
+
+	snprintf(name, sizeof(name), "hash/%s", label);
+	pool_init(&pool, sizeof(micro_item_t));
+	hash = hash_init(&pool);
+	if (hash == NULL) {
+		fputs("no memory\n", stderr);
+		exit(1);
+	}
+
+	micro_hash_make_id(name, n);
+
+	/* items are allocated and touched before, not measured */
+	for (i = 0; i < n; i++) {
+		item = pool_alloc(&pool);
+		if (item == NULL) {
+			fputs("no memory\n", stderr);
+			exit(1);
+		}
+		micro_hash_id(i, item->hnode.id);
+	}
+
+	micro_start();
+	for (i = 0; i < n; i++) {
+		hash_add(hash, &micro_hash_item(&pool, i)->hnode, NULL, 0);
+	}
+	micro_stop(name, "add", n);
+	printf("# %s: %.1f bytes of buckets per item\n", name,
+			(double)hash_memory(hash) / n);
+
+	stride = micro_stride(n);
+	found = 0;
+	micro_start();
+	for (j = 0; j < n; j++) {
+		micro_hash_id(micro_scatter(j, n, stride), id);
+		found += hash_get(hash, NULL, 0, id) != NULL;
+	}
+	micro_stop(name, "get-hit", n);
+	if (found != n) {
+		printf("# %s: %ld of %ld found\n", name, found, n);
+	}
+
+	found = 0;
+	micro_start();
+	for (j = 0; j < n; j++) {
+		micro_hash_id(n + n + j, id);
+		found += hash_get(hash, NULL, 0, id) != NULL;
+	}
+	micro_stop(name, "get-miss", n);
+	if (found != 0) {
+		printf("# %s: %ld of misses found\n", name, found);
+	}
+
+	/* add more items until a resize begins, when hash_memory()
+	 * grows by 2 times of the previous buckets */
+	total = n;
+	last = hash_memory(hash);
+	for (;;) {
+		item = pool_alloc(&pool);
+		if (item == NULL) {
+			fputs("no memory\n", stderr);
+			exit(1);
+		}
+		micro_hash_id(total, item->hnode.id);
+		hash_add(hash, &item->hnode, NULL, 0);
+		total++;
+
+		memory = hash_memory(hash);
+		if (memory > last) {
+			break;
+		}
+		last = memory;
+	}
+
+	/* each operation migrates 2 buckets, so measure a quarter of
+	 * the previous buckets' operations, within the resize */
+	ops = (memory - last) / 128 / 4;
+	ops = ops ? ops : 1;
+	stride = micro_stride(total);
+	found = 0;
+	micro_start();
+	for (j = 0; j < ops; j++) {
+		micro_hash_id(micro_scatter(j, total, stride), id);
+		found += hash_get(hash, NULL, 0, id) != NULL;
+	}
+	micro_stop(name, "get-resizing", ops);
+	if (found != ops) {
+		printf("# %s: %ld of %ld found in resizing\n", name, found, ops);
+	}
+
+	stride = micro_stride(total);
+	micro_start();
+	for (j = 0; j < total; j++) {
+		item = micro_hash_item(&pool, micro_scatter(j, total, stride));
+		hash_del(hash, &item->hnode);
+	}
+	micro_stop(name, "del", total);
+
+	hash_destroy(hash);
+	micro_pool_release(&pool);
+}
@@ -0,0 +1,254 @@
+/*
+ * Benchmark of utils/ipbucket.h, as the free blocks of a device: an
+ * allocation gets a free block and cuts its rear as device.c does,
+ * and a free merges the neighbour free blocks, and updates the
+ * merged one. The space is filled up at first, and then churned by
+ * freeing a random block and allocating another, until fragmented.
+ *
+ * Sizes are of these distributions:
+ *   uniform: 512 to 128K;
+ *   lognormal: median 16K, sigma 1.5;
+ *   bimodal: 90% 4K and 10% 512K, which fragments most.
+ *
+ * The space is 64K for each of @n, so about @n blocks are live, and
+ * @n blocks are churned.
+ *
+ * Author: Wu Bingzheng
+ *
+ */
+
+#include <math.h>
+#include "micro.h"
+#include "../../utils/ipbucket.h"
+
+#define MICRO_SIZE_UNIFORM	0
+#define MICRO_SIZE_LOGNORMAL	1
+#define MICRO_SIZE_BIMODAL	2
+
+#define MICRO_SIZE_MAX		(16 * 1024 * 1024)
+
+/* sizes are made before, and used in turn */
+#define MICRO_SIZES		(1 << 16)
+
+static const char *micro_size_names[] = {
+	"uniform", "lognormal", "bimodal"
+};
+
+typedef struct micro_block_s micro_block_t;
+struct micro_block_s {
+	struct list_head	bucket_node;	/* if free */
+	micro_block_t		*prev;		/* neighbours by offset */
+	micro_block_t		*next;
+	size_t			offset;
+	size_t			size;
+	long			live;		/* index in live, or -1 if free */
+};
+
+typedef struct {
+	fca_ipbucket_t		ipb;
+	micro_block_t		*spare;		/* recycled, linked by next */
+	micro_block_t		**live;
+	long			live_nr;
+	long			live_alloc;
+	long			free_nr;
+	size_t			used;
+} micro_space_t;
+
+static size_t micro_size(int dist, uint64_t *seed)
+{
+	double u1, u2;
+	size_t size;
+
+	switch (dist) {
+	case MICRO_SIZE_UNIFORM:
+		return 512 + micro_random(seed) % (128 * 1024 - 512);
+	case MICRO_SIZE_LOGNORMAL:
+		/* Box-Muller */
+		u1 = (micro_random(seed) >> 11) * (1.0 / 9007199254740992.0);
+		u2 = (micro_random(seed) >> 11) * (1.0 / 9007199254740992.0);
+		size = 16384 * exp(1.5 * sqrt(-2 * log(u1 > 0 ? u1 : 1e-300))
+				* cos(2 * M_PI * u2)) + 1;
+		return size < MICRO_SIZE_MAX ? size : MICRO_SIZE_MAX;
+	default:
+		return micro_random(seed) % 10 ? 4096 : 512 * 1024;
+	}
+}
+
+static micro_block_t *micro_block_new(micro_space_t *space)
+{
+	micro_block_t *b = space->spare;
+
+	if (b != NULL) {
+		space->spare = b->next;
+		return b;
+	}
+	return micro_malloc(sizeof(micro_block_t));
+}
+
+static void micro_block_put(micro_space_t *space, micro_block_t *b)
+{
+	b->next = space->spare;
+	space->spare = b;
+}
+
+static int micro_alloc(micro_space_t *space, size_t length)
+{
+	size_t bsize = ipbucket_block_size(length);
+	struct list_head *p;
+	micro_block_t *f, *b;
+
+	p = ipbucket_get(&space->ipb, length);
+	if (p == NULL) {
+		return -1;
+	}
+	f = list_entry(p, micro_block_t, bucket_node);
+
+	if (f->size > bsize) {
+		/* cut from rear */
+		b = micro_block_new(space);
+		b->offset = f->offset + f->size - bsize;
+		b->size = bsize;
+		b->prev = f;
+		b->next = f->next;
+		if (f->next) {
+			f->next->prev = b;
+		}
+		f->next = b;
+		f->size -= bsize;
+		ipbucket_add(&space->ipb, &f->bucket_node, f->size);
+
+	} else if (f->size == bsize) {
+		b = f;
+		space->free_nr--;
+	} else {
+		fprintf(stderr, "ipbucket gives %lu for %lu\n", f->size, bsize);
+		exit(1);
+	}
+
+	if (space->live_nr == space->live_alloc) {
+		space->live_alloc *= 2;
+		space->live = realloc(space->live,
+				sizeof(micro_block_t *) * space->live_alloc);
+		if (space->live == NULL) {
+			fputs("no memory\n", stderr);
+			exit(1);
+		}
+	}
+	b->live = space->live_nr;
+	space->live[space->live_nr++] = b;
+	space->used += bsize;
+	return 0;
+}
+
+static void micro_free(micro_space_t *space, long index)
+{
+	micro_block_t *b = space->live[index];
+	micro_block_t *prev = b->prev, *next = b->next;
+
+	space->live[index] = space->live[--space->live_nr];
+	space->live[index]->live = index;
+	space->used -= b->size;
+	b->live = -1;
+
+	/* merge the next into @b */
+	if (next && next->live == -1) {
+		ipbucket_del(&next->bucket_node);
+		b->size += next->size;
+		b->next = next->next;
+		if (next->next) {
+			next->next->prev = b;
+		}
+		micro_block_put(space, next);
+		space->free_nr--;
+	}
+
+	/* merge @b into the previous */
+	if (prev && prev->live == -1) {
+		prev->size += b->size;
+		prev->next = b->next;
+		if (b->next) {
+			b->next->prev = prev;
+		}
+		micro_block_put(space, b);
+		ipbucket_update(&space->ipb, &prev->bucket_node, prev->size);
+		return;
+	}
+
+	ipbucket_add(&space->ipb, &b->bucket_node, b->size);
+	space->free_nr++;
+}
+
+static void micro_ipbucket_run(long n, int dist, const char *name)
+{
+	micro_space_t space;
+	micro_block_t *head, *b;
+	uint64_t seed = micro_seed;
+	size_t *sizes = micro_malloc(sizeof(size_t) * MICRO_SIZES);
+	long i, k, fills, retries;
+	size_t capacity = (size_t)(n > 1024 ? n : 1024) * 65536;
+
+	ipbucket_init(&space.ipb);
+	space.spare = NULL;
+	space.live_alloc = 1024;
+	space.live = micro_malloc(sizeof(micro_block_t *) * space.live_alloc);
+	space.live_nr = 0;
+	space.used = 0;
+
+	/* the block at offset 0 is never merged into others */
+	head = micro_block_new(&space);
+	head->prev = head->next = NULL;
+	head->offset = 0;
+	head->size = capacity;
+	head->live = -1;
+	ipbucket_add(&space.ipb, &head->bucket_node, head->size);
+	space.free_nr = 1;
+
+	for (k = 0; k < MICRO_SIZES; k++) {
+		sizes[k] = micro_size(dist, &seed);
+	}
+
+	k = 0;
+	micro_start();
+	for (fills = 0; micro_alloc(&space, sizes[k++ % MICRO_SIZES]) == 0; fills++);
+	micro_stop(name, "fill", fills);
+
+	/* free random blocks until the allocation succeeds */
+	retries = 0;
+	micro_start();
+	for (i = 0; i < n; i++, k++) {
+		micro_free(&space, micro_random(&seed) % space.live_nr);
+		while (micro_alloc(&space, sizes[k % MICRO_SIZES]) != 0) {
+			micro_free(&space, micro_random(&seed) % space.live_nr);
+			retries++;
+		}
+	}
+	micro_stop(name, "churn", n);
+
+	printf("# %s: %ld live, %ld free blocks, %.1f%% used, %ld retries\n",
+			name, space.live_nr, space.free_nr,
+			100.0 * space.used / capacity, retries);
+
+	while (space.live_nr > 0) {
+		micro_free(&space, space.live_nr - 1);
+	}
+	ipbucket_destory(&space.ipb);
+	free(head);
+	while ((b = space.spare) != NULL) {
+		space.spare = b->next;
+		free(b);
+	}
+	free(space.live);
+	free(sizes);
+}
+
+void micro_ipbucket(long n, const char *label)
+{
+	char name[64];
+	int dist;
+
+	for (dist = 0; dist < 3; dist++) {
+		snprintf(name, sizeof(name), "ipbucket-%s/%s",
+				micro_size_names[dist], label);
+		micro_ipbucket_run(n, dist, name);
+	}
+}
@@ -0,0 +1,205 @@
+/*
+ * Micro-benchmarks of the data structures in utils/, run by
+ * 'make bench-utils'.
+ *
+ * Each benchmark runs with each size of -n, and prints a line for
+ * each operation, with nanoseconds, and cycles, instructions and
+ * cache misses by perf_event_open(2), of each operation. The counters
+ * are '-' if not available, such as in containers, or if
+ * /proc/sys/kernel/perf_event_paranoid is above 2.
+ *
+ * Keys and sizes are random by the seed of -s, so runs are the same
+ * with the same options. Pin to a CPU by -c for steadier results.
+ *
+ * Author: Wu Bingzheng
+ *
+ */
+
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "micro.h"
+
+#define MICRO_COUNTERS	3
+
+static const char *micro_names[] = {
+	"hash", "slab", "ipbucket", "timer"
+};
+static void (*micro_benches[])(long, const char *) = {
+	micro_hash, micro_slab, micro_ipbucket, micro_timer
+};
+#define MICRO_BENCHES	(sizeof(micro_names) / sizeof(micro_names[0]))
+
+static const uint64_t micro_configs[MICRO_COUNTERS] = {
+	PERF_COUNT_HW_CPU_CYCLES,
+	PERF_COUNT_HW_INSTRUCTIONS,
+	PERF_COUNT_HW_CACHE_MISSES,
+};
+
+uint64_t micro_seed = 1;
+
+/* opened counters in the group, and their indexes in micro_configs */
+static int perf_leader = -1;
+static int perf_nr;
+static int perf_index[MICRO_COUNTERS];
+
+static struct timespec micro_begin;
+
+static int micro_perf_open(uint64_t config, int group)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.size = sizeof(attr);
+	attr.config = config;
+	attr.disabled = (group == -1);
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_GROUP;
+
+	return syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+}
+
+static void micro_perf_init(void)
+{
+	int i, fd;
+
+	for (i = 0; i < MICRO_COUNTERS; i++) {
+		fd = micro_perf_open(micro_configs[i], perf_leader);
+		if (fd < 0) {
+			continue;
+		}
+		if (perf_leader == -1) {
+			perf_leader = fd;
+		}
+		perf_index[perf_nr++] = i;
+	}
+}
+
+void micro_start(void)
+{
+	if (perf_leader != -1) {
+		ioctl(perf_leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+		ioctl(perf_leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &micro_begin);
+}
+
+void micro_stop(const char *name, const char *op, long n)
+{
+	uint64_t values[1 + MICRO_COUNTERS];
+	double counters[MICRO_COUNTERS];
+	struct timespec end;
+	double ns;
+	int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	for (i = 0; i < MICRO_COUNTERS; i++) {
+		counters[i] = -1;
+	}
+	if (perf_leader != -1) {
+		ioctl(perf_leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+		if (read(perf_leader, values, sizeof(values)) > 0) {
+			for (i = 0; i < perf_nr; i++) {
+				counters[perf_index[i]] = (double)values[1 + i] / n;
+			}
+		}
+	}
+
+	ns = (end.tv_sec - micro_begin.tv_sec) * 1e9
+		+ (end.tv_nsec - micro_begin.tv_nsec);
+
+	printf("%-26s %-14s %11ld %9.1f", name, op, n, n ? ns / n : 0.0);
+	for (i = 0; i < MICRO_COUNTERS; i++) {
+		if (counters[i] < 0) {
+			printf(" %11s", "-");
+		} else {
+			printf(" %11.2f", counters[i]);
+		}
+	}
+	printf("\n");
+	fflush(stdout);
+}
+
+/* "1M" -> 1000000. Counts, so in 1000s */
+static long micro_parse_count(const char *s)
+{
+	char *end;
+	long n = strtol(s, &end, 10);
+
+	switch (*end) {
+	case 'k': case 'K': n *= 1000; end++; break;
+	case 'm': case 'M': n *= 1000000; end++; break;
+	case 'g': case 'G': n *= 1000000000; end++; break;
+	}
+	return (*end == '\0' && n > 0) ? n : -1;
+}
+
+static void micro_usage(void)
+{
+	fputs("Usage: fcache-bench-utils [options]\n"
+		"\t-b LIST       benchmarks, of hash,slab,ipbucket,timer [all]\n"
+		"\t-n LIST       sizes, such as 1M,100M,500M [1M,10M]\n"
+		"\t-s SEED       random seed [1]\n"
+		"\t-c CPU        pin to CPU\n", stderr);
+}
+
+int main(int argc, char **argv)
+{
+	char *benches = NULL, *sizes = "1M,10M";
+	char *list, *label, *saveptr;
+	cpu_set_t cpus;
+	unsigned i;
+	long n;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "b:n:s:c:")) != -1) {
+		switch (opt) {
+		case 'b': benches = optarg; break;
+		case 'n': sizes = optarg; break;
+		case 's': micro_seed = strtoull(optarg, NULL, 0); break;
+		case 'c':
+			CPU_ZERO(&cpus);
+			CPU_SET(atoi(optarg), &cpus);
+			if (sched_setaffinity(0, sizeof(cpus), &cpus) < 0) {
+				perror("sched_setaffinity");
+				return 1;
+			}
+			break;
+		default: micro_usage(); return 1;
+		}
+	}
+	if (micro_seed == 0) {
+		micro_seed = 1;
+	}
+
+	micro_perf_init();
+	printf("# seed %lu, perf counters %s\n", (unsigned long)micro_seed,
+			perf_leader != -1 ? "on" : "off");
+	printf("%-26s %-14s %11s %9s %11s %11s %11s\n", "# name", "op", "n",
+			"ns/op", "cycles/op", "insns/op", "misses/op");
+
+	for (i = 0; i < MICRO_BENCHES; i++) {
+		if (benches != NULL && strstr(benches, micro_names[i]) == NULL) {
+			continue;
+		}
+
+		list = strdup(sizes);
+		for (label = strtok_r(list, ",", &saveptr); label != NULL;
+				label = strtok_r(NULL, ",", &saveptr)) {
+			n = micro_parse_count(label);
+			if (n < 0) {
+				fprintf(stderr, "invalid size: %s\n", label);
+				return 1;
+			}
+			micro_benches[i](n, label);
+		}
+		free(list);
+	}
+	return 0;
+}
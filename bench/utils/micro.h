@@ -0,0 +1,77 @@
+/*
+ * Micro-benchmarks of the data structures in utils/.
+ *
+ * Author: Wu Bingzheng
+ *
+ */
+
+#ifndef _FCA_MICRO_H_
+#define _FCA_MICRO_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+extern uint64_t micro_seed;
+
+/* measure the operations between micro_start() and micro_stop(),
+ * and print a line of @name, @op, and the costs of each of @n */
+void micro_start(void);
+void micro_stop(const char *name, const char *op, long n);
+
+/* benchmarks, with @n elements, and @label as the name of @n */
+void micro_hash(long n, const char *label);
+void micro_slab(long n, const char *label);
+void micro_ipbucket(long n, const char *label);
+void micro_timer(long n, const char *label);
+
+static inline uint64_t micro_random(uint64_t *state)
+{
+	/* xorshift64* */
+	uint64_t x = *state;
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*state = x;
+	return x * 0x2545F4914F6CDD1DULL;
+}
+
+static inline uint64_t micro_mix64(uint64_t x)
+{
+	/* splitmix64 finalizer */
+	x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+	return x ^ (x >> 31);
+}
+
+/* visit [0, @n) in a scattered order: the @j-th is micro_scatter(j),
+ * with a stride coprime to @n from micro_stride(n) */
+static inline long micro_stride(long n)
+{
+	long a, b, t, stride = 2654435761L % n;
+
+	for (;; stride++) {
+		for (a = n, b = stride; b != 0; t = a % b, a = b, b = t);
+		if (a == 1 || n == 1) {
+			return stride;
+		}
+	}
+}
+
+static inline long micro_scatter(long j, long n, long stride)
+{
+	return (uint64_t)j * stride % n;
+}
+
+static inline void *micro_malloc(size_t size)
+{
+	void *p = malloc(size);
+	if (p == NULL) {
+		fputs("no memory\n", stderr);
+		exit(1);
+	}
+	return p;
+}
+
+#endif
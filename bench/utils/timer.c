@@ -0,0 +1,78 @@
+/*
+ * Benchmark of utils/timer.c with @n connections: add, update with
+ * the same timeout as a request comes, update to another timeout,
+ * and expire all.
+ *
+ * There are a few different timeouts, as the keepalive and request
+ * timeouts of several servers.
+ *
+ * Author: Wu Bingzheng
+ *
+ */
+
+#include "micro.h"
+#include "../../utils/timer.h"
+
+#define MICRO_TIMEOUTS	4
+
+static const time_t micro_timeouts[MICRO_TIMEOUTS] = { 5, 10, 60, 300 };
+
+void micro_timer(long n, const char *label)
+{
+	fca_timer_node_t *tnodes = micro_malloc(sizeof(fca_timer_node_t) * n);
+	fca_timer_node_t *tnode;
+	struct list_head *expires, *p, *safe;
+	fca_timer_t timer;
+	char name[64];
+	long i, j, stride, expired;
+
+	snprintf(name, sizeof(name), "timer/%s", label);
+	timer_init(&timer);
+
+	/* touch the nodes before */
+	memset(tnodes, 0, sizeof(fca_timer_node_t) * n);
+
+	micro_start();
+	for (i = 0; i < n; i++) {
+		if (timer_add(&timer, &tnodes[i], micro_timeouts[i % MICRO_TIMEOUTS]) != 0) {
+			fputs("no memory\n", stderr);
+			exit(1);
+		}
+	}
+	micro_stop(name, "add", n);
+
+	stride = micro_stride(n);
+	micro_start();
+	for (j = 0; j < n; j++) {
+		timer_update(&tnodes[micro_scatter(j, n, stride)], 0);
+	}
+	micro_stop(name, "update", n);
+
+	micro_start();
+	for (j = 0; j < n; j++) {
+		i = micro_scatter(j, n, stride);
+		timer_update(&tnodes[i], micro_timeouts[(i + 1) % MICRO_TIMEOUTS]);
+	}
+	micro_stop(name, "update-move", n);
+
+	/* make them all expired, not measured */
+	for (i = 0; i < n; i++) {
+		tnodes[i].timeout = 0;
+	}
+
+	expired = 0;
+	micro_start();
+	expires = timer_expire(&timer);
+	list_for_each_safe(p, safe, expires) {
+		tnode = list_entry(p, fca_timer_node_t, tnode_node);
+		timer_del(tnode);
+		expired++;
+	}
+	micro_stop(name, "expire", n);
+	if (expired != n) {
+		printf("# %s: %ld of %ld expired\n", name, expired, n);
+	}
+
+	timer_destroy(&timer);
+	free(tnodes);
+}
@@ -99,10 +99,101 @@ static const char *conf_set_flag(fca_conf_command_t *cmd, void *data, char *arg)
 	return FCA_CONF_OK;
 }
 
+/* handler of eviction policy name */
+static const char *conf_set_evict_policy(fca_conf_command_t *cmd, void *data, char *arg)
+{
+	int policy = evict_policy_index(arg);
+	if (policy < 0) {
+		return "invalid evict policy";
+	}
+
+	*((int *)(((char *)data) + cmd->offset)) = policy;
+	return FCA_CONF_OK;
+}
+
+/* options after the device path, in 'name value' pairs */
+static const char *conf_device_options(fca_device_t *device, char *options)
+{
+	char *name, *name_end, *value;
+
+	while (1) {
+		name = strnonwhite(options);
+		if (*name == '\0') {
+			return FCA_CONF_OK;
+		}
+		name_end = strwhite(name);
+		value = strnonwhite(name_end);
+		if (*value == '\0') {
+			return "miss device option value";
+		}
+		options = strwhite(value);
+		*name_end = '\0';
+		if (*options != '\0') {
+			*options++ = '\0';
+		}
+
+		if (strcmp(name, "alloc") == 0) {
+			if (strcmp(value, "append") == 0) {
+				device->alloc = DEVICE_ALLOC_APPEND;
+			} else if (strcmp(value, "extent") == 0) {
+				device->alloc = DEVICE_ALLOC_EXTENT;
+			} else if (strcmp(value, "ipbucket") == 0) {
+				device->alloc = DEVICE_ALLOC_IPBUCKET;
+			} else {
+				return "invalid device alloc";
+			}
+		} else if (strcmp(name, "io") == 0) {
+			if (strcmp(value, "direct") == 0) {
+				device->direct = 1;
+			} else if (strcmp(value, "buffered") == 0) {
+				device->direct = 0;
+			} else {
+				return "invalid device io";
+			}
+		} else if (strcmp(name, "cache") == 0) {
+			fca_conf_command_t cmd = { name, conf_set_size,
+				offsetof(fca_device_t, cache_size) };
+			const char *msg = conf_set_size(&cmd, device, value);
+			if (msg != FCA_CONF_OK) {
+				return msg;
+			}
+		} else if (strcmp(name, "size") == 0) {
+			fca_conf_command_t cmd = { name, conf_set_size,
+				offsetof(fca_device_t, size) };
+			const char *msg = conf_set_size(&cmd, device, value);
+			if (msg != FCA_CONF_OK) {
+				return msg;
+			}
+		} else if (strcmp(name, "threads") == 0) {
+			fca_conf_command_t cmd = { name, conf_set_int,
+				offsetof(fca_device_t, thread_nr) };
+			const char *msg = conf_set_int(&cmd, device, value);
+			if (msg != FCA_CONF_OK) {
+				return msg;
+			}
+			if (device->thread_nr < 1
+					|| device->thread_nr > DEVICE_THREADS_LIMIT) {
+				return "invalid device threads";
+			}
+		} else if (strcmp(name, "dispatch") == 0) {
+			if (strcmp(value, "least") == 0) {
+				device->dispatch = DEVICE_DISPATCH_LEAST;
+			} else if (strcmp(value, "rr") == 0) {
+				device->dispatch = DEVICE_DISPATCH_RR;
+			} else {
+				return "invalid device dispatch";
+			}
+		} else {
+			return "invalid device option";
+		}
+	}
+}
+
 static const char *conf_new_device(fca_conf_command_t *cmd, void *data, char *arg)
 {
 	fca_device_t *device;
 	struct list_head *p;
+	char *options;
 
 	if (!list_empty(&reserved_devices)) {
 		p = reserved_devices.next;
@@ -116,10 +207,18 @@ static const char *conf_new_device(fca_conf_command_t *cmd, void *data, char *ar
 	}
 	bzero(device, sizeof(fca_device_t));
 
+	options = strwhite(arg);
+	if (*options != '\0') {
+		*options++ = '\0';
+	}
+
 	device->fd = -1;
+	device->direct_fd = -1;
+	device->cache_size = DEVICE_CACHE_SIZE;
+	device->thread_nr = 1;
 	strcpy(device->filename, arg);
 	list_add_tail(&device->dnode, &conf_cycle.devices);
-	return FCA_CONF_OK;
+	return conf_device_options(device, options);
 }
 
 static const char *conf_new_server(fca_conf_command_t *cmd, void *data, char *arg)
@@ -127,6 +226,7 @@ static const char *conf_new_server(fca_conf_command_t *cmd, void *data, char *ar
 	fca_server_t *server;
 	struct list_head *p;
 	char *endp;
+	int i;
 	long port = strtol(arg, &endp, 0);
 	if (*endp != '\0' || port < 0 || port > 65535) {
 		return "invalid port";
@@ -145,7 +245,9 @@ static const char *conf_new_server(fca_conf_command_t *cmd, void *data, char *ar
 
 	*server = default_server;
 	server->listen_port = (unsigned short)port;
-	server->listen_fd = -1;
+	for (i = 0; i < MASTERS_LIMIT; i++) {
+		server->listen_fds[i] = -1;
+	}
 	list_add_tail(&server->snode, &conf_cycle.servers);
 
 	return FCA_CONF_OK;
@@ -155,6 +257,10 @@ static const char *conf_new_server(fca_conf_command_t *cmd, void *data, char *ar
 #define COMMAND_NUMBER (int)(sizeof(g_commands) / sizeof(fca_conf_command_t))
 static fca_conf_command_t g_commands[] = {
 	/* global */
+	{	"threads",
+		conf_set_int,
+		offsetof(fca_conf_t, threads)
+	},
 	{	"error_log",
 		conf_set_path,
 		offsetof(fca_conf_t, error_log)
@@ -171,6 +277,38 @@ static fca_conf_command_t g_commands[] = {
 		conf_set_flag,
 		offsetof(fca_conf_t, device_check_270G)
 	},
+	{	"device_io_uring",
+		conf_set_flag,
+		offsetof(fca_conf_t, device_io_uring)
+	},
+	{	"device_splice",
+		conf_set_flag,
+		offsetof(fca_conf_t, device_splice)
+	},
+	{	"device_write_combine",
+		conf_set_flag,
+		offsetof(fca_conf_t, device_write_combine)
+	},
+	{	"device_journal_size",
+		conf_set_size,
+		offsetof(fca_conf_t, device_journal_size)
+	},
+	{	"device_journal_checkpoint",
+		conf_set_int,
+		offsetof(fca_conf_t, device_journal_checkpoint)
+	},
+	{	"device_defrag_rate",
+		conf_set_size,
+		offsetof(fca_conf_t, device_defrag_rate)
+	},
+	{	"device_fadvise_size",
+		conf_set_size,
+		offsetof(fca_conf_t, device_fadvise_size)
+	},
+	{	"device_readahead",
+		conf_set_size,
+		offsetof(fca_conf_t, device_readahead)
+	},
 	{	"device",
 		conf_new_device,
 		0
@@ -189,6 +327,22 @@ static fca_conf_command_t g_commands[] = {
 		conf_set_path,
 		offsetof(fca_server_t, access_log)
 	},
+	{	"slow_log",
+		conf_set_path,
+		offsetof(fca_server_t, slow_log)
+	},
+	{	"slow_log_threshold",
+		conf_set_int,
+		offsetof(fca_server_t, slow_log_threshold)
+	},
+	{	"trace_log",
+		conf_set_path,
+		offsetof(fca_server_t, trace_log)
+	},
+	{	"trace_log_sample",
+		conf_set_int,
+		offsetof(fca_server_t, trace_log_sample)
+	},
 	{	"connections_limit",
 		conf_set_int,
 		offsetof(fca_server_t, connections_limit)
@@ -269,6 +423,22 @@ static fca_conf_command_t g_commands[] = {
 		conf_set_int,
 		offsetof(fca_server_t, passby_expire)
 	},
+	{	"ram_capacity",
+		conf_set_size,
+		offsetof(fca_server_t, ram_capacity)
+	},
+	{	"ram_item_max_size",
+		conf_set_size,
+		offsetof(fca_server_t, ram_item_max_size)
+	},
+	{	"ram_admit_hits",
+		conf_set_int,
+		offsetof(fca_server_t, ram_admit_hits)
+	},
+	{	"evict_policy",
+		conf_set_evict_policy,
+		offsetof(fca_server_t, evict_policy)
+	},
 	{	"status_period",
 		conf_set_int,
 		offsetof(fca_server_t, status_period)
@@ -299,11 +469,11 @@ static const char *conf_readline(FILE *fp, char *cmd, char *arg)
 		return "miss argument";
 	}
 
+	/* more arguments are checked by the caller */
 	arg_end = strwhite(arg_start);
-
-	line_end = strnonwhite(arg_end);
-	if (*line_end != '\0' && *line_end != '#') {
-		return "too many arguments";
+	for (line_end = strnonwhite(arg_end); *line_end != '\0' && *line_end != '#';
+			line_end = strnonwhite(arg_end)) {
+		arg_end = strwhite(line_end);
 	}
 
 	*cmd_end = *arg_end = '\0';
@@ -358,6 +528,10 @@ static int conf_parse_file(const char *filename, int deep)
 
 		/* "include" */
 		if (strcmp(cmd, "include") == 0) {
+			if (*strwhite(arg) != '\0') {
+				msg_rc = "too many arguments";
+				break;
+			}
 			char *included_file = arg;
 			char buffer[PATH_LENGTH];
 			char *dir = strrchr(filename, '/');
@@ -388,6 +562,12 @@ static int conf_parse_file(const char *filename, int deep)
 			break;
 		}
 
+		/* only 'device' takes options after its argument */
+		if (c->set_handler != conf_new_device && *strwhite(arg) != '\0') {
+			msg_rc = "too many arguments";
+			break;
+		}
+
 		if (i < server_context_begin) {
 			if (!list_empty(&conf_cycle.servers)) {
 				msg_rc = "global command in server context";
@@ -432,9 +612,18 @@ fca_conf_t *conf_parse(const char *filename)
 	/* init conf */
 	INIT_LIST_HEAD(&conf_cycle.devices);
 	INIT_LIST_HEAD(&conf_cycle.servers);
+	conf_cycle.threads = 1;
 	conf_cycle.quit_timeout = 60;
 	conf_cycle.device_badblock_percent = 1;
 	conf_cycle.device_check_270G = 1;
+	conf_cycle.device_io_uring = 0;
+	conf_cycle.device_splice = 0;
+	conf_cycle.device_write_combine = 0;
+	conf_cycle.device_journal_size = 0;
+	conf_cycle.device_journal_checkpoint = 300;
+	conf_cycle.device_defrag_rate = 0;
+	conf_cycle.device_fadvise_size = 0;
+	conf_cycle.device_readahead = 0;
 	strcpy(conf_cycle.error_log, "error.log");
 
 	/* init default_server */
@@ -446,6 +635,10 @@ fca_conf_t *conf_parse(const char *filename)
 	default_server.request_timeout = 60;
 	default_server.keepalive_timeout = 60;
 	default_server.item_max_size = 100 << 20; /*100M*/
+	default_server.ram_capacity = 0;
+	default_server.ram_item_max_size = 16 << 10; /*16K*/
+	default_server.ram_admit_hits = 2;
+	default_server.evict_policy = EVICT_LRU;
 	default_server.expire_default = 259200;  /*3days*/
 	default_server.expire_force = 0;
 	default_server.sndbuf = 0;
@@ -462,6 +655,10 @@ fca_conf_t *conf_parse(const char *filename)
 	default_server.passby_expire = 3600;
 	default_server.status_period = 60;
 	strcpy(default_server.access_log, "access.log");
+	default_server.slow_log[0] = '\0';
+	default_server.slow_log_threshold = 100;
+	default_server.trace_log[0] = '\0';
+	default_server.trace_log_sample = 1;
 
 	/* parse */
 	if (conf_parse_file(filename, 0) == FCA_ERROR) {
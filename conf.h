@@ -11,8 +11,17 @@
 #include "fcache.h"
 
 struct fca_conf_s {
+	int		threads;
 	int		device_badblock_percent;
 	fca_flag_t	device_check_270G;
+	fca_flag_t	device_io_uring;
+	fca_flag_t	device_splice;
+	fca_flag_t	device_write_combine;
+	size_t		device_journal_size;
+	int		device_journal_checkpoint;
+	size_t		device_defrag_rate;
+	size_t		device_fadvise_size;
+	size_t		device_readahead;
 	time_t		quit_timeout;
 
 	char		error_log[PATH_LENGTH];
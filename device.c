@@ -5,16 +5,42 @@
  *
  */
 
+#define _GNU_SOURCE /* for copy_file_range */
 #include "device.h"
 
-/* init in device_conf_load() */
-static fca_ipbucket_t free_blocks;
+/* free blocks of each shard. init in device_conf_load() */
+static fca_ipbucket_t free_blocks[MASTERS_LIMIT];
+
+/* regions of append devices of each shard, taking turns */
+static struct list_head append_regions[MASTERS_LIMIT];
+
+/* regions of extent devices of each shard */
+static struct list_head extent_regions[MASTERS_LIMIT];
+
+_Static_assert(sizeof(fca_free_block_t) == sizeof(fca_item_t),
+		"fca_free_block_t mismatch");
+_Static_assert(offsetof(fca_free_block_t, order_node) == ITEM_ORDER_NODE,
+		"fca_free_block_t mismatch");
+
+/* set after device_format_load() */
+static int device_loaded = 0;
 
 static LIST_HEAD(devices);
 static LIST_HEAD(deleted_devices);
 
+static void device_defrag_start(fca_device_t *d);
+
 static int device_badblock_percent;
 static int device_check_270G;
+int device_io_uring;
+int device_splice;
+int device_write_combine;
+size_t device_journal_size;
+int device_journal_checkpoint;
+size_t device_defrag_rate;
+size_t device_fadvise_size;
+size_t device_readahead;
+int device_loading_nr;
 
 /* this makes things complicated, but it's useful for saving
  * memory, in fca_item_t and fca_free_block_t. */
@@ -32,37 +58,83 @@ inline fca_device_t *device_of_item(fca_item_t *item)
 }
 
 
-static inline void device_ipbucket_add(fca_free_block_t *fblock)
+static inline size_t device_block_size(fca_device_t *device, size_t length)
 {
-	ipbucket_add(&free_blocks, &fblock->bucket_node, fblock->block_size);
+	return device->alloc == DEVICE_ALLOC_EXTENT ? extent_block_size(length)
+		: ipbucket_block_size(length);
 }
 
-static inline void device_ipbucket_update(fca_free_block_t *fblock)
+size_t device_item_block_size(fca_item_t *item)
 {
-	ipbucket_update(&free_blocks, &fblock->bucket_node, fblock->block_size);
+	return device_block_size(device_of_item(item), item->length);
 }
 
-/* add a free block (with @offset and @size) into @device's order list,
- * before @base. */
-static fca_free_block_t *device_fblock_insert(fca_device_t *device,
-		struct list_head *base, off_t offset, size_t size)
+/* index free block by size. Free blocks of append devices are found
+ * by the cursor, not by size. */
+static void device_fblock_index(fca_free_block_t *fblock)
 {
-	static fca_slab_t free_block_slab = FCA_SLAB_INIT(fca_free_block_t);
+	fca_device_t *device = device_of_fblock(fblock);
+	fca_pool_t *pool = &item_pools[fblock->shard];
+
+	switch (device->alloc) {
+	case DEVICE_ALLOC_IPBUCKET:
+		ipbucket_add(&free_blocks[fblock->shard], &fblock->bucket_node,
+				fblock->block_size);
+		break;
+	case DEVICE_ALLOC_EXTENT:
+		extent_add(pool, &device->regions[fblock->shard].extents,
+				pool_handle(pool, fblock));
+		break;
+	default:
+		fblock->bucket_node.prev = NULL;
+	}
+}
+
+static void device_fblock_unindex(fca_free_block_t *fblock)
+{
+	fca_device_t *device = device_of_fblock(fblock);
+	fca_pool_t *pool = &item_pools[fblock->shard];
+
+	if (device->alloc == DEVICE_ALLOC_EXTENT) {
+		extent_del(pool, &device->regions[fblock->shard].extents,
+				pool_handle(pool, fblock));
+	} else {
+		ipbucket_del(&fblock->bucket_node);
+	}
+}
 
+static void device_fblock_resize(fca_free_block_t *fblock, off_t offset, size_t size)
+{
+	device_fblock_unindex(fblock);
+	fblock->offset = offset;
+	fblock->block_size = size;
+	device_fblock_index(fblock);
+}
+
+/* add a free block (with @offset and @size) into @device's order list
+ * of @shard, before @base, or at the end if @base is 0. */
+static fca_free_block_t *device_fblock_insert(fca_device_t *device, int shard,
+		fca_handle_t base, off_t offset, size_t size)
+{
+	fca_pool_t *pool = &item_pools[shard];
+	fca_ilist_head_t *head = &device->regions[shard].order_head;
 	fca_free_block_t *fblock;
 
-	fblock = slab_alloc(&free_block_slab);
+	fblock = pool_alloc(pool);
 	if (fblock == NULL) {
 		return NULL;
 	}
 	fblock->fblock = 1;
+	fblock->shard = shard;
 	fblock->device_index = device->index;
 	fblock->offset = offset;
 	fblock->block_size = size;
-	list_add_tail(&fblock->order_node, base);
-	device_ipbucket_add(fblock);
+	ilist_insert(pool, ITEM_ORDER_NODE, head, pool_handle(pool, fblock),
+			base ? ilist_prev(pool, ITEM_ORDER_NODE, base) : head->last,
+			base);
+	device_fblock_index(fblock);
 
-	device->fblock_nr++;
+	device->regions[shard].fblock_nr++;
 	return fblock;
 }
 
@@ -70,10 +142,75 @@ static fca_free_block_t *device_fblock_insert(fca_device_t *device,
 static void device_fblock_delete(fca_free_block_t *fblock)
 {
 	fca_device_t *device = device_of_fblock(fblock);
-	device->fblock_nr--;
-	ipbucket_del(&fblock->bucket_node);
-	list_del(&fblock->order_node);
-	slab_free(fblock);
+	fca_pool_t *pool = &item_pools[fblock->shard];
+	fca_device_region_t *region = &device->regions[fblock->shard];
+	fca_handle_t h = pool_handle(pool, fblock);
+
+	if (region->cursor == h) {
+		region->cursor = fblock->order_node.prev
+			? fblock->order_node.prev : fblock->order_node.next;
+	}
+
+	region->fblock_nr--;
+	device_fblock_unindex(fblock);
+	ilist_del(pool, ITEM_ORDER_NODE, &region->order_head, h);
+	pool_free(pool, fblock);
+}
+
+/* split space from @device->load_offset to the end into regions evenly */
+static int device_spread_space(fca_device_t *device)
+{
+	size_t offset = device->load_offset;
+	size_t size;
+	int i;
+
+	if (offset >= device->capacity) {
+		return FCA_OK;
+	}
+
+	size = ((device->capacity - offset) / master_nr) & ~(EXTENT_UNIT - 1);
+	for (i = 0; i < master_nr; i++) {
+		if (i == master_nr - 1) {
+			size = device->capacity - offset;
+		}
+		if (size == 0) {
+			continue;
+		}
+
+		server_shard_lock(i);
+		if (device_fblock_insert(device, i, 0, offset, size) == NULL) {
+			server_shard_unlock(i);
+			return FCA_ERROR;
+		}
+		server_shard_unlock(i);
+
+		offset += size;
+	}
+	device->load_offset = device->capacity;
+	return FCA_OK;
+}
+
+/* the append or extent device is ready for allocating, after loaded */
+static void device_alloc_start(fca_device_t *device)
+{
+	struct list_head *heads;
+	int i;
+
+	switch (device->alloc) {
+	case DEVICE_ALLOC_APPEND:
+		heads = append_regions;
+		break;
+	case DEVICE_ALLOC_EXTENT:
+		heads = extent_regions;
+		break;
+	default:
+		return;
+	}
+	for (i = 0; i < master_nr; i++) {
+		server_shard_lock(i);
+		list_add_tail(&device->regions[i].alloc_node, &heads[i]);
+		server_shard_unlock(i);
+	}
 }
 
 /* remove the conf_device from conf_cycle.devices list,
@@ -83,25 +220,45 @@ static void device_add(fca_device_t *conf_device)
 {
 	fca_device_t *d = conf_device;
 
+	int i;
+
 	list_del(&d->dnode);
 	list_add_tail(&d->dnode, &devices);
 
-	INIT_LIST_HEAD(&d->order_head);
+	for (i = 0; i < master_nr; i++) {
+		INIT_ILIST_HEAD(&d->regions[i].order_head);
+		INIT_LIST_HEAD(&d->regions[i].alloc_node);
+		extent_init(&d->regions[i].extents);
+		d->regions[i].device = d;
+	}
 	conf_device->index = idx_pointer_add(&device_indexs, conf_device);
-	if (d->capacity != 0) {
-		if (device_fblock_insert(d, &d->order_head, 0, d->capacity) == NULL) {
-			conf_device->kicked = 1;
-			log_error_admin(0, "add device %s [NOMEM]", d->filename);
-			return;
+
+	/* items are after the journal */
+	if (d->journal != NULL) {
+		d->load_offset = device_journal_size;
+		if (device_loaded) {
+			journal_reset(d->journal);
 		}
 	}
 
+	/* the space is spread in device_load_post(), if not loaded yet */
+	if (device_loaded && device_spread_space(d) != FCA_OK) {
+		conf_device->kicked = 1;
+		log_error_admin(0, "add device %s [NOMEM]", d->filename);
+		return;
+	}
+	if (device_loaded) {
+		device_alloc_start(d);
+		device_defrag_start(d);
+	}
+
 	/* other fields were set to zero, when malloc the conf_server */
 }
 
 static void device_update(fca_device_t *d, fca_device_t *conf_device)
 {
 	strcpy(d->filename, conf_device->filename);
+	d->dispatch = conf_device->dispatch;
 
 	/* keep in order */
 	list_del(&d->dnode);
@@ -110,8 +267,17 @@ static void device_update(fca_device_t *d, fca_device_t *conf_device)
 
 static void device_delete(fca_device_t *d)
 {
+	int i;
+
 	list_del(&d->dnode);
 
+	for (i = 0; i < master_nr; i++) {
+		server_shard_lock(i);
+		list_del_init(&d->regions[i].alloc_node);
+		server_shard_unlock(i);
+	}
+	__atomic_store_n(&d->defrag_quit, 1, __ATOMIC_RELEASE);
+
 	if (d->kicked) {
 		free(d);
 	} else {
@@ -120,25 +286,55 @@ static void device_delete(fca_device_t *d)
 	}
 }
 
+static void device_workers_delete(fca_device_t *d, time_t quit_time)
+{
+	int i;
+	for (i = 0; i < d->thread_nr; i++) {
+		if (d->workers[i] != NULL) {
+			worker_delete(d->workers[i], quit_time);
+			d->workers[i] = NULL;
+		}
+	}
+}
+
+static int device_empty(fca_device_t *d)
+{
+	int i;
+	for (i = 0; i < master_nr; i++) {
+		if (!ilist_empty(&d->regions[i].order_head)) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
 static void device_destroy(fca_device_t *d)
 {
-	struct list_head *p, *safe;
 	fca_free_block_t *fblock;
 	fca_item_t *item;
-	int count = 0;
-
-	list_for_each_safe(p, safe, &d->order_head) {
-		fblock = list_entry(p, fca_free_block_t, order_node);
-		if (fblock->fblock) {
-			device_fblock_delete(fblock);
-		} else {
-			item = list_entry(p, fca_item_t, order_node);
-			server_item_delete(item);
-		}
+	fca_pool_t *pool;
+	fca_handle_t h, next;
+	int count, i;
+
+	for (i = 0; i < master_nr; i++) {
+		count = 0;
+		pool = &item_pools[i];
+		server_shard_lock(i);
+		for (h = d->regions[i].order_head.first; h != 0; h = next) {
+			next = ilist_next(pool, ITEM_ORDER_NODE, h);
+			fblock = pool_ptr(pool, h);
+			if (fblock->fblock) {
+				device_fblock_delete(fblock);
+			} else {
+				item = pool_ptr(pool, h);
+				server_item_delete(item);
+			}
 
-		if (count++ >= LOOP_LIMIT) {
-			break;
+			if (count++ >= LOOP_LIMIT) {
+				break;
+			}
 		}
+		server_shard_unlock(i);
 	}
 
 	/* we want to close the fd as soon as possible, while not
@@ -146,15 +342,32 @@ static void device_destroy(fca_device_t *d)
 	if (d->used == 0 && d->fd != -1) {
 		close(d->fd);
 		d->fd = -1;
+		if (d->direct_fd != -1) {
+			close(d->direct_fd);
+			d->direct_fd = -1;
+		}
 	}
 
-	if (!list_empty(&d->order_head)) {
+	if (!device_empty(d) || __atomic_load_n(&d->loading, __ATOMIC_ACQUIRE)
+			|| __atomic_load_n(&d->defragging, __ATOMIC_ACQUIRE)) {
 		return;
 	}
 
-	if (d->worker != NULL) {
-		worker_delete(d->worker, 0);
+	if (d->load_joinable) {
+		pthread_join(d->load_tid, NULL);
+	}
+	if (d->defrag_joinable) {
+		pthread_join(d->defrag_tid, NULL);
+	}
+	device_workers_delete(d, 0);
+	if (d->bcache != NULL) {
+		bcache_destroy(d->bcache);
+		free(d->bcache);
+	}
+	if (d->journal != NULL) {
+		journal_delete(d->journal);
 	}
+	free(d->metrics);
 	list_del(&d->dnode);
 	idx_pointer_delete(&device_indexs, d->index);
 	free(d);
@@ -165,6 +378,7 @@ static void device_destroy(fca_device_t *d)
  * for show status and re-load configure. */
 static void device_kick(fca_device_t *device)
 {
+	int i;
 	fca_device_t *bad_dev = malloc(sizeof(fca_device_t));
 	if (bad_dev == NULL) {
 		return;
@@ -173,7 +387,19 @@ static void device_kick(fca_device_t *device)
 	*bad_dev = *device;
 
 	bad_dev->kicked = 1;
-	INIT_LIST_HEAD(&bad_dev->order_head);
+	bad_dev->journal = NULL;
+	bad_dev->thread_nr = 0;
+	bad_dev->bcache = NULL;
+	bad_dev->metrics = NULL;
+	bad_dev->loading = 0;
+	bad_dev->load_joinable = 0;
+	bad_dev->defragging = 0;
+	bad_dev->defrag_joinable = 0;
+	for (i = 0; i < master_nr; i++) {
+		INIT_ILIST_HEAD(&bad_dev->regions[i].order_head);
+		INIT_LIST_HEAD(&bad_dev->regions[i].alloc_node);
+		extent_init(&bad_dev->regions[i].extents);
+	}
 
 	list_add(&bad_dev->dnode, &device->dnode);
 	device_delete(device);
@@ -208,7 +434,7 @@ int device_conf_check(fca_conf_t *conf_cycle)
 	fca_device_t *d, *d2;
 	const char *msg;
 	struct stat filestat;
-	int count = 0;
+	int count = 0, i;
 
 	if (list_empty(&conf_cycle->devices)) {
 		log_error_admin(0, "you must set at least 1 device");
@@ -218,6 +444,15 @@ int device_conf_check(fca_conf_t *conf_cycle)
 		log_error_admin(0, "device_badblock_percent must be less than 100");
 		return FCA_ERROR;
 	}
+	if (!list_empty(&devices)
+			&& conf_cycle->device_journal_size != device_journal_size) {
+		log_error_admin(0, "device_journal_size can not be changed by reload");
+		return FCA_ERROR;
+	}
+	if (conf_cycle->device_journal_size % (2 * 4096) != 0) {
+		log_error_admin(0, "device_journal_size must be multiple of 8K");
+		return FCA_ERROR;
+	}
 
 	list_for_each(p, &devices) {
 		d = list_entry(p, fca_device_t, dnode);
@@ -237,6 +472,18 @@ int device_conf_check(fca_conf_t *conf_cycle)
 			goto fail;
 		}
 
+		/* no file in simulation, but only the space by 'size' */
+		if (fca_simulate) {
+			if (d->size == 0) {
+				msg = "simulation needs size";
+				goto fail;
+			}
+			d->dev = 0;
+			d->inode = count;
+			d->capacity = d->size & ~0x1FFL;
+			continue;
+		}
+
 		if (stat(d->filename, &filestat) < 0) {
 			msg = "error in stat device";
 			goto fail;
@@ -260,6 +507,19 @@ int device_conf_check(fca_conf_t *conf_cycle)
 				goto fail;
 			}
 
+			if (d2->alloc != d->alloc) {
+				msg = "alloc can not be changed by reload";
+				goto fail;
+			}
+			if (d2->direct != d->direct || d2->cache_size != d->cache_size) {
+				msg = "io and cache can not be changed by reload";
+				goto fail;
+			}
+			if (d2->thread_nr != d->thread_nr) {
+				msg = "threads can not be changed by reload";
+				goto fail;
+			}
+
 			d2->conf = d;
 			d->conf = d2;
 			continue;
@@ -278,6 +538,25 @@ int device_conf_check(fca_conf_t *conf_cycle)
 			goto fail;
 		}
 
+		d->metrics = calloc(master_nr, sizeof(fca_metrics_t));
+		if (d->metrics == NULL) {
+			msg = "error in create metrics";
+			goto fail;
+		}
+
+		/* direct IO needs items aligned, by the extent allocator */
+		if (d->direct) {
+			if (d->alloc != DEVICE_ALLOC_EXTENT) {
+				msg = "io direct needs alloc extent";
+				goto fail;
+			}
+			d->direct_fd = open(d->filename, O_RDWR | O_DIRECT);
+			if (d->direct_fd < 0) {
+				msg = "error in open device by O_DIRECT";
+				goto fail;
+			}
+		}
+
 		if (S_ISREG(filestat.st_mode)) {
 			d->capacity = filestat.st_size & ~0x1FFL;
 
@@ -294,6 +573,10 @@ int device_conf_check(fca_conf_t *conf_cycle)
 			goto fail;
 		}
 
+		if (d->size != 0 && d->capacity > d->size) {
+			d->capacity = d->size & ~0x1FFL;
+		}
+
 		if (d->capacity > 0x4020010000) {
 			/* sendfile supports only 0x4020010000 */
 			if (conf_cycle->device_check_270G) {
@@ -304,9 +587,37 @@ int device_conf_check(fca_conf_t *conf_cycle)
 		}
 
 		if (d->capacity > 0) {
-			d->worker = worker_create();
-			if (d->worker == NULL) {
-				msg = "error in create worker thread";
+			for (i = 0; i < d->thread_nr; i++) {
+				d->workers[i] = worker_create();
+				if (d->workers[i] == NULL) {
+					msg = "error in create worker thread";
+					goto fail;
+				}
+			}
+		}
+
+		if (d->capacity > 0 && d->direct) {
+			d->bcache = malloc(sizeof(fca_bcache_t));
+			if (d->bcache == NULL) {
+				msg = "error in create block cache";
+				goto fail;
+			}
+			if (bcache_init(d->bcache, d->cache_size) != FCA_OK) {
+				free(d->bcache);
+				d->bcache = NULL;
+				msg = "error in create block cache";
+				goto fail;
+			}
+		}
+
+		if (d->capacity > 0 && conf_cycle->device_journal_size != 0) {
+			if (d->capacity <= conf_cycle->device_journal_size) {
+				msg = "device is too small for device_journal_size";
+				goto fail;
+			}
+			d->journal = journal_create(d);
+			if (d->journal == NULL) {
+				msg = "error in create journal";
 				goto fail;
 			}
 		}
@@ -323,16 +634,29 @@ void device_conf_load(fca_conf_t *conf_cycle)
 {
 	struct list_head *p, *safe;
 	fca_device_t *d;
+	int i;
 
 	/* init free_blocks. executes only once */
 	static int first = 1;
 	if (first) {
 		first = 0;
-		ipbucket_init(&free_blocks);
+		for (i = 0; i < master_nr; i++) {
+			ipbucket_init(&free_blocks[i]);
+			INIT_LIST_HEAD(&append_regions[i]);
+			INIT_LIST_HEAD(&extent_regions[i]);
+		}
 	}
 
 	device_badblock_percent = conf_cycle->device_badblock_percent;
 	device_check_270G = conf_cycle->device_check_270G;
+	device_io_uring = conf_cycle->device_io_uring;
+	device_splice = conf_cycle->device_splice;
+	device_write_combine = conf_cycle->device_write_combine;
+	device_journal_size = conf_cycle->device_journal_size;
+	device_journal_checkpoint = conf_cycle->device_journal_checkpoint;
+	device_defrag_rate = conf_cycle->device_defrag_rate;
+	device_fadvise_size = conf_cycle->device_fadvise_size;
+	device_readahead = conf_cycle->device_readahead;
 
 	list_for_each_safe(p, safe, &devices) {
 		d = list_entry(p, fca_device_t, dnode);
@@ -361,43 +685,163 @@ void device_conf_rollback(fca_conf_t *conf_cycle)
 		if (d->fd >= 0) {
 			close(d->fd);
 		}
-		if (d->worker != NULL) {
-			worker_delete(d->worker, 0);
+		if (d->direct_fd >= 0) {
+			close(d->direct_fd);
+		}
+		device_workers_delete(d, 0);
+		if (d->bcache != NULL) {
+			bcache_destroy(d->bcache);
+			free(d->bcache);
 		}
+		if (d->journal != NULL) {
+			journal_delete(d->journal);
+		}
+		free(d->metrics);
 	}
 }
 
-static void device_delete_item(fca_device_t *d, struct list_head *p)
+static void device_delete_item(int shard, fca_handle_t h)
 {
-	if (p == &d->order_head) {
+	if (h == 0) {
 		return;
 	}
 
-	fca_free_block_t *fblock = list_entry(p, fca_free_block_t, order_node);
+	fca_free_block_t *fblock = pool_ptr(&item_pools[shard], h);
 	if (fblock->fblock) {
 		return;
 	}
 
-	fca_item_t *item = list_entry(p, fca_item_t, order_node);
+	fca_item_t *item = pool_ptr(&item_pools[shard], h);
 	if (item->putting || item->used) { /* do not delete hot item */
 		return;
 	}
 	server_item_delete(item);
 }
 
-/* delete items to extend free block, to make a big one */
-int device_free_block_extend(size_t target)
+/* return the cost to delete block @h, which is the bytes of item,
+ * or -1 if it can not be deleted. Set its place too. */
+static long device_block_cost(fca_device_t *device, int shard, fca_handle_t h,
+		size_t *offset, size_t *size)
+{
+	fca_free_block_t *fblock = pool_ptr(&item_pools[shard], h);
+	fca_item_t *item;
+
+	if (fblock->fblock) {
+		*offset = fblock->offset;
+		*size = fblock->block_size;
+		return 0;
+	}
+
+	item = pool_ptr(&item_pools[shard], h);
+	*offset = item->offset;
+	*size = device_block_size(device, item->length);
+	if (item->zombie || item->putting || item->used) {
+		return -1;
+	}
+	return item->length;
+}
+
+/* Find the continuous space of @target in @region, which costs the
+ * least to free, and delete its items. Search LOOP_LIMIT blocks from
+ * the cursor by a sliding window, and the next search goes on. */
+static int device_extent_evict(fca_device_region_t *region, int shard, size_t target)
+{
+	fca_pool_t *pool = &item_pools[shard];
+	fca_handle_t victims[LOOP_LIMIT];
+	fca_handle_t h, first = 0, best = 0, best_last = 0;
+	size_t offset, size, end = 0, wsize = 0;
+	long cost, wcost = 0, best_cost = LONG_MAX;
+	int count, n = 0;
+
+	h = region->cursor ? region->cursor : region->order_head.first;
+	for (count = 0; count < LOOP_LIMIT && h != 0; count++) {
+		cost = device_block_cost(region->device, shard, h, &offset, &size);
+
+		/* restart the window after a hot item or a hole */
+		if (cost < 0 || (first != 0 && offset != end)) {
+			first = 0;
+			wsize = wcost = 0;
+		}
+		if (cost < 0) {
+			h = ilist_next(pool, ITEM_ORDER_NODE, h);
+			continue;
+		}
+
+		if (first == 0) {
+			first = h;
+		}
+		wsize += size;
+		wcost += cost;
+		end = offset + size;
+
+		/* shrink the window from the front, while big enough */
+		while (wsize >= target) {
+			if (wcost < best_cost) {
+				best = first;
+				best_last = h;
+				best_cost = wcost;
+			}
+			wcost -= device_block_cost(region->device, shard, first,
+					&offset, &size);
+			wsize -= size;
+			first = ilist_next(pool, ITEM_ORDER_NODE, first);
+		}
+
+		h = ilist_next(pool, ITEM_ORDER_NODE, h);
+	}
+	region->cursor = h;
+
+	if (best == 0) {
+		return FCA_ERROR;
+	}
+
+	/* deleting items merges and deletes free blocks, so remember
+	 * the items before deleting */
+	for (h = best; ; h = ilist_next(pool, ITEM_ORDER_NODE, h)) {
+		if (!((fca_free_block_t *)pool_ptr(pool, h))->fblock) {
+			victims[n++] = h;
+		}
+		if (h == best_last) {
+			break;
+		}
+	}
+	while (n > 0) {
+		server_item_delete(pool_ptr(pool, victims[--n]));
+		__sync_fetch_and_add(&region->device->alloc_reclaims, 1);
+	}
+	return FCA_OK;
+}
+
+/* delete items to extend free block of @shard, to make a big one */
+int device_free_block_extend(size_t target, int shard)
 {
 	fca_free_block_t *fblock;
+	fca_device_region_t *region;
 	fca_device_t *d;
-	struct list_head *p, *next;
-	size_t last = 0;
+	struct list_head *p;
+	fca_handle_t prev, next;
+	size_t last = 0, esize;
 	int i;
 
+	/* extent devices: free the cheapest space */
+	esize = extent_block_size(target);
+	list_for_each(p, &extent_regions[shard]) {
+		region = list_entry(p, fca_device_region_t, alloc_node);
+		if (extent_best_fit(&item_pools[shard], &region->extents, esize) != 0) {
+			return FCA_OK;
+		}
+	}
+	list_for_each(p, &extent_regions[shard]) {
+		region = list_entry(p, fca_device_region_t, alloc_node);
+		if (device_extent_evict(region, shard, esize) == FCA_OK) {
+			return FCA_OK;
+		}
+	}
+
 	target = ipbucket_block_size(target);
 
 	for (i = 0; i < LOOP_LIMIT; i++) {
-		p = ipbucket_biggest(&free_blocks);
+		p = ipbucket_biggest(&free_blocks[shard]);
 		if (p == NULL) {
 			return FCA_ERROR;
 		}
@@ -420,27 +864,169 @@ int device_free_block_extend(size_t target)
 
 		/* device_delete_item() makes @fblock invalid, so
 		 * we have to remember @next before call it. */
+		prev = fblock->order_node.prev;
 		next = fblock->order_node.next;
-		device_delete_item(d, fblock->order_node.prev);
-		device_delete_item(d, next);
+		device_delete_item(shard, prev);
+		device_delete_item(shard, next);
 	}
 	return FCA_ERROR;
 }
 
-/* @server module call this to allocate a free block for a new item.
- * Set @item's @device and @offset member, and return free-block's
- * size, if alloc successfully.
+/* account a new block of @bsize for @item */
+static size_t device_alloc_done(fca_device_t *device, int shard,
+		fca_item_t *item, size_t bsize)
+{
+	size_t end;
+
+	device->regions[shard].item_nr++;
+	device->regions[shard].consumed += bsize;
+	device->regions[shard].content += item->length;
+	item->device_index = device->index;
+
+	/* it's a seek if not following the last one */
+	end = __atomic_exchange_n(&device->alloc_end, item->offset + bsize,
+			__ATOMIC_RELAXED);
+	if (end != item->offset) {
+		__sync_fetch_and_add(&device->alloc_seeks, 1);
+	}
+	__sync_fetch_and_add(&device->allocs, 1);
+	__sync_fetch_and_add(&device->alloc_bytes, bsize);
+	return bsize;
+}
+
+/* Allocate @bsize at the cursor of @region, of an append device, so
+ * PUTs become sequential writes. Items at the cursor are deleted to
+ * make room, so the space is reclaimed in order of places, as a
+ * circular log. Items in use are skipped. Return 0 if fail. */
+static size_t device_append_get(fca_device_region_t *region, int shard,
+		fca_item_t *item, size_t bsize)
+{
+	fca_pool_t *pool = &item_pools[shard];
+	fca_free_block_t *fblock;
+	fca_item_t *victim;
+	fca_handle_t h, next;
+	int count;
+
+	h = region->cursor;
+	for (count = 0; count < LOOP_LIMIT; count++) {
+		if (h == 0) {
+			/* wrap around */
+			h = region->order_head.first;
+			if (h == 0) {
+				break;
+			}
+		}
+
+		fblock = pool_ptr(pool, h);
+		if (fblock->fblock) {
+			if (fblock->block_size < bsize) {
+				h = fblock->order_node.next;
+				continue;
+			}
+
+			/* cut from the front */
+			item->offset = fblock->offset;
+			ilist_insert(pool, ITEM_ORDER_NODE, &region->order_head,
+					pool_handle(pool, item), fblock->order_node.prev, h);
+			if (fblock->block_size == bsize) {
+				next = fblock->order_node.next;
+				device_fblock_delete(fblock);
+				region->cursor = next;
+			} else {
+				fblock->offset += bsize;
+				fblock->block_size -= bsize;
+				region->cursor = h;
+			}
+			return bsize;
+		}
+
+		victim = pool_ptr(pool, h);
+		next = victim->order_node.next;
+		if (victim->zombie || victim->putting || victim->used != 0) {
+			h = next;
+			continue;
+		}
+
+		/* the freed space is merged into a free block, and the
+		 * cursor is moved to it by device_return_free_block() */
+		region->cursor = h;
+		server_item_delete(victim);
+		__sync_fetch_and_add(&region->device->alloc_reclaims, 1);
+		h = (region->cursor != h) ? region->cursor : next;
+	}
+
+	region->cursor = h;
+	return 0;
+}
+
+/* Allocate @bsize from the best fit free block in @region, of an
+ * extent device. Return 0 if fail. */
+static size_t device_extent_get(fca_device_region_t *region, int shard,
+		fca_item_t *item, size_t bsize)
+{
+	fca_pool_t *pool = &item_pools[shard];
+	fca_free_block_t *fblock;
+	fca_handle_t h;
+
+	h = extent_best_fit(pool, &region->extents, bsize);
+	if (h == 0) {
+		return 0;
+	}
+
+	/* cut from the front */
+	fblock = pool_ptr(pool, h);
+	item->offset = fblock->offset;
+	ilist_insert(pool, ITEM_ORDER_NODE, &region->order_head,
+			pool_handle(pool, item), fblock->order_node.prev, h);
+	if (fblock->block_size == (off_t)bsize) {
+		device_fblock_delete(fblock);
+	} else {
+		device_fblock_resize(fblock, fblock->offset + bsize,
+				fblock->block_size - bsize);
+	}
+	return bsize;
+}
+
+/* @server module call this to allocate a free block for a new item
+ * from @shard. Set @item's @device and @offset member, and return
+ * free-block's size, if alloc successfully.
  * Return 0 if fail. */
-size_t device_get_free_block(fca_item_t *item)
+size_t device_get_free_block(fca_item_t *item, int shard)
 {
 	fca_free_block_t *fblock;
 	fca_device_t *device;
+	fca_device_region_t *region;
+	fca_pool_t *pool = &item_pools[shard];
 	struct list_head *p;
 	size_t bsize;
 	int try = 0;
 
+	bsize = ipbucket_block_size(item->length);
+
+	/* append devices first, in turn */
+	list_for_each(p, &append_regions[shard]) {
+		region = list_entry(p, fca_device_region_t, alloc_node);
+		if (device_append_get(region, shard, item, bsize) != 0) {
+			list_del(p);
+			list_add_tail(p, &append_regions[shard]);
+			return device_alloc_done(region->device, shard, item, bsize);
+		}
+	}
+
+	/* then extent devices, in turn */
+	list_for_each(p, &extent_regions[shard]) {
+		region = list_entry(p, fca_device_region_t, alloc_node);
+		if (device_extent_get(region, shard, item,
+					extent_block_size(item->length)) != 0) {
+			list_del(p);
+			list_add_tail(p, &extent_regions[shard]);
+			return device_alloc_done(region->device, shard, item,
+					extent_block_size(item->length));
+		}
+	}
+
 try_again:
-	p = ipbucket_get(&free_blocks, item->length);
+	p = ipbucket_get(&free_blocks[shard], item->length);
 	if (p == NULL) {
 		return 0;
 	}
@@ -455,21 +1041,22 @@ try_again:
 		return 0;
 	}
 
-	bsize = ipbucket_block_size(item->length);
 	if (fblock->block_size > bsize) {
 		/* fblock is bigger than needed, so cut bsize from rear */
 
 		item->offset = fblock->offset + fblock->block_size - bsize;
-		list_add(&item->order_node, &fblock->order_node);
+		ilist_add_after(pool, ITEM_ORDER_NODE, &device->regions[shard].order_head,
+				pool_handle(pool, item), pool_handle(pool, fblock));
 
 		fblock->block_size -= bsize;
-		device_ipbucket_add(fblock);
+		device_fblock_index(fblock);
 
 	} else if (fblock->block_size == bsize) {
 		/* fit exactly */
 		item->offset = fblock->offset;
 
-		list_add(&item->order_node, &fblock->order_node);
+		ilist_add_after(pool, ITEM_ORDER_NODE, &device->regions[shard].order_head,
+				pool_handle(pool, item), pool_handle(pool, fblock));
 		device_fblock_delete(fblock);
 	} else {
 		/* should not be here */
@@ -477,10 +1064,7 @@ try_again:
 		exit(1);
 	}
 
-	device->item_nr++;
-	device->consumed += bsize;
-	item->device_index = device->index;
-	return bsize;
+	return device_alloc_done(device, shard, item, bsize);
 }
 
 /* @server module call this to free a free block when delete a item */
@@ -488,117 +1072,442 @@ size_t device_return_free_block(fca_item_t *item)
 {
 	fca_free_block_t *prev = NULL, *next = NULL;
 	fca_device_t *device = device_of_item(item);
+	int shard = server_shard_of_item(item);
+	fca_device_region_t *region = &device->regions[shard];
+	fca_pool_t *pool = &item_pools[shard];
+	fca_handle_t h = pool_handle(pool, item);
+	fca_handle_t cover = item->order_node.next;
 	off_t bsize;
 	int badp;
-	struct list_head *order = &item->order_node;
 	int forward = 0, backward = 0;
 
-	bsize = ipbucket_block_size(item->length);
+	bsize = device_block_size(device, item->length);
 
 	/* just delete item from order-list, if the device is deleted or bad. */
 	if (device->deleted) {
 		goto done;
 	}
 	if (item->badblock) {
-		device->badblock += bsize;
-		badp = device->badblock * 100 / device->capacity;
+		/* kick it in device_routine() by the first master thread */
+		badp = __sync_add_and_fetch(&device->badblock, bsize) * 100 / device->capacity;
 		if (badp > device_badblock_percent) {
-			log_error_run(0, "kick device '%s', badblock:%ld(%d%%)",
-					device->filename, device->badblock, badp);
-			device_kick(device);
+			device->kick_pending = 1;
 		}
 		goto done;
 	}
 
 	/* ok, now recycle the item's block */
 
-	if (order->prev != &device->order_head) {
-		prev = list_entry(order->prev, fca_free_block_t, order_node);
+	if (item->order_node.prev != 0) {
+		prev = pool_ptr(pool, item->order_node.prev);
 		forward = prev->fblock && (prev->offset + prev->block_size == item->offset);
 	}
-	if (order->next != &device->order_head) {
-		next = list_entry(order->next, fca_free_block_t, order_node);
+	if (item->order_node.next != 0) {
+		next = pool_ptr(pool, item->order_node.next);
 		backward = next->fblock && (next->offset == item->offset + bsize);
 	}
 
 	if (forward && backward) {
-		prev->block_size += bsize + next->block_size;
-		device_ipbucket_update(prev);
-
+		device_fblock_resize(prev, prev->offset,
+				prev->block_size + bsize + next->block_size);
 		device_fblock_delete(next);
+		cover = item->order_node.prev;
 
 	} else if (forward) {
-		prev->block_size += bsize;
-		device_ipbucket_update(prev);
+		device_fblock_resize(prev, prev->offset, prev->block_size + bsize);
+		cover = item->order_node.prev;
 
 	} else if (backward) {
-		next->offset -= bsize;
-		next->block_size += bsize;
-		device_ipbucket_update(next);
+		device_fblock_resize(next, next->offset - bsize,
+				next->block_size + bsize);
 
 	} else {
 		/* we don't care the return value here */
-		device_fblock_insert(device, order, item->offset, bsize);
+		if (device_fblock_insert(device, shard, h, item->offset, bsize) != NULL) {
+			cover = item->order_node.prev;
+		}
 	}
 
-	device->item_nr--;
-	device->consumed -= bsize;
+	region->item_nr--;
+	region->consumed -= bsize;
+	region->content -= item->length;
 
 done:
-	list_del(order);
+	/* the cursor goes to the block covering the space */
+	if (region->cursor == h) {
+		region->cursor = cover;
+	}
+	ilist_del(pool, ITEM_ORDER_NODE, &region->order_head, h);
 	return bsize;
 }
 
 /* @format module call this to cut a free-block from the beginning
- * of the remaining space */
+ * of the remaining space. Items must be loaded in order of offset. */
 size_t device_cut_free_block(fca_item_t *item)
 {
-	fca_free_block_t *current;
-	size_t bsize, step, gap;
 	fca_device_t *device = device_of_item(item);
+	int shard = server_shard_of_item(item);
+	fca_device_region_t *region = &device->regions[shard];
+	size_t bsize, gap;
 
-	current = list_entry(device->order_head.prev, fca_free_block_t, order_node);
-	bsize = ipbucket_block_size(item->length);
-	gap = item->offset - current->offset;
-	step = bsize + gap;
+	bsize = device_block_size(device, item->length);
 
-	if (item->offset < current->offset || current->block_size < step) {
+	if (item->offset < device->load_offset
+			|| item->offset + bsize > device->capacity) {
 		log_error_run(0, "wrong fcache dump device %s", device->filename);
 		return 0;
 	}
 
+	/* the gap before @item goes to the same region */
+	gap = item->offset - device->load_offset;
 	if (gap > 0) {
 		/* we don't care the return value here */
-		device_fblock_insert(device, &current->order_node,
-				current->offset, gap);
+		device_fblock_insert(device, shard, 0, device->load_offset, gap);
+	}
+
+	ilist_add_tail(&item_pools[shard], ITEM_ORDER_NODE, &region->order_head,
+			pool_handle(&item_pools[shard], item));
+	device->load_offset = item->offset + bsize;
+
+	region->item_nr++;
+	region->consumed += bsize;
+	region->content += item->length;
+	return bsize;
+}
+
+/* copy @len bytes in device @fd, from @from to @to, which do not overlap */
+static int device_copy(int fd, off_t from, off_t to, size_t len)
+{
+	char buf[64 * 1024];
+	ssize_t n;
+
+	while (len > 0) {
+		n = copy_file_range(fd, &from, fd, &to, len, 0);
+		if (n > 0) {
+			len -= n;
+			continue;
+		}
+		if (n == 0 || (errno != EINVAL && errno != EXDEV
+				&& errno != ENOSYS && errno != EOPNOTSUPP)) {
+			return FCA_ERROR;
+		}
+
+		/* not supported, e.g. block devices, so copy by hand */
+		n = pread(fd, buf, len < sizeof(buf) ? len : sizeof(buf), from);
+		if (n <= 0 || pwrite(fd, buf, n, to) != n) {
+			return FCA_ERROR;
+		}
+		from += n;
+		to += n;
+		len -= n;
+	}
+	return FCA_OK;
+}
+
+/* return an idle item following a free block which it fits in, and
+ * set @pfblock. Search LOOP_LIMIT blocks from the cursor. */
+static fca_item_t *device_defrag_pick(fca_device_t *d, int shard,
+		fca_free_block_t **pfblock)
+{
+	fca_device_region_t *region = &d->regions[shard];
+	fca_pool_t *pool = &item_pools[shard];
+	fca_free_block_t *fblock;
+	fca_item_t *item;
+	fca_handle_t h, next;
+	int count;
+
+	/* not fragmented */
+	if (region->fblock_nr < 2) {
+		return NULL;
+	}
+
+	h = region->cursor ? region->cursor : region->order_head.first;
+	for (count = 0; count < LOOP_LIMIT && h != 0; count++, h = next) {
+		fblock = pool_ptr(pool, h);
+		next = fblock->order_node.next;
+		if (!fblock->fblock || next == 0) {
+			continue;
+		}
+
+		item = pool_ptr(pool, next);
+		if (item->other || item->offset != fblock->offset + fblock->block_size
+				|| item->zombie || item->putting || item->deleted
+				|| item->badblock || item->used != 0
+				|| device_block_size(d, item->length) > (size_t)fblock->block_size) {
+			continue;
+		}
+
+		region->cursor = next;
+		*pfblock = fblock;
+		return item;
+	}
+	region->cursor = h;
+	return NULL;
+}
+
+/* move @item to the place of @hold, and @hold takes the old place.
+ * They are in the same region, and @hold is before @item. */
+static void device_defrag_swap(fca_device_t *d, int shard,
+		fca_item_t *item, fca_item_t *hold)
+{
+	fca_pool_t *pool = &item_pools[shard];
+	fca_ilist_head_t *head = &d->regions[shard].order_head;
+	fca_handle_t hi = pool_handle(pool, item);
+	fca_handle_t hh = pool_handle(pool, hold);
+	fca_handle_t prev = item->order_node.prev;
+	fca_handle_t next = item->order_node.next;
+	size_t offset;
+
+	ilist_del(pool, ITEM_ORDER_NODE, head, hi);
+	ilist_insert(pool, ITEM_ORDER_NODE, head, hi, hold->order_node.prev, hh);
+	if (prev != hh) {
+		ilist_del(pool, ITEM_ORDER_NODE, head, hh);
+		ilist_insert(pool, ITEM_ORDER_NODE, head, hh, prev, next);
+	}
+
+	offset = item->offset;
+	item->offset = hold->offset;
+	hold->offset = offset;
+}
+
+/* Move an item of @d forward, into the free block before it, so the
+ * free blocks around it merge. The new place is held by a deleted
+ * item while copying, out of the shard lock. The move is given up if
+ * the item is read or deleted then. Return the bytes, or 0 if no
+ * item to move. */
+static size_t device_defrag_move(fca_device_t *d)
+{
+	fca_free_block_t *fblock = NULL;
+	fca_item_t *item = NULL, *hold;
+	fca_pool_t *pool;
+	unsigned long epoch;
+	size_t bsize;
+	int i, shard = 0, rc;
+
+	for (i = 0; i < master_nr; i++) {
+		shard = d->defrag_shard;
+		d->defrag_shard = (shard + 1) % master_nr;
+
+		server_shard_lock(shard);
+		if (!d->deleted && (item = device_defrag_pick(d, shard, &fblock)) != NULL) {
+			break;
+		}
+		server_shard_unlock(shard);
+	}
+	if (i == master_nr) {
+		return 0;
+	}
+
+	/* pin the item, while copying */
+	if (server_item_use(shard, item) != FCA_OK) {
+		d->defrag_aborts++;
+		server_shard_unlock(shard);
+		return 0;
+	}
+
+	/* hold the new place */
+	pool = &item_pools[shard];
+	hold = pool_alloc(pool);
+	if (hold == NULL) {
+		server_item_unuse(shard, item);
+		server_shard_unlock(shard);
+		return 0;
+	}
+	memcpy(hold, item, sizeof(fca_item_t));
+	hold->deleted = 1;
+	hold->used = 1;
+	hold->hot = 0;
+	hold->offset = fblock->offset;
+
+	bsize = device_block_size(d, item->length);
+	ilist_insert(pool, ITEM_ORDER_NODE, &d->regions[shard].order_head,
+			pool_handle(pool, hold), fblock->order_node.prev,
+			pool_handle(pool, fblock));
+	if (fblock->block_size == (off_t)bsize) {
+		device_fblock_delete(fblock);
+	} else {
+		device_fblock_resize(fblock, fblock->offset + bsize,
+				fblock->block_size - bsize);
+	}
+	d->regions[shard].item_nr++;
+	d->regions[shard].consumed += bsize;
+	d->regions[shard].content += item->length;
+
+	__sync_fetch_and_add(&d->used, 1);
+	server_shard_unlock(shard);
+
+	rc = device_copy(d->fd, item->offset, hold->offset, item->length);
+	if (rc != FCA_OK) {
+		log_error_run(errno, "defrag copy in device %s", d->filename);
 	}
 
-	list_add_tail(&item->order_node, &current->order_node);
+	server_shard_lock(shard);
+	server_item_unuse(shard, item);
+	hold->used = 0;
 
-	/* we don't call ipbucket_update(current) here, while call it
-	 * in device_load_post() later. */
-	current->offset += step;
-	current->block_size -= step;
+	if (rc == FCA_OK && !item->deleted && item->used == 0 && !d->deleted) {
+		device_defrag_swap(d, shard, item, hold);
+		d->defrag_moves++;
+		d->defrag_bytes += item->length;
+
+		/* the old place is kept until the new one is journaled */
+		epoch = journal_item_put(item);
+		if (epoch != 0) {
+			server_item_bury(hold, epoch);
+			hold = NULL;
+		}
+	} else {
+		d->defrag_aborts++;
+		if (item->deleted && item->used == 0) {
+			server_item_delete(item);
+		}
+	}
 
-	device->item_nr++;
-	device->consumed += bsize;
+	if (hold != NULL) {
+		device_return_free_block(hold);
+		pool_free(pool, hold);
+	}
+	server_shard_unlock(shard);
+
+	__sync_fetch_and_sub(&d->used, 1);
 	return bsize;
 }
 
+/* Defrag by @device_defrag_rate. Append devices are not fragmented,
+ * so no this thread for them. */
+static void *device_defrag_thread(void *data)
+{
+	fca_device_t *d = data;
+	fca_timer_t timer;
+	long budget = 0;
+	size_t bytes;
+
+	timer_init(&timer);
+	thread_timer = &timer;
+
+	while (!__atomic_load_n(&d->defrag_quit, __ATOMIC_ACQUIRE)) {
+		sleep(1);
+		timer_refresh(&timer);
+
+		/* the bytes over budget are paid in next seconds */
+		budget += device_defrag_rate;
+		if (budget > (long)device_defrag_rate) {
+			budget = device_defrag_rate;
+		}
+		while (budget > 0 && !__atomic_load_n(&d->defrag_quit, __ATOMIC_ACQUIRE)) {
+			bytes = device_defrag_move(d);
+			if (bytes == 0) {
+				break;
+			}
+			budget -= bytes;
+		}
+	}
+
+	timer_destroy(&timer);
+	__atomic_store_n(&d->defragging, 0, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+static void device_defrag_start(fca_device_t *d)
+{
+	/* the moves by @fd are not seen by the block cache of direct IO */
+	if (d->alloc == DEVICE_ALLOC_APPEND || d->direct || d->kicked
+			|| d->capacity == 0 || device_defrag_rate == 0
+			|| fca_simulate) {
+		return;
+	}
+
+	d->defrag_quit = 0;
+	d->defragging = 1;
+	if (pthread_create(&d->defrag_tid, NULL, device_defrag_thread, d) != 0) {
+		log_error_run(errno, "create defrag thread of device %s", d->filename);
+		d->defragging = 0;
+		return;
+	}
+	d->defrag_joinable = 1;
+}
+
+/* start or stop the defrag thread of @d, if device_defrag_rate is
+ * reloaded. It does not wait, but joins the thread after it quits. */
+static void device_defrag_update(fca_device_t *d)
+{
+	if (d->defrag_joinable && !__atomic_load_n(&d->defragging, __ATOMIC_ACQUIRE)) {
+		pthread_join(d->defrag_tid, NULL);
+		d->defrag_joinable = 0;
+	}
+
+	if (device_defrag_rate == 0) {
+		if (d->defrag_joinable) {
+			__atomic_store_n(&d->defrag_quit, 1, __ATOMIC_RELEASE);
+		}
+	} else if (!d->defrag_joinable
+			&& !__atomic_load_n(&d->loading, __ATOMIC_ACQUIRE)) {
+		device_defrag_start(d);
+	}
+}
+
+/* stop the defrag threads, and wait for them */
+static void device_defrag_stop(struct list_head *head)
+{
+	struct list_head *p;
+	fca_device_t *d;
+
+	list_for_each(p, head) {
+		d = list_entry(p, fca_device_t, dnode);
+		__atomic_store_n(&d->defrag_quit, 1, __ATOMIC_RELEASE);
+	}
+	list_for_each(p, head) {
+		d = list_entry(p, fca_device_t, dnode);
+		if (d->defrag_joinable) {
+			pthread_join(d->defrag_tid, NULL);
+			d->defrag_joinable = 0;
+		}
+	}
+}
+
 /* @format module call this, after finish loading items of a device,
- * to update the remaining space */
+ * to spread the remaining space */
 void device_load_post(fca_device_t *device)
 {
-	fca_free_block_t *current;
-	current = list_entry(device->order_head.prev, fca_free_block_t, order_node);
+	if (device_spread_space(device) != FCA_OK) {
+		log_error_run(0, "spread space of device %s [NOMEM]", device->filename);
+	}
+	device_alloc_start(device);
+	device_defrag_start(device);
+}
 
-	if (current->block_size == 0) {
-		device_fblock_delete(current);
-	} else {
-		device_ipbucket_update(current);
+/* load items of a device, while masters are serving. Items not
+ * loaded yet are just missed. */
+static void *device_load_thread(void *data)
+{
+	fca_device_t *d = data;
+	fca_timer_t timer;
+	time_t begin;
+
+	timer_init(&timer);
+	thread_timer = &timer;
+	timer_refresh(&timer);
+	begin = timer_now_ms(&timer);
+
+	if (d->journal == NULL || journal_load(d->journal) != FCA_OK) {
+		format_load_device(d);
+		if (d->journal != NULL) {
+			journal_reset(d->journal);
+		}
 	}
+	device_load_post(d);
+
+	timer_refresh(&timer);
+	d->load_msec = timer_now_ms(&timer) - begin;
+	log_error_run(0, "load %ld items of device %s in %ld ms",
+			d->load_items, d->filename, d->load_msec);
+
+	__atomic_store_n(&d->loading, 0, __ATOMIC_RELEASE);
+	__atomic_sub_fetch(&device_loading_nr, 1, __ATOMIC_RELEASE);
+	return NULL;
 }
 
+/* start a loading thread for each device, and return at once */
 void device_format_load(void)
 {
 	struct list_head *p;
@@ -606,7 +1515,44 @@ void device_format_load(void)
 
 	list_for_each(p, &devices) {
 		d = list_entry(p, fca_device_t, dnode);
-		format_load_device(d);
+		if (d->kicked || d->capacity == 0) {
+			continue;
+		}
+
+		/* nothing to load in simulation */
+		if (fca_simulate) {
+			device_load_post(d);
+			continue;
+		}
+
+		d->loading = 1;
+		__atomic_add_fetch(&device_loading_nr, 1, __ATOMIC_RELEASE);
+		if (pthread_create(&d->load_tid, NULL, device_load_thread, d) != 0) {
+			log_error_run(errno, "create load thread of device %s",
+					d->filename);
+			exit(1);
+		}
+		d->load_joinable = 1;
+	}
+	device_loaded = 1;
+
+	if (!fca_simulate) {
+		journal_start();
+	}
+}
+
+/* wait for the loading threads, before storing */
+static void device_load_wait(struct list_head *head)
+{
+	struct list_head *p;
+	fca_device_t *d;
+
+	list_for_each(p, head) {
+		d = list_entry(p, fca_device_t, dnode);
+		if (d->load_joinable) {
+			pthread_join(d->load_tid, NULL);
+			d->load_joinable = 0;
+		}
 	}
 }
 
@@ -616,11 +1562,35 @@ void device_format_store(void)
 	fca_device_t *d;
 	unsigned short server_ports[SERVERS_LIMIT];
 
+	device_load_wait(&devices);
+	device_load_wait(&deleted_devices);
+	device_defrag_stop(&devices);
+	device_defrag_stop(&deleted_devices);
+
+	/* the journaled devices get their final checkpoints */
+	journal_stop();
+
 	server_dump_ports(server_ports);
 
 	list_for_each(p, &devices) {
 		d = list_entry(p, fca_device_t, dnode);
-		format_store_device(server_ports, d);
+		if (d->journal == NULL) {
+			format_store_device(server_ports, d);
+		}
+	}
+}
+
+/* @server module call this in server_clear() */
+void device_journal_clear(unsigned short port)
+{
+	struct list_head *p;
+	fca_device_t *d;
+
+	list_for_each(p, &devices) {
+		d = list_entry(p, fca_device_t, dnode);
+		if (d->journal != NULL) {
+			journal_server_clear(d->journal, port);
+		}
 	}
 }
 
@@ -631,10 +1601,38 @@ void device_worker_quit(time_t quit_time)
 
 	list_for_each(p, &devices) {
 		d = list_entry(p, fca_device_t, dnode);
-		if (d->worker != NULL) {
-			worker_delete(d->worker, quit_time);
+		device_workers_delete(d, quit_time);
+	}
+}
+
+/* pick a worker thread for a request on @d, called by master threads */
+fca_worker_t *device_worker_pick(fca_device_t *d)
+{
+	fca_worker_t *worker, *least;
+	int i, n, start, depth, min;
+
+	if (d->thread_nr == 1) {
+		return d->workers[0];
+	}
+
+	start = __sync_fetch_and_add(&d->dispatch_next, 1) % d->thread_nr;
+	if (d->dispatch == DEVICE_DISPATCH_RR) {
+		return d->workers[start];
+	}
+
+	/* the least loaded, from a rotating start to break ties */
+	least = d->workers[start];
+	min = __atomic_load_n(&least->request_nr, __ATOMIC_RELAXED);
+	for (i = 1; i < d->thread_nr && min > 0; i++) {
+		n = (start + i) % d->thread_nr;
+		worker = d->workers[n];
+		depth = __atomic_load_n(&worker->request_nr, __ATOMIC_RELAXED);
+		if (depth < min) {
+			min = depth;
+			least = worker;
 		}
 	}
+	return least;
 }
 
 /* regular routine, called by master thread */
@@ -643,22 +1641,208 @@ void device_routine(void)
 	struct list_head *p, *safep;
 	fca_device_t *d;
 
+	list_for_each_safe(p, safep, &devices) {
+		d = list_entry(p, fca_device_t, dnode);
+		if (d->kick_pending && !d->kicked) {
+			log_error_run(0, "kick device '%s', badblock:%ld(%ld%%)",
+					d->filename, d->badblock,
+					d->badblock * 100 / d->capacity);
+			device_kick(d);
+			continue;
+		}
+		device_defrag_update(d);
+	}
+
 	list_for_each_safe(p, safep, &deleted_devices) {
 		d = list_entry(p, fca_device_t, dnode);
 		device_destroy(d);
 	}
 }
 
-void device_status(FILE *filp)
+size_t device_consumed(fca_device_t *d)
+{
+	size_t consumed = 0;
+	int i;
+	for (i = 0; i < master_nr; i++) {
+		consumed += d->regions[i].consumed;
+	}
+	return consumed;
+}
+
+long device_item_nr(fca_device_t *d)
+{
+	long item_nr = 0;
+	int i;
+	for (i = 0; i < master_nr; i++) {
+		item_nr += d->regions[i].item_nr;
+	}
+	return item_nr;
+}
+
+static const char *device_alloc_names[] = {
+	[DEVICE_ALLOC_IPBUCKET] = "ipbucket",
+	[DEVICE_ALLOC_APPEND] = "append",
+	[DEVICE_ALLOC_EXTENT] = "extent",
+};
+
+/* sum of consumed and content of @d */
+static void device_fragment_internal(fca_device_t *d, size_t *consumed,
+		size_t *content)
+{
+	int i;
+
+	for (i = 0; i < master_nr; i++) {
+		*consumed += d->regions[i].consumed;
+		*content += d->regions[i].content;
+	}
+}
+
+/* sum of free space and the biggest free block of extent device @d */
+static void device_fragment_external(fca_device_t *d, size_t *free_size,
+		size_t *biggest)
+{
+	fca_free_block_t *fblock;
+	fca_handle_t h;
+	int i;
+
+	for (i = 0; i < master_nr; i++) {
+		server_shard_lock(i);
+		*free_size += d->regions[i].extents.size;
+		h = extent_biggest(&item_pools[i], &d->regions[i].extents);
+		if (h != 0) {
+			fblock = pool_ptr(&item_pools[i], h);
+			if ((size_t)fblock->block_size > *biggest) {
+				*biggest = fblock->block_size;
+			}
+		}
+		server_shard_unlock(i);
+	}
+}
+
+/* Internal fragmentation is the space wasted by rounding items up
+ * to blocks. External fragmentation is the free space not in the
+ * biggest free block, which is known for extent devices only. */
+static void device_fragment_status(FILE *filp, fca_device_t *d)
+{
+	size_t consumed = 0, content = 0, free_size = 0, biggest = 0;
+
+	device_fragment_internal(d, &consumed, &content);
+	fprintf(filp, "%.3f ", consumed ? (double)(consumed - content) / consumed : 0.0);
+
+	if (d->alloc != DEVICE_ALLOC_EXTENT || d->kicked) {
+		fputs("-", filp);
+		return;
+	}
+	device_fragment_external(d, &free_size, &biggest);
+	fprintf(filp, "%.3f", free_size ? 1 - (double)biggest / free_size : 0.0);
+}
+
+/* fragmentation of all devices, as device_fragment_status(). The
+ * external one is the free space not in the biggest free block of
+ * each extent device, and is -1 if there is no extent device. */
+void device_fragments(double *internal, double *external)
 {
 	struct list_head *p;
 	fca_device_t *d;
+	size_t consumed = 0, content = 0, free_size = 0, biggest = 0;
+	size_t b;
+	int extents = 0;
+
+	list_for_each(p, &devices) {
+		d = list_entry(p, fca_device_t, dnode);
+		device_fragment_internal(d, &consumed, &content);
+		if (d->alloc == DEVICE_ALLOC_EXTENT && !d->kicked) {
+			b = 0;
+			device_fragment_external(d, &free_size, &b);
+			biggest += b;
+			extents++;
+		}
+	}
+
+	*internal = consumed ? (double)(consumed - content) / consumed : 0.0;
+	*external = extents == 0 ? -1
+		: free_size ? 1 - (double)biggest / free_size : 0.0;
+}
 
-	fputs("\n+ device capacity consumed badblock status\n", filp);
+void device_status(FILE *filp)
+{
+	struct list_head *p;
+	fca_device_t *d;
+	fca_bcache_t *bc;
+
+	fputs("\n+ device capacity consumed badblock status"
+			" | threads requests dispatch_depth recycle_depth"
+			" wakeups recycle_wakeups combine_writes combine_flushes"
+			" dontneed_bytes willneed_bytes sequentials"
+			" | journal_gen journal_used journal_records"
+			" checkpoints checkpoint_items journal_status"
+			" | load_status load_items load_total load_msec"
+			" | alloc allocs alloc_bytes seeks reclaims"
+			" internal_frag external_frag"
+			" | defrag_moves defrag_bytes defrag_aborts"
+			" | io cache_memory cache_hits cache_misses cache_evicts\n", filp);
 	list_for_each(p, &devices) {
 		d = list_entry(p, fca_device_t, dnode);
-		fprintf(filp, "++ %s %ld %ld %ld %s\n",
-				d->filename, d->capacity, d->consumed,
+		fprintf(filp, "++ %s %ld %ld %ld %s | ",
+				d->filename, d->capacity, device_consumed(d),
 				d->badblock, d->kicked ? "kicked" : "ok");
+		if (d->thread_nr > 0 && d->workers[0] != NULL) {
+			worker_status(filp, d->workers, d->thread_nr);
+		} else {
+			fputs("-", filp);
+		}
+		fputs(" | ", filp);
+		if (d->journal != NULL) {
+			journal_status(filp, d->journal);
+		} else {
+			fputs("-", filp);
+		}
+		fprintf(filp, " | %s %ld %ld %ld",
+				__atomic_load_n(&d->loading, __ATOMIC_ACQUIRE)
+				? "loading" : "loaded",
+				d->load_items, d->load_total, d->load_msec);
+		fprintf(filp, " | %s %ld %ld %ld %ld ",
+				device_alloc_names[d->alloc],
+				d->allocs, d->alloc_bytes, d->alloc_seeks,
+				d->alloc_reclaims);
+		device_fragment_status(filp, d);
+		fprintf(filp, " | %ld %ld %ld", d->defrag_moves,
+				d->defrag_bytes, d->defrag_aborts);
+		if (d->bcache != NULL) {
+			bc = d->bcache;
+			fprintf(filp, " | direct %ld %ld %ld %ld\n", bcache_memory(bc),
+					bc->hits, bc->misses, bc->evicts);
+		} else {
+			fprintf(filp, " | %s -\n", d->direct ? "direct" : "buffered");
+		}
+	}
+}
+
+/* print @family of metrics of each device, for metrics_exposition() */
+void device_metrics(FILE *filp, int family)
+{
+	struct list_head *p;
+	fca_device_t *d;
+	fca_metrics_t total;
+	char labels[PATH_LENGTH * 2 + 20], *q;
+	char *c;
+
+	list_for_each(p, &devices) {
+		d = list_entry(p, fca_device_t, dnode);
+		if (d->metrics == NULL) {
+			continue;
+		}
+		metrics_merge(&total, d->metrics, master_nr);
+
+		/* escape the path for the label value */
+		q = labels + sprintf(labels, "device=\"");
+		for (c = d->filename; *c != '\0'; c++) {
+			if (*c == '"' || *c == '\\') {
+				*q++ = '\\';
+			}
+			*q++ = *c == '\n' ? ' ' : *c;
+		}
+		strcpy(q, "\"");
+		metrics_print(filp, family, labels, &total);
 	}
 }
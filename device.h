@@ -10,63 +10,173 @@
 
 #include "fcache.h"
 
+/* space of a device is split into regions, one for each shard.
+ * A region is not continuous, but a list of blocks in order. */
+typedef struct {
+	fca_ilist_head_t	order_head;
+	long		item_nr;
+	long		fblock_nr;
+	size_t		consumed;
+	size_t		content;
+
+	/* a free block or an item in @order_head, 0 for the first.
+	 * Append allocator puts new items here, extent allocator starts
+	 * searching victims for big items here, and so does defrag for
+	 * items to move. */
+	fca_device_t		*device;
+	fca_handle_t		cursor;
+	struct list_head	alloc_node;
+
+	/* extent allocator only */
+	fca_extent_tree_t	extents;
+} fca_device_region_t;
+
+#define DEVICE_ALLOC_IPBUCKET	0
+#define DEVICE_ALLOC_APPEND	1
+#define DEVICE_ALLOC_EXTENT	2
+
+#define DEVICE_DISPATCH_LEAST	0
+#define DEVICE_DISPATCH_RR	1
+
+#define DEVICE_THREADS_LIMIT	32
+
 struct fca_device_s {
 	unsigned	deleted:1;
 	unsigned	kicked:1;
+	unsigned	load_joinable:1;
+	unsigned	defrag_joinable:1;
+	/* DEVICE_ALLOC_xxx */
+	unsigned	alloc:2;
+	/* items are read and written by @direct_fd, with O_DIRECT */
+	unsigned	direct:1;
+	/* DEVICE_DISPATCH_xxx */
+	unsigned	dispatch:1;
 
 	int		fd;
+	int		direct_fd;
+	size_t		cache_size;
 	int		index;
 	int		used;
+	int		kick_pending;
 	char		filename[PATH_LENGTH];
 	dev_t		dev;
 	ino_t		inode;
-	long		item_nr;
-	long		fblock_nr;
 	size_t		capacity;
-	size_t		consumed;
+	/* by 'size' option, limits @capacity if not 0 */
+	size_t		size;
 	size_t		badblock;
 
-	fca_worker_t		*worker;
+	/* the end of loaded items, in format_load_device() */
+	size_t		load_offset;
+
+	/* loaded by its own thread when starts, see device_format_load() */
+	int		loading;
+	pthread_t	load_tid;
+	long		load_items;
+	long		load_total;
+	long		load_msec;
+
+	/* allocation statistics, updated by all master threads */
+	long		allocs;
+	size_t		alloc_bytes;
+	long		alloc_seeks;
+	long		alloc_reclaims;
+	size_t		alloc_end;
+
+	/* moves items by its own thread, see device_defrag_thread() */
+	int		defragging;
+	int		defrag_quit;
+	pthread_t	defrag_tid;
+	int		defrag_shard;
+	long		defrag_moves;
+	size_t		defrag_bytes;
+	long		defrag_aborts;
+
+	/* requests are dispatched to @workers by @dispatch */
+	int			thread_nr;
+	unsigned		dispatch_next;
+	fca_worker_t		*workers[DEVICE_THREADS_LIMIT];
+	/* shared by @workers, in direct IO mode */
+	fca_bcache_t		*bcache;
+	fca_journal_t		*journal;
+
+	/* metrics of requests, one for each master thread */
+	fca_metrics_t		*metrics;
 
-	struct list_head	order_head;
 	struct list_head	dnode;
 
 	struct fca_device_s	*conf;
+
+	fca_device_region_t	regions[MASTERS_LIMIT];
 };
 
+/* It's in the same pool with fca_item_t, so in the same layout. */
 typedef struct {
-	/* @order_node and @fblock must be together, to
-	 * distinguish fca_item_t and fca_free_block_t. */
-	struct list_head	order_node;
-	unsigned		fblock:1;
-
-	short			device_index;
+	off_t			block_size;
+	uint32_t		shard;
+	fca_ilist_node_t	order_node;
+	uint32_t		_pad;
+	union {
+		struct list_head	bucket_node;
+		fca_extent_node_t	extent_node;
+	};
 
 	/* since sendfile(2) supports only 0x4020010000, so 40bits is enough */
 	unsigned long		offset:40;
 
-	off_t			block_size;
-	struct list_head	bucket_node;
+	/* at the same place with fca_item_t.other */
+	unsigned long		fblock:1;
+	unsigned long		_pad2:3;
+	unsigned long		device_index:12;
 } fca_free_block_t;
 
 #define DEVICES_LIMIT IPT_ARRAY_SIZE
 
+/* block cache size of devices in direct IO mode, by default */
+#define DEVICE_CACHE_SIZE	(64*1024*1024)
+
+/* write PUT bodies by io_uring, or by splice */
+extern int device_io_uring;
+extern int device_splice;
+extern int device_write_combine;
+
+/* journal at the beginning of devices, 0 for off */
+extern size_t device_journal_size;
+extern int device_journal_checkpoint;
+
+/* bytes moved per second by defrag, 0 for off */
+extern size_t device_defrag_rate;
+
+/* page cache advice, 0 for off */
+extern size_t device_fadvise_size;
+extern size_t device_readahead;
+
+/* devices whose items are being loaded */
+extern int device_loading_nr;
+
 fca_device_t *device_of_item(fca_item_t *item);
+size_t device_item_block_size(fca_item_t *item);
 
 int device_conf_check(fca_conf_t *conf_cycle);
 void device_conf_load(fca_conf_t *conf_cycle);
 void device_conf_rollback(fca_conf_t *conf_cycle);
 
-int device_free_block_extend(size_t target);
-size_t device_get_free_block(fca_item_t *item);
+int device_free_block_extend(size_t target, int shard);
+size_t device_get_free_block(fca_item_t *item, int shard);
 size_t device_return_free_block(fca_item_t *item);
 size_t device_cut_free_block(fca_item_t *item);
 void device_load_post(fca_device_t *device);
+size_t device_consumed(fca_device_t *d);
+long device_item_nr(fca_device_t *d);
 
 void device_worker_quit(time_t quit_time);
+fca_worker_t *device_worker_pick(fca_device_t *d);
+void device_metrics(FILE *filp, int family);
 void device_format_load(void);
 void device_format_store(void);
+void device_journal_clear(unsigned short port);
 void device_routine(void);
 void device_status(FILE *filp);
+void device_fragments(double *internal, double *external);
 
 #endif
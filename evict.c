@@ -0,0 +1,343 @@
+/*
+ * Eviction policies of items.
+ *
+ * LRU moves an item to the head of queue on each hit.
+ *
+ * CLOCK just sets the item's reference bit on hit. The victim is
+ * searched from the tail, and referenced items get a second chance
+ * by clearing the bit and moving to the head.
+ *
+ * S3-FIFO keeps new items in a small FIFO, which takes 10% of the
+ * space. Items hit there are moved to the main FIFO when they reach
+ * the tail, while others are evicted and remembered in the ghost.
+ * New items found in the ghost go to the main FIFO directly. Items
+ * in the main FIFO are re-inserted while their frequency (hits, at
+ * most 3) is not 0, and the frequency decreases each time. So
+ * one-hit-wonders in scans are evicted quickly.
+ *
+ * Author: Wu Bingzheng
+ *
+ */
+
+#include "fcache.h"
+
+/* bits of item->evict */
+#define EVICT_REF		1	/* CLOCK */
+#define EVICT_FREQ_MASK		3	/* S3-FIFO */
+#define EVICT_MAIN		4	/* S3-FIFO */
+
+#define EVICT_GHOSTS_BEGIN	1024
+
+static inline fca_handle_t evict_handle(fca_evict_t *e, fca_item_t *item)
+{
+	return pool_handle(e->pool, item);
+}
+
+static inline fca_item_t *evict_tail(fca_evict_t *e, int q)
+{
+	return e->queues[q].last ? pool_ptr(e->pool, e->queues[q].last) : NULL;
+}
+
+static void evict_queue_add(fca_evict_t *e, int q, fca_item_t *item)
+{
+	ilist_add(e->pool, ITEM_LRU_NODE, &e->queues[q], evict_handle(e, item));
+	e->queue_nr[q]++;
+	e->queue_size[q] += item->length;
+}
+
+static void evict_queue_del(fca_evict_t *e, int q, fca_item_t *item)
+{
+	ilist_del(e->pool, ITEM_LRU_NODE, &e->queues[q], evict_handle(e, item));
+	e->queue_nr[q]--;
+	e->queue_size[q] -= item->length;
+}
+
+/* the item before @item, towards the head, or NULL */
+static inline fca_item_t *evict_prev(fca_evict_t *e, fca_item_t *item)
+{
+	fca_handle_t h = ilist_prev(e->pool, ITEM_LRU_NODE, evict_handle(e, item));
+	return h ? pool_ptr(e->pool, h) : NULL;
+}
+
+/* move @item to the head of queue @q */
+static void evict_queue_move(fca_evict_t *e, int q, fca_item_t *item)
+{
+	fca_handle_t h = evict_handle(e, item);
+	if (e->queues[q].first != h) {
+		ilist_del(e->pool, ITEM_LRU_NODE, &e->queues[q], h);
+		ilist_add(e->pool, ITEM_LRU_NODE, &e->queues[q], h);
+	}
+}
+
+
+/* LRU */
+static void evict_lru_add(fca_evict_t *e, fca_item_t *item)
+{
+	item->evict = 0;
+	evict_queue_add(e, 0, item);
+}
+
+static void evict_lru_del(fca_evict_t *e, fca_item_t *item)
+{
+	evict_queue_del(e, 0, item);
+}
+
+static void evict_lru_hit(fca_evict_t *e, fca_item_t *item)
+{
+	evict_queue_move(e, 0, item);
+}
+
+static fca_item_t *evict_lru_victim(fca_evict_t *e)
+{
+	return evict_tail(e, 0);
+}
+
+static fca_item_t *evict_lru_peek(fca_evict_t *e)
+{
+	return evict_tail(e, 0);
+}
+
+
+/* CLOCK */
+static void evict_clock_hit(fca_evict_t *e, fca_item_t *item)
+{
+	item->evict = EVICT_REF;
+}
+
+static fca_item_t *evict_clock_victim(fca_evict_t *e)
+{
+	fca_item_t *item;
+	long i;
+
+	/* at most one round, after which all bits are cleared */
+	for (i = 0; i < e->queue_nr[0]; i++) {
+		item = evict_tail(e, 0);
+		if (!(item->evict & EVICT_REF)) {
+			return item;
+		}
+		item->evict = 0;
+		evict_queue_move(e, 0, item);
+	}
+	return evict_tail(e, 0);
+}
+
+static fca_item_t *evict_clock_peek(fca_evict_t *e)
+{
+	fca_item_t *item;
+
+	/* the referenced ones would be moved to the head */
+	for (item = evict_tail(e, 0); item != NULL; item = evict_prev(e, item)) {
+		if (!(item->evict & EVICT_REF)) {
+			return item;
+		}
+	}
+	return evict_tail(e, 0);
+}
+
+
+/* S3-FIFO */
+static inline uint32_t *evict_ghost_slot(fca_evict_t *e, fca_item_t *item)
+{
+	uint32_t *words = (uint32_t *)item->hnode.id;
+	return &e->ghosts[words[0] & e->ghost_mask];
+}
+
+static inline uint32_t evict_ghost_print(fca_item_t *item)
+{
+	uint32_t *words = (uint32_t *)item->hnode.id;
+	return words[1] | 1; /* 0 for empty */
+}
+
+/* the ghost grows with items, to remember about as many as them */
+static void evict_ghost_grow(fca_evict_t *e)
+{
+	unsigned long size = e->ghosts ? (e->ghost_mask + 1) * 2
+		: EVICT_GHOSTS_BEGIN;
+	uint32_t *ghosts;
+
+	ghosts = calloc(size, sizeof(uint32_t));
+	if (ghosts == NULL) {
+		return;
+	}
+	free(e->ghosts);
+	e->ghosts = ghosts;
+	e->ghost_mask = size - 1;
+}
+
+static void evict_s3fifo_add(fca_evict_t *e, fca_item_t *item)
+{
+	uint32_t *slot;
+
+	if (e->ghosts == NULL || e->queue_nr[0] + e->queue_nr[1] > (long)e->ghost_mask) {
+		evict_ghost_grow(e);
+	}
+
+	if (e->ghosts != NULL) {
+		slot = evict_ghost_slot(e, item);
+		if (*slot == evict_ghost_print(item)) {
+			*slot = 0;
+			item->evict = EVICT_MAIN;
+			evict_queue_add(e, 1, item);
+			return;
+		}
+	}
+
+	item->evict = 0;
+	evict_queue_add(e, 0, item);
+}
+
+static void evict_s3fifo_del(fca_evict_t *e, fca_item_t *item)
+{
+	evict_queue_del(e, (item->evict & EVICT_MAIN) ? 1 : 0, item);
+}
+
+static void evict_s3fifo_hit(fca_evict_t *e, fca_item_t *item)
+{
+	if ((item->evict & EVICT_FREQ_MASK) != EVICT_FREQ_MASK) {
+		item->evict++;
+	}
+}
+
+static fca_item_t *evict_s3fifo_victim(fca_evict_t *e)
+{
+	fca_item_t *item;
+	size_t total;
+	long i, limit;
+
+	/* each item is moved 4 times at most */
+	limit = (e->queue_nr[0] + e->queue_nr[1]) * 4;
+	for (i = 0; i < limit; i++) {
+		total = e->queue_size[0] + e->queue_size[1];
+		if (e->queue_nr[0] != 0 && (e->queue_nr[1] == 0
+					|| e->queue_size[0] * 10 >= total)) {
+			item = evict_tail(e, 0);
+			if ((item->evict & EVICT_FREQ_MASK) == 0) {
+				if (e->ghosts != NULL) {
+					*evict_ghost_slot(e, item) = evict_ghost_print(item);
+				}
+				return item;
+			}
+			evict_queue_del(e, 0, item);
+			item->evict = EVICT_MAIN;
+			evict_queue_add(e, 1, item);
+
+		} else {
+			item = evict_tail(e, 1);
+			if ((item->evict & EVICT_FREQ_MASK) == 0) {
+				return item;
+			}
+			item->evict--;
+			evict_queue_move(e, 1, item);
+		}
+	}
+	return e->queue_nr[1] ? evict_tail(e, 1) : evict_tail(e, 0);
+}
+
+/* Follow evict_s3fifo_victim() without moving items. Items moved from
+ * the small FIFO are behind all of the main FIFO, and items in the
+ * main FIFO with frequency are not visited again, so the tail of the
+ * main FIFO is returned if all of them would be re-inserted. */
+static fca_item_t *evict_s3fifo_peek(fca_evict_t *e)
+{
+	fca_item_t *small = evict_tail(e, 0);
+	fca_item_t *main = evict_tail(e, 1);
+	size_t small_size = e->queue_size[0];
+	size_t main_size = e->queue_size[1];
+	long main_nr = e->queue_nr[1];
+
+	while (small != NULL || main != NULL) {
+		if (small != NULL && (main_nr == 0
+					|| small_size * 10 >= small_size + main_size)) {
+			if ((small->evict & EVICT_FREQ_MASK) == 0) {
+				return small;
+			}
+			small_size -= small->length;
+			main_size += small->length;
+			main_nr++;
+			small = evict_prev(e, small);
+
+		} else if (main != NULL) {
+			if ((main->evict & EVICT_FREQ_MASK) == 0) {
+				return main;
+			}
+			main = evict_prev(e, main);
+
+		} else {
+			break;
+		}
+	}
+	return e->queue_nr[1] ? evict_tail(e, 1) : evict_tail(e, 0);
+}
+
+
+static const fca_evict_policy_t evict_policies[] = {
+	[EVICT_LRU] = { "lru",
+		evict_lru_add, evict_lru_del, evict_lru_hit,
+		evict_lru_victim, evict_lru_peek },
+	[EVICT_CLOCK] = { "clock",
+		evict_lru_add, evict_lru_del, evict_clock_hit,
+		evict_clock_victim, evict_clock_peek },
+	[EVICT_S3FIFO] = { "s3fifo",
+		evict_s3fifo_add, evict_s3fifo_del, evict_s3fifo_hit,
+		evict_s3fifo_victim, evict_s3fifo_peek },
+};
+
+#define EVICT_POLICY_NUMBER (int)(sizeof(evict_policies) / sizeof(fca_evict_policy_t))
+
+int evict_policy_index(const char *name)
+{
+	int i;
+	for (i = 0; i < EVICT_POLICY_NUMBER; i++) {
+		if (strcmp(evict_policies[i].name, name) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+const char *evict_policy_name(int policy)
+{
+	return evict_policies[policy].name;
+}
+
+void evict_init(fca_evict_t *e, fca_pool_t *pool, int policy)
+{
+	bzero(e, sizeof(fca_evict_t));
+	e->pool = pool;
+	e->policy = &evict_policies[policy];
+	INIT_ILIST_HEAD(&e->queues[0]);
+	INIT_ILIST_HEAD(&e->queues[1]);
+}
+
+void evict_destroy(fca_evict_t *e)
+{
+	free(e->ghosts);
+	e->ghosts = NULL;
+	e->ghost_mask = 0;
+}
+
+/* re-add all items by the new policy, from the oldest */
+void evict_switch(fca_evict_t *e, int policy)
+{
+	fca_ilist_head_t queues[2];
+	fca_item_t *item;
+	fca_handle_t h;
+	int q;
+
+	if (e->policy == &evict_policies[policy]) {
+		return;
+	}
+
+	queues[0] = e->queues[0];
+	queues[1] = e->queues[1];
+	evict_destroy(e);
+	evict_init(e, e->pool, policy);
+
+	for (q = 1; q >= 0; q--) {
+		while ((h = queues[q].last) != 0) {
+			ilist_del(e->pool, ITEM_LRU_NODE, &queues[q], h);
+			item = pool_ptr(e->pool, h);
+			e->policy->add(e, item);
+		}
+	}
+}
@@ -0,0 +1,99 @@
+/*
+ * Eviction policies of items: LRU, CLOCK and S3-FIFO.
+ *
+ * Each shard of each server has its own queues, protected by the
+ * shard lock. The policy is set by 'evict_policy' of server.
+ *
+ * Author: Wu Bingzheng
+ *
+ */
+
+#ifndef _FCA_EVICT_H_
+#define _FCA_EVICT_H_
+
+#include <stddef.h>
+#include "utils/ilist.h"
+
+typedef struct fca_item_s fca_item_t;
+typedef struct fca_evict_s fca_evict_t;
+
+#define EVICT_LRU	0
+#define EVICT_CLOCK	1
+#define EVICT_S3FIFO	2
+
+typedef struct {
+	const char	*name;
+
+	/* a new item */
+	void		(*add)(fca_evict_t *e, fca_item_t *item);
+	/* an item is deleted */
+	void		(*del)(fca_evict_t *e, fca_item_t *item);
+	/* an item is hit */
+	void		(*hit)(fca_evict_t *e, fca_item_t *item);
+	/* return the next item to evict, but not delete it */
+	fca_item_t	*(*victim)(fca_evict_t *e);
+	/* return the item @victim would, but change nothing */
+	fca_item_t	*(*peek)(fca_evict_t *e);
+} fca_evict_policy_t;
+
+struct fca_evict_s {
+	const fca_evict_policy_t	*policy;
+	fca_pool_t		*pool;
+
+	/* LRU and CLOCK use @queues[0] only. S3-FIFO uses @queues[0]
+	 * as the small FIFO, and @queues[1] as the main FIFO. */
+	fca_ilist_head_t	queues[2];
+	long			queue_nr[2];
+	size_t			queue_size[2];
+
+	/* S3-FIFO only. fingerprints of items evicted from the small
+	 * FIFO, direct-mapped, so old ones are overwritten. */
+	uint32_t		*ghosts;
+	unsigned long		ghost_mask;
+};
+
+int evict_policy_index(const char *name);
+const char *evict_policy_name(int policy);
+
+void evict_init(fca_evict_t *e, fca_pool_t *pool, int policy);
+void evict_destroy(fca_evict_t *e);
+void evict_switch(fca_evict_t *e, int policy);
+
+static inline void evict_add(fca_evict_t *e, fca_item_t *item)
+{
+	e->policy->add(e, item);
+}
+
+static inline void evict_del(fca_evict_t *e, fca_item_t *item)
+{
+	e->policy->del(e, item);
+}
+
+static inline void evict_hit(fca_evict_t *e, fca_item_t *item)
+{
+	e->policy->hit(e, item);
+}
+
+static inline fca_item_t *evict_victim(fca_evict_t *e)
+{
+	return e->policy->victim(e);
+}
+
+static inline fca_item_t *evict_peek(fca_evict_t *e)
+{
+	return e->policy->peek(e);
+}
+
+static inline long evict_item_nr(fca_evict_t *e)
+{
+	return e->queue_nr[0] + e->queue_nr[1];
+}
+
+/* put @item back, as a new one, if it can not be evicted now */
+static inline void evict_requeue(fca_evict_t *e, fca_item_t *item)
+{
+	e->policy->del(e, item);
+	e->policy->add(e, item);
+}
+
+#endif
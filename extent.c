@@ -0,0 +1,155 @@
+/*
+ * Extent tree of free blocks.
+ *
+ * It's a treap, whose priorities are hashes of the handles, so no
+ * space is needed for them, and the node takes 2 handles only. The
+ * expected depth is O(log n), for adding, deleting and best-fit.
+ *
+ * Author: Wu Bingzheng
+ *
+ */
+
+#include "fcache.h"
+
+static inline fca_free_block_t *extent_block(fca_pool_t *pool, fca_handle_t h)
+{
+	return pool_ptr(pool, h);
+}
+
+static inline uint32_t extent_priority(fca_handle_t h)
+{
+	return h * 2654435761U;
+}
+
+/* order by size, and then by offset */
+static inline int extent_less(fca_free_block_t *a, fca_free_block_t *b)
+{
+	return a->block_size < b->block_size || (a->block_size == b->block_size
+			&& a->offset < b->offset);
+}
+
+/* split subtree @h into @left, less than @key, and @right */
+static void extent_split(fca_pool_t *pool, fca_handle_t h, fca_free_block_t *key,
+		fca_handle_t *left, fca_handle_t *right)
+{
+	fca_free_block_t *fblock;
+
+	if (h == 0) {
+		*left = *right = 0;
+		return;
+	}
+
+	fblock = extent_block(pool, h);
+	if (extent_less(fblock, key)) {
+		*left = h;
+		extent_split(pool, fblock->extent_node.right, key,
+				&fblock->extent_node.right, right);
+	} else {
+		*right = h;
+		extent_split(pool, fblock->extent_node.left, key,
+				left, &fblock->extent_node.left);
+	}
+}
+
+/* merge subtrees @left and @right, all in @left are less */
+static fca_handle_t extent_merge(fca_pool_t *pool, fca_handle_t left,
+		fca_handle_t right)
+{
+	fca_free_block_t *fblock;
+
+	if (left == 0) {
+		return right;
+	}
+	if (right == 0) {
+		return left;
+	}
+
+	if (extent_priority(left) > extent_priority(right)) {
+		fblock = extent_block(pool, left);
+		fblock->extent_node.right = extent_merge(pool,
+				fblock->extent_node.right, right);
+		return left;
+	} else {
+		fblock = extent_block(pool, right);
+		fblock->extent_node.left = extent_merge(pool,
+				left, fblock->extent_node.left);
+		return right;
+	}
+}
+
+void extent_add(fca_pool_t *pool, fca_extent_tree_t *tree, fca_handle_t h)
+{
+	fca_free_block_t *fblock = extent_block(pool, h);
+	fca_free_block_t *node;
+	fca_handle_t *link = &tree->root;
+	uint32_t priority = extent_priority(h);
+
+	while (*link != 0 && extent_priority(*link) > priority) {
+		node = extent_block(pool, *link);
+		link = extent_less(fblock, node) ? &node->extent_node.left
+			: &node->extent_node.right;
+	}
+
+	extent_split(pool, *link, fblock, &fblock->extent_node.left,
+			&fblock->extent_node.right);
+	*link = h;
+
+	tree->nr++;
+	tree->size += fblock->block_size;
+}
+
+void extent_del(fca_pool_t *pool, fca_extent_tree_t *tree, fca_handle_t h)
+{
+	fca_free_block_t *fblock = extent_block(pool, h);
+	fca_free_block_t *node;
+	fca_handle_t *link = &tree->root;
+
+	while (*link != h) {
+		if (*link == 0) {
+			/* should not be here */
+			log_error_run(0, "oops! extent not found");
+			return;
+		}
+		node = extent_block(pool, *link);
+		link = extent_less(fblock, node) ? &node->extent_node.left
+			: &node->extent_node.right;
+	}
+
+	*link = extent_merge(pool, fblock->extent_node.left,
+			fblock->extent_node.right);
+
+	tree->nr--;
+	tree->size -= fblock->block_size;
+}
+
+/* return the smallest block not less than @size, 0 if none */
+fca_handle_t extent_best_fit(fca_pool_t *pool, fca_extent_tree_t *tree, size_t size)
+{
+	fca_free_block_t *fblock;
+	fca_handle_t h = tree->root;
+	fca_handle_t best = 0;
+
+	while (h != 0) {
+		fblock = extent_block(pool, h);
+		if ((size_t)fblock->block_size >= size) {
+			best = h;
+			h = fblock->extent_node.left;
+		} else {
+			h = fblock->extent_node.right;
+		}
+	}
+	return best;
+}
+
+fca_handle_t extent_biggest(fca_pool_t *pool, fca_extent_tree_t *tree)
+{
+	fca_handle_t h = tree->root;
+
+	if (h == 0) {
+		return 0;
+	}
+	while (extent_block(pool, h)->extent_node.right != 0) {
+		h = extent_block(pool, h)->extent_node.right;
+	}
+	return h;
+}
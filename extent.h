@@ -0,0 +1,50 @@
+/*
+ * Extent tree of free blocks, indexed by size and then offset, for
+ * best-fit allocation. Neighbour blocks are found by the order list
+ * of region, so this indexes by size only.
+ *
+ * Each region of extent devices has its own tree, protected by the
+ * shard lock. The nodes are free blocks in the shard's item pool.
+ *
+ * Author: Wu Bingzheng
+ *
+ */
+
+#ifndef _FCA_EXTENT_H_
+#define _FCA_EXTENT_H_
+
+#include <stddef.h>
+#include "utils/pool.h"
+
+/* allocation unit of extent devices */
+#define EXTENT_UNIT		4096
+
+typedef struct {
+	fca_handle_t		left;
+	fca_handle_t		right;
+} fca_extent_node_t;
+
+typedef struct {
+	fca_handle_t		root;
+	long			nr;
+	size_t			size;
+} fca_extent_tree_t;
+
+static inline void extent_init(fca_extent_tree_t *tree)
+{
+	tree->root = 0;
+	tree->nr = 0;
+	tree->size = 0;
+}
+
+static inline size_t extent_block_size(size_t size)
+{
+	return (size + EXTENT_UNIT - 1) & ~(size_t)(EXTENT_UNIT - 1);
+}
+
+void extent_add(fca_pool_t *pool, fca_extent_tree_t *tree, fca_handle_t h);
+void extent_del(fca_pool_t *pool, fca_extent_tree_t *tree, fca_handle_t h);
+fca_handle_t extent_best_fit(fca_pool_t *pool, fca_extent_tree_t *tree, size_t size);
+fca_handle_t extent_biggest(fca_pool_t *pool, fca_extent_tree_t *tree);
+
+#endif
@@ -1,5 +1,5 @@
 /*
- * Entry of fcache, and master thread.
+ * Entry of fcache, and master threads.
  *
  * Author: Wu Bingzheng
  *
@@ -12,15 +12,46 @@ static char *conf_filename = "fcache.conf";
 static char error_log[PATH_LENGTH];
 static time_t quit_timeout;
 
-int master_epoll_fd;
-fca_timer_t master_timer;
-LIST_HEAD(master_requests);
+__thread int master_epoll_fd;
+__thread fca_timer_t master_timer;
+__thread struct list_head master_requests;
+__thread int master_index;
+__thread fca_timer_t *thread_timer;
+int master_nr = 0;
+int master_epoll_fds[MASTERS_LIMIT];
+int fca_simulate = 0;
+static pthread_t master_tids[MASTERS_LIMIT];
 FILE *error_filp;
 FILE *admin_out_filp;
+/* set by master 0, and read by all masters */
 static time_t quit_time = 0;
 
 static int fcache_global_conf_check(fca_conf_t *conf_cycle)
 {
+	int i;
+
+	if (master_nr != 0) {
+		if (conf_cycle->threads != master_nr) {
+			log_error_admin(0, "threads can not be changed by reload");
+			return FCA_ERROR;
+		}
+	} else {
+		/* first load. the master epolls are needed by workers and
+		 * listen sockets in device_conf_check() and server_conf_check(). */
+		if (conf_cycle->threads < 1 || conf_cycle->threads > MASTERS_LIMIT) {
+			log_error_admin(0, "threads must be in 1~%d", MASTERS_LIMIT);
+			return FCA_ERROR;
+		}
+		master_nr = conf_cycle->threads;
+		for (i = 1; i < master_nr; i++) {
+			master_epoll_fds[i] = epoll_create(100);
+			if (master_epoll_fds[i] < 0) {
+				log_error_admin(errno, "open master epoll");
+				return FCA_ERROR;
+			}
+		}
+	}
+
 	conf_cycle->error_filp = NULL;
 	if (strcmp(conf_cycle->error_log, error_log)) {
 		conf_cycle->error_filp = fopen(conf_cycle->error_log, "a");
@@ -80,19 +111,62 @@ rollback:
 
 static void fcache_quit(void)
 {
+	time_t qt;
+
+	/* only master 0 sets it, so no atomic load here */
 	if (quit_time != 0) { /* already in quiting */
 		return;
 	}
 
-	quit_time = timer_now(&master_timer) + quit_timeout;
+	qt = timer_now(&master_timer) + quit_timeout;
+	__atomic_store_n(&quit_time, qt, __ATOMIC_RELEASE);
 	server_stop_service();
-	device_worker_quit(quit_time);
+	device_worker_quit(qt);
 }
 
 static void fcache_status(FILE *filp)
 {
 	device_status(filp);
 	server_status(filp);
+	trace_status(filp);
+	logger_status(filp);
+}
+
+/* 'GET /metrics' on admin port. The metrics are printed into memory
+ * first, and sent at once, so a slow scraper blocks the master for
+ * at most FCACHE_METRICS_SEND_TIMEOUT. */
+#define FCACHE_METRICS_SEND_TIMEOUT	1
+static void fcache_metrics_handler(int sock_fd)
+{
+	struct timeval tv = { FCACHE_METRICS_SEND_TIMEOUT, 0 };
+	char header[200], *body = NULL;
+	size_t body_len = 0;
+	int len, sndbuf;
+	FILE *filp;
+
+	filp = open_memstream(&body, &body_len);
+	if (filp == NULL) {
+		close(sock_fd);
+		return;
+	}
+	metrics_exposition(filp);
+	fclose(filp);
+
+	len = sprintf(header, "HTTP/1.0 200 OK\r\n"
+			"Content-Type: text/plain; version=0.0.4\r\n"
+			"Content-Length: %lu\r\n"
+			"Connection: close\r\n\r\n", body_len);
+
+	sndbuf = len + body_len;
+	setsockopt(sock_fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+	setsockopt(sock_fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+	fcntl(sock_fd, F_SETFL, fcntl(sock_fd, F_GETFL) & ~O_NONBLOCK);
+
+	if (send(sock_fd, header, len, MSG_MORE | MSG_NOSIGNAL) == len) {
+		send(sock_fd, body, body_len, MSG_NOSIGNAL);
+	}
+	free(body);
+	close(sock_fd);
 }
 
 /* handler of admin port, print the current status */
@@ -113,6 +187,11 @@ static void fcache_admin_handler(int admin_fd)
 	}
 	buf[rc] = '\0';
 
+	if (strncmp(buf, "GET /metrics", 12) == 0) {
+		fcache_metrics_handler(sock_fd);
+		return;
+	}
+
 	admin_out_filp = fdopen(sock_fd, "w");
 	if (admin_out_filp == NULL) {
 		return;
@@ -131,6 +210,12 @@ static void fcache_admin_handler(int admin_fd)
 		fcache_quit();
 		fputs("Quiting...\n", admin_out_filp);
 
+	} else if (strncmp(buf, "reopen", 6) == 0) {
+		rc = logger_reopen();
+		if (rc == FCA_OK) {
+			fputs("Logs reopened!\n", admin_out_filp);
+		}
+
 	} else if (strncmp(buf, "clear ", 6) == 0) {
 		rc = server_clear((unsigned short)atoi(buf + 6));
 		if (rc == FCA_OK) {
@@ -139,15 +224,16 @@ static void fcache_admin_handler(int admin_fd)
 
 	} else {
 		fputs("Invalid command!\n", admin_out_filp);
-		fputs("Usage: status|reload|quit|clear SERVER\n", admin_out_filp);
+		fputs("Usage: status|reload|reopen|quit|clear SERVER|GET /metrics\n", admin_out_filp);
 	}
 
 	fclose(admin_out_filp);
 	admin_out_filp = NULL;
 }
 
-/* entry of the master thread */
-static void fcache_master_entry(int admin_fd)
+/* event loop of master threads. only the first master handles the
+ * admin port, and runs the routines. */
+static void fcache_master_loop(int admin_fd)
 {
 #define MAX_EVENTS 512
 	struct epoll_event events[MAX_EVENTS];
@@ -156,13 +242,12 @@ static void fcache_master_entry(int admin_fd)
 	int rc, i, type;
 	void *ptr;
 	fca_request_t *r;
-	time_t last, now;
+	time_t last, now, qt;
 
 	last = timer_now(&master_timer);
 
-	device_format_load();
-
-	while (quit_time == 0 || !request_check_quit(quit_time > last)) {
+	while ((qt = __atomic_load_n(&quit_time, __ATOMIC_ACQUIRE)) == 0
+			|| !request_check_quit(qt > last)) {
 
 		rc = epoll_wait(master_epoll_fd, events, MAX_EVENTS, 1000);
 		if (rc == -1 && errno != EINTR) {
@@ -204,17 +289,60 @@ static void fcache_master_entry(int admin_fd)
 			request_timeout_handler(r);
 		}
 
+		/* wake up workers, which requests are dispatched to */
+		worker_wakeup_flush();
+
 		/* routines */
 		now = timer_now(&master_timer);
 		if (now != last) {
 			last = now;
 
-			server_routine();
-			device_routine();
-			fflush(error_filp);
+			if (master_index == 0) {
+				server_routine();
+				device_routine();
+				fflush(error_filp);
+			}
+		}
+	}
+}
+
+/* entry of the other master threads */
+static void *fcache_master_thread(void *data)
+{
+	master_index = (intptr_t)data;
+	master_epoll_fd = master_epoll_fds[master_index];
+	INIT_LIST_HEAD(&master_requests);
+	worker_master_init();
+	timer_init(&master_timer);
+	thread_timer = &master_timer;
+
+	fcache_master_loop(-1);
+	return NULL;
+}
+
+/* entry of the first master thread */
+static void fcache_master_entry(int admin_fd)
+{
+	int i;
+
+	device_format_load();
+
+	for (i = 1; i < master_nr; i++) {
+		if (pthread_create(&master_tids[i], NULL, fcache_master_thread,
+					(void *)(intptr_t)i) != 0) {
+			log_error_run(errno, "create master thread");
+			exit(1);
 		}
 	}
 
+	fcache_master_loop(admin_fd);
+
+	for (i = 1; i < master_nr; i++) {
+		pthread_join(master_tids[i], NULL);
+	}
+
+	trace_stop();
+	logger_stop();
 	device_format_store();
 }
 
@@ -293,8 +421,12 @@ int main(int argc, char **argv)
 	 * fcache_admin_handler() before calling fcache_load_conf(). */
 	admin_out_filp = stderr;
 
-	/* master timer */
+	/* the main thread is the first master */
+	master_index = 0;
+	INIT_LIST_HEAD(&master_requests);
+	worker_master_init();
 	timer_init(&master_timer);
+	thread_timer = &master_timer;
 
 	/* master epoll */
 	master_epoll_fd = epoll_create(100);
@@ -302,9 +434,10 @@ int main(int argc, char **argv)
 		perror("error in open epoll");
 		return 1;
 	}
+	master_epoll_fds[0] = master_epoll_fd;
 
 	/* admin port */
-	admin_fd = tcp_bind(admin_port);
+	admin_fd = tcp_bind(admin_port, 0);
 	if (admin_fd < 0) {
 		perror("error in bind admin port");
 		return 1;
@@ -20,6 +20,8 @@
 
 #define LOOP_LIMIT	1000
 
+#define MASTERS_LIMIT	64
+
 #define EVENT_TYPE_SOCKET	0
 #define EVENT_TYPE_LISTEN	1
 #define EVENT_TYPE_PIPE		2
@@ -42,6 +44,7 @@ typedef char fca_flag_t;
 #include <pthread.h>
 #include <sys/ioctl.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/socket.h>
@@ -56,11 +59,15 @@ typedef char fca_flag_t;
 #include "utils/socktcp.h"
 #include "utils/string.h"
 #include "utils/slab.h"
+#include "utils/pool.h"
+#include "utils/ilist.h"
 #include "utils/hash.h"
 #include "utils/epoll.h"
 #include "utils/timer.h"
 #include "utils/ipbucket.h"
 #include "utils/idx_pointer.h"
+#include "utils/ring.h"
+#include "utils/uring.h"
 
 
 typedef struct fca_request_s fca_request_t;
@@ -68,20 +75,44 @@ typedef struct fca_item_s fca_item_t;
 typedef struct fca_server_s fca_server_t;
 typedef struct fca_device_s fca_device_t;
 typedef struct fca_worker_s fca_worker_t;
+typedef struct fca_journal_s fca_journal_t;
+typedef struct fca_trace_s fca_trace_t;
+typedef struct fca_logger_s fca_logger_t;
 typedef struct fca_format_item_s fca_format_item_t;
 typedef struct fca_conf_s fca_conf_t;
 typedef void req_handler_f(fca_request_t *r);
 
-extern int master_epoll_fd;
-extern fca_timer_t master_timer;
-extern struct list_head master_requests;
-
+/* each master thread has its own epoll, timer and requests */
+extern __thread int master_epoll_fd;
+extern __thread fca_timer_t master_timer;
+extern __thread struct list_head master_requests;
+extern __thread int master_index;
+extern int master_nr;
+extern int master_epoll_fds[MASTERS_LIMIT];
+
+/* timer for log, master_timer in masters and own timer in workers */
+extern __thread fca_timer_t *thread_timer;
+
+/* set by fcache-sim, which runs servers and devices without sockets,
+ * device files or threads, see sim/sim.c */
+extern int fca_simulate;
+
+#include "hot.h"
+#include "evict.h"
+#include "admit.h"
+#include "extent.h"
+#include "bcache.h"
+#include "advise.h"
+#include "metrics.h"
 #include "conf.h"
 #include "format.h"
 #include "http.h"
 #include "server.h"
 #include "worker.h"
 #include "device.h"
+#include "journal.h"
+#include "trace.h"
+#include "logger.h"
 #include "request.h"
 #include "event.h"
 
@@ -89,7 +120,7 @@ void log_error(FILE *filp, const char *prefix, int errnum, const char *fmt, ...)
 
 extern FILE *error_filp;
 #define log_error_run(errnum, fmt, ...) \
-	log_error(error_filp, timer_format_log(&master_timer), errnum, fmt, ##__VA_ARGS__)
+	log_error(error_filp, timer_format_log(thread_timer), errnum, fmt, ##__VA_ARGS__)
 
 extern FILE *admin_out_filp;
 #define log_error_admin(errnum, fmt, ...) \
@@ -19,11 +19,12 @@
 
 
 #define FCA_FM_MAGIC		0x2143484556494c4fL /* OLIVEHC! */
-#define FCA_FM_VERSION		1
+#define FCA_FM_VERSION		2
 
 typedef struct {
 	uint64_t	magic;
 	int		version;
+	int		alloc;		/* DEVICE_ALLOC_xxx, since version 2 */
 	uint64_t	checksum;
 	long		item_nr;
 } fca_superblock_t;
@@ -32,6 +33,9 @@ typedef struct {
 #define FCA_FM_INFO_SIZE (sizeof(fca_superblock_t) + SERVER_PORTS_SIZE)
 #define FCA_FM_CHS_FEED 0x57eb0b4eecfeb465L
 
+/* items read from device at a time, in format_load_device() */
+#define FCA_FM_READ_ITEMS 16384
+
 static uint64_t format_checksum(void *buf, size_t len)
 {
 	uint64_t *p = buf;
@@ -44,16 +48,76 @@ static uint64_t format_checksum(void *buf, size_t len)
 	return checksum;
 }
 
+void format_batch_init(fca_format_batch_t *batch, fca_device_t *device)
+{
+	batch->device = device;
+	batch->nr = 0;
+}
+
+/* items must be added in order of offset */
+void format_batch_add(fca_format_batch_t *batch, fca_server_t *server,
+		fca_format_item_t *fm_item)
+{
+	batch->servers[batch->nr] = server;
+	batch->items[batch->nr] = *fm_item;
+	if (++batch->nr == FORMAT_BATCH_SIZE) {
+		format_batch_flush(batch);
+	}
+}
+
+/* Insert the batch. All shard locks are taken, because items of all
+ * shards are cut from the device in order of offset. */
+void format_batch_flush(fca_format_batch_t *batch)
+{
+	long loaded = 0;
+	int i;
+
+	if (batch->nr == 0) {
+		return;
+	}
+
+	for (i = 0; i < master_nr; i++) {
+		server_shard_lock(i);
+	}
+	for (i = 0; i < batch->nr; i++) {
+		if (server_load_fm_item(batch->servers[i], batch->device,
+					&batch->items[i]) == FCA_OK) {
+			loaded++;
+		}
+	}
+	for (i = master_nr - 1; i >= 0; i--) {
+		server_shard_unlock(i);
+	}
+
+	__sync_fetch_and_add(&batch->device->load_items, loaded);
+	batch->nr = 0;
+}
+
+/* return the first item from @h in the order list of @shard, or NULL */
+static fca_item_t *format_next_item(int shard, fca_handle_t h)
+{
+	fca_pool_t *pool = &item_pools[shard];
+	fca_free_block_t *fblock;
+
+	for (; h != 0; h = ilist_next(pool, ITEM_ORDER_NODE, h)) {
+		fblock = pool_ptr(pool, h);
+		if (!fblock->fblock) {
+			return pool_ptr(pool, h);
+		}
+	}
+	return NULL;
+}
+
 int format_store_device(unsigned short *server_ports, fca_device_t *device)
 {
-	struct list_head *p;
 	fca_superblock_t superb;
 	fca_item_t *item;
-	fca_free_block_t *fblock;
+	fca_item_t *nexts[MASTERS_LIMIT];
 	fca_format_item_t fm_item;
 	fca_server_t *server;
+	int i, min;
 
-	if (device->item_nr == 0) {
+	if (device_item_nr(device) == 0) {
 		return FCA_ERROR;
 	}
 
@@ -65,6 +129,7 @@ int format_store_device(unsigned short *server_ports, fca_device_t *device)
 	/* init superblock */
 	superb.magic = FCA_FM_MAGIC;
 	superb.version = FCA_FM_VERSION;
+	superb.alloc = device->alloc;
 	superb.checksum = 0;
 	superb.item_nr = 0;
 
@@ -76,15 +141,27 @@ int format_store_device(unsigned short *server_ports, fca_device_t *device)
 		return FCA_ERROR;
 	}
 
-	/* items */
-	list_for_each(p, &device->order_head) {
-		fblock = list_entry(p, fca_free_block_t, order_node);
-		if (fblock->fblock) {
-			continue;
+	/* items. merge the regions, because format_load_device()
+	 * needs them in order of offset. */
+	for (i = 0; i < master_nr; i++) {
+		nexts[i] = format_next_item(i, device->regions[i].order_head.first);
+	}
+	while (1) {
+		min = -1;
+		for (i = 0; i < master_nr; i++) {
+			if (nexts[i] != NULL && (min == -1
+					|| nexts[i]->offset < nexts[min]->offset)) {
+				min = i;
+			}
+		}
+		if (min == -1) {
+			break;
 		}
 
-		item = list_entry(p, fca_item_t, order_node);
-		if (!server_item_valid(item)) {
+		item = nexts[min];
+		nexts[min] = format_next_item(min, item->order_node.next);
+
+		if (item->deleted || !server_item_valid(item)) {
 			continue;
 		}
 
@@ -93,7 +170,8 @@ int format_store_device(unsigned short *server_ports, fca_device_t *device)
 			continue;
 		}
 
-		memcpy(fm_item.hash_id, item->hnode.id, 16);
+		memset(fm_item.hash_id, 0, sizeof(fm_item.hash_id));
+		memcpy(fm_item.hash_id, item->hnode.id, HASH_ID_LEN);
 		fm_item.expire = item->expire;
 		fm_item.length = item->length;
 		fm_item.headers_len = item->headers_len;
@@ -133,33 +211,48 @@ int format_load_device(fca_device_t *device)
 	fca_superblock_t *superb;
 	fca_server_t *server;
 	fca_server_t *disk_servers[SERVERS_LIMIT];
-	fca_format_item_t fm_item;
-	FILE *filp;
-	long i;
+	fca_format_item_t *fm_items = NULL, *fm_item;
+	fca_format_batch_t batch;
+	long i, n, j;
+	ssize_t len;
 	off_t override;
-	int rc = FCA_ERROR;
+	int fd, rc = FCA_ERROR;
 
-	time_t now = timer_now(&master_timer);
+	/* in the loading thread, but not master */
+	time_t now = time(NULL);
 
-	filp = fopen(device->filename, "r+");
-	if (filp == NULL) {
+	fd = open(device->filename, O_RDWR);
+	if (fd < 0) {
 		return FCA_ERROR;
 	}
-	if (fread(buffer, FCA_FM_INFO_SIZE, 1, filp) < 1) {
+	if (pread(fd, buffer, FCA_FM_INFO_SIZE, 0) != FCA_FM_INFO_SIZE) {
 		goto out;
 	}
 	superb = (fca_superblock_t *)&buffer[0];
 	server_ports = (unsigned short *)(superb + 1);
 
-	/* check */
-	if (superb->magic != FCA_FM_MAGIC || superb->version != FCA_FM_VERSION) {
+	/* check. Version 1 has ipbucket only. */
+	if (superb->magic != FCA_FM_MAGIC || superb->version < 1
+			|| superb->version > FCA_FM_VERSION) {
 		goto out;
 	}
+	if (superb->version == 1) {
+		superb->alloc = DEVICE_ALLOC_IPBUCKET;
+	}
 
 	if (format_checksum(buffer, FCA_FM_INFO_SIZE) != FCA_FM_CHS_FEED) {
 		goto out;
 	}
 
+	/* items are in blocks sized by the alloc, so they are dropped if
+	 * it's changed. The magic is cleared, otherwise they could be
+	 * loaded by the old alloc later, while the space is reused. */
+	if (superb->alloc != device->alloc) {
+		log_error_run(0, "alloc of device %s is changed, drop its items",
+				device->filename);
+		goto clear;
+	}
+
 	/* build @disk_servers */
 	for (i = 0; i < SERVERS_LIMIT; i++) {
 		if (server_ports[i] != 0) {
@@ -167,39 +260,56 @@ int format_load_device(fca_device_t *device)
 		}
 	}
 
-	/* load items! */
-	override = FCA_FM_INFO_SIZE + superb->item_nr * sizeof(fca_format_item_t);
-	if (fseek(filp, FCA_FM_INFO_SIZE, SEEK_SET) < 0) {
+	fm_items = malloc(sizeof(fca_format_item_t) * FCA_FM_READ_ITEMS);
+	if (fm_items == NULL) {
 		goto out;
 	}
-	for (i = 0; i < superb->item_nr; i++) {
-		if (fread(&fm_item, sizeof(fca_format_item_t), 1, filp) < 1) {
+	device->load_total = superb->item_nr;
+
+	/* load items! in big chunks */
+	override = FCA_FM_INFO_SIZE + superb->item_nr * sizeof(fca_format_item_t);
+	format_batch_init(&batch, device);
+	for (i = 0; i < superb->item_nr; i += n) {
+		n = superb->item_nr - i;
+		if (n > FCA_FM_READ_ITEMS) {
+			n = FCA_FM_READ_ITEMS;
+		}
+		len = sizeof(fca_format_item_t) * n;
+		if (pread(fd, fm_items, len, FCA_FM_INFO_SIZE
+					+ sizeof(fca_format_item_t) * i) != len) {
+			format_batch_flush(&batch);
 			goto out;
 		}
 
-		if (fm_item.offset < override || fm_item.expire <= now) {
-			continue;
-		}
+		for (j = 0; j < n; j++) {
+			fm_item = &fm_items[j];
 
-		server = disk_servers[fm_item.server_index];
-		if (server == NULL) {
-			continue;
-		}
+			/* items in the journal region are overridden too */
+			if (fm_item->offset < override
+					|| fm_item->offset < device->load_offset
+					|| fm_item->expire <= now) {
+				continue;
+			}
 
-		server_load_fm_item(server, device, &fm_item);
+			server = disk_servers[fm_item->server_index];
+			if (server == NULL) {
+				continue;
+			}
+
+			format_batch_add(&batch, server, fm_item);
+		}
 	}
-	device_load_post(device);
+	format_batch_flush(&batch);
+	rc = FCA_OK;
 
+clear:
 	/* clear the magic */
-	if (fseek(filp, 0, SEEK_SET) < 0) {
-		goto out;
-	}
-	if (fwrite("FeiLiWuShi", 10, 1, filp) < 1) {
-		goto out;
+	if (pwrite(fd, "FeiLiWuShi", 10, 0) != 10) {
+		rc = FCA_ERROR;
 	}
-	rc = FCA_OK;
 
 out:
-	fclose(filp);
+	free(fm_items);
+	close(fd);
 	return rc;
 }
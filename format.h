@@ -21,6 +21,21 @@ struct fca_format_item_s {
 	short		server_index;
 };
 
+/* loaded items are inserted in batches, to take the shard locks less */
+#define FORMAT_BATCH_SIZE 1024
+
+typedef struct {
+	fca_device_t		*device;
+	int			nr;
+	fca_server_t		*servers[FORMAT_BATCH_SIZE];
+	fca_format_item_t	items[FORMAT_BATCH_SIZE];
+} fca_format_batch_t;
+
+void format_batch_init(fca_format_batch_t *batch, fca_device_t *device);
+void format_batch_add(fca_format_batch_t *batch, fca_server_t *server,
+		fca_format_item_t *fm_item);
+void format_batch_flush(fca_format_batch_t *batch);
+
 int format_store_device(unsigned short *ports, fca_device_t *device);
 int format_load_device(fca_device_t *device);
 
@@ -0,0 +1,196 @@
+/*
+ * RAM tier of hot small items. Items hit frequently are copied
+ * into memory, and served by master threads directly, without
+ * dispatching to worker threads.
+ *
+ * An item is admitted when its counter in @freqs, shared by items
+ * with the same hash bits, reaches @admit_hits. The counters are
+ * halved every status period, so they approximate recent hits.
+ * Entries are evicted in LRU order when exceeding the budget.
+ *
+ * Author: Wu Bingzheng
+ *
+ */
+
+#include "fcache.h"
+
+#define HOT_BUCKETS_BEGIN	64
+
+int hot_init(fca_hot_t *hot)
+{
+	unsigned long i;
+
+	INIT_LIST_HEAD(&hot->lru_head);
+	hot->size = 0;
+	hot->entry_nr = 0;
+	bzero(hot->freqs, sizeof(hot->freqs));
+
+	hot->buckets = malloc(sizeof(struct list_head) * HOT_BUCKETS_BEGIN);
+	if (hot->buckets == NULL) {
+		return FCA_ERROR;
+	}
+	hot->bucket_mask = HOT_BUCKETS_BEGIN - 1;
+	for (i = 0; i < HOT_BUCKETS_BEGIN; i++) {
+		INIT_LIST_HEAD(&hot->buckets[i]);
+	}
+	return FCA_OK;
+}
+
+static inline struct list_head *hot_bucket(fca_hot_t *hot, fca_item_t *item)
+{
+	/* items are 48 bytes, so drop the lower bits */
+	return &hot->buckets[((uintptr_t)item >> 4) & hot->bucket_mask];
+}
+
+/* double the buckets. do nothing if fails. */
+static void hot_rehash(fca_hot_t *hot)
+{
+	struct list_head *old = hot->buckets;
+	unsigned long old_nr = hot->bucket_mask + 1;
+	struct list_head *p, *safe;
+	fca_hot_entry_t *entry;
+	unsigned long i;
+
+	hot->buckets = malloc(sizeof(struct list_head) * old_nr * 2);
+	if (hot->buckets == NULL) {
+		hot->buckets = old;
+		return;
+	}
+	hot->bucket_mask = old_nr * 2 - 1;
+	for (i = 0; i < old_nr * 2; i++) {
+		INIT_LIST_HEAD(&hot->buckets[i]);
+	}
+
+	for (i = 0; i < old_nr; i++) {
+		list_for_each_safe(p, safe, &old[i]) {
+			entry = list_entry(p, fca_hot_entry_t, bucket_node);
+			list_add(&entry->bucket_node, hot_bucket(hot, entry->item));
+		}
+	}
+	free(old);
+}
+
+static fca_hot_entry_t *hot_search(fca_hot_t *hot, fca_item_t *item)
+{
+	struct list_head *p, *head = hot_bucket(hot, item);
+	fca_hot_entry_t *entry;
+
+	list_for_each(p, head) {
+		entry = list_entry(p, fca_hot_entry_t, bucket_node);
+		if (entry->item == item) {
+			return entry;
+		}
+	}
+	return NULL;
+}
+
+/* take @item's entry. @item->hot must be set. */
+fca_hot_entry_t *hot_get(fca_hot_t *hot, fca_item_t *item)
+{
+	fca_hot_entry_t *entry = hot_search(hot, item);
+	if (entry == NULL) {
+		return NULL;
+	}
+
+	list_del(&entry->lru_node);
+	list_add(&entry->lru_node, &hot->lru_head);
+	entry->refs++;
+	return entry;
+}
+
+void hot_put(fca_hot_entry_t *entry)
+{
+	if (--entry->refs == 0) {
+		free(entry);
+	}
+}
+
+/* count a hit of @item. return 1 if it should be admitted. */
+int hot_admit(fca_hot_t *hot, fca_item_t *item, int admit_hits)
+{
+	unsigned char *freq = &hot->freqs[((uint32_t *)item->hnode.id)[1]
+			& (HOT_FREQ_SIZE - 1)];
+
+	if (*freq < 255) {
+		(*freq)++;
+	}
+	return *freq >= admit_hits;
+}
+
+void hot_age(fca_hot_t *hot)
+{
+	int i;
+	for (i = 0; i < HOT_FREQ_SIZE; i++) {
+		hot->freqs[i] >>= 1;
+	}
+}
+
+/* called out of shard lock, by worker threads */
+fca_hot_entry_t *hot_entry_alloc(size_t length)
+{
+	fca_hot_entry_t *entry = malloc(sizeof(fca_hot_entry_t) + length);
+	if (entry == NULL) {
+		return NULL;
+	}
+	entry->length = length;
+	entry->refs = 1;
+	return entry;
+}
+
+static void hot_entry_delete(fca_hot_t *hot, fca_hot_entry_t *entry)
+{
+	entry->item->hot = 0;
+	list_del(&entry->lru_node);
+	list_del(&entry->bucket_node);
+	hot->size -= entry->length;
+	hot->entry_nr--;
+	hot_put(entry);
+}
+
+void hot_shrink(fca_hot_t *hot, size_t budget)
+{
+	fca_hot_entry_t *entry;
+
+	while (hot->size > budget) {
+		entry = list_entry(hot->lru_head.prev, fca_hot_entry_t, lru_node);
+		hot_entry_delete(hot, entry);
+	}
+}
+
+/* add @entry, filled with @item's data, into the tier */
+void hot_add(fca_hot_t *hot, fca_hot_entry_t *entry, fca_item_t *item,
+		size_t budget)
+{
+	if (item->hot || entry->length > budget) {
+		hot_put(entry);
+		return;
+	}
+
+	hot_shrink(hot, budget - entry->length);
+
+	if (hot->entry_nr > hot->bucket_mask * 2) {
+		hot_rehash(hot);
+	}
+
+	entry->item = item;
+	list_add(&entry->lru_node, &hot->lru_head);
+	list_add(&entry->bucket_node, hot_bucket(hot, item));
+	hot->size += entry->length;
+	hot->entry_nr++;
+	item->hot = 1;
+}
+
+void hot_remove(fca_hot_t *hot, fca_item_t *item)
+{
+	fca_hot_entry_t *entry = hot_search(hot, item);
+	if (entry != NULL) {
+		hot_entry_delete(hot, entry);
+	}
+}
+
+void hot_destroy(fca_hot_t *hot)
+{
+	hot_shrink(hot, 0);
+	free(hot->buckets);
+	hot->buckets = NULL;
+}
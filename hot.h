@@ -0,0 +1,65 @@
+/*
+ * RAM tier of hot small items. Items hit frequently are copied
+ * into memory, and served by master threads directly, without
+ * dispatching to worker threads.
+ *
+ * Each shard of each server has its own tier, protected by the
+ * shard lock.
+ *
+ * Author: Wu Bingzheng
+ *
+ */
+
+#ifndef _FCA_HOT_H_
+#define _FCA_HOT_H_
+
+#include <stddef.h>
+#include "utils/list.h"
+
+typedef struct fca_item_s fca_item_t;
+typedef struct fca_hot_entry_s fca_hot_entry_t;
+
+/* admission counters of each tier */
+#define HOT_FREQ_SIZE		4096
+
+struct fca_hot_entry_s {
+	fca_item_t		*item;
+	struct list_head	lru_node;
+	struct list_head	bucket_node;
+
+	/* the tier holds 1, and each request serving it holds 1 */
+	int			refs;
+
+	size_t			length;
+	char			data[];
+};
+
+typedef struct {
+	struct list_head	lru_head;
+
+	/* entries indexed by item's address */
+	struct list_head	*buckets;
+	unsigned long		bucket_mask;
+
+	size_t			size;
+	long			entry_nr;
+
+	unsigned char		freqs[HOT_FREQ_SIZE];
+} fca_hot_t;
+
+int hot_init(fca_hot_t *hot);
+void hot_destroy(fca_hot_t *hot);
+
+fca_hot_entry_t *hot_get(fca_hot_t *hot, fca_item_t *item);
+void hot_put(fca_hot_entry_t *entry);
+
+int hot_admit(fca_hot_t *hot, fca_item_t *item, int admit_hits);
+void hot_age(fca_hot_t *hot);
+
+fca_hot_entry_t *hot_entry_alloc(size_t length);
+void hot_add(fca_hot_t *hot, fca_hot_entry_t *entry, fca_item_t *item,
+		size_t budget);
+void hot_remove(fca_hot_t *hot, fca_item_t *item);
+void hot_shrink(fca_hot_t *hot, size_t budget);
+
+#endif
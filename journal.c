@@ -0,0 +1,799 @@
+/*
+ * Journal of items of each device, for recovering after crash.
+ *
+ * Author: Wu Bingzheng
+ *
+ */
+
+#include "journal.h"
+
+/*
+ * Format of the journal region, [0, device_journal_size) of device:
+ *
+ *     half-0: fca_journal_header_t, padded to JOURNAL_HEADER_SIZE
+ *             fca_journal_record_t[item_nr], the checkpoint
+ *             fca_journal_record_t[], appended after the checkpoint
+ *     half-1: the same, for the next generation
+ *
+ * Generations take the two halves in turn, so the last checkpoint is
+ * kept until the next one is done. The header is written after the
+ * checkpoint, so a valid header means a complete checkpoint.
+ * Records are checksummed with the nonce of their checkpoint, and
+ * the appended ones are valid until the first bad one. So the
+ * records of an unfinished checkpoint are never taken.
+ */
+
+#define JOURNAL_MAGIC		0x214c4e524a414346L /* FCAJRNL! */
+#define JOURNAL_VERSION		1
+#define JOURNAL_HEADER_SIZE	4096
+#define JOURNAL_READ_SIZE	(1024 * 1024)
+#define JOURNAL_BUF_SIZE	(64 * 1024)
+
+#define JOURNAL_PUT		1
+#define JOURNAL_DELETE		2
+#define JOURNAL_CLEAR		3
+
+typedef struct {
+	uint64_t	magic;
+	uint32_t	version;
+	uint32_t	gen;
+	uint32_t	nonce;
+	uint32_t	items_checksum;
+	uint64_t	journal_size;
+	uint64_t	item_nr;
+	uint32_t	alloc;		/* DEVICE_ALLOC_xxx of the device */
+	uint32_t	checksum;
+} fca_journal_header_t;
+
+typedef struct {
+	uint64_t	offset;
+	unsigned char	id[HASH_ID_LEN];
+	uint32_t	length;
+	int32_t		expire;
+	uint32_t	nonce;
+	uint16_t	port;
+	uint16_t	headers_len;
+	uint8_t		type;
+	uint8_t		_pad[7];
+	uint32_t	checksum;
+} fca_journal_record_t;
+
+_Static_assert(sizeof(fca_journal_record_t) == 48, "fca_journal_record_t grows");
+
+static LIST_HEAD(journals);
+static pthread_mutex_t journals_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t journal_tid;
+static int journal_running = 0;
+static int journal_quit = 0;
+
+/* rounds of the journal thread. A record appended when the epoch
+ * is N is durable after the round N+1 finishes. */
+static unsigned long journal_epoch = 1;
+
+static char journal_zero_header[JOURNAL_HEADER_SIZE];
+
+
+/* FNV-1a */
+static uint32_t journal_checksum(uint32_t seed, const void *buf, size_t len)
+{
+	const unsigned char *p = buf;
+	uint32_t h = seed ^ 2166136261U;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		h ^= p[i];
+		h *= 16777619;
+	}
+	return h;
+}
+
+static inline size_t journal_half_size(void)
+{
+	return device_journal_size / 2;
+}
+
+static inline off_t journal_half_base(uint32_t gen)
+{
+	return (gen & 1) * journal_half_size();
+}
+
+static inline size_t journal_records_max(void)
+{
+	return (journal_half_size() - JOURNAL_HEADER_SIZE)
+		/ sizeof(fca_journal_record_t);
+}
+
+static void journal_record_item(fca_journal_record_t *rec, int type,
+		fca_item_t *item)
+{
+	bzero(rec, sizeof(fca_journal_record_t));
+	rec->type = type;
+	rec->port = server_of_item(item)->listen_port;
+	memcpy(rec->id, item->hnode.id, HASH_ID_LEN);
+	rec->offset = item->offset;
+	rec->length = item->length;
+	rec->expire = item->expire;
+	rec->headers_len = item->headers_len;
+}
+
+static void journal_record_seal(fca_journal_record_t *rec, uint32_t nonce)
+{
+	rec->nonce = nonce;
+	rec->checksum = journal_checksum(nonce, rec,
+			offsetof(fca_journal_record_t, checksum));
+}
+
+static int journal_record_check(fca_journal_record_t *rec, uint32_t nonce)
+{
+	return rec->nonce == nonce && rec->checksum == journal_checksum(nonce,
+			rec, offsetof(fca_journal_record_t, checksum));
+}
+
+static int journal_pwrite(fca_journal_t *j, const void *buf, size_t len,
+		off_t offset)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = pwrite(j->fd, buf, len, offset);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			log_error_run(errno, "write journal of device %s",
+					j->device->filename);
+			return FCA_ERROR;
+		}
+		buf = (const char *)buf + n;
+		len -= n;
+		offset += n;
+	}
+	return FCA_OK;
+}
+
+/* invalidate both checkpoints */
+static int journal_invalidate(fca_journal_t *j)
+{
+	if (journal_pwrite(j, journal_zero_header, JOURNAL_HEADER_SIZE,
+				journal_half_base(0)) != FCA_OK
+			|| journal_pwrite(j, journal_zero_header, JOURNAL_HEADER_SIZE,
+				journal_half_base(1)) != FCA_OK
+			|| fdatasync(j->fd) < 0) {
+		return FCA_ERROR;
+	}
+	return FCA_OK;
+}
+
+/* stop appending, until the next checkpoint succeeds. Both
+ * checkpoints are invalidated, so nothing is loaded if crash. */
+static void journal_break(fca_journal_t *j, const char *reason)
+{
+	pthread_mutex_lock(&j->lock);
+	j->broken = 1;
+	j->buf_len = 0;
+	pthread_mutex_unlock(&j->lock);
+
+	log_error_run(0, "journal of device %s is broken: %s",
+			j->device->filename, reason);
+
+	if (journal_invalidate(j) != FCA_OK) {
+		log_error_run(errno, "invalidate journal of device %s",
+				j->device->filename);
+	}
+}
+
+/* the caller should hold @j->lock */
+static void journal_append(fca_journal_t *j, fca_journal_record_t *rec)
+{
+	size_t size;
+	char *buf;
+
+	if (j->broken) {
+		return;
+	}
+
+	if (j->buf_len + sizeof(fca_journal_record_t) > j->buf_size) {
+		size = j->buf_size ? j->buf_size * 2 : JOURNAL_BUF_SIZE;
+		buf = size <= journal_half_size() ? realloc(j->buf, size) : NULL;
+		if (buf == NULL) {
+			/* the lost records are covered by the checkpoint */
+			j->checkpoint_pending = 1;
+			return;
+		}
+		j->buf = buf;
+		j->buf_size = size;
+	}
+
+	journal_record_seal(rec, j->nonce);
+	memcpy(j->buf + j->buf_len, rec, sizeof(fca_journal_record_t));
+	j->buf_len += sizeof(fca_journal_record_t);
+	j->records++;
+}
+
+/* @server module call this, when a PUT completes; and @device module
+ * when an item is moved. Return the epoch, after which the record
+ * is durable; or 0 if not journaled. */
+unsigned long journal_item_put(fca_item_t *item)
+{
+	fca_journal_t *j = device_of_item(item)->journal;
+	fca_journal_record_t rec;
+	unsigned long epoch = 0;
+
+	if (j == NULL || !server_of_item(item)->server_dump) {
+		return 0;
+	}
+
+	journal_record_item(&rec, JOURNAL_PUT, item);
+
+	pthread_mutex_lock(&j->lock);
+	if (!j->broken) {
+		journal_append(j, &rec);
+		epoch = __atomic_load_n(&journal_epoch, __ATOMIC_ACQUIRE);
+	}
+	pthread_mutex_unlock(&j->lock);
+	return epoch;
+}
+
+/* @server module call this, when delete an item. Return the epoch,
+ * after which the item's space could be reused; or 0 if at once. */
+unsigned long journal_item_delete(fca_item_t *item)
+{
+	fca_journal_t *j = device_of_item(item)->journal;
+	fca_journal_record_t rec;
+	unsigned long epoch = 0;
+
+	if (j == NULL) {
+		return 0;
+	}
+
+	journal_record_item(&rec, JOURNAL_DELETE, item);
+
+	pthread_mutex_lock(&j->lock);
+	if (!j->broken) {
+		journal_append(j, &rec);
+		epoch = __atomic_load_n(&journal_epoch, __ATOMIC_ACQUIRE);
+	}
+	pthread_mutex_unlock(&j->lock);
+	return epoch;
+}
+
+void journal_server_clear(fca_journal_t *j, unsigned short port)
+{
+	fca_journal_record_t rec;
+
+	bzero(&rec, sizeof(fca_journal_record_t));
+	rec.type = JOURNAL_CLEAR;
+	rec.port = port;
+
+	pthread_mutex_lock(&j->lock);
+	journal_append(j, &rec);
+	pthread_mutex_unlock(&j->lock);
+}
+
+int journal_durable(fca_journal_t *j, unsigned long epoch)
+{
+	return epoch < __atomic_load_n(&j->durable_epoch, __ATOMIC_ACQUIRE);
+}
+
+/* write the appended records */
+static void journal_flush(fca_journal_t *j)
+{
+	char *buf;
+	size_t len, size, room;
+	off_t offset, base;
+
+	pthread_mutex_lock(&j->lock);
+	if (j->broken || j->written < 0 || j->buf_len == 0) {
+		pthread_mutex_unlock(&j->lock);
+		return;
+	}
+
+	buf = j->buf;
+	size = j->buf_size;
+	len = j->buf_len;
+	offset = j->written;
+
+	j->buf = j->flush_buf;
+	j->buf_size = j->flush_buf_size;
+	j->buf_len = 0;
+	j->flush_buf = buf;
+	j->flush_buf_size = size;
+
+	base = journal_half_base(j->gen);
+	room = base + journal_half_size() - offset;
+	if (len > room) {
+		/* the lost records are covered by the checkpoint */
+		len = room;
+		j->checkpoint_pending = 1;
+	}
+	j->written += len;
+
+	/* compact it, if the appended records take too much */
+	if (j->written - base > journal_half_size() / 2) {
+		j->checkpoint_pending = 1;
+	}
+	pthread_mutex_unlock(&j->lock);
+
+	/* the items' bodies must be durable before their records */
+	if (fdatasync(j->fd) < 0) {
+		journal_break(j, "sync device");
+		return;
+	}
+	if (journal_pwrite(j, buf, len, offset) != FCA_OK) {
+		journal_break(j, "write records");
+		return;
+	}
+	if (fdatasync(j->fd) < 0) {
+		journal_break(j, "sync records");
+	}
+}
+
+static uint32_t journal_make_nonce(fca_journal_t *j, uint32_t gen)
+{
+	struct {
+		struct timespec	ts;
+		pid_t		pid;
+		uint32_t	gen;
+		void		*j;
+	} seed;
+
+	bzero(&seed, sizeof(seed));
+	clock_gettime(CLOCK_REALTIME, &seed.ts);
+	seed.pid = getpid();
+	seed.gen = gen;
+	seed.j = j;
+	return journal_checksum(0, &seed, sizeof(seed));
+}
+
+/* write all valid items of the device into the next half */
+static void journal_checkpoint(fca_journal_t *j)
+{
+	fca_device_t *device = j->device;
+	fca_journal_record_t *recs = NULL, *tmp;
+	fca_journal_header_t *header;
+	fca_free_block_t *fblock;
+	fca_item_t *item;
+	fca_server_t *s;
+	fca_pool_t *pool;
+	fca_handle_t h;
+	char header_buf[JOURNAL_HEADER_SIZE];
+	const char *reason = "NoMem";
+	size_t nr = 0, alloc = 0;
+	uint32_t gen, nonce;
+	off_t base;
+	time_t now = time(NULL);
+	int i;
+
+	/* records appended after this are for the new generation. The ones
+	 * in buffer are dropped, since they are covered by the checkpoint. */
+	pthread_mutex_lock(&j->lock);
+	gen = j->gen + 1;
+	nonce = journal_make_nonce(j, gen);
+	j->gen = gen;
+	j->nonce = nonce;
+	j->written = -1;
+	j->buf_len = 0;
+	j->broken = 0;
+	j->checkpoint_pending = 0;
+	pthread_mutex_unlock(&j->lock);
+
+	j->last_checkpoint = now;
+	base = journal_half_base(gen);
+
+	for (i = 0; i < master_nr; i++) {
+		pool = &item_pools[i];
+		server_shard_lock(i);
+		for (h = device->regions[i].order_head.first; h != 0;
+				h = ilist_next(pool, ITEM_ORDER_NODE, h)) {
+			fblock = pool_ptr(pool, h);
+			if (fblock->fblock) {
+				continue;
+			}
+			item = pool_ptr(pool, h);
+			if (item->putting || item->deleted || item->zombie
+					|| item->badblock || item->expire <= now) {
+				continue;
+			}
+			s = server_of_item(item);
+			if (s->deleted || !s->server_dump
+					|| item->clear != (s->clear & ITEM_CLEAR_MASK)) {
+				continue;
+			}
+
+			if (nr == alloc) {
+				alloc = alloc ? alloc * 2 : 1024;
+				tmp = realloc(recs, sizeof(fca_journal_record_t) * alloc);
+				if (tmp == NULL) {
+					server_shard_unlock(i);
+					goto fail;
+				}
+				recs = tmp;
+			}
+			journal_record_item(&recs[nr], JOURNAL_PUT, item);
+			journal_record_seal(&recs[nr], nonce);
+			nr++;
+		}
+		server_shard_unlock(i);
+	}
+
+	if (nr > journal_records_max()) {
+		reason = "too many items, increase device_journal_size";
+		goto fail;
+	}
+
+	bzero(header_buf, JOURNAL_HEADER_SIZE);
+	header = (fca_journal_header_t *)header_buf;
+	header->magic = JOURNAL_MAGIC;
+	header->version = JOURNAL_VERSION;
+	header->gen = gen;
+	header->nonce = nonce;
+	header->journal_size = device_journal_size;
+	header->item_nr = nr;
+	header->alloc = j->device->alloc;
+	header->items_checksum = journal_checksum(nonce, recs,
+			sizeof(fca_journal_record_t) * nr);
+	header->checksum = journal_checksum(0, header,
+			offsetof(fca_journal_header_t, checksum));
+
+	reason = "write checkpoint";
+	if (journal_pwrite(j, recs, sizeof(fca_journal_record_t) * nr,
+				base + JOURNAL_HEADER_SIZE) != FCA_OK
+			|| fdatasync(j->fd) < 0
+			|| journal_pwrite(j, header_buf, JOURNAL_HEADER_SIZE, base) != FCA_OK
+			|| fdatasync(j->fd) < 0) {
+		goto fail;
+	}
+	free(recs);
+
+	pthread_mutex_lock(&j->lock);
+	j->written = base + JOURNAL_HEADER_SIZE + sizeof(fca_journal_record_t) * nr;
+	pthread_mutex_unlock(&j->lock);
+
+	j->checkpoints++;
+	j->checkpoint_items = nr;
+	return;
+
+fail:
+	free(recs);
+	journal_break(j, reason);
+}
+
+static void journal_round(int final)
+{
+	struct list_head *p;
+	fca_journal_t *j;
+	unsigned long epoch;
+	time_t now = time(NULL);
+
+	epoch = __atomic_add_fetch(&journal_epoch, 1, __ATOMIC_ACQ_REL);
+
+	pthread_mutex_lock(&journals_lock);
+	list_for_each(p, &journals) {
+		j = list_entry(p, fca_journal_t, jnode);
+		if (j->device->deleted) {
+			continue;
+		}
+
+		journal_flush(j);
+
+		if (final || j->checkpoint_pending
+				|| now - j->last_checkpoint >= device_journal_checkpoint) {
+			journal_checkpoint(j);
+		}
+
+		__atomic_store_n(&j->durable_epoch, epoch, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&journals_lock);
+}
+
+static void *journal_thread(void *data)
+{
+	fca_timer_t timer;
+
+	timer_init(&timer);
+	thread_timer = &timer;
+
+	while (!__atomic_load_n(&journal_quit, __ATOMIC_ACQUIRE)) {
+		sleep(1);
+		timer_refresh(&timer);
+		journal_round(0);
+	}
+	return NULL;
+}
+
+void journal_start(void)
+{
+	if (device_journal_size == 0) {
+		return;
+	}
+	if (pthread_create(&journal_tid, NULL, journal_thread, NULL) != 0) {
+		log_error_run(errno, "create journal thread");
+		exit(1);
+	}
+	journal_running = 1;
+}
+
+/* stop the thread, and write the final checkpoints */
+void journal_stop(void)
+{
+	if (!journal_running) {
+		return;
+	}
+	__atomic_store_n(&journal_quit, 1, __ATOMIC_RELEASE);
+	pthread_join(journal_tid, NULL);
+	journal_running = 0;
+
+	journal_round(1);
+}
+
+fca_journal_t *journal_create(fca_device_t *device)
+{
+	fca_journal_t *j = calloc(1, sizeof(fca_journal_t));
+	if (j == NULL) {
+		return NULL;
+	}
+
+	j->fd = dup(device->fd);
+	if (j->fd < 0) {
+		free(j);
+		return NULL;
+	}
+	j->device = device;
+	j->written = -1;
+	j->checkpoint_pending = 1;
+	INIT_LIST_HEAD(&j->jnode);
+	pthread_mutex_init(&j->lock, NULL);
+	return j;
+}
+
+void journal_delete(fca_journal_t *j)
+{
+	pthread_mutex_lock(&journals_lock);
+	list_del(&j->jnode);
+	pthread_mutex_unlock(&journals_lock);
+
+	pthread_mutex_destroy(&j->lock);
+	close(j->fd);
+	free(j->buf);
+	free(j->flush_buf);
+	free(j);
+}
+
+static void journal_register(fca_journal_t *j)
+{
+	pthread_mutex_lock(&journals_lock);
+	list_add_tail(&j->jnode, &journals);
+	pthread_mutex_unlock(&journals_lock);
+}
+
+/* for a new device, or one whose journal is not loaded */
+void journal_reset(fca_journal_t *j)
+{
+	if (journal_invalidate(j) != FCA_OK) {
+		log_error_run(errno, "invalidate journal of device %s",
+				j->device->filename);
+	}
+	journal_register(j);
+}
+
+/* read the valid header of @half into @header */
+static int journal_read_header(fca_journal_t *j, int half,
+		fca_journal_header_t *header)
+{
+	if (pread(j->fd, header, sizeof(fca_journal_header_t),
+				journal_half_base(half)) != sizeof(fca_journal_header_t)) {
+		return FCA_ERROR;
+	}
+	if (header->magic != JOURNAL_MAGIC || header->version != JOURNAL_VERSION
+			|| header->journal_size != device_journal_size
+			|| header->alloc != j->device->alloc
+			|| header->checksum != journal_checksum(0, header,
+				offsetof(fca_journal_header_t, checksum))
+			|| (header->gen & 1) != half
+			|| header->item_nr > journal_records_max()) {
+		return FCA_ERROR;
+	}
+	return FCA_OK;
+}
+
+/* read the checkpoint and the appended records of @header */
+static fca_journal_record_t *journal_read_records(fca_journal_t *j,
+		fca_journal_header_t *header, size_t *nr_out)
+{
+	fca_journal_record_t *recs;
+	size_t i, nr, max = journal_records_max();
+	size_t chunk = JOURNAL_READ_SIZE / sizeof(fca_journal_record_t);
+	off_t offset = journal_half_base(header->gen) + JOURNAL_HEADER_SIZE;
+	ssize_t n;
+	uint32_t checksum;
+
+	recs = malloc(sizeof(fca_journal_record_t) * max);
+	if (recs == NULL) {
+		return NULL;
+	}
+
+	/* the checkpoint */
+	n = sizeof(fca_journal_record_t) * header->item_nr;
+	if (pread(j->fd, recs, n, offset) != n) {
+		goto fail;
+	}
+	checksum = journal_checksum(header->nonce, recs, n);
+	if (checksum != header->items_checksum) {
+		goto fail;
+	}
+
+	/* the appended records, until the first bad one */
+	nr = header->item_nr;
+	while (nr < max) {
+		if (chunk > max - nr) {
+			chunk = max - nr;
+		}
+		n = pread(j->fd, &recs[nr], sizeof(fca_journal_record_t) * chunk,
+				offset + sizeof(fca_journal_record_t) * nr);
+		if (n < (ssize_t)sizeof(fca_journal_record_t)) {
+			break;
+		}
+		n /= sizeof(fca_journal_record_t);
+		for (i = 0; i < n; i++) {
+			if (!journal_record_check(&recs[nr], header->nonce)) {
+				goto done;
+			}
+			nr++;
+		}
+	}
+
+done:
+	*nr_out = nr;
+	return recs;
+
+fail:
+	free(recs);
+	return NULL;
+}
+
+static int journal_record_id_cmp(const void *a, const void *b)
+{
+	fca_journal_record_t *ra = *(fca_journal_record_t **)a;
+	fca_journal_record_t *rb = *(fca_journal_record_t **)b;
+	int rc;
+
+	if (ra->port != rb->port) {
+		return ra->port < rb->port ? -1 : 1;
+	}
+	rc = memcmp(ra->id, rb->id, HASH_ID_LEN);
+	if (rc != 0) {
+		return rc;
+	}
+	/* keep the order of records */
+	return ra < rb ? -1 : (ra > rb);
+}
+
+static int journal_record_offset_cmp(const void *a, const void *b)
+{
+	fca_journal_record_t *ra = *(fca_journal_record_t **)a;
+	fca_journal_record_t *rb = *(fca_journal_record_t **)b;
+
+	return ra->offset < rb->offset ? -1 : (ra->offset > rb->offset);
+}
+
+/* replay @recs, and load the surviving items in order of offset */
+static void journal_replay(fca_journal_t *j, fca_journal_record_t *recs,
+		size_t nr)
+{
+	fca_journal_record_t **ptrs, *rec;
+	fca_format_item_t fm_item;
+	fca_format_batch_t batch;
+	fca_server_t *server;
+	size_t i, n = 0, live = 0;
+	time_t now = time(NULL);
+
+	/* index of the last CLEAR of each port, plus 1 */
+	size_t *clears = calloc(65536, sizeof(size_t));
+	ptrs = malloc(sizeof(fca_journal_record_t *) * nr);
+	if (clears == NULL || ptrs == NULL) {
+		goto out;
+	}
+
+	for (i = 0; i < nr; i++) {
+		rec = &recs[i];
+		if (rec->type == JOURNAL_CLEAR) {
+			clears[rec->port] = i + 1;
+		} else if (rec->type == JOURNAL_PUT || rec->type == JOURNAL_DELETE) {
+			ptrs[n++] = rec;
+		}
+	}
+
+	/* the last record of each item decides */
+	qsort(ptrs, n, sizeof(fca_journal_record_t *), journal_record_id_cmp);
+	for (i = 0; i < n; i++) {
+		rec = ptrs[i];
+		if (i + 1 < n && rec->port == ptrs[i+1]->port
+				&& memcmp(rec->id, ptrs[i+1]->id, HASH_ID_LEN) == 0) {
+			continue;
+		}
+		if (rec->type != JOURNAL_PUT || rec->expire <= now
+				|| rec - recs < clears[rec->port]) {
+			continue;
+		}
+		ptrs[live++] = rec;
+	}
+
+	/* device_cut_free_block() needs them in order of offset */
+	qsort(ptrs, live, sizeof(fca_journal_record_t *), journal_record_offset_cmp);
+	j->device->load_total = live;
+	format_batch_init(&batch, j->device);
+	for (i = 0; i < live; i++) {
+		rec = ptrs[i];
+		server = server_by_port(rec->port);
+		if (server == NULL) {
+			continue;
+		}
+
+		memset(fm_item.hash_id, 0, sizeof(fm_item.hash_id));
+		memcpy(fm_item.hash_id, rec->id, HASH_ID_LEN);
+		fm_item.offset = rec->offset;
+		fm_item.length = rec->length;
+		fm_item.expire = rec->expire;
+		fm_item.headers_len = rec->headers_len;
+		fm_item.server_index = server->index;
+		format_batch_add(&batch, server, &fm_item);
+	}
+	format_batch_flush(&batch);
+
+out:
+	free(clears);
+	free(ptrs);
+}
+
+/* load items from the newest valid checkpoint and the records after
+ * it. Return FCA_ERROR if no valid checkpoint. */
+int journal_load(fca_journal_t *j)
+{
+	fca_journal_header_t headers[2], *header;
+	fca_journal_record_t *recs;
+	int valid[2];
+	size_t nr;
+
+	valid[0] = journal_read_header(j, 0, &headers[0]) == FCA_OK;
+	valid[1] = journal_read_header(j, 1, &headers[1]) == FCA_OK;
+	if (!valid[0] && !valid[1]) {
+		return FCA_ERROR;
+	}
+	if (valid[0] && valid[1]) {
+		header = headers[0].gen > headers[1].gen ? &headers[0] : &headers[1];
+	} else {
+		header = valid[0] ? &headers[0] : &headers[1];
+	}
+
+	recs = journal_read_records(j, header, &nr);
+	if (recs == NULL) {
+		log_error_run(0, "bad journal checkpoint of device %s",
+				j->device->filename);
+		return FCA_ERROR;
+	}
+
+	journal_replay(j, recs, nr);
+	free(recs);
+
+	log_error_run(0, "replay journal of device %s, %ld items in checkpoint "
+			"and %ld records after", j->device->filename,
+			(long)header->item_nr, (long)(nr - header->item_nr));
+
+	/* the following records go after a new checkpoint, since there
+	 * may be stale records after the valid ones of this generation. */
+	j->gen = header->gen;
+	journal_register(j);
+	return FCA_OK;
+}
+
+void journal_status(FILE *filp, fca_journal_t *j)
+{
+	off_t written;
+
+	pthread_mutex_lock(&j->lock);
+	written = j->written < 0 ? 0 : j->written - journal_half_base(j->gen);
+	fprintf(filp, "%u %ld %ld %ld %ld %s", j->gen, written, j->records,
+			j->checkpoints, j->checkpoint_items,
+			j->broken ? "broken" : "ok");
+	pthread_mutex_unlock(&j->lock);
+}
@@ -0,0 +1,63 @@
+/*
+ * Journal of items of each device. PUT-complete and delete events
+ * are appended, and compacted checkpoints are written periodically,
+ * both by a background thread. So items are recovered after a crash,
+ * except the last few seconds.
+ *
+ * Author: Wu Bingzheng
+ *
+ */
+
+#ifndef _FCA_JOURNAL_H_
+#define _FCA_JOURNAL_H_
+
+#include "fcache.h"
+
+struct fca_journal_s {
+	fca_device_t		*device;
+	int			fd;
+	struct list_head	jnode;
+
+	/* protects the following, since records are appended by masters */
+	pthread_mutex_t		lock;
+	char			*buf;
+	size_t			buf_len;
+	size_t			buf_size;
+	uint32_t		gen;
+	uint32_t		nonce;
+	/* where @buf is written to. -1 if the checkpoint is in progress */
+	off_t			written;
+	unsigned		broken:1;
+	unsigned		checkpoint_pending:1;
+
+	/* records appended before it are durable. A journal is not
+	 * processed until its device is loaded, so it stays 0 till then. */
+	unsigned long		durable_epoch;
+
+	/* used by the journal thread only */
+	char			*flush_buf;
+	size_t			flush_buf_size;
+	time_t			last_checkpoint;
+
+	/* statistics */
+	long			records;
+	long			checkpoints;
+	long			checkpoint_items;
+};
+
+fca_journal_t *journal_create(fca_device_t *device);
+void journal_delete(fca_journal_t *j);
+
+int journal_load(fca_journal_t *j);
+void journal_reset(fca_journal_t *j);
+void journal_start(void);
+void journal_stop(void);
+
+unsigned long journal_item_put(fca_item_t *item);
+unsigned long journal_item_delete(fca_item_t *item);
+void journal_server_clear(fca_journal_t *j, unsigned short port);
+int journal_durable(fca_journal_t *j, unsigned long epoch);
+
+void journal_status(FILE *filp, fca_journal_t *j);
+
+#endif
@@ -0,0 +1,373 @@
+/*
+ * Access logs written by a background thread, see logger.h.
+ *
+ * Author: Wu Bingzheng
+ *
+ */
+
+#include "logger.h"
+
+/* the logger thread writes the buffers at this interval */
+#define LOGGER_FLUSH_USEC	10000
+
+/* closed loggers are freed after this, when masters do not put
+ * records into them any more */
+#define LOGGER_CLOSE_DELAY	2
+
+/* a request in the buffer, followed by its strings */
+typedef struct {
+	uint32_t	size;		/* in the buffer, aligned to 8 */
+	uint32_t	padding;	/* 1 if it fills the end of buffer */
+	time_t		time;
+	long		msec;
+	struct in_addr	client;
+	int		http_code;
+	int		method;
+	int		error_number;
+	/* string literals, so the pointers are kept */
+	const char	*error_reason;
+	const char	*step;
+	/* uri, host, fca_key and range, each ends with '\0' */
+	char		strs[];
+} fca_logger_record_t;
+
+#define LOGGER_STRS	4
+
+static LIST_HEAD(loggers);
+static pthread_mutex_t loggers_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t logger_tid;
+static int logger_running = 0;
+static int logger_quit = 0;
+
+static void logger_free(fca_logger_t *l)
+{
+	int i;
+
+	if (l->filp) {
+		fclose(l->filp);
+	}
+	if (l->reopen_filp) {
+		fclose(l->reopen_filp);
+	}
+	for (i = 0; i < MASTERS_LIMIT; i++) {
+		free(l->buffers[i]);
+	}
+	free(l);
+}
+
+/* in the format before the logger, so tools parsing the log work */
+static void logger_write(FILE *fp, fca_logger_record_t *rec, fca_timer_t *timer)
+{
+	char *strs[LOGGER_STRS];
+	int i;
+
+	strs[0] = rec->strs;
+	for (i = 1; i < LOGGER_STRS; i++) {
+		strs[i] = strs[i - 1] + strlen(strs[i - 1]) + 1;
+	}
+
+	if (timer->now != rec->time) {
+		timer->now = rec->time;
+		timer->format_log[0] = '\0';
+	}
+
+	fprintf(fp, "%s %s %d %ld %s%s %s %s %s",
+		timer_format_log(timer),
+		inet_ntoa(rec->client),
+		rec->http_code,
+		rec->msec,
+		http_methods[rec->method].str.base,
+		strs[0], strs[1], strs[2], strs[3]);
+
+	if (rec->error_reason) {
+		if (rec->http_code == 204) {
+			fprintf(fp, " [%s]\n", rec->error_reason);
+
+		} else if (rec->error_number) {
+			fprintf(fp, " [%s(%s) while %s]\n", rec->error_reason,
+				strerror(rec->error_number), rec->step);
+		} else {
+			fprintf(fp, " [%s while %s]\n",
+				rec->error_reason, rec->step);
+		}
+	} else {
+		fputs("\n", fp);
+	}
+}
+
+/* write the records in @b. return the number */
+static long logger_flush_buffer(fca_logger_t *l, fca_logger_buffer_t *b,
+		fca_timer_t *timer)
+{
+	fca_logger_record_t *rec;
+	unsigned long head = b->head;
+	unsigned long tail = __atomic_load_n(&b->tail, __ATOMIC_ACQUIRE);
+	long n = 0;
+
+	while (head != tail) {
+		rec = (fca_logger_record_t *)(b->data + (head & (LOGGER_BUFFER_SIZE - 1)));
+		if (!rec->padding) {
+			logger_write(l->filp, rec, timer);
+			n++;
+		}
+		head += rec->size;
+	}
+
+	__atomic_store_n(&b->head, head, __ATOMIC_RELEASE);
+	return n;
+}
+
+/* The records are written out of @loggers_lock, which the masters
+ * take, so a slow disk does not stall them. Only this thread deletes
+ * loggers from the list, so @l is kept while being written. */
+static void logger_round(fca_timer_t *timer, int final)
+{
+	struct list_head *p;
+	fca_logger_t *l;
+	FILE *filp;
+	time_t now = time(NULL), closed;
+	long n;
+	int i;
+
+	pthread_mutex_lock(&loggers_lock);
+	p = loggers.next;
+	pthread_mutex_unlock(&loggers_lock);
+
+	while (p != &loggers) {
+		l = list_entry(p, fca_logger_t, lnode);
+
+		n = 0;
+		for (i = 0; i < master_nr; i++) {
+			n += logger_flush_buffer(l, l->buffers[i], timer);
+		}
+		if (n != 0) {
+			fflush(l->filp);
+			l->records += n;
+		}
+
+		/* the records before 'reopen' are in the old file */
+		filp = __atomic_exchange_n(&l->reopen_filp, NULL, __ATOMIC_ACQ_REL);
+		if (filp != NULL) {
+			fclose(l->filp);
+			l->filp = filp;
+		}
+
+		pthread_mutex_lock(&loggers_lock);
+		p = p->next;
+		closed = l->closed;
+		if (closed != 0 && (final || now - closed >= LOGGER_CLOSE_DELAY)) {
+			list_del(&l->lnode);
+		} else {
+			closed = 0;
+		}
+		pthread_mutex_unlock(&loggers_lock);
+
+		if (closed != 0) {
+			logger_free(l);
+		}
+	}
+}
+
+static void *logger_thread(void *data)
+{
+	fca_timer_t timer;
+
+	timer_init(&timer);
+	thread_timer = &timer;
+
+	while (!__atomic_load_n(&logger_quit, __ATOMIC_ACQUIRE)) {
+		usleep(LOGGER_FLUSH_USEC);
+		logger_round(&timer, 0);
+	}
+	return NULL;
+}
+
+/* open the log file. The logger thread is started at the first time. */
+fca_logger_t *logger_open(const char *path)
+{
+	fca_logger_t *l;
+	int i, err;
+
+	l = calloc(1, sizeof(fca_logger_t));
+	if (l == NULL) {
+		return NULL;
+	}
+	INIT_LIST_HEAD(&l->lnode);
+	strcpy(l->path, path);
+
+	l->filp = fopen(path, "a");
+	if (l->filp == NULL) {
+		goto fail;
+	}
+
+	for (i = 0; i < master_nr; i++) {
+		l->buffers[i] = malloc(sizeof(fca_logger_buffer_t));
+		if (l->buffers[i] == NULL) {
+			goto fail;
+		}
+		l->buffers[i]->head = 0;
+		l->buffers[i]->tail = 0;
+		l->buffers[i]->drops = 0;
+	}
+
+	if (!logger_running) {
+		if (pthread_create(&logger_tid, NULL, logger_thread, NULL) != 0) {
+			goto fail;
+		}
+		logger_running = 1;
+	}
+
+	pthread_mutex_lock(&loggers_lock);
+	list_add_tail(&l->lnode, &loggers);
+	pthread_mutex_unlock(&loggers_lock);
+	return l;
+
+fail:
+	err = errno;
+	logger_free(l);
+	errno = err;
+	return NULL;
+}
+
+/* the logger thread writes the remaining records, and frees it later */
+void logger_close(fca_logger_t *l)
+{
+	pthread_mutex_lock(&loggers_lock);
+	l->closed = time(NULL);
+	pthread_mutex_unlock(&loggers_lock);
+}
+
+/* put a record of @r into the master's buffer, or drop it if full.
+ * Called in master threads. */
+void logger_request(fca_logger_t *l, fca_request_t *r, time_t now)
+{
+	fca_logger_buffer_t *b = l->buffers[master_index];
+	fca_logger_record_t *rec;
+	unsigned long tail = b->tail;
+	char *strs[LOGGER_STRS], *q;
+	size_t lens[LOGGER_STRS], size, pos, pad;
+	int i;
+
+	strs[0] = strshow(&r->uri);
+	strs[1] = strshow(&r->host);
+	strs[2] = strshow(&r->fca_key);
+	strs[3] = strshow(&r->range);
+
+	size = sizeof(fca_logger_record_t);
+	for (i = 0; i < LOGGER_STRS; i++) {
+		lens[i] = strlen(strs[i]) + 1;
+		size += lens[i];
+	}
+	size = (size + 7) & ~7UL;
+
+	/* a record does not wrap, so fill the end of buffer if short */
+	pos = tail & (LOGGER_BUFFER_SIZE - 1);
+	pad = (pos + size > LOGGER_BUFFER_SIZE) ? LOGGER_BUFFER_SIZE - pos : 0;
+
+	if (tail + pad + size - __atomic_load_n(&b->head, __ATOMIC_ACQUIRE)
+			> LOGGER_BUFFER_SIZE) {
+		b->drops++;
+		return;
+	}
+
+	if (pad != 0) {
+		rec = (fca_logger_record_t *)(b->data + pos);
+		rec->size = pad;
+		rec->padding = 1;
+		tail += pad;
+		pos = 0;
+	}
+
+	rec = (fca_logger_record_t *)(b->data + pos);
+	rec->size = size;
+	rec->padding = 0;
+	rec->time = timer_now(&master_timer);
+	rec->msec = (now - r->start_time) / 1000;
+	rec->client = r->client.sin_addr;
+	rec->http_code = r->http_code;
+	rec->method = r->method;
+	rec->error_number = r->error_number;
+	rec->error_reason = r->error_reason;
+	rec->step = r->step;
+
+	q = rec->strs;
+	for (i = 0; i < LOGGER_STRS; i++) {
+		memcpy(q, strs[i], lens[i]);
+		q += lens[i];
+	}
+
+	__atomic_store_n(&b->tail, tail + size, __ATOMIC_RELEASE);
+}
+
+/* reopen the log files by their paths, after they are moved away
+ * for rotation. The logger thread switches to them soon. */
+int logger_reopen(void)
+{
+	struct list_head *p;
+	fca_logger_t *l;
+	FILE *filp;
+	int rc = FCA_OK;
+
+	pthread_mutex_lock(&loggers_lock);
+	list_for_each(p, &loggers) {
+		l = list_entry(p, fca_logger_t, lnode);
+		if (l->closed != 0) {
+			continue;
+		}
+
+		filp = fopen(l->path, "a");
+		if (filp == NULL) {
+			log_error_admin(errno, "reopen log %s", l->path);
+			rc = FCA_ERROR;
+			continue;
+		}
+
+		/* taken by the logger thread, out of the lock */
+		filp = __atomic_exchange_n(&l->reopen_filp, filp, __ATOMIC_ACQ_REL);
+		if (filp != NULL) {
+			fclose(filp);
+		}
+	}
+	pthread_mutex_unlock(&loggers_lock);
+	return rc;
+}
+
+/* stop the thread, and write the remaining records */
+void logger_stop(void)
+{
+	fca_timer_t timer;
+
+	if (!logger_running) {
+		return;
+	}
+	__atomic_store_n(&logger_quit, 1, __ATOMIC_RELEASE);
+	pthread_join(logger_tid, NULL);
+	logger_running = 0;
+
+	timer_init(&timer);
+	logger_round(&timer, 1);
+}
+
+void logger_status(FILE *filp)
+{
+	struct list_head *p;
+	fca_logger_t *l;
+	long drops;
+	int i;
+
+	fputs("\n* access_log records drops\n", filp);
+
+	pthread_mutex_lock(&loggers_lock);
+	list_for_each(p, &loggers) {
+		l = list_entry(p, fca_logger_t, lnode);
+		if (l->closed != 0) {
+			continue;
+		}
+		drops = 0;
+		for (i = 0; i < master_nr; i++) {
+			drops += l->buffers[i]->drops;
+		}
+		fprintf(filp, "** %s %ld %ld\n", l->path, l->records, drops);
+	}
+	pthread_mutex_unlock(&loggers_lock);
+}
@@ -0,0 +1,61 @@
+/*
+ * Access logs, written by a background thread. Master threads put
+ * raw records of requests into their own lock-free buffers, and the
+ * logger thread formats and writes them, so a slow disk never stalls
+ * the masters. Records are dropped and counted if the buffer is full.
+ *
+ * Author: Wu Bingzheng
+ *
+ */
+
+#ifndef _FCA_LOGGER_H_
+#define _FCA_LOGGER_H_
+
+#include "fcache.h"
+
+/* bytes of records of each master thread, a power of 2 */
+#define LOGGER_BUFFER_SIZE	(1024 * 1024)
+
+/* for one master thread to put, and the logger thread to write.
+ * Records are in variable sizes, see fca_logger_record_t. */
+typedef struct {
+	/* logger thread side */
+	unsigned long		head;
+	char			_pad1[RING_CACHE_LINE - sizeof(unsigned long)];
+
+	/* master thread side */
+	unsigned long		tail;
+	long			drops;
+	char			_pad2[RING_CACHE_LINE - 2 * sizeof(unsigned long)];
+
+	char			data[LOGGER_BUFFER_SIZE];
+} fca_logger_buffer_t;
+
+struct fca_logger_s {
+	struct list_head	lnode;
+	char			path[PATH_LENGTH];
+
+	/* by the logger thread */
+	FILE			*filp;
+	long			records;
+
+	/* opened by 'reopen' of admin port, and taken by the logger
+	 * thread after writing the records before, both by atomic
+	 * exchange */
+	FILE			*reopen_filp;
+
+	/* freed by the logger thread a while after closed, since
+	 * masters may be still putting records */
+	time_t			closed;
+
+	fca_logger_buffer_t	*buffers[MASTERS_LIMIT];
+};
+
+fca_logger_t *logger_open(const char *path);
+void logger_close(fca_logger_t *l);
+void logger_request(fca_logger_t *l, fca_request_t *r, time_t now);
+int logger_reopen(void);
+void logger_stop(void);
+void logger_status(FILE *filp);
+
+#endif
@@ -0,0 +1,258 @@
+/*
+ * Metrics of requests, exported in Prometheus text format.
+ *
+ * Latencies are in HDR-style histograms, whose buckets are linear
+ * inside each power of 2, so small and large latencies are both in
+ * the same relative precision. They are exported at the bounds of
+ * powers of 2 only, which are the same set at every scrape, as
+ * Prometheus needs, and not too many.
+ *
+ * Author: Wu Bingzheng
+ *
+ */
+
+#include "fcache.h"
+
+#define METRICS_SUB_COUNT	(1 << METRICS_SUB_BITS)
+
+#define METRICS_REQUESTS	0
+#define METRICS_INPUT_BYTES	1
+#define METRICS_OUTPUT_BYTES	2
+#define METRICS_FIRST_BYTE	3
+#define METRICS_TOTAL		4
+#define METRICS_PHASE		5
+#define METRICS_FAMILIES	6
+
+static struct {
+	const char	*name;
+	const char	*type;
+	const char	*help;
+} metrics_families[METRICS_FAMILIES] = {
+	{ "fcache_requests_total", "counter",
+		"Requests finished." },
+	{ "fcache_input_bytes_total", "counter",
+		"Bytes received of requests." },
+	{ "fcache_output_bytes_total", "counter",
+		"Bytes sent of responses." },
+	{ "fcache_first_byte_seconds", "histogram",
+		"Time from the request arriving to the first byte of response." },
+	{ "fcache_request_seconds", "histogram",
+		"Time from the request arriving to the request finished." },
+	{ "fcache_phase_seconds", "histogram",
+		"Time in each phase of requests." },
+};
+
+static const char *metrics_kind_names[METRICS_KINDS] = {
+	"get_hit", "get_miss", "put", "delete"
+};
+
+const char *metrics_phase_names[METRICS_PHASES] = {
+	"accept", "header", "lookup", "queue", "process", "send"
+};
+
+/* bucket of @us microseconds. The bucket @i holds (bound(i-1), bound(i)] */
+static int metrics_bucket(time_t us)
+{
+	unsigned long v = us > 0 ? us - 1 : 0;
+	int shift, i;
+
+	if (v < METRICS_SUB_COUNT) {
+		return v;
+	}
+	shift = 63 - __builtin_clzl(v) - METRICS_SUB_BITS;
+	i = ((shift + 1) << METRICS_SUB_BITS) + (v >> shift) - METRICS_SUB_COUNT;
+	return i < METRICS_BUCKETS ? i : METRICS_BUCKETS - 1;
+}
+
+/* the upper bound of bucket @i in microseconds, inclusive */
+static unsigned long metrics_bucket_bound(int i)
+{
+	int shift;
+
+	if (i < METRICS_SUB_COUNT) {
+		return i + 1;
+	}
+	shift = (i >> METRICS_SUB_BITS) - 1;
+	return (unsigned long)((i & (METRICS_SUB_COUNT - 1))
+			+ METRICS_SUB_COUNT + 1) << shift;
+}
+
+static void metrics_histogram_add(fca_histogram_t *h, time_t us)
+{
+	if (us < 0) {
+		us = 0;
+	}
+	h->counts[metrics_bucket(us)]++;
+	h->sum_us += us;
+}
+
+/* return METRICS_xxx of the finished request, or -1 if none */
+int metrics_kind(fca_request_t *r)
+{
+	switch (r->method) {
+	case FCA_HTTP_METHOD_GET:
+	case FCA_HTTP_METHOD_HEAD:
+		return r->item != NULL ? METRICS_GET_HIT : METRICS_GET_MISS;
+	case FCA_HTTP_METHOD_PUT:
+	case FCA_HTTP_METHOD_POST:
+		return METRICS_PUT;
+	case FCA_HTTP_METHOD_PURGE:
+	case FCA_HTTP_METHOD_DELETE:
+		return METRICS_DELETE;
+	default:
+		return -1;
+	}
+}
+
+/* durations of METRICS_PHASE_xxx of the request finished at @now.
+ * A phase not reached takes no time, e.g. queue of a miss. */
+void metrics_phases(fca_request_t *r, time_t now, time_t *phases)
+{
+	time_t stamps[METRICS_PHASES + 1] = {
+		r->accept_time ? r->accept_time : r->start_time,
+		r->start_time, r->header_time, r->dispatch_time,
+		r->pickup_time, r->first_byte_time, now
+	};
+	time_t last = stamps[0];
+	int i;
+
+	for (i = 0; i < METRICS_PHASES; i++) {
+		if (stamps[i + 1] < last) { /* 0, or not in order */
+			stamps[i + 1] = last;
+		}
+		phases[i] = stamps[i + 1] - last;
+		last = stamps[i + 1];
+	}
+}
+
+/* record the finished request @r, at @now by timer_clock_us() */
+void metrics_record(fca_metrics_t *m, fca_request_t *r, int kind, time_t now)
+{
+	fca_metrics_kind_t *k = &m->kinds[kind];
+	time_t phases[METRICS_PHASES];
+	int i;
+
+	k->requests++;
+	k->input_bytes += r->input_size;
+	k->output_bytes += r->output_size;
+	if (r->first_byte_time != 0) {
+		metrics_histogram_add(&k->first_byte,
+				r->first_byte_time - r->start_time);
+	}
+	metrics_histogram_add(&k->total, now - r->start_time);
+
+	metrics_phases(r, now, phases);
+	for (i = 0; i < METRICS_PHASES; i++) {
+		metrics_histogram_add(&k->phases[i], phases[i]);
+	}
+}
+
+static void metrics_histogram_merge(fca_histogram_t *total, fca_histogram_t *h)
+{
+	int i;
+	for (i = 0; i < METRICS_BUCKETS; i++) {
+		total->counts[i] += h->counts[i];
+	}
+	total->sum_us += h->sum_us;
+}
+
+/* merge the @n metrics of master threads into @total */
+void metrics_merge(fca_metrics_t *total, fca_metrics_t *m, int n)
+{
+	fca_metrics_kind_t *t, *k;
+	int i, j, p;
+
+	bzero(total, sizeof(fca_metrics_t));
+	for (i = 0; i < n; i++) {
+		for (j = 0; j < METRICS_KINDS; j++) {
+			t = &total->kinds[j];
+			k = &m[i].kinds[j];
+			t->requests += k->requests;
+			t->input_bytes += k->input_bytes;
+			t->output_bytes += k->output_bytes;
+			metrics_histogram_merge(&t->first_byte, &k->first_byte);
+			metrics_histogram_merge(&t->total, &k->total);
+			for (p = 0; p < METRICS_PHASES; p++) {
+				metrics_histogram_merge(&t->phases[p], &k->phases[p]);
+			}
+		}
+	}
+}
+
+static void metrics_print_histogram(FILE *filp, const char *name,
+		const char *labels, fca_histogram_t *h)
+{
+	unsigned long count = 0, bound;
+	int i;
+
+	for (i = 0; i < METRICS_BUCKETS; i++) {
+		count += h->counts[i];
+		if ((i & (METRICS_SUB_COUNT - 1)) != METRICS_SUB_COUNT - 1) {
+			continue;
+		}
+		bound = metrics_bucket_bound(i);
+		fprintf(filp, "%s_bucket{%s,le=\"%lu.%06lu\"} %lu\n", name, labels,
+				bound / 1000000, bound % 1000000, count);
+	}
+	fprintf(filp, "%s_bucket{%s,le=\"+Inf\"} %lu\n", name, labels, count);
+	fprintf(filp, "%s_sum{%s} %lu.%06lu\n", name, labels,
+			h->sum_us / 1000000, h->sum_us % 1000000);
+	fprintf(filp, "%s_count{%s} %lu\n", name, labels, count);
+}
+
+/* print @family of metrics @m, with @labels as 'server="8535"' */
+void metrics_print(FILE *filp, int family, const char *labels, fca_metrics_t *m)
+{
+	const char *name = metrics_families[family].name;
+	fca_metrics_kind_t *k;
+	char kind_labels[PATH_LENGTH * 2 + 100];
+	char phase_labels[PATH_LENGTH * 2 + 150];
+	int i, p;
+
+	for (i = 0; i < METRICS_KINDS; i++) {
+		k = &m->kinds[i];
+		snprintf(kind_labels, sizeof(kind_labels), "%s,kind=\"%s\"",
+				labels, metrics_kind_names[i]);
+
+		switch (family) {
+		case METRICS_REQUESTS:
+			fprintf(filp, "%s{%s} %lu\n", name, kind_labels, k->requests);
+			break;
+		case METRICS_INPUT_BYTES:
+			fprintf(filp, "%s{%s} %lu\n", name, kind_labels, k->input_bytes);
+			break;
+		case METRICS_OUTPUT_BYTES:
+			fprintf(filp, "%s{%s} %lu\n", name, kind_labels, k->output_bytes);
+			break;
+		case METRICS_FIRST_BYTE:
+			metrics_print_histogram(filp, name, kind_labels, &k->first_byte);
+			break;
+		case METRICS_TOTAL:
+			metrics_print_histogram(filp, name, kind_labels, &k->total);
+			break;
+		case METRICS_PHASE:
+			for (p = 0; p < METRICS_PHASES; p++) {
+				snprintf(phase_labels, sizeof(phase_labels),
+						"%s,phase=\"%s\"", kind_labels,
+						metrics_phase_names[p]);
+				metrics_print_histogram(filp, name, phase_labels,
+						&k->phases[p]);
+			}
+			break;
+		}
+	}
+}
+
+/* print all metrics of servers and devices */
+void metrics_exposition(FILE *filp)
+{
+	int i;
+
+	for (i = 0; i < METRICS_FAMILIES; i++) {
+		fprintf(filp, "# HELP %s %s\n# TYPE %s %s\n",
+				metrics_families[i].name, metrics_families[i].help,
+				metrics_families[i].name, metrics_families[i].type);
+		server_metrics(filp, i);
+		device_metrics(filp, i);
+	}
+}
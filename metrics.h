@@ -0,0 +1,69 @@
+/*
+ * Metrics of requests, exported in Prometheus text format by
+ * 'GET /metrics' on the admin port.
+ *
+ * Each master thread has its own metrics of each server and device,
+ * so no lock. They are merged when exported.
+ *
+ * Author: Wu Bingzheng
+ *
+ */
+
+#ifndef _FCA_METRICS_H_
+#define _FCA_METRICS_H_
+
+#include <stdio.h>
+#include <time.h>
+
+typedef struct fca_request_s fca_request_t;
+
+#define METRICS_GET_HIT		0
+#define METRICS_GET_MISS	1
+#define METRICS_PUT		2
+#define METRICS_DELETE		3
+#define METRICS_KINDS		4
+
+/* between the timestamps of requests, see fca_request_t */
+#define METRICS_PHASE_ACCEPT	0 /* accepted -> received */
+#define METRICS_PHASE_HEADER	1 /* received -> header parsed */
+#define METRICS_PHASE_LOOKUP	2 /* header parsed -> dispatched */
+#define METRICS_PHASE_QUEUE	3 /* dispatched -> received by worker */
+#define METRICS_PHASE_PROCESS	4 /* received by worker -> first byte sent */
+#define METRICS_PHASE_SEND	5 /* first byte sent -> finished */
+#define METRICS_PHASES		6
+
+/* HDR-style buckets in microseconds: 2^METRICS_SUB_BITS linear
+ * sub-buckets in each power of 2, so the error is less than 25%,
+ * up to 2^33 us (about 2.4 hours). */
+#define METRICS_SUB_BITS	2
+#define METRICS_BUCKETS		(32 << METRICS_SUB_BITS)
+
+typedef struct {
+	unsigned long	counts[METRICS_BUCKETS];
+	unsigned long	sum_us;
+} fca_histogram_t;
+
+typedef struct {
+	unsigned long	requests;
+	unsigned long	input_bytes;
+	unsigned long	output_bytes;
+	/* time to first byte, only of requests sending something */
+	fca_histogram_t	first_byte;
+	fca_histogram_t	total;
+	fca_histogram_t	phases[METRICS_PHASES];
+} fca_metrics_kind_t;
+
+typedef struct {
+	fca_metrics_kind_t	kinds[METRICS_KINDS];
+} fca_metrics_t;
+
+extern const char *metrics_phase_names[METRICS_PHASES];
+
+int metrics_kind(fca_request_t *r);
+void metrics_phases(fca_request_t *r, time_t now, time_t *phases);
+void metrics_record(fca_metrics_t *m, fca_request_t *r, int kind, time_t now);
+void metrics_merge(fca_metrics_t *total, fca_metrics_t *m, int n);
+void metrics_print(FILE *filp, int family, const char *labels, fca_metrics_t *m);
+void metrics_exposition(FILE *filp);
+
+#endif
@@ -5,12 +5,15 @@
  *
  */
 
-#define _XOPEN_SOURCE 500 /* for pwrite */
+#define _GNU_SOURCE /* for pwrite and splice */
 #include "request.h"
 
-static int connections_total = 0;
+/* of the current master thread */
+static __thread int connections_total = 0;
 
 static void request_read_request_header(fca_request_t *r);
+static void request_put_read_request_body(fca_request_t *r);
+static void request_finalize(fca_request_t *r);
 
 static inline void request_cork_set(fca_request_t *r)
 {
@@ -36,8 +39,23 @@ static void request_reset(fca_request_t *r)
 	r->cork = 0;
 	r->range_set = 0;
 	r->disk_error = 0;
+	r->disk_writing = 0;
+	r->hot_admit = 0;
+	r->combine_waiting = 0;
+	r->hash_set = 0;
+	r->combine_pending = 0;
+	r->body_buf = NULL;
+	r->direct_buf = NULL;
+	r->direct_len = 0;
+	r->hot = NULL;
+	r->hot_fill = NULL;
 	r->output_size = 0;
 	r->input_size = 0;
+	r->accept_time = 0;
+	r->header_time = 0;
+	r->dispatch_time = 0;
+	r->pickup_time = 0;
+	r->first_byte_time = 0;
 	r->event_handler = NULL;
 	r->method = FCA_HTTP_METHOD_INVALID;
 	r->uri.base = NULL;
@@ -55,6 +73,14 @@ static void request_reset(fca_request_t *r)
 	/* other members will be set later */
 }
 
+static inline void request_output(fca_request_t *r, ssize_t length)
+{
+	if (r->output_size == 0) {
+		r->first_byte_time = timer_clock_us();
+	}
+	r->output_size += length;
+}
+
 /* Send a short buffer at the beginning of response. so we assume
  * that the socket sndbuf is empty and there is no block.
  * If blocked, in case, we do not record the breakpoint, and
@@ -76,7 +102,61 @@ interupted:
 		return FCA_ERROR;
 	}
 
-	r->output_size += rc;
+	request_output(r, rc);
+	return FCA_OK;
+}
+
+/* send from the block cache, for devices in direct IO mode.
+ * Return FCA_DECLINE if no block to use, and sendfile() instead. */
+static int request_send_block(fca_request_t *r, off_t start, off_t length)
+{
+	fca_device_t *device = device_of_item(r->item);
+	fca_bcache_block_t *block;
+	fca_bcache_t *bc = device->bcache;
+	ssize_t rc, n;
+	off_t off;
+
+	while (r->process_size < (size_t)length) {
+		off = start + r->process_size;
+		block = bcache_get(bc, device->direct_fd, off, r->item_freq);
+		if (block == NULL) {
+			if (errno == EBUSY || errno == ENOMEM) {
+				return FCA_DECLINE;
+			}
+			r->disk_error = 1;
+			log_error_run(errno, "read block server:%d, "
+					"device:%s, off:%ld",
+					r->server->listen_port, device->filename, off);
+			r->error_reason = "ReadDiskError";
+			r->error_number = errno;
+			return FCA_ERROR;
+		}
+
+		n = block->offset + block->len - off;
+		if (n > length - (off_t)r->process_size) {
+			n = length - r->process_size;
+		}
+interupted:
+		/* more blocks follow, no partial frame by Nagle */
+		rc = send(r->sock_fd, block->data + (off - block->offset), n,
+				off + n < start + length ? MSG_MORE : 0);
+		if (rc == -1 && errno == EINTR) {
+			goto interupted;
+		}
+		bcache_put(bc, block);
+		if (rc == -1) {
+			if (errno == EAGAIN) {
+				return FCA_AGAIN;
+			}
+			r->connection_broken = 1;
+			r->error_reason = "SendError";
+			r->error_number = errno;
+			return FCA_ERROR;
+		}
+
+		request_output(r, rc);
+		r->process_size += rc;
+	}
 	return FCA_OK;
 }
 
@@ -86,6 +166,13 @@ static int request_send_file(fca_request_t *r, off_t start, off_t length)
 	off_t off;
 	fca_device_t *device = device_of_item(r->item);
 
+	if (device->direct) {
+		rc = request_send_block(r, start, length);
+		if (rc != FCA_DECLINE) {
+			return rc;
+		}
+	}
+
 	off = start + r->process_size;
 interupted:
 	rc = sendfile(r->sock_fd, device->fd, &off, length - r->process_size);
@@ -111,12 +198,117 @@ interupted:
 		return FCA_ERROR;
 	}
 
-	r->output_size += rc;
+	request_output(r, rc);
 	r->process_size += rc;
 	return (length == r->process_size) ? FCA_OK : FCA_AGAIN;
 }
 
 
+static int request_write_disk_error(fca_request_t *r, off_t length,
+		ssize_t rc, int err)
+{
+	fca_device_t *device = device_of_item(r->item);
+
+	log_error_run(err, "pwrite, server:%d, device:%s, "
+			"off:%ld, len:%ld, ret:%ld",
+			r->server->listen_port, device->filename,
+			r->item->offset + r->process_size, length, rc);
+	r->http_code = 500;
+	r->disk_error = 1;
+	r->error_reason = "WriteDiskError";
+	r->error_number = err;
+	return FCA_ERROR;
+}
+
+/* completion of asynchronous write */
+static void request_put_write_disk_done(fca_request_t *r)
+{
+	if (r->io_result != r->io_length) {
+		request_write_disk_error(r, r->io_length, r->io_result,
+				r->io_result < 0 ? -r->io_result : 0);
+		request_finalize(r);
+		return;
+	}
+
+	r->process_size += r->io_length;
+	request_put_read_request_body(r);
+}
+
+/* write the buffered data of direct IO, padded to BCACHE_ALIGN */
+static int request_write_direct_flush(fca_request_t *r)
+{
+	fca_item_t *item = r->item;
+	fca_device_t *device = device_of_item(item);
+	fca_bcache_t *bc = device->bcache;
+	size_t len = (r->direct_len + BCACHE_ALIGN - 1) & ~(BCACHE_ALIGN - 1);
+	off_t offset = item->offset + r->process_size - r->direct_len;
+	ssize_t rc;
+
+	bzero(r->direct_buf + r->direct_len, len - r->direct_len);
+
+	/* after writing, so the blocks read by other workers meanwhile
+	 * are dropped too */
+	rc = pwrite(device->direct_fd, r->direct_buf, len, offset);
+	bcache_invalidate(bc, offset, len);
+	if (rc != (ssize_t)len) {
+		r->process_size -= r->direct_len;
+		return request_write_disk_error(r, len, rc, errno);
+	}
+	r->direct_len = 0;
+	return FCA_OK;
+}
+
+/* write by O_DIRECT, which needs aligned buffer, offset and length.
+ * So the data is gathered in @r->direct_buf, and flushed when it is
+ * full or the item is finished. The padding at the end is in the
+ * item's space, whose size is in units of EXTENT_UNIT. */
+static int request_write_direct(fca_request_t *r, char *buffer, off_t length)
+{
+	fca_item_t *item = r->item;
+	fca_device_t *device = device_of_item(item);
+	size_t size, n;
+	ssize_t rc;
+
+	/* not aligned, from the free blocks of old layout */
+	if (item->offset & (BCACHE_ALIGN - 1)) {
+		rc = pwrite(device->fd, buffer, length, item->offset + r->process_size);
+		bcache_invalidate(device->bcache, item->offset + r->process_size,
+				length);
+		if (rc != length) {
+			return request_write_disk_error(r, length, rc, errno);
+		}
+		r->process_size += length;
+		return FCA_OK;
+	}
+
+	size = item->length < REQ_DIRECT_BUF_SIZE ? item->length : REQ_DIRECT_BUF_SIZE;
+	size = (size + BCACHE_ALIGN - 1) & ~(BCACHE_ALIGN - 1);
+	if (r->direct_buf == NULL && posix_memalign((void **)&r->direct_buf,
+				BCACHE_ALIGN, size) != 0) {
+		r->direct_buf = NULL;
+		return request_write_disk_error(r, length, -1, ENOMEM);
+	}
+
+	while (length > 0) {
+		n = size - r->direct_len;
+		if (n > (size_t)length) {
+			n = length;
+		}
+		memcpy(r->direct_buf + r->direct_len, buffer, n);
+		r->direct_len += n;
+		r->process_size += n;
+		buffer += n;
+		length -= n;
+
+		if ((r->direct_len == size || r->process_size == item->length)
+				&& request_write_direct_flush(r) != FCA_OK) {
+			return FCA_ERROR;
+		}
+	}
+	return FCA_OK;
+}
+
+/* return FCA_AGAIN if the write is in flight asynchronously */
 static int request_write_disk(fca_request_t *r, char *buffer, off_t length)
 {
 	fca_item_t *item = r->item;
@@ -130,17 +322,29 @@ static int request_write_disk(fca_request_t *r, char *buffer, off_t length)
 	}
 
 	device = device_of_item(item);
+
+	if (device->direct) {
+		return request_write_direct(r, buffer, length);
+	}
+
+	rc = worker_disk_combine(r, device->fd, buffer, length,
+			item->offset + r->process_size);
+	if (rc == FCA_OK) {
+		goto out;
+	}
+
+	if (buffer == r->body_buf) {
+		rc = worker_disk_write(r, device->fd, buffer, length,
+				item->offset + r->process_size,
+				request_put_write_disk_done);
+		if (rc == FCA_OK) {
+			return FCA_AGAIN;
+		}
+	}
+
 	rc = pwrite(device->fd, buffer, length, item->offset + r->process_size);
 	if (rc != length) {
-		log_error_run(errno, "pwrite, server:%d, device:%s, "
-				"off:%ld, len:%ld, ret:%ld",
-				r->server->listen_port, device->filename,
-				item->offset + r->process_size, length, rc);
-		r->http_code = 500;
-		r->disk_error = 1;
-		r->error_reason = "WriteDiskError";
-		r->error_number = errno;
-		return FCA_ERROR;
+		return request_write_disk_error(r, length, rc, errno);
 	}
 
 out:
@@ -148,41 +352,67 @@ out:
 	return FCA_OK;
 }
 
+/* log the phases of slow request, with the item's place */
+static void request_slow_log(fca_request_t *r, FILE *fp, time_t now)
+{
+	time_t phases[METRICS_PHASES];
+	fca_item_t *item = r->item;
+	int i;
+
+	metrics_phases(r, now, phases);
+
+	flockfile(fp);
+
+	fprintf(fp, "%s %s %d %s%s %.3f |",
+		timer_format_log(&master_timer),
+		inet_ntoa(r->client.sin_addr), r->http_code,
+		http_methods[r->method].str.base, strshow(&r->uri),
+		(now - r->start_time) / 1000.0);
+	for (i = 0; i < METRICS_PHASES; i++) {
+		fprintf(fp, " %s %.3f", metrics_phase_names[i], phases[i] / 1000.0);
+	}
+	fprintf(fp, " | %s", r->step);
+	if (item != NULL) {
+		fprintf(fp, " %s %lu %u", device_of_item(item)->filename,
+				(unsigned long)item->offset, item->length);
+	}
+	fprintf(fp, " %lu %lu\n", r->input_size, r->output_size);
+
+	funlockfile(fp);
+}
+
 static void request_do_finalize(fca_request_t *r)
 {
 	fca_server_t *s = r->server;
-	FILE *fp = s->access_filp;
+	time_t now = timer_clock_us();
+	FILE *slow_filp;
+	int kind;
+
+	/* before the item is released, with the device */
+	if (r->active && (kind = metrics_kind(r)) >= 0) {
+		metrics_record(&s->metrics[master_index], r, kind, now);
+		if (r->item != NULL) {
+			metrics_record(&device_of_item(r->item)->metrics[master_index],
+					r, kind, now);
+		}
+	}
+	/* read once, since reload may replace it */
+	slow_filp = __atomic_load_n(&s->slow_filp, __ATOMIC_ACQUIRE);
+	if (r->active && slow_filp != NULL
+			&& now - r->start_time >= (time_t)s->slow_log_threshold * 1000) {
+		request_slow_log(r, slow_filp, now);
+	}
+	if (r->active && s->trace != NULL) {
+		trace_request(s->trace, r, now);
+	}
 
 	server_request_finalize(r);
-	s->output_size_current_period += r->output_size;
-	s->input_size_current_period += r->input_size;
+	__sync_fetch_and_add(&s->output_size_current_period, r->output_size);
+	__sync_fetch_and_add(&s->input_size_current_period, r->input_size);
 
-	/* log */
+	/* log, written by the logger thread */
 	if (r->active) {
-		
-		fprintf(fp, "%s %s %d %ld %s%s %s %s %s",
-			timer_format_log(&master_timer),
-			inet_ntoa(r->client.sin_addr),
-			r->http_code,
-			timer_now_ms(&master_timer) - r->start_time,
-			http_methods[r->method].str.base,
-			strshow(&r->uri), strshow(&r->host),
-			strshow(&r->fca_key), strshow(&r->range));
-
-		if (r->error_reason) {
-			if (r->http_code == 204) {
-				fprintf(fp, " [%s]\n", r->error_reason);
-
-			} else if (r->error_number) {
-				fprintf(fp, " [%s(%s) while %s]\n", r->error_reason,
-					strerror(r->error_number), r->step);
-			} else {
-				fprintf(fp, " [%s while %s]\n",
-					r->error_reason, r->step);
-			}
-		} else {
-			fputs("\n", fp);
-		}
+		logger_request(s->access_logger, r, now);
 	}
 
 	if (r->keepalive && !r->connection_broken) {
@@ -192,15 +422,67 @@ static void request_do_finalize(fca_request_t *r)
 	}
 
 	list_del(&r->rnode);
-	s->connections--;
+	__sync_fetch_and_sub(&s->connections, 1);
 	connections_total--;
 	event_del(r);
 	close(r->sock_fd);
 	slab_free(r);
 }
 
+/* advise the page cache by the finished request, in worker */
+static void request_advise(fca_request_t *r)
+{
+	fca_item_t *item = r->item;
+	fca_device_t *device;
+	fca_advise_t *a;
+
+	if (item == NULL || r->disk_error || r->connection_broken) {
+		return;
+	}
+	device = device_of_item(item);
+	if (device->direct) {
+		return;
+	}
+	a = &r->worker_thread->advise;
+
+	switch (r->method) {
+	case FCA_HTTP_METHOD_GET:
+		if (r->range_set) {
+			if (r->http_code == 206) {
+				advise_range(a, device->fd, item, r->range_start,
+						r->range_end, timer_now(thread_timer));
+			}
+		} else if (r->process_size == item->length) {
+			advise_get(a, device->fd, item, timer_now(thread_timer));
+		}
+		break;
+
+	case FCA_HTTP_METHOD_PUT:
+	case FCA_HTTP_METHOD_POST:
+		if (r->process_size == item->length) {
+			advise_put(a, device->fd, item, r->item_freq,
+					timer_now(thread_timer));
+		}
+		break;
+
+	default:
+		;
+	}
+}
+
 static void request_finalize(fca_request_t *r)
 {
+	/* wait for the combined writes flushed, before visible */
+	if (r->worker_thread && worker_disk_combine_wait(r,
+				request_finalize) == FCA_OK) {
+		return;
+	}
+
+	free(r->body_buf);
+	r->body_buf = NULL;
+	free(r->direct_buf);
+	r->direct_buf = NULL;
+
 	if (!r->connection_broken && r->output_size == 0) {
 		/* don't check @request_send_buffer's return, for simple.*/
 		string_t *page = http_code_page(r->http_code);
@@ -208,6 +490,7 @@ static void request_finalize(fca_request_t *r)
 	}
 
 	if (r->worker_thread) {
+		request_advise(r);
 		worker_request_return(r, request_do_finalize);
 	} else {
 		request_do_finalize(r);
@@ -218,11 +501,22 @@ static void request_put_read_request_body(fca_request_t *r)
 {
 	ssize_t rc;
 #define RECV_BUF_SIZE (100*1024)
-	char buf[RECV_BUF_SIZE];
+	char stack_buf[RECV_BUF_SIZE];
+	char *buf = stack_buf;
 	size_t item_len = r->content_length + r->put_header_length;
 
 	r->step = "ReadBody";
 
+	/* the buffer of asynchronous write must live until completion */
+	if (r->item != NULL && device_io_uring) {
+		if (r->body_buf == NULL) {
+			r->body_buf = malloc(RECV_BUF_SIZE);
+		}
+		if (r->body_buf != NULL) {
+			buf = r->body_buf;
+		}
+	}
+
 	/* receive from socket, and write into disk file */
 	while (r->process_size < item_len) {
 
@@ -258,6 +552,9 @@ static void request_put_read_request_body(fca_request_t *r)
 		if (rc == FCA_ERROR) {
 			goto finish;
 		}
+		if (rc == FCA_AGAIN) {
+			return;
+		}
 	}
 
 finish:
@@ -270,6 +567,81 @@ again:
 }
 
 
+/* move body from socket into device through the worker's pipe by
+ * splice(), without copying into userspace. */
+static void request_put_splice_request_body(fca_request_t *r)
+{
+	fca_item_t *item = r->item;
+	fca_device_t *device = device_of_item(item);
+	size_t item_len = r->content_length + r->put_header_length;
+	int *pipe_fds = r->worker_thread->splice_fds;
+	ssize_t rc, n;
+	loff_t off;
+	int avail;
+
+	r->step = "SpliceBody";
+
+	while (r->process_size < item_len) {
+
+		/* bytes over the body are an error, as in the recv() path */
+		if (ioctl(r->sock_fd, FIONREAD, &avail) == 0
+				&& (size_t)avail > item_len - r->process_size) {
+			r->error_reason = "BodyLargerThanDeclared";
+			r->http_code = 400;
+			r->keepalive = 0;
+			goto finish;
+		}
+
+		/* socket -> pipe. The pipe is empty here. */
+		rc = splice(r->sock_fd, NULL, pipe_fds[1], NULL,
+				item_len - r->process_size,
+				SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if (rc == -1) {
+			if (errno == EAGAIN) {
+				goto again;
+			} else if (errno == EINTR) {
+				continue;
+			} else {
+				r->error_reason = "ReceiveError";
+				r->error_number = errno;
+				r->connection_broken = 1;
+				goto finish;
+			}
+		}
+		if (rc == 0) {
+			r->error_reason = "ClientClose";
+			r->connection_broken = 1;
+			goto finish;
+		}
+		r->input_size += rc;
+
+		/* pipe -> device, drain the pipe */
+		while (rc > 0) {
+			off = item->offset + r->process_size;
+			n = splice(pipe_fds[0], NULL, device->fd, &off, rc,
+					SPLICE_F_MOVE);
+			if (n <= 0) {
+				if (n == -1 && errno == EINTR) {
+					continue;
+				}
+				request_write_disk_error(r, rc, n, errno);
+				worker_splice_pipe_close(r->worker_thread);
+				goto finish;
+			}
+			r->process_size += n;
+			rc -= n;
+		}
+	}
+
+finish:
+	request_finalize(r);
+	return;
+
+again:
+	event_add_read(r, request_put_splice_request_body);
+	return;
+}
+
 static void request_put_read_request_body_preread(fca_request_t *r)
 {
 	ssize_t len;
@@ -293,7 +665,51 @@ static void request_put_read_request_body_preread(fca_request_t *r)
 		return;
 	}
 
-	request_put_read_request_body(r);
+	/* only the pre-read bytes above are written by buffer */
+	if (r->item != NULL && device_splice
+			&& !device_of_item(r->item)->direct
+			&& worker_splice_pipe(r->worker_thread) != NULL) {
+		request_put_splice_request_body(r);
+	} else {
+		request_put_read_request_body(r);
+	}
+}
+
+/* read from the device, through the block cache in direct IO mode */
+static ssize_t request_read_disk(fca_request_t *r, void *buf, size_t len,
+		off_t offset)
+{
+	fca_device_t *device = device_of_item(r->item);
+	ssize_t rc;
+
+	if (device->direct) {
+		rc = bcache_read(device->bcache, device->direct_fd, buf, len,
+				offset, r->item_freq);
+		if (rc >= 0 || (errno != EBUSY && errno != ENOMEM)) {
+			return rc;
+		}
+	}
+	return pread(device->fd, buf, len, offset);
+}
+
+/* copy the item into a new entry, which is added into the RAM tier
+ * in server_request_finalize(). It's just read by sendfile, so in the
+ * page cache probably. */
+static void request_get_hot_fill(fca_request_t *r)
+{
+	fca_item_t *item = r->item;
+	fca_hot_entry_t *entry;
+
+	entry = hot_entry_alloc(item->length);
+	if (entry == NULL) {
+		return;
+	}
+	if (request_read_disk(r, entry->data, item->length,
+				item->offset) != item->length) {
+		hot_put(entry);
+		return;
+	}
+	r->hot_fill = entry;
 }
 
 static void request_get_write_response(fca_request_t *r)
@@ -308,9 +724,51 @@ static void request_get_write_response(fca_request_t *r)
 
 	if (rc == FCA_AGAIN) {
 		event_add_write(r, request_get_write_response);
-	} else { /* rc == FCA_OK || rc == FCA_ERROR */
+		return;
+	}
+
+	/* rc == FCA_OK || rc == FCA_ERROR */
+	if (rc == FCA_OK && r->hot_admit) {
+		request_get_hot_fill(r);
+	}
+	request_finalize(r);
+}
+
+/* serve from the RAM tier, in master thread */
+static void request_get_write_response_hot(fca_request_t *r)
+{
+	fca_hot_entry_t *entry = r->hot;
+	size_t length = (r->method == FCA_HTTP_METHOD_HEAD)
+			? r->item->headers_len : entry->length;
+	ssize_t rc;
+
+	r->step = "WriteResponseRAM";
+
+interupted:
+	rc = send(r->sock_fd, entry->data + r->process_size,
+			length - r->process_size, 0);
+	if (rc == -1) {
+		if (errno == EAGAIN) {
+			event_add_write(r, request_get_write_response_hot);
+			return;
+		}
+		if (errno == EINTR) {
+			goto interupted;
+		}
+		r->connection_broken = 1;
+		r->error_reason = "SendError";
+		r->error_number = errno;
 		request_finalize(r);
+		return;
+	}
+
+	request_output(r, rc);
+	r->process_size += rc;
+	if (r->process_size < length) {
+		event_add_write(r, request_get_write_response_hot);
+		return;
 	}
+	request_finalize(r);
 }
 
 static void request_get_write_response_206_body(fca_request_t *r)
@@ -435,7 +893,7 @@ interupted:
 
 	if (!r->active) {
 		r->active = 1;
-		r->start_time = timer_now_ms(&master_timer);
+		r->start_time = timer_clock_us();
 	}
 
 	/* http parse */
@@ -456,6 +914,7 @@ interupted:
 	}
 
 	/* rc == FCA_DONE, parse ok */
+	r->header_time = timer_clock_us();
 
 	switch(r->method) {
 	case FCA_HTTP_METHOD_GET:
@@ -466,6 +925,12 @@ interupted:
 			goto fail;
 		}
 
+		if (r->hot != NULL) {
+			r->http_code = 200;
+			request_get_write_response_hot(r);
+			break;
+		}
+
 		if (r->range_set) {
 			r->http_code = 206;
 			rc = worker_request_dispatch(r, request_get_write_response_206_header_mem);
@@ -535,7 +1000,7 @@ fail:
 /* entry of request process, called when receive a new request */
 void request_process_entry(fca_server_t *s, int sock_fd, struct sockaddr_in *client)
 {
-	static fca_slab_t request_slab = FCA_SLAB_INIT(fca_request_t);
+	static __thread fca_slab_t request_slab = FCA_SLAB_INIT(fca_request_t);
 
 	fca_request_t *r;
 
@@ -553,15 +1018,17 @@ void request_process_entry(fca_server_t *s, int sock_fd, struct sockaddr_in *cli
 	}
 
 	list_add(&r->rnode, &master_requests);
-	s->connections++;
+	__sync_fetch_and_add(&s->connections, 1);
 	connections_total++;
 
 	r->server = s;
+	r->master_index = master_index;
 	r->sock_fd = sock_fd;
 	r->client = *client;
 
 	r->events = 0;
 	request_reset(r);
+	r->accept_time = timer_clock_us();
 
 	request_read_request_header(r);
 }
@@ -586,6 +1053,11 @@ void request_clean(struct list_head *requests, int keepalive_only)
 			continue;
 		}
 
+		/* wait for the completion of disk write */
+		if (r->disk_writing || r->combine_waiting) {
+			continue;
+		}
+
 		if (r->event_handler != request_finalize) {
 			r->connection_broken = 1;
 			r->error_reason = "CleanByQuitTimeout";
@@ -11,6 +11,7 @@
 #include "fcache.h"
 
 #define REQ_BUF_SIZE	4096
+#define REQ_DIRECT_BUF_SIZE	(256*1024)
 /* a request, include its downstream connection */
 struct fca_request_s {
 	fca_server_t	*server;
@@ -19,6 +20,9 @@ struct fca_request_s {
 
 	fca_worker_t	*worker_thread;
 
+	/* the master thread which accepts the connection */
+	int		master_index;
+
 	unsigned	events:2;
 	unsigned	keepalive:1;
 	unsigned	active:1;
@@ -26,6 +30,10 @@ struct fca_request_s {
 	unsigned	cork:1;
 	unsigned	range_set:1;
 	unsigned	disk_error:1;
+	unsigned	disk_writing:1;
+	unsigned	hot_admit:1;
+	unsigned	combine_waiting:1;
+	unsigned	hash_set:1;
 
 	/* request line and headers */
 	int		method;
@@ -42,12 +50,42 @@ struct fca_request_s {
 	int		put_header_length;
 	time_t		expire;
 
-	time_t		start_time;
+	/* phases of the request, by timer_clock_us(). 0 if not reached,
+	 * and @accept_time is 0 in keepalive requests. */
+	time_t		accept_time;
+	time_t		start_time;	/* first bytes of request received */
+	time_t		header_time;	/* request header parsed */
+	time_t		dispatch_time;	/* dispatched to worker */
+	time_t		pickup_time;	/* received by worker */
+	time_t		first_byte_time; /* first byte of response sent */
 
 	/* in GET, record sendfile process size;
 	 * in PUT, record recv item process size. */
 	size_t		process_size;
 
+	/* in PUT with io_uring, buffer of the asynchronous write */
+	char		*body_buf;
+	ssize_t		io_length;
+	ssize_t		io_result;
+
+	/* in PUT with write-combining, batches holding our writes */
+	int		combine_pending;
+
+	/* in PUT with direct IO, aligned buffer of the writes */
+	char		*direct_buf;
+	size_t		direct_len;
+
+	/* frequency of the item by the admission filter */
+	int		item_freq;
+
+	/* of the key, set by server module if @hash_set */
+	unsigned char	hash_id[16];
+
+	/* in GET, the RAM tier entry serving it, or a new entry
+	 * filled by the worker thread for the RAM tier */
+	fca_hot_entry_t	*hot;
+	fca_hot_entry_t	*hot_fill;
+
 	size_t		output_size;
 	size_t		input_size;
 
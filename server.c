@@ -9,12 +9,51 @@
 #include "server.h"
 
 
-static fca_slab_t item_slab = FCA_SLAB_INIT(fca_item_t);
-
 static LIST_HEAD(servers);
 static LIST_HEAD(deleted_servers);
 
-static LIST_HEAD(shared_lru_head);
+_Static_assert(sizeof(fca_item_t) == 48, "fca_item_t grows");
+
+/* use counts of items over ITEM_USED_MAX. It's rare, so a list is enough. */
+typedef struct {
+	fca_item_t		*item;
+	long			count;
+	struct list_head	node;
+} fca_used_overflow_t;
+
+/* slow log files replaced by reload are closed after this, when
+ * masters do not write them any more */
+#define SERVER_SLOW_CLOSE_DELAY	2
+
+typedef struct {
+	FILE			*filp;
+	time_t			closed;
+	struct list_head	node;
+} fca_slow_closed_t;
+
+static LIST_HEAD(slow_closed_files);
+
+/* a key deleted or stored while devices are loading */
+typedef struct {
+	fca_hash_node_t		hnode;
+	fca_handle_t		next;
+} fca_tomb_t;
+
+/* things in the same shard of all servers */
+typedef struct {
+	pthread_mutex_t		lock;
+	/* items of servers whose capacity is 0, always by LRU */
+	fca_evict_t		shared_evict;
+	struct list_head	used_overflows;
+	/* zombie items, linked by lru_node */
+	fca_ilist_head_t	zombie_head;
+	/* tombs of servers' shards */
+	fca_pool_t		tomb_pool;
+} fca_shard_t;
+
+static fca_shard_t shards[MASTERS_LIMIT];
+
+fca_pool_t item_pools[MASTERS_LIMIT];
 
 /* this makes things complicated, but it's useful for saving
  * memory, in fca_item_t. */
@@ -25,6 +64,16 @@ fca_server_t *server_of_item(fca_item_t *item)
 	return idx_pointer_get(&server_indexs, item->server_index);
 }
 
+void server_shard_lock(int shard)
+{
+	pthread_mutex_lock(&shards[shard].lock);
+}
+
+void server_shard_unlock(int shard)
+{
+	pthread_mutex_unlock(&shards[shard].lock);
+}
+
 void server_dump_ports(unsigned short *ports)
 {
 	struct list_head *p;
@@ -39,46 +88,63 @@ void server_dump_ports(unsigned short *ports)
 
 static void server_listen_close(fca_server_t *s)
 {
-	epoll_del(master_epoll_fd, s->listen_fd);
-	close(s->listen_fd);
+	int i;
+	for (i = 0; i < master_nr; i++) {
+		epoll_del(master_epoll_fds[i], s->listen_fds[i]);
+		close(s->listen_fds[i]);
+		s->listen_fds[i] = -1;
+	}
 }
 
+/* each master thread listens on its own socket */
 static int server_listen_start(fca_server_t *s)
 {
-	tcp_listen(s->listen_fd);
-	return epoll_add_read(master_epoll_fd, s->listen_fd,
-			(void *)((uintptr_t)s | EVENT_TYPE_LISTEN));
+	int i;
+	for (i = 0; i < master_nr; i++) {
+		tcp_listen(s->listen_fds[i]);
+		if (epoll_add_read(master_epoll_fds[i], s->listen_fds[i],
+				(void *)((uintptr_t)s | EVENT_TYPE_LISTEN)) < 0) {
+			return -1;
+		}
+	}
+	return 0;
 }
 
 /* we don't check their return values */
 static void server_listen_set(fca_server_t *s)
 {
-	if (s->sndbuf != 0) {
-		set_sndbuf(s->listen_fd, s->sndbuf);
-	}
-	if (s->rcvbuf != 0) {
-		set_rcvbuf(s->listen_fd, s->rcvbuf);
-	}
-	if (s->request_timeout != 60) {
-		set_defer_accept(s->listen_fd, s->request_timeout);
+	int i;
+	for (i = 0; i < master_nr; i++) {
+		if (s->sndbuf != 0) {
+			set_sndbuf(s->listen_fds[i], s->sndbuf);
+		}
+		if (s->rcvbuf != 0) {
+			set_rcvbuf(s->listen_fds[i], s->rcvbuf);
+		}
+		if (s->request_timeout != 60) {
+			set_defer_accept(s->listen_fds[i], s->request_timeout);
+		}
 	}
 }
 
 /* we don't check their return values */
 static void server_listen_update(fca_server_t *s, fca_server_t *conf_server)
 {
-	if (conf_server->sndbuf != s->sndbuf) {
-		set_sndbuf(s->listen_fd, conf_server->sndbuf);
-		s->sndbuf = conf_server->sndbuf;
-	}
-	if (conf_server->rcvbuf != s->rcvbuf) {
-		set_rcvbuf(s->listen_fd, conf_server->rcvbuf);
-		s->rcvbuf = conf_server->rcvbuf;
-	}
-	if (conf_server->request_timeout != s->request_timeout) {
-		set_defer_accept(s->listen_fd, conf_server->request_timeout);
-		s->request_timeout = conf_server->request_timeout;
+	int i;
+	for (i = 0; i < master_nr; i++) {
+		if (conf_server->sndbuf != s->sndbuf) {
+			set_sndbuf(s->listen_fds[i], conf_server->sndbuf);
+		}
+		if (conf_server->rcvbuf != s->rcvbuf) {
+			set_rcvbuf(s->listen_fds[i], conf_server->rcvbuf);
+		}
+		if (conf_server->request_timeout != s->request_timeout) {
+			set_defer_accept(s->listen_fds[i], conf_server->request_timeout);
+		}
 	}
+	s->sndbuf = conf_server->sndbuf;
+	s->rcvbuf = conf_server->rcvbuf;
+	s->request_timeout = conf_server->request_timeout;
 }
 
 
@@ -87,13 +153,19 @@ static void server_listen_update(fca_server_t *s, fca_server_t *conf_server)
  * the new server */
 static void server_create(fca_server_t *conf_server)
 {
+	int i;
+
 	list_del(&conf_server->snode);
 	list_add_tail(&conf_server->snode, &servers);
 
-	server_listen_start(conf_server);
-	server_listen_set(conf_server);
-	INIT_LIST_HEAD(&conf_server->lru_head);
-	INIT_LIST_HEAD(&conf_server->passby_lru_head);
+	if (!fca_simulate) {
+		server_listen_start(conf_server);
+		server_listen_set(conf_server);
+	}
+	for (i = 0; i < master_nr; i++) {
+		evict_init(&conf_server->shards[i].evict, &item_pools[i],
+				conf_server->evict_policy);
+	}
 	conf_server->index = idx_pointer_add(&server_indexs, conf_server);
 
 	/* other fields were set to zero, when malloc the conf_server */
@@ -109,23 +181,80 @@ static void server_delete(fca_server_t *s)
 	list_add(&s->snode, &deleted_servers);
 }
 
+/* close @filp later, since other masters may be writing it */
+static void server_slow_close(FILE *filp)
+{
+	fca_slow_closed_t *c = malloc(sizeof(fca_slow_closed_t));
+	if (c == NULL) {
+		return; /* leave it open, rather than close it too early */
+	}
+	c->filp = filp;
+	c->closed = timer_now(&master_timer);
+	list_add_tail(&c->node, &slow_closed_files);
+}
+
+static void server_slow_close_release(time_t now)
+{
+	struct list_head *p, *safep;
+	fca_slow_closed_t *c;
+
+	list_for_each_safe(p, safep, &slow_closed_files) {
+		c = list_entry(p, fca_slow_closed_t, node);
+		if (now - c->closed < SERVER_SLOW_CLOSE_DELAY) {
+			break;
+		}
+		fclose(c->filp);
+		list_del(&c->node);
+		free(c);
+	}
+}
+
 /* update a server by @conf_server */
 static void server_update(fca_server_t *s, fca_server_t *conf_server)
 {
+	int i;
+
 	/* make in order */
 	list_del(&s->snode);
 	list_add_tail(&s->snode, &servers);
 
-	if (conf_server->access_filp) {
-		fclose(s->access_filp);
-		s->access_filp = conf_server->access_filp;
+	if (conf_server->access_logger) {
+		logger_close(s->access_logger);
+		s->access_logger = conf_server->access_logger;
 		strcpy(s->access_log, conf_server->access_log);
 	}
+	if (strcmp(s->slow_log, conf_server->slow_log)) {
+		if (s->slow_filp) {
+			server_slow_close(s->slow_filp);
+		}
+		__atomic_store_n(&s->slow_filp, conf_server->slow_filp, __ATOMIC_RELEASE);
+		strcpy(s->slow_log, conf_server->slow_log);
+	}
+	s->slow_log_threshold = conf_server->slow_log_threshold;
+	if (strcmp(s->trace_log, conf_server->trace_log)) {
+		if (s->trace) {
+			trace_close(s->trace);
+		}
+		s->trace = conf_server->trace;
+		strcpy(s->trace_log, conf_server->trace_log);
+	}
+	s->trace_log_sample = conf_server->trace_log_sample;
 
 	s->capacity = conf_server->capacity;
+	if (s->evict_policy != conf_server->evict_policy) {
+		s->evict_policy = conf_server->evict_policy;
+		for (i = 0; i < master_nr; i++) {
+			server_shard_lock(i);
+			evict_switch(&s->shards[i].evict, s->evict_policy);
+			server_shard_unlock(i);
+		}
+	}
 	s->send_timeout = conf_server->send_timeout;
 	s->recv_timeout = conf_server->recv_timeout;
 	s->item_max_size = conf_server->item_max_size;
+	s->ram_capacity = conf_server->ram_capacity;
+	s->ram_item_max_size = conf_server->ram_item_max_size;
+	s->ram_admit_hits = conf_server->ram_admit_hits;
 	s->passby_enable = conf_server->passby_enable;
 	s->passby_begin_item_nr = conf_server->passby_begin_item_nr;
 	s->passby_begin_consumed = conf_server->passby_begin_consumed;
@@ -176,7 +305,7 @@ int server_conf_check(fca_conf_t *conf_cycle)
 	struct list_head *p;
 	fca_server_t *s, *s2;
 	const char *msg;
-	int count = 0;
+	int count = 0, i;
 
 	if (list_empty(&conf_cycle->servers)) {
 		log_error_admin(0, "you must set at least 1 server");
@@ -231,26 +360,68 @@ int server_conf_check(fca_conf_t *conf_cycle)
 				goto fail;
 			}
 
-			s->listen_fd = tcp_bind(s->listen_port);
-			if (s->listen_fd < 0) {
-				msg = "error in bind port";
+			s->metrics = calloc(master_nr, sizeof(fca_metrics_t));
+			if (s->metrics == NULL) {
+				msg = "no mem when init metrics";
 				goto fail;
 			}
 
-			s->hash = hash_init();
-			if (s->hash == NULL) {
-				msg = "no mem when init hash";
-				goto fail;
+			for (i = 0; i < master_nr; i++) {
+				if (!fca_simulate) {
+					s->listen_fds[i] = tcp_bind(s->listen_port, master_nr > 1);
+					if (s->listen_fds[i] < 0) {
+						msg = "error in bind port";
+						goto fail;
+					}
+				}
+
+				s->shards[i].hash = hash_init(&item_pools[i]);
+				if (s->shards[i].hash == NULL) {
+					msg = "no mem when init hash";
+					goto fail;
+				}
+
+				if (hot_init(&s->shards[i].hot) != FCA_OK) {
+					msg = "no mem when init RAM tier";
+					goto fail;
+				}
 			}
 		}
 
+		/* no logs in simulation */
+		if (fca_simulate) {
+			continue;
+		}
+
 		if (s->conf == NULL || strcmp(s->access_log, s->conf->access_log)) {
-			s->access_filp = fopen(s->access_log, "a");
-			if (s->access_filp == NULL) {
+			s->access_logger = logger_open(s->access_log);
+			if (s->access_logger == NULL) {
 				msg = "error in open log file";
 				goto fail;
 			}
 		}
+
+		if (s->slow_log[0] != '\0' && (s->conf == NULL
+					|| strcmp(s->slow_log, s->conf->slow_log))) {
+			s->slow_filp = fopen(s->slow_log, "a");
+			if (s->slow_filp == NULL) {
+				msg = "error in open slow log file";
+				goto fail;
+			}
+		}
+
+		if (s->trace_log_sample < 1) {
+			msg = "trace_log_sample must be positive";
+			goto fail;
+		}
+		if (s->trace_log[0] != '\0' && (s->conf == NULL
+					|| strcmp(s->trace_log, s->conf->trace_log))) {
+			s->trace = trace_open(s->trace_log);
+			if (s->trace == NULL) {
+				msg = "error in open trace log file";
+				goto fail;
+			}
+		}
 	}
 
 	return FCA_OK;
@@ -263,6 +434,21 @@ void server_conf_load(fca_conf_t *conf_cycle)
 {
 	struct list_head *p, *safe;
 	fca_server_t *s;
+	int i;
+
+	/* init shards. executes only once */
+	static int first = 1;
+	if (first) {
+		first = 0;
+		for (i = 0; i < master_nr; i++) {
+			pthread_mutex_init(&shards[i].lock, NULL);
+			pool_init(&item_pools[i], sizeof(fca_item_t));
+			evict_init(&shards[i].shared_evict, &item_pools[i], EVICT_LRU);
+			INIT_LIST_HEAD(&shards[i].used_overflows);
+			INIT_ILIST_HEAD(&shards[i].zombie_head);
+			pool_init(&shards[i].tomb_pool, sizeof(fca_tomb_t));
+		}
+	}
 
 	list_for_each_safe(p, safe, &servers) {
 		s = list_entry(p, fca_server_t, snode);
@@ -285,17 +471,30 @@ void server_conf_rollback(fca_conf_t *conf_cycle)
 {
 	struct list_head *p;
 	fca_server_t *s;
+	int i;
 
 	list_for_each(p, &conf_cycle->servers) {
 		s = list_entry(p, fca_server_t, snode);
-		if (s->access_filp) {
-			fclose(s->access_filp);
+		if (s->access_logger) {
+			logger_close(s->access_logger);
 		}
-		if (s->listen_fd >= 0) {
-			close(s->listen_fd);
+		if (s->slow_filp) {
+			fclose(s->slow_filp);
 		}
-		if (s->hash) {
-			hash_destroy(s->hash);
+		if (s->trace) {
+			trace_close(s->trace);
+		}
+		free(s->metrics);
+		for (i = 0; i < master_nr; i++) {
+			if (s->listen_fds[i] >= 0) {
+				close(s->listen_fds[i]);
+			}
+			if (s->shards[i].hash) {
+				hash_destroy(s->shards[i].hash);
+			}
+			if (s->shards[i].hot.buckets) {
+				hot_destroy(&s->shards[i].hot);
+			}
 		}
 	}
 }
@@ -311,38 +510,162 @@ void server_stop_service(void)
 	}
 }
 
+static inline size_t server_shard_capacity(fca_server_t *s)
+{
+	return s->capacity / master_nr;
+}
+
+static inline size_t server_shard_ram_capacity(fca_server_t *s)
+{
+	return s->ram_capacity / master_nr;
+}
+
+static inline fca_evict_t *server_evict(fca_server_t *s, int shard)
+{
+	return s->capacity ? &s->shards[shard].evict
+		: &shards[shard].shared_evict;
+}
+
+/* delete all items of @s */
+static void server_purge(fca_server_t *s)
+{
+	fca_pool_t *pool;
+	fca_evict_t *e;
+	fca_handle_t h, prev;
+	fca_item_t *item;
+	int i, q;
+
+	for (i = 0; i < master_nr; i++) {
+		pool = &item_pools[i];
+		e = server_evict(s, i);
+
+		server_shard_lock(i);
+		for (q = 0; q < 2; q++) {
+			for (h = e->queues[q].last; h != 0; h = prev) {
+				prev = ilist_prev(pool, ITEM_LRU_NODE, h);
+				item = pool_ptr(pool, h);
+				if (server_of_item(item) == s && !item->deleted) {
+					server_item_delete(item);
+				}
+			}
+		}
+		server_shard_unlock(i);
+	}
+}
+
 int server_clear(unsigned short port)
 {
+	int i;
 	fca_server_t *s = server_by_port(port);
 	if (s == NULL) {
 		log_error_admin(0, "no matched server");
 		return FCA_ERROR;
 	}
 
+	/* item->clear has 4 bits only. Before a generation is reused,
+	 * delete all items, which are invalid after clear anyway. */
+	if (((s->clear + 1) & ITEM_CLEAR_MASK) == 0) {
+		server_purge(s);
+	}
+
 	s->clear++;
+	device_journal_clear(port);
+
+	for (i = 0; i < master_nr; i++) {
+		server_shard_lock(i);
+		hot_shrink(&s->shards[i].hot, 0);
+		server_shard_unlock(i);
+	}
 	return FCA_OK;
 }
 
-static inline struct list_head *server_lru_head(fca_server_t *s)
+/* remember the key, if the loaders may bring back its stale copy.
+ * The caller should hold the shard lock. */
+static void server_tomb_add(fca_server_t *s, int shard, unsigned char *hash_id)
 {
-	return s->capacity ? &s->lru_head : &shared_lru_head;
+	fca_server_shard_t *sh = &s->shards[shard];
+	fca_pool_t *pool = &shards[shard].tomb_pool;
+	fca_tomb_t *tomb;
+
+	if (__atomic_load_n(&device_loading_nr, __ATOMIC_ACQUIRE) == 0) {
+		return;
+	}
+
+	if (sh->tombs == NULL) {
+		sh->tombs = hash_init(pool);
+		if (sh->tombs == NULL) {
+			log_error_run(0, "no mem when init tombs");
+			return;
+		}
+	}
+	if (hash_get(sh->tombs, NULL, 0, hash_id) != NULL) {
+		return;
+	}
+
+	tomb = pool_alloc(pool);
+	if (tomb == NULL) {
+		log_error_run(0, "no mem for tomb");
+		return;
+	}
+	memcpy(tomb->hnode.id, hash_id, HASH_ID_LEN);
+	if (hash_add(sh->tombs, &tomb->hnode, NULL, 0) != 0) {
+		log_error_run(0, "no mem for tomb");
+		pool_free(pool, tomb);
+		return;
+	}
+	tomb->next = sh->tomb_first;
+	sh->tomb_first = pool_handle(pool, tomb);
+}
+
+/* the caller should hold the shard lock */
+static void server_tombs_release(fca_server_t *s, int shard)
+{
+	fca_server_shard_t *sh = &s->shards[shard];
+	fca_pool_t *pool = &shards[shard].tomb_pool;
+	fca_tomb_t *tomb;
+	fca_handle_t h, next;
+
+	if (sh->tombs == NULL) {
+		return;
+	}
+	for (h = sh->tomb_first; h != 0; h = next) {
+		tomb = pool_ptr(pool, h);
+		next = tomb->next;
+		pool_free(pool, tomb);
+	}
+	hash_destroy(sh->tombs);
+	sh->tombs = NULL;
+	sh->tomb_first = 0;
 }
 
-/* @format module call this to add an item, when load an item from device */
+/* @format module call this to add an item, when load an item from device.
+ * The caller should hold the shard lock. */
 int server_load_fm_item(fca_server_t *s, fca_device_t *device,
 		fca_format_item_t *fm_item)
 {
 	fca_item_t *item;
 	size_t block_size;
+	int shard = server_shard_of_id(fm_item->hash_id);
+	fca_server_shard_t *sh = &s->shards[shard];
+
+	/* devices are loaded while serving, so it may be PUT or
+	 * deleted already */
+	if (hash_get(sh->hash, NULL, 0, fm_item->hash_id) != NULL
+			|| (sh->tombs != NULL && hash_get(sh->tombs,
+					NULL, 0, fm_item->hash_id) != NULL)) {
+		return FCA_ERROR;
+	}
 
-	item = slab_alloc(&item_slab);
+	item = pool_alloc(&item_pools[shard]);
 	if (item == NULL) {
 		return FCA_ERROR;
 	}
 
+	item->other = 0;
 	item->putting = 0;
 	item->badblock = 0;
 	item->deleted = 0;
+	item->zombie = 0;
 	item->used = 0;
 	item->clear = 0;
 	item->server_index = s->index;
@@ -351,53 +674,50 @@ int server_load_fm_item(fca_server_t *s, fca_device_t *device,
 	item->headers_len = fm_item->headers_len;
 	item->offset = fm_item->offset;
 	item->device_index = device->index;
+	memcpy(item->hnode.id, fm_item->hash_id, HASH_ID_LEN);
 
 	block_size = device_cut_free_block(item);
 	if (block_size == 0) {
-		slab_free(item);
+		pool_free(&item_pools[shard], item);
 		return FCA_ERROR;
 	}
 
-	memcpy(item->hnode.id, fm_item->hash_id, 16);
-	hash_add(s->hash, &item->hnode, NULL, 0);
-	list_add(&item->lru_node, server_lru_head(s));
-
-	s->consumed += block_size;
-	s->content += item->length;
-	s->item_nr++;
+	if (hash_add(sh->hash, &item->hnode, NULL, 0) != 0) {
+		log_error_run(0, "hash full, drop loaded item in server %d",
+				s->listen_port);
+		device_return_free_block(item);
+		pool_free(&item_pools[shard], item);
+		return FCA_ERROR;
+	}
+	evict_add(server_evict(s, shard), item);
 
+	sh->consumed += block_size;
+	sh->content += item->length;
+	sh->item_nr++;
 	return FCA_OK;
 }
 
-/* pass-by item. only ID(uri), but no data(body). */
-typedef struct {
-	/* @hnode and @passby must be together, to
-	 * distinguish fca_item_t and fca_passby_item_t. */
-	fca_hash_node_t		hnode;
-	unsigned		passby:1;
-
-	int32_t			expire;
-	struct list_head	lru_node;
-} fca_passby_item_t;
-
-
-static void server_passby_item_delete(fca_server_t *s,
-		fca_passby_item_t *passby_item)
-{
-	hash_del(s->hash, &passby_item->hnode);
-	list_del(&passby_item->lru_node);
-	slab_free(passby_item);
-	s->passby_item_nr--;
-}
-
+/* the caller should hold the shard lock of @item */
 void server_item_delete(fca_item_t *item)
 {
 	fca_server_t *s = server_of_item(item);
+	int shard = server_shard_of_item(item);
+	fca_server_shard_t *sh = &s->shards[shard];
+	fca_pool_t *pool = &item_pools[shard];
 	size_t block_size;
+	unsigned long epoch;
+
+	if (item->zombie) {
+		return;
+	}
+
+	if (item->hot) {
+		hot_remove(&sh->hot, item);
+	}
 
 	/* 1st time get in here for the @item */
 	if (item->deleted == 0) {
-		hash_del(s->hash, &item->hnode);
+		hash_del(sh->hash, &item->hnode);
 	}
 
 	/* if used, delete later */
@@ -407,54 +727,159 @@ void server_item_delete(fca_item_t *item)
 	}
 
 	/* delete the item actally */
-	list_del(&item->lru_node);
-	s->content -= item->length;
+	evict_del(server_evict(s, shard), item);
+	sh->content -= item->length;
+	sh->item_nr--;
+
+	/* If the item is in journal, its space can not be reused until the
+	 * delete is durable, otherwise it may be loaded after crash with
+	 * other's data. */
+	epoch = journal_item_delete(item);
+	if (epoch != 0 && !item->badblock) {
+		item->zombie = 1;
+		item->expire = epoch;
+		sh->consumed -= device_item_block_size(item);
+		ilist_add_tail(pool, ITEM_LRU_NODE, &shards[shard].zombie_head,
+				pool_handle(pool, item));
+		return;
+	}
+
 	block_size = device_return_free_block(item);
-	s->consumed -= block_size;
-	s->item_nr--;
-	slab_free(item);
+	sh->consumed -= block_size;
+	pool_free(pool, item);
+}
+
+/* keep the space of @item, which is not in any server, until @epoch
+ * is durable in journal, as a zombie. The shard lock is held. */
+void server_item_bury(fca_item_t *item, unsigned long epoch)
+{
+	int shard = server_shard_of_item(item);
+	fca_pool_t *pool = &item_pools[shard];
+
+	item->zombie = 1;
+	item->expire = epoch;
+	ilist_add_tail(pool, ITEM_LRU_NODE, &shards[shard].zombie_head,
+			pool_handle(pool, item));
+}
+
+/* free zombie items, whose deletes are durable in journal */
+static void server_zombie_release(int shard)
+{
+	fca_ilist_head_t *head = &shards[shard].zombie_head;
+	fca_pool_t *pool = &item_pools[shard];
+	fca_device_t *device;
+	fca_item_t *item;
+	fca_handle_t h, next;
+
+	for (h = head->first; h != 0; h = next) {
+		next = ilist_next(pool, ITEM_LRU_NODE, h);
+		item = pool_ptr(pool, h);
+		device = device_of_item(item);
+		if (!device->deleted && !journal_durable(device->journal, item->expire)) {
+			continue;
+		}
+		ilist_del(pool, ITEM_LRU_NODE, head, h);
+		device_return_free_block(item);
+		pool_free(pool, item);
+	}
 }
 
 inline int server_item_valid(fca_item_t *item)
 {
 	return !device_of_item(item)->deleted
 		&& !server_of_item(item)->deleted
-		&& item->clear == server_of_item(item)->clear
+		&& item->clear == (server_of_item(item)->clear & ITEM_CLEAR_MASK)
 		&& item->expire > timer_now(&master_timer);
 }
 
-static void server_item_expire(fca_server_t *s, size_t target)
+static fca_used_overflow_t *server_used_overflow(int shard, fca_item_t *item)
 {
-	fca_item_t *item;
-	fca_passby_item_t *passby_item;
-	struct list_head *p, *safe;
-	time_t now = timer_now(&master_timer);
-	size_t before = s->consumed;
-	int count = 0;
-
-	list_for_each_reverse_safe(p, safe, &s->lru_head) {
-		item = list_entry(p, fca_item_t, lru_node);
+	struct list_head *p;
+	fca_used_overflow_t *uo;
 
-		if (before - s->consumed >= target && server_item_valid(item)) {
-			break;
+	list_for_each(p, &shards[shard].used_overflows) {
+		uo = list_entry(p, fca_used_overflow_t, node);
+		if (uo->item == item) {
+			return uo;
 		}
+	}
+	return NULL;
+}
 
-		server_item_delete(item);
+/* item->used has 8 bits only, and the use counts over it are
+ * kept in the shard's used_overflows. */
+int server_item_use(int shard, fca_item_t *item)
+{
+	fca_used_overflow_t *uo;
 
-		if (count++ >= LOOP_LIMIT) {
-			break;
+	if (item->used < ITEM_USED_MAX) {
+		item->used++;
+		return FCA_OK;
+	}
+
+	uo = server_used_overflow(shard, item);
+	if (uo == NULL) {
+		uo = malloc(sizeof(fca_used_overflow_t));
+		if (uo == NULL) {
+			return FCA_ERROR;
+		}
+		uo->item = item;
+		uo->count = 0;
+		list_add(&uo->node, &shards[shard].used_overflows);
+	}
+	uo->count++;
+	return FCA_OK;
+}
+
+void server_item_unuse(int shard, fca_item_t *item)
+{
+	fca_used_overflow_t *uo;
+
+	if (item->used == ITEM_USED_MAX) {
+		uo = server_used_overflow(shard, item);
+		if (uo != NULL) {
+			if (--uo->count == 0) {
+				list_del(&uo->node);
+				free(uo);
+			}
+			return;
 		}
 	}
+	item->used--;
+}
 
-	list_for_each_reverse_safe(p, safe, &s->passby_lru_head) {
-		passby_item = list_entry(p, fca_passby_item_t, lru_node);
+/* delete the victim @item of @e. Valid ones are counted as evicted. */
+static void server_item_evict(fca_evict_t *e, fca_server_shard_t *sh,
+		fca_item_t *item)
+{
+	int busy = (item->used != 0 || item->putting);
+
+	if (server_item_valid(item)) {
+		sh->evicts++;
+		sh->evicts_current_period++;
+	}
 
-		if (s->passby_enable && s->passby_item_nr < s->passby_limit_nr
-				&& passby_item->expire > now) {
+	server_item_delete(item);
+
+	/* still in @e if used, so move it away from the victim place */
+	if (busy) {
+		evict_requeue(e, item);
+	}
+}
+
+static void server_item_expire(fca_server_t *s, int shard, size_t target)
+{
+	fca_item_t *item;
+	fca_server_shard_t *sh = &s->shards[shard];
+	size_t before = sh->consumed;
+	int count = 0;
+
+	while ((item = evict_victim(&sh->evict)) != NULL) {
+		if (before - sh->consumed >= target && server_item_valid(item)) {
 			break;
 		}
 
-		server_passby_item_delete(s, passby_item);
+		server_item_evict(&sh->evict, sh, item);
 
 		if (count++ >= LOOP_LIMIT) {
 			break;
@@ -462,22 +887,20 @@ static void server_item_expire(fca_server_t *s, size_t target)
 	}
 }
 
-static void server_shared_expire(size_t target)
+static void server_shared_expire(int shard, size_t target)
 {
 	fca_item_t *item;
-	struct list_head *p, *safe;
+	fca_evict_t *e = &shards[shard].shared_evict;
 	size_t size = 0;
 	int count = 0;
 
-	list_for_each_reverse_safe(p, safe, &shared_lru_head) {
-		item = list_entry(p, fca_item_t, lru_node);
-
+	while ((item = evict_victim(e)) != NULL) {
 		if (size >= target && server_item_valid(item)) {
 			break;
 		}
 
 		size += item->length;
-		server_item_delete(item);
+		server_item_evict(e, &server_of_item(item)->shards[shard], item);
 
 		if (count++ >= LOOP_LIMIT) {
 			break;
@@ -485,7 +908,8 @@ static void server_shared_expire(size_t target)
 	}
 }
 
-static fca_hash_node_t *server_hash_get(fca_request_t *r, unsigned char *hash_id)
+/* calculate the hash id of the request's key, which decides the shard */
+static int server_request_hash_id(fca_request_t *r, unsigned char *hash_id)
 {
 	fca_server_t *s = r->server;
 	char key[REQ_BUF_SIZE]; /* REQ_BUF_SIZE is just enough */
@@ -512,32 +936,29 @@ static fca_hash_node_t *server_hash_get(fca_request_t *r, unsigned char *hash_id
 		length += r->fca_key.len;
 	}
 
-	return hash_get(s->hash, (unsigned char *)key, length, hash_id);
+	hash_make_id((unsigned char *)key, length, hash_id);
+	r->hash_set = 1;
+	return server_shard_of_id(hash_id);
 }
 
 
-/* request module call this, in a GET request, to get the item */
-int server_request_get_handler(fca_request_t *r)
+static int server_do_get(fca_request_t *r, int shard, unsigned char *hash_id)
 {
 	fca_item_t *item;
-	fca_passby_item_t *passby_item;
 	fca_hash_node_t *hnode;
 	fca_server_t *s = r->server;
+	fca_server_shard_t *sh = &s->shards[shard];
 
-	s->gets++;
-	s->gets_current_period++;
+	sh->gets++;
+	sh->gets_current_period++;
 
-	hnode = server_hash_get(r, NULL);
+	hnode = hash_get(sh->hash, NULL, 0, hash_id);
 	if (hnode == NULL) {
-		return FCA_ERROR;
-	}
-
-	passby_item = list_entry(hnode, fca_passby_item_t, hnode);
-	if (passby_item->passby) {
-		list_del(&passby_item->lru_node);
-		list_add(&passby_item->lru_node, &s->passby_lru_head);
-		s->passby_hits++;
-		s->passby_hits_current_period++;
+		/* passed by in PUT before */
+		if (admit_ready(&sh->admit) && admit_estimate(&sh->admit, hash_id) != 0) {
+			sh->passby_hits++;
+			sh->passby_hits_current_period++;
+		}
 		return FCA_ERROR;
 	}
 
@@ -550,74 +971,118 @@ int server_request_get_handler(fca_request_t *r)
 		return FCA_ERROR;
 	}
 
-	s->hits++;
-	s->hits_current_period++;
-	device_of_item(item)->used++;
+	if (server_item_use(shard, item) != FCA_OK) {
+		return FCA_ERROR;
+	}
+
+	sh->hits++;
+	sh->hits_current_period++;
+	__sync_fetch_and_add(&device_of_item(item)->used, 1);
+
+	r->item_freq = 0;
+	if (admit_ready(&sh->admit)) {
+		r->item_freq = admit_record(&sh->admit, hash_id);
+	}
 
-	item->used++;
 	r->item = item;
 
-	/* update LRU */
-	list_del(&item->lru_node);
-	list_add(&item->lru_node, server_lru_head(s));
+	/* RAM tier, not for Range requests */
+	if (item->hot && !r->range_set) {
+		r->hot = hot_get(&sh->hot, item);
+		sh->ram_hits++;
+		sh->ram_hits_current_period++;
+
+	} else if (s->ram_capacity != 0 && !r->range_set
+			&& r->method == FCA_HTTP_METHOD_GET
+			&& item->length <= s->ram_item_max_size
+			&& item->length <= server_shard_ram_capacity(s)
+			&& hot_admit(&sh->hot, item, s->ram_admit_hits)) {
+		r->hot_admit = 1;
+	}
+
+	evict_hit(server_evict(s, shard), item);
 
 	return FCA_OK;
 }
 
-static int server_passby_store(fca_server_t *s, unsigned char *hash_id)
+/* request module call this, in a GET request, to get the item */
+int server_request_get_handler(fca_request_t *r)
 {
-	static fca_slab_t passby_item_slab = FCA_SLAB_INIT(fca_passby_item_t);
+	int shard, rc;
+
+	shard = server_request_hash_id(r, r->hash_id);
 
-	fca_passby_item_t *passby_item;
+	server_shard_lock(shard);
+	rc = server_do_get(r, shard, r->hash_id);
+	server_shard_unlock(shard);
+
+	return rc;
+}
 
-	if (!s->passby_enable || s->item_nr < s->passby_begin_item_nr
-			     || s->consumed < s->passby_begin_consumed) {
+/* Decide whether to store a new item, by its frequency in PUTs and
+ * hits. Return FCA_OK to pass it by. A key seen the first time is
+ * passed by. If the space is full, the item is stored only if it is
+ * more frequent than the victim it evicts. */
+static int server_passby_store(fca_server_t *s, int shard,
+		unsigned char *hash_id, size_t length)
+{
+	fca_server_shard_t *sh = &s->shards[shard];
+	fca_item_t *victim;
+	int freq;
+
+	if (!s->passby_enable || !admit_ready(&sh->admit)
+			|| sh->item_nr < s->passby_begin_item_nr / master_nr
+			|| sh->consumed < s->passby_begin_consumed / master_nr) {
 		return FCA_DECLINE;
 	}
 
-	passby_item = slab_alloc(&passby_item_slab);
-	if (passby_item == NULL) {
-		log_error_run(0, "NoMem");
-		return FCA_ERROR;
+	freq = admit_record(&sh->admit, hash_id);
+	if (freq == 0) {
+		goto passby;
 	}
 
-	passby_item->passby = 1;
-	passby_item->expire = timer_now(&master_timer) + s->passby_expire;
-	memcpy(passby_item->hnode.id, hash_id, 16);
-	hash_add(s->hash, &passby_item->hnode, NULL, 0);
-	list_add(&passby_item->lru_node, &s->passby_lru_head);
-	s->passby_item_nr++;
-	s->passby_stores++;
-	s->passby_stores_current_period++;
+	if (s->capacity != 0 && sh->consumed + length > server_shard_capacity(s)) {
+		victim = evict_peek(&sh->evict);
+		if (victim != NULL && server_item_valid(victim)
+				&& freq <= admit_estimate(&sh->admit, victim->hnode.id)) {
+			goto passby;
+		}
+	}
+	return FCA_DECLINE;
 
+passby:
+	sh->passby_stores++;
+	sh->passby_stores_current_period++;
 	return FCA_OK;
 }
 
-/* @request module call this, in a PUT request, to put an item */
-int server_request_put_handler(fca_request_t *r)
+static int server_do_put(fca_request_t *r, int shard, unsigned char *hash_id)
 {
 	fca_item_t *item;
-	fca_passby_item_t *passby_item;
 	fca_hash_node_t *hnode;
-	fca_server_t *s;
-	unsigned char hash_id[16];
+	fca_server_t *s = r->server;
+	fca_server_shard_t *sh = &s->shards[shard];
+	size_t capacity = server_shard_capacity(s);
 	size_t block_size;
 	time_t now;
 	int try = 0;
 
-	s = r->server;
-	s->puts++;
-	s->puts_current_period++;
+	sh->puts++;
+	sh->puts_current_period++;
 
 	/* check size */
 	if (s->item_max_size != 0 && r->content_length > s->item_max_size) {
 		r->error_reason = "TooBigItem1";
 		return FCA_DECLINE;
 	}
-	if (s->capacity != 0 && r->content_length + r->put_header_length > s->capacity) {
+	if (s->capacity != 0 && r->content_length + r->put_header_length > capacity) {
 		r->error_reason = "TooBigItem2";
 		return FCA_DECLINE;
 	}
+	if (r->put_header_length > ITEM_HEADERS_MAX) {
+		r->error_reason = "TooBigHeaders";
+		return FCA_DECLINE;
+	}
 
 	/* check expire */
 	now = timer_now(&master_timer);
@@ -633,20 +1098,20 @@ int server_request_put_handler(fca_request_t *r)
 
 	} else {}
 
+	r->item_freq = admit_ready(&sh->admit)
+		? admit_estimate(&sh->admit, hash_id) : 0;
+
 	/* check exist */
-	hnode = server_hash_get(r, hash_id);
+	hnode = hash_get(sh->hash, NULL, 0, hash_id);
 	if (hnode == NULL) {
-		if (server_passby_store(s, hash_id) == FCA_OK) {
+		if (server_passby_store(s, shard, hash_id, r->content_length
+					+ r->put_header_length) == FCA_OK) {
 			r->error_reason = "StorePassby";
 			return FCA_DECLINE;
 		}
 	} else {
-		passby_item = list_entry(hnode, fca_passby_item_t, hnode);
 		item = list_entry(hnode, fca_item_t, hnode);
-		if (passby_item->passby) {
-			server_passby_item_delete(s, passby_item);
-
-		} else if (r->method == FCA_HTTP_METHOD_PUT || !server_item_valid(item)) {
+		if (r->method == FCA_HTTP_METHOD_PUT || !server_item_valid(item)) {
 			server_item_delete(item);
 
 		} else {
@@ -657,42 +1122,43 @@ int server_request_put_handler(fca_request_t *r)
 
 	/* check done, store the item now */
 
-	item = slab_alloc(&item_slab);
+	item = pool_alloc(&item_pools[shard]);
 	if (item == NULL) {
 		log_error_run(0, "NoMem");
 		return FCA_ERROR;
 	}
+	item->other = 0;
 	item->length = r->content_length + r->put_header_length;
 	item->headers_len = r->put_header_length;
 
 try_again:
-	block_size = device_get_free_block(item);
+	block_size = device_get_free_block(item, shard);
 	if (block_size == 0) {
 		/* If fails in getting free block, expire some items and try again.
 		 * The following expire order is complicated, and there is no
 		 * specific reason for the order. Just feeling. */
-		if (try++ < 2 && !list_empty(&s->lru_head)
-				&& s->consumed + item->length*2 > s->capacity) {
-			server_item_expire(s, item->length * 2);
+		if (try++ < 2 && evict_item_nr(&sh->evict) != 0
+				&& sh->consumed + item->length*2 > capacity) {
+			server_item_expire(s, shard, item->length * 2);
 			goto try_again;
 		}
-		if (try++ < 5 && !list_empty(&shared_lru_head)) {
-			server_shared_expire(item->length * 2);
+		if (try++ < 5 && evict_item_nr(&shards[shard].shared_evict) != 0) {
+			server_shared_expire(shard, item->length * 2);
 			goto try_again;
 		}
-		if (try++ < 9 && !list_empty(&s->lru_head)) {
-			server_item_expire(s, item->length * 2);
+		if (try++ < 9 && evict_item_nr(&sh->evict) != 0) {
+			server_item_expire(s, shard, item->length * 2);
 			goto try_again;
 		}
 		if (try++ < 12) {
-			device_free_block_extend(item->length);
+			device_free_block_extend(item->length, shard);
 			goto try_again;
 		}
 
-		slab_free(item);
 		r->error_reason = "NoSpace";
-		log_error_run(0, "space(%ld) alloc fail in server %d",
+		log_error_run(0, "space(%u) alloc fail in server %d",
 				item->length, s->listen_port);
+		pool_free(&item_pools[shard], item);
 		return FCA_ERROR;
 	}
 
@@ -701,71 +1167,124 @@ try_again:
 	item->putting = 1;
 	item->badblock = 0;
 	item->deleted = 0;
+	item->zombie = 0;
 	item->used = 0;
 	item->clear = s->clear;
 	item->expire = r->expire;
 	item->server_index = s->index;
-	memcpy(item->hnode.id, hash_id, 16);
-	hash_add(s->hash, &item->hnode, NULL, 0);
-	list_add(&item->lru_node, server_lru_head(s));
-	s->consumed += block_size;
-	s->content += item->length;
-	s->item_nr++;
-	s->stores++;
-	s->stores_current_period++;
-	device_of_item(item)->used++;
+	memcpy(item->hnode.id, hash_id, HASH_ID_LEN);
+	if (hash_add(sh->hash, &item->hnode, NULL, 0) != 0) {
+		r->item = NULL;
+		r->error_reason = "NoMem";
+		log_error_run(0, "hash full in server %d", s->listen_port);
+		device_return_free_block(item);
+		pool_free(&item_pools[shard], item);
+		return FCA_ERROR;
+	}
+	evict_add(server_evict(s, shard), item);
+	server_tomb_add(s, shard, hash_id);
+	sh->consumed += block_size;
+	sh->content += item->length;
+	sh->item_nr++;
+	sh->stores++;
+	sh->stores_current_period++;
+	__sync_fetch_and_add(&device_of_item(item)->used, 1);
 
 	return FCA_OK;
 }
 
-/* @request module call this, in a DELETE request, to delete an item */
-int server_request_delete_handler(fca_request_t *r)
+/* @request module call this, in a PUT request, to put an item */
+int server_request_put_handler(fca_request_t *r)
+{
+	int shard, rc;
+
+	shard = server_request_hash_id(r, r->hash_id);
+
+	server_shard_lock(shard);
+	rc = server_do_put(r, shard, r->hash_id);
+	server_shard_unlock(shard);
+
+	return rc;
+}
+
+static int server_do_delete(fca_request_t *r, int shard, unsigned char *hash_id)
 {
 	fca_hash_node_t *hnode;
 	fca_item_t *item;
-	fca_passby_item_t *passby_item;
-	fca_server_t *s = r->server;
+	fca_server_shard_t *sh = &r->server->shards[shard];
+
+	sh->deletes++;
+	sh->deletes_current_period++;
 
-	s->deletes++;
-	s->deletes_current_period++;
+	server_tomb_add(r->server, shard, hash_id);
 
-	hnode = server_hash_get(r, NULL);
+	hnode = hash_get(sh->hash, NULL, 0, hash_id);
 	if (hnode == NULL) {
 		return FCA_ERROR;
 	}
 
-	passby_item = list_entry(hnode, fca_passby_item_t, hnode);
-	if (passby_item->passby) {
-		server_passby_item_delete(s, passby_item);
-	} else {
-		item = list_entry(hnode, fca_item_t, hnode);
-		server_item_delete(item);
-	}
+	item = list_entry(hnode, fca_item_t, hnode);
+	server_item_delete(item);
 	return FCA_OK;
 }
 
+/* @request module call this, in a DELETE request, to delete an item */
+int server_request_delete_handler(fca_request_t *r)
+{
+	int shard, rc;
+
+	shard = server_request_hash_id(r, r->hash_id);
+
+	server_shard_lock(shard);
+	rc = server_do_delete(r, shard, r->hash_id);
+	server_shard_unlock(shard);
+
+	return rc;
+}
+
 /* @request module call this, when a request finishs */
 void server_request_finalize(fca_request_t *r)
 {
+	fca_server_t *s;
 	fca_item_t *item = r->item;
-	int not_finish = 0;
+	int not_finish = 0, putting = 0;
+	int shard;
 
 	if (item == NULL) {
 		return;
 	}
 	r->item = NULL;
 
-	device_of_item(item)->used--;
+	__sync_fetch_and_sub(&device_of_item(item)->used, 1);
+
+	shard = server_shard_of_item(item);
+	server_shard_lock(shard);
+
+	if (r->hot != NULL) {
+		hot_put(r->hot);
+		r->hot = NULL;
+	}
+	if (r->hot_fill != NULL) {
+		s = server_of_item(item);
+		if (!item->deleted && !r->disk_error && server_item_valid(item)) {
+			hot_add(&s->shards[shard].hot, r->hot_fill, item,
+					server_shard_ram_capacity(s));
+		} else {
+			hot_put(r->hot_fill);
+		}
+		r->hot_fill = NULL;
+	}
 
 	if (item->putting) {
 		item->putting = 0;
+		putting = 1;
 
 		if (r->process_size < item->length) {
 			not_finish = 1;
 		}
 
 	} else {
-		item->used--;
+		server_item_unuse(shard, item);
 	}
 
 	if (r->disk_error) {
@@ -774,7 +1293,12 @@ void server_request_finalize(fca_request_t *r)
 
 	} else if (item->deleted || not_finish) {
 		server_item_delete(item);
+
+	} else if (putting) {
+		journal_item_put(item);
 	}
+
+	server_shard_unlock(shard);
 }
 
 /* server port listen handler, called on new request */
@@ -784,7 +1308,7 @@ void server_listen_handler(fca_server_t *s)
 	struct sockaddr_in client;
 
 	while (1) {
-		sock_fd = tcp_accept(s->listen_fd, &client);
+		sock_fd = tcp_accept(s->listen_fds[master_index], &client);
 		if (sock_fd == -1) {
 			if (errno == EAGAIN) {
 				return;
@@ -799,67 +1323,165 @@ void server_listen_handler(fca_server_t *s)
 
 static void server_destroy(fca_server_t *s)
 {
+	fca_server_shard_t *sh;
+	int i;
+
 	/* If s->capacity==0, server_item_expire() does not works, because
-	 * the items are linked on shared_lru_head.
+	 * the items are linked on shared_evict.
 	 * So maybe we need hash_pop()? */
-	server_item_expire(s, s->consumed);
+	for (i = 0; i < master_nr; i++) {
+		sh = &s->shards[i];
+
+		server_shard_lock(i);
+		server_item_expire(s, i, sh->consumed);
+		server_shard_unlock(i);
 
-	if (s->item_nr != 0 || s->passby_item_nr != 0) {
+		if (sh->item_nr != 0) {
+			return;
+		}
+	}
+
+	/* requests of other master threads may be still using it */
+	if (s->connections != 0) {
 		return;
 	}
 
 	list_del(&s->snode);
-	hash_destroy(s->hash);
-	fclose(s->access_filp);
+	for (i = 0; i < master_nr; i++) {
+		hash_destroy(s->shards[i].hash);
+		server_shard_lock(i);
+		server_tombs_release(s, i);
+		server_shard_unlock(i);
+		hot_destroy(&s->shards[i].hot);
+		evict_destroy(&s->shards[i].evict);
+		admit_destroy(&s->shards[i].admit);
+	}
+	logger_close(s->access_logger);
+	if (s->slow_filp) {
+		fclose(s->slow_filp);
+	}
+	if (s->trace) {
+		trace_close(s->trace);
+	}
+	free(s->metrics);
 	idx_pointer_delete(&server_indexs, s->index);
 	free(s);
 }
 
-/* regular routine, called by master thread */
+/* in case of passby_* reloaded */
+static void server_admit_update(fca_server_t *s, fca_server_shard_t *sh, int age)
+{
+	fca_admit_t *admit = &sh->admit;
+	long keys = s->passby_limit_nr / master_nr;
+
+	if (!s->passby_enable) {
+		admit_destroy(admit);
+		return;
+	}
+
+	if (admit_ready(admit) && admit->keys == keys) {
+		if (age) {
+			admit_age(admit);
+		}
+		return;
+	}
+
+	admit_destroy(admit);
+	if (admit_init(admit, keys) != FCA_OK) {
+		log_error_run(0, "NoMem for passby in server %d", s->listen_port);
+	}
+}
+
+/* regular routine, called by the first master thread */
 void server_routine(void)
 {
 	struct list_head *p, *safep;
 	fca_server_t *s;
+	fca_server_shard_t *sh;
+	size_t capacity;
 	time_t now;
+	int i, clear, age, loading;
 
 	now = timer_now(&master_timer);
 	list_for_each(p, &servers) {
 		s = list_entry(p, fca_server_t, snode);
+		capacity = server_shard_capacity(s);
+
+		/* pass-by keys are forgotten gradually */
+		age = (now - s->passby_last_age >= s->passby_expire);
+		if (age) {
+			s->passby_last_age = now;
+		}
 
 		/* update statistics */
-		if (now - s->last_clear >= s->status_period) {
+		clear = (now - s->last_clear >= s->status_period);
+		if (clear) {
 			s->last_clear = now;
 
-			s->gets_last_period = s->gets_current_period;
-			s->hits_last_period = s->hits_current_period;
-			s->passby_hits_last_period = s->passby_hits_current_period;
-			s->gets_current_period = 0;
-			s->hits_current_period = 0;
-			s->passby_hits_current_period = 0;
+			s->output_size_last_period = __sync_fetch_and_and(
+					&s->output_size_current_period, 0);
+			s->input_size_last_period = __sync_fetch_and_and(
+					&s->input_size_current_period, 0);
+		}
 
-			s->puts_last_period = s->puts_current_period;
-			s->stores_last_period = s->stores_current_period;
-			s->passby_stores_last_period = s->passby_stores_current_period;
-			s->puts_current_period = 0;
-			s->stores_current_period = 0;
-			s->passby_stores_current_period = 0;
+		for (i = 0; i < master_nr; i++) {
+			sh = &s->shards[i];
+			server_shard_lock(i);
+
+			if (clear) {
+				sh->gets_last_period = sh->gets_current_period;
+				sh->hits_last_period = sh->hits_current_period;
+				sh->passby_hits_last_period = sh->passby_hits_current_period;
+				sh->gets_current_period = 0;
+				sh->hits_current_period = 0;
+				sh->passby_hits_current_period = 0;
+
+				sh->puts_last_period = sh->puts_current_period;
+				sh->stores_last_period = sh->stores_current_period;
+				sh->passby_stores_last_period = sh->passby_stores_current_period;
+				sh->puts_current_period = 0;
+				sh->stores_current_period = 0;
+				sh->passby_stores_current_period = 0;
+
+				sh->deletes_last_period = sh->deletes_current_period;
+				sh->deletes_current_period = 0;
+
+				sh->ram_hits_last_period = sh->ram_hits_current_period;
+				sh->ram_hits_current_period = 0;
+
+				sh->evicts_last_period = sh->evicts_current_period;
+				sh->evicts_current_period = 0;
+				hot_age(&sh->hot);
+			}
 
-			s->deletes_last_period = s->deletes_current_period;
-			s->deletes_current_period = 0;
+			server_admit_update(s, sh, age);
 
-			s->output_size_last_period = s->output_size_current_period;
-			s->input_size_last_period = s->input_size_current_period;
-			s->output_size_current_period = 0;
-			s->input_size_current_period = 0;
-		}
+			/* in case of ram_capacity reloaded */
+			hot_shrink(&sh->hot, server_shard_ram_capacity(s));
 
-		/* expire item if over-size */
-		server_item_expire(s, s->consumed > s->capacity ? s->consumed - s->capacity : 0);
+			/* expire item if over-size */
+			server_item_expire(s, i, sh->consumed > capacity
+					? sh->consumed - capacity : 0);
 
-		fflush(s->access_filp);
+			server_shard_unlock(i);
+		}
+	}
+
+	loading = __atomic_load_n(&device_loading_nr, __ATOMIC_ACQUIRE);
+	for (i = 0; i < master_nr; i++) {
+		server_shard_lock(i);
+		server_shared_expire(i, 0);
+		server_zombie_release(i);
+		if (!loading) {
+			list_for_each(p, &servers) {
+				s = list_entry(p, fca_server_t, snode);
+				server_tombs_release(s, i);
+			}
+		}
+		server_shard_unlock(i);
 	}
 
-	server_shared_expire(0);
+	server_slow_close_release(now);
 
 	/* clear deleted servers */
 	list_for_each_safe(p, safep, &deleted_servers) {
@@ -868,33 +1490,135 @@ void server_routine(void)
 	}
 }
 
+/* merge the shards into @total */
+static void server_shards_merge(fca_server_t *s, fca_server_shard_t *total)
+{
+	fca_server_shard_t *sh;
+	int i;
+
+	bzero(total, sizeof(fca_server_shard_t));
+	for (i = 0; i < master_nr; i++) {
+		sh = &s->shards[i];
+
+		total->consumed += sh->consumed;
+		total->content += sh->content;
+		total->item_nr += sh->item_nr;
+		total->admit.key_nr += sh->admit.key_nr;
+
+		total->gets += sh->gets;
+		total->hits += sh->hits;
+		total->passby_hits += sh->passby_hits;
+		total->gets_last_period += sh->gets_last_period;
+		total->hits_last_period += sh->hits_last_period;
+		total->passby_hits_last_period += sh->passby_hits_last_period;
+
+		total->puts += sh->puts;
+		total->stores += sh->stores;
+		total->passby_stores += sh->passby_stores;
+		total->puts_last_period += sh->puts_last_period;
+		total->stores_last_period += sh->stores_last_period;
+		total->passby_stores_last_period += sh->passby_stores_last_period;
+
+		total->deletes += sh->deletes;
+		total->deletes_last_period += sh->deletes_last_period;
+
+		total->ram_hits += sh->ram_hits;
+		total->ram_hits_last_period += sh->ram_hits_last_period;
+		total->evicts += sh->evicts;
+		total->evicts_last_period += sh->evicts_last_period;
+
+		total->hot.size += sh->hot.size;
+		total->hot.entry_nr += sh->hot.entry_nr;
+	}
+}
+
+/* memory of items' metadata, including the pools and the hash tables */
+static void server_memory_status(FILE *filp)
+{
+	struct list_head *p;
+	fca_server_t *s;
+	size_t memory = 0;
+	long objects = 0, items = 0;
+	int i;
+
+	for (i = 0; i < master_nr; i++) {
+		server_shard_lock(i);
+		memory += pool_memory(&item_pools[i]);
+		objects += item_pools[i].obj_nr;
+		list_for_each(p, &servers) {
+			s = list_entry(p, fca_server_t, snode);
+			memory += hash_memory(s->shards[i].hash);
+			memory += admit_memory(&s->shards[i].admit);
+			items += s->shards[i].item_nr;
+		}
+		server_shard_unlock(i);
+	}
+
+	fprintf(filp, "\n* index_memory objects items memory_per_item\n"
+			"** %ld %ld %ld %ld\n", memory, objects, items,
+			items ? memory / items : 0);
+}
+
 void server_status(FILE *filp)
 {
 	struct list_head *p;
 	fca_server_t *s;
+	fca_server_shard_t t;
 
 	fputs("\n- listen capacity period "
 			"| consumed content items passbyitems connections "
 			"| gets _gets hits _hits passbyhits _passbyhits "
 			"| puts _puts stores _stores passbystores _passbystores "
 			"| deletes _deletes "
-			"| output input\n", filp);
+			"| output input "
+			"| ramsize ramitems ramhits _ramhits ramratio _ramratio "
+			"| policy hitratio _hitratio evicts _evicts\n", filp);
 
 	list_for_each(p, &servers) {
 		s = list_entry(p, fca_server_t, snode);
+		server_shards_merge(s, &t);
 		fprintf(filp, "-- %d %ld %ld "
 				"| %ld %ld %ld %ld %d "
 				"| %ld %ld %ld %ld %ld %ld "
 				"| %ld %ld %ld %ld %ld %ld "
 				"| %ld %ld "
-				"| %ld %ld\n",
+				"| %ld %ld "
+				"| %ld %ld %ld %ld %.3f %.3f "
+				"| %s %.3f %.3f %ld %ld\n",
 				s->listen_port, s->capacity, s->status_period,
-				s->consumed, s->content, s->item_nr, s->passby_item_nr, s->connections,
-				s->gets, s->gets_last_period, s->hits, s->hits_last_period,
-				s->passby_hits, s->passby_hits_last_period,
-				s->puts, s->puts_last_period, s->stores, s->stores_last_period,
-				s->passby_stores, s->passby_stores_last_period,
-				s->deletes, s->deletes_last_period,
-				s->output_size_last_period, s->input_size_last_period);
+				t.consumed, t.content, t.item_nr, t.admit.key_nr, s->connections,
+				t.gets, t.gets_last_period, t.hits, t.hits_last_period,
+				t.passby_hits, t.passby_hits_last_period,
+				t.puts, t.puts_last_period, t.stores, t.stores_last_period,
+				t.passby_stores, t.passby_stores_last_period,
+				t.deletes, t.deletes_last_period,
+				s->output_size_last_period, s->input_size_last_period,
+				t.hot.size, t.hot.entry_nr, t.ram_hits, t.ram_hits_last_period,
+				t.gets ? (double)t.ram_hits / t.gets : 0.0,
+				t.gets_last_period ? (double)t.ram_hits_last_period
+					/ t.gets_last_period : 0.0,
+				evict_policy_name(s->capacity ? s->evict_policy : EVICT_LRU),
+				t.gets ? (double)t.hits / t.gets : 0.0,
+				t.gets_last_period ? (double)t.hits_last_period
+					/ t.gets_last_period : 0.0,
+				t.evicts, t.evicts_last_period);
+	}
+
+	server_memory_status(filp);
+}
+
+/* print @family of metrics of each server, for metrics_exposition() */
+void server_metrics(FILE *filp, int family)
+{
+	struct list_head *p;
+	fca_server_t *s;
+	fca_metrics_t total;
+	char labels[100];
+
+	list_for_each(p, &servers) {
+		s = list_entry(p, fca_server_t, snode);
+		metrics_merge(&total, s->metrics, master_nr);
+		sprintf(labels, "server=\"%d\"", s->listen_port);
+		metrics_print(filp, family, labels, &total);
 	}
 }
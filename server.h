@@ -11,22 +11,71 @@
 
 #include "fcache.h"
 
-struct fca_server_s {
-	struct list_head	snode;
+/* Items of a server are split into shards by hash id, one shard for
+ * each master thread. A shard is protected by the shard lock, and its
+ * items take space only from the same region of devices. */
+typedef struct {
+	fca_evict_t		evict;
 
-	struct list_head	lru_head;
-	struct list_head	passby_lru_head;
+	fca_hash_t	*hash;
 
-	unsigned short	listen_port;
-	int		listen_fd;
+	/* keys deleted or stored while devices are loading, so the
+	 * loaders do not bring back their stale copies on devices */
+	fca_hash_t	*tombs;
+	fca_handle_t	tomb_first;
 
-	fca_hash_t	*hash;
+	fca_hot_t	hot;
+
+	/* pass-by filter of new items */
+	fca_admit_t	admit;
 
-	size_t		capacity;
 	size_t		consumed;
 	size_t		content;
 	long		item_nr;
 
+	/* statistics */
+	long		gets;
+	long		hits;
+	long		passby_hits;
+	long		gets_last_period;
+	long		hits_last_period;
+	long		passby_hits_last_period;
+	long		gets_current_period;
+	long		hits_current_period;
+	long		passby_hits_current_period;
+
+	long		puts;
+	long		stores;
+	long		passby_stores;
+	long		puts_last_period;
+	long		stores_last_period;
+	long		passby_stores_last_period;
+	long		puts_current_period;
+	long		stores_current_period;
+	long		passby_stores_current_period;
+
+	long		deletes;
+	long		deletes_current_period;
+	long		deletes_last_period;
+
+	long		ram_hits;
+	long		ram_hits_last_period;
+	long		ram_hits_current_period;
+
+	long		evicts;
+	long		evicts_last_period;
+	long		evicts_current_period;
+} fca_server_shard_t;
+
+struct fca_server_s {
+	struct list_head	snode;
+
+	unsigned short	listen_port;
+	int		listen_fds[MASTERS_LIMIT];
+
+	size_t		capacity;
+	int		evict_policy;
+
 	fca_server_t	*conf;
 
 	int		index;
@@ -46,8 +95,7 @@ struct fca_server_s {
 	size_t		passby_begin_consumed;
 	long		passby_limit_nr;
 	time_t		passby_expire;
-
-	long		passby_item_nr;
+	time_t		passby_last_age;
 
 	size_t		sndbuf;
 	size_t		rcvbuf;
@@ -58,49 +106,48 @@ struct fca_server_s {
 	int		request_timeout;
 	int		keepalive_timeout;
 	char		access_log[PATH_LENGTH];
-	FILE		*access_filp;
+	fca_logger_t	*access_logger;
+	/* requests slower than @slow_log_threshold ms, with phases */
+	char		slow_log[PATH_LENGTH];
+	FILE		*slow_filp;
+	int		slow_log_threshold;
+	/* binary trace of 1 in @trace_log_sample keys, see trace.h */
+	char		trace_log[PATH_LENGTH];
+	fca_trace_t	*trace;
+	int		trace_log_sample;
 	size_t		item_max_size;
-	time_t		expire_default;
-	time_t		expire_force;
 
-	/* statistics */
-	long		gets;
-	long		hits;
-	long		passby_hits;
-	long		gets_last_period;
-	long		hits_last_period;
-	long		passby_hits_last_period;
-	long		gets_current_period;
-	long		hits_current_period;
-	long		passby_hits_current_period;
+	/* RAM tier */
+	size_t		ram_capacity;
+	size_t		ram_item_max_size;
+	int		ram_admit_hits;
 
-	long		puts;
-	long		stores;
-	long		passby_stores;
-	long		puts_last_period;
-	long		stores_last_period;
-	long		passby_stores_last_period;
-	long		puts_current_period;
-	long		stores_current_period;
-	long		passby_stores_current_period;
-
-	long		deletes;
-	long		deletes_current_period;
-	long		deletes_last_period;
+	time_t		expire_default;
+	time_t		expire_force;
 
+	/* updated by all master threads, so atomically */
 	size_t		output_size_last_period;
 	size_t		output_size_current_period;
 	size_t		input_size_last_period;
 	size_t		input_size_current_period;
 
+	/* metrics of requests, one for each master thread */
+	fca_metrics_t	*metrics;
+
 	time_t		last_clear;
 	time_t		status_period;
+
+	fca_server_shard_t	shards[MASTERS_LIMIT];
 };
 
+/* Items, pass-by items and free blocks of a shard are all objects of
+ * the shard's pool, and linked by 32-bit handles. */
+extern fca_pool_t item_pools[MASTERS_LIMIT];
+
 struct fca_item_s {
 	fca_hash_node_t		hnode;
-	struct list_head	order_node;
-	struct list_head	lru_node;
+	fca_ilist_node_t	order_node;
+	fca_ilist_node_t	lru_node;
 
 	/* since the number of items is huge, so we try our
 	 * best to minimize the size of fca_item_s. */
@@ -111,23 +158,58 @@ struct fca_item_s {
 	/* 2038 is enough... */
 	int32_t			expire;
 
+	unsigned		server_index:12;
+	unsigned		headers_len:12;
+	/* deleted, but the space is kept until the delete is durable
+	 * in journal. @expire is the journal epoch then. */
+	unsigned		zombie:1;
+	/* generation of server_clear(), wraps */
+	unsigned		clear:4;
+	/* used by the eviction policy */
+	unsigned		evict:3;
+
 	/* since sendfile(2) supports only 0x4020010000, so 40bits is enough */
 	unsigned long		offset:40;
 
-	unsigned		putting:1;
-	unsigned		deleted:1;
-	unsigned		badblock:1;
+	/* @other must be at the same place with fca_free_block_t.fblock,
+	 * to distinguish them. 0 here. */
+	unsigned long		other:1;
 
-	short			server_index;
-	short			device_index;
+	unsigned long		putting:1;
+	unsigned long		deleted:1;
+	unsigned long		badblock:1;
+	unsigned long		device_index:12;
 
-	unsigned short		headers_len;
-	unsigned short		used;
-	unsigned short		clear;
+	/* in the RAM tier */
+	unsigned long		hot:1;
+
+	/* saturates at ITEM_USED_MAX, see server_item_use() */
+	unsigned long		used:7;
 };
 
+#define ITEM_USED_MAX		127
+#define ITEM_CLEAR_MASK		15
+#define ITEM_HEADERS_MAX	4095
+
+#define ITEM_ORDER_NODE		offsetof(fca_item_t, order_node)
+#define ITEM_LRU_NODE		offsetof(fca_item_t, lru_node)
+
 #define SERVERS_LIMIT IPT_ARRAY_SIZE
 
+static inline int server_shard_of_id(unsigned char *id)
+{
+	/* the first 64 bits are used as hash index */
+	return ((uint32_t *)id)[2] % master_nr;
+}
+
+static inline int server_shard_of_item(fca_item_t *item)
+{
+	return server_shard_of_id(item->hnode.id);
+}
+
+void server_shard_lock(int shard);
+void server_shard_unlock(int shard);
+
 void server_dump_ports(unsigned short *ports);
 fca_server_t *server_of_item(fca_item_t *item);
 fca_server_t *server_by_port(unsigned short port);
@@ -149,9 +231,13 @@ int server_load_fm_item(fca_server_t *s, fca_device_t *d,
 		fca_format_item_t *fm_item);
 
 void server_item_delete(fca_item_t *item);
+int server_item_use(int shard, fca_item_t *item);
+void server_item_unuse(int shard, fca_item_t *item);
+void server_item_bury(fca_item_t *item, unsigned long epoch);
 
 void server_listen_handler(fca_server_t *s);
 
 void server_routine(void);
 void server_status(FILE *filp);
+void server_metrics(FILE *filp, int family);
 #endif
@@ -0,0 +1,639 @@
+/*
+ * Offline cache simulator. It replays an access log, or a binary
+ * trace (see trace.h), through the real server and device modules,
+ * which run in fca_simulate mode: no sockets, no device files and no
+ * threads, so only the indexes, eviction, pass-by and allocators
+ * work. The RAM tier works too, while its entries are not filled.
+ *
+ * Each configure file is simulated by a child process. The trace is
+ * parsed once by the parent, and fanned out to the children by pipes,
+ * so several configures are compared in one pass. The capacity of
+ * each device is set by its 'size' option.
+ *
+ * Hit ratio, byte hit ratio, evictions and fragmentation are printed
+ * for each interval of the trace time, and in total at last.
+ *
+ * Author: Wu Bingzheng
+ *
+ */
+
+#define _GNU_SOURCE
+#include <time.h>
+#include <sys/wait.h>
+#include "../fcache.h"
+
+/* as defined in fcache.c */
+__thread int master_epoll_fd;
+__thread fca_timer_t master_timer;
+__thread struct list_head master_requests;
+__thread int master_index;
+__thread fca_timer_t *thread_timer;
+int master_nr = 0;
+int master_epoll_fds[MASTERS_LIMIT];
+int fca_simulate = 1;
+FILE *error_filp;
+FILE *admin_out_filp;
+
+#define SIM_CONFS_LIMIT		32
+#define SIM_PIPE_BUFFER		(1024 * 1024)
+
+/* a request sent from the parent to the children, followed by
+ * the uri, host and fca_key, whose lengths are 0 if not set */
+typedef struct {
+	time_t		time;
+	int		method;
+	int		range_set;
+	size_t		length;		/* of the item, 0 if unknown */
+	size_t		range_bytes;	/* 0 if unknown */
+	unsigned short	uri_len;
+	unsigned short	host_len;
+	unsigned short	key_len;
+} sim_record_t;
+
+typedef struct {
+	long		requests;
+	long		gets;
+	long		hits;
+	long		ram_hits;
+	size_t		get_bytes;
+	size_t		hit_bytes;
+	long		puts;
+	long		stores;
+	long		passby_stores;
+	long		store_fails;
+	long		deletes;
+	long		evicts;
+} sim_stats_t;
+
+/* set by options */
+static int sim_binary = 0;
+static time_t sim_interval = 3600;
+static int sim_put_on_miss = 0;
+static size_t sim_default_size = 32 * 1024;
+static unsigned short sim_port = 0;
+static char *sim_error_log = "/dev/null";
+
+/* in child */
+static const char *sim_conf;
+static fca_server_t *sim_server;
+static fca_request_t *sim_r;
+static sim_stats_t sim_period, sim_total;
+static time_t sim_period_start;
+static long sim_last_evicts;
+
+void log_error(FILE *filp, const char *prefix, int errnum, const char *fmt, ...)
+{
+	if (prefix) {
+		fputs(prefix, filp);
+		fputs(" ", filp);
+	}
+
+	va_list args;
+	va_start(args, fmt);
+	vfprintf(filp, fmt, args);
+	va_end(args);
+
+	if (errnum) {
+		fprintf(filp, " [%s]\n", strerror(errnum));
+	} else {
+		fputs("\n", filp);
+	}
+}
+
+/* "32K" -> 32768 */
+static long sim_parse_size(const char *s)
+{
+	char *end;
+	long n = strtol(s, &end, 10);
+
+	switch (*end) {
+	case 'k': case 'K': n <<= 10; end++; break;
+	case 'm': case 'M': n <<= 20; end++; break;
+	case 'g': case 'G': n <<= 30; end++; break;
+	}
+	return (*end == '\0' && n > 0) ? n : -1;
+}
+
+static void sim_set_time(time_t now)
+{
+	if (master_timer.now != now) {
+		master_timer.now = now;
+		master_timer.format_rfc1123[0] = '\0';
+		master_timer.format_log[0] = '\0';
+	}
+	master_timer.now_ms = now * 1000;
+}
+
+/* load the configure, at the time of the first request */
+static int sim_load(void)
+{
+	unsigned short ports[SERVERS_LIMIT];
+	fca_conf_t *conf_cycle;
+	int i;
+
+	conf_cycle = conf_parse(sim_conf);
+	if (conf_cycle == NULL) {
+		return FCA_ERROR;
+	}
+	if (conf_cycle->threads < 1 || conf_cycle->threads > MASTERS_LIMIT) {
+		log_error_admin(0, "threads must be in 1~%d", MASTERS_LIMIT);
+		return FCA_ERROR;
+	}
+	master_nr = conf_cycle->threads;
+
+	if (device_conf_check(conf_cycle) != FCA_OK
+			|| server_conf_check(conf_cycle) != FCA_OK) {
+		return FCA_ERROR;
+	}
+	device_conf_load(conf_cycle);
+	server_conf_load(conf_cycle);
+	device_format_load();
+
+	if (sim_port == 0) {
+		server_dump_ports(ports);
+		for (i = 0; i < SERVERS_LIMIT && sim_port == 0; i++) {
+			sim_port = ports[i];
+		}
+	}
+	sim_server = server_by_port(sim_port);
+	if (sim_server == NULL) {
+		log_error_admin(0, "no server of port %d", sim_port);
+		return FCA_ERROR;
+	}
+
+	sim_r = calloc(1, sizeof(fca_request_t));
+	if (sim_r == NULL) {
+		log_error_admin(errno, "no mem for request");
+		return FCA_ERROR;
+	}
+	sim_r->server = sim_server;
+	return FCA_OK;
+}
+
+static void sim_stats_add(sim_stats_t *to, sim_stats_t *from)
+{
+	to->requests += from->requests;
+	to->gets += from->gets;
+	to->hits += from->hits;
+	to->ram_hits += from->ram_hits;
+	to->get_bytes += from->get_bytes;
+	to->hit_bytes += from->hit_bytes;
+	to->puts += from->puts;
+	to->stores += from->stores;
+	to->passby_stores += from->passby_stores;
+	to->store_fails += from->store_fails;
+	to->deletes += from->deletes;
+	to->evicts += from->evicts;
+}
+
+static void sim_print(FILE *out, const char *when, sim_stats_t *st)
+{
+	fca_server_shard_t *sh;
+	long item_nr = 0;
+	size_t consumed = 0;
+	double internal, external;
+	int i;
+
+	for (i = 0; i < master_nr; i++) {
+		sh = &sim_server->shards[i];
+		item_nr += sh->item_nr;
+		consumed += sh->consumed;
+	}
+	device_fragments(&internal, &external);
+
+	fprintf(out, "%s %s %ld %ld %.4f %.4f %.4f %ld %ld %ld %ld %ld %ld"
+			" %ld %lu %.3f ", sim_conf, when, st->requests, st->gets,
+			st->gets ? (double)st->hits / st->gets : 0.0,
+			st->get_bytes ? (double)st->hit_bytes / st->get_bytes : 0.0,
+			st->gets ? (double)st->ram_hits / st->gets : 0.0,
+			st->puts, st->stores, st->passby_stores, st->store_fails,
+			st->deletes, st->evicts, item_nr, consumed, internal);
+	if (external < 0) {
+		fputs("-\n", out);
+	} else {
+		fprintf(out, "%.3f\n", external);
+	}
+}
+
+static void sim_period_end(FILE *out)
+{
+	char when[32];
+	struct tm tm;
+	long evicts = 0;
+	int i;
+
+	for (i = 0; i < master_nr; i++) {
+		evicts += sim_server->shards[i].evicts;
+	}
+	sim_period.evicts = evicts - sim_last_evicts;
+	sim_last_evicts = evicts;
+
+	localtime_r(&sim_period_start, &tm);
+	strftime(when, sizeof(when), "%Y-%m-%dT%H:%M:%S", &tm);
+	sim_print(out, when, &sim_period);
+
+	sim_stats_add(&sim_total, &sim_period);
+	bzero(&sim_period, sizeof(sim_period));
+}
+
+static void sim_put(fca_request_t *r, int method, size_t length)
+{
+	int rc;
+
+	sim_period.puts++;
+
+	r->item = NULL;
+	r->method = method;
+	r->content_length = length;
+	r->put_header_length = 0;
+	r->expire = 0;
+	r->error_reason = NULL;
+
+	rc = server_request_put_handler(r);
+	if (rc == FCA_OK) {
+		sim_period.stores++;
+		r->process_size = length;
+		server_request_finalize(r);
+
+	} else if (rc == FCA_ERROR) {
+		sim_period.store_fails++;
+
+	} else if (r->error_reason && strcmp(r->error_reason, "StorePassby") == 0) {
+		sim_period.passby_stores++;
+	}
+}
+
+static void sim_get(fca_request_t *r, sim_record_t *rec)
+{
+	size_t length;
+
+	sim_period.gets++;
+
+	r->item = NULL;
+	r->hot = NULL;
+	r->hot_fill = NULL;
+	r->hot_admit = 0;
+
+	if (server_request_get_handler(r) == FCA_OK) {
+		length = rec->length ? rec->length : r->item->length;
+		length = rec->range_bytes ? rec->range_bytes : length;
+		sim_period.hits++;
+		sim_period.hit_bytes += length;
+		sim_period.get_bytes += length;
+		if (r->hot != NULL) {
+			sim_period.ram_hits++;
+		}
+		if (r->hot_admit) {
+			r->hot_fill = hot_entry_alloc(r->item->length);
+		}
+		server_request_finalize(r);
+		return;
+	}
+
+	length = rec->length ? rec->length : sim_default_size;
+	sim_period.get_bytes += rec->range_bytes ? rec->range_bytes : length;
+
+	if (sim_put_on_miss) {
+		sim_put(r, FCA_HTTP_METHOD_PUT, length);
+	}
+}
+
+static void sim_request(sim_record_t *rec, char *strs, FILE *out)
+{
+	fca_request_t *r = sim_r;
+	char *p;
+
+	/* new second */
+	if (rec->time != master_timer.now) {
+		sim_set_time(rec->time);
+		server_routine();
+		device_routine();
+	}
+	if (rec->time >= sim_period_start + sim_interval) {
+		if (sim_period.requests > 0) {
+			sim_period_end(out);
+		}
+		sim_period_start = rec->time - rec->time % sim_interval;
+	}
+
+	sim_period.requests++;
+
+	/* a writable copy, since server_request_hash_id() writes '?'
+	 * after the uri */
+	p = r->_buffer;
+	memcpy(p, strs, rec->uri_len + rec->host_len + rec->key_len);
+	r->uri.base = p;
+	r->uri.len = rec->uri_len;
+	p += rec->uri_len;
+	r->host.base = rec->host_len ? p : NULL;
+	r->host.len = rec->host_len;
+	p += rec->host_len;
+	r->fca_key.base = rec->key_len ? p : NULL;
+	r->fca_key.len = rec->key_len;
+	p += rec->key_len;
+	*p = '\0';
+
+	r->method = rec->method;
+	r->range_set = rec->range_set;
+
+	switch (rec->method) {
+	case FCA_HTTP_METHOD_GET:
+	case FCA_HTTP_METHOD_HEAD:
+		sim_get(r, rec);
+		break;
+	case FCA_HTTP_METHOD_PUT:
+	case FCA_HTTP_METHOD_POST:
+		sim_put(r, rec->method, rec->length ? rec->length : sim_default_size);
+		break;
+	case FCA_HTTP_METHOD_PURGE:
+	case FCA_HTTP_METHOD_DELETE:
+		sim_period.deletes++;
+		server_request_delete_handler(r);
+		break;
+	default:
+		break;
+	}
+}
+
+/* the child: simulate @conf with requests from @in, and print into @out */
+static int sim_child(const char *conf, FILE *in, FILE *out)
+{
+	sim_record_t rec;
+	char strs[REQ_BUF_SIZE];
+	size_t len;
+
+	sim_conf = conf;
+	admin_out_filp = stderr;
+	error_filp = fopen(sim_error_log, "a");
+	if (error_filp == NULL) {
+		perror("error in open error log");
+		return 1;
+	}
+
+	master_index = 0;
+	INIT_LIST_HEAD(&master_requests);
+	timer_init(&master_timer);
+	thread_timer = &master_timer;
+
+	while (fread(&rec, sizeof(rec), 1, in) == 1) {
+		len = rec.uri_len + rec.host_len + rec.key_len;
+		if (fread(strs, 1, len, in) != len) {
+			break;
+		}
+
+		if (sim_server == NULL) {
+			sim_set_time(rec.time);
+			if (sim_load() != FCA_OK) {
+				fprintf(stderr, "error in load %s\n", conf);
+				return 1;
+			}
+			sim_period_start = rec.time - rec.time % sim_interval;
+		}
+
+		sim_request(&rec, strs, out);
+	}
+
+	if (sim_server == NULL) {
+		return 0;
+	}
+	if (sim_period.requests > 0) {
+		sim_period_end(out);
+	}
+	sim_print(out, "total", &sim_total);
+	return 0;
+}
+
+/* parse a line of access log, as request_do_finalize() prints:
+ * "date time client code msec method uri host fca_key range ..." */
+static int sim_parse_log(char *line, sim_record_t *rec, char **strs)
+{
+	static char last_time[LEN_TIME_FARMAT_LOG];
+	static time_t last;
+	char *fields[10], *saveptr;
+	struct tm tm;
+	int i;
+
+	for (i = 0; i < 10; i++) {
+		fields[i] = strtok_r(i == 0 ? line : NULL, " \n", &saveptr);
+		if (fields[i] == NULL) {
+			return FCA_ERROR;
+		}
+	}
+
+	/* "date time", parsed by mktime() only if changed */
+	fields[1][-1] = ' ';
+	if (strcmp(fields[0], last_time) != 0) {
+		bzero(&tm, sizeof(tm));
+		if (strptime(fields[0], "%Y-%m-%d %H:%M:%S", &tm) == NULL) {
+			return FCA_ERROR;
+		}
+		tm.tm_isdst = -1;
+		last = mktime(&tm);
+		snprintf(last_time, sizeof(last_time), "%s", fields[0]);
+	}
+	rec->time = last;
+
+	for (i = 0; i < FCA_HTTP_METHOD_INVALID; i++) {
+		if (strlen(fields[5]) == http_methods[i].str.len - 1
+				&& memcmp(fields[5], http_methods[i].str.base,
+					http_methods[i].str.len - 1) == 0) {
+			break;
+		}
+	}
+	rec->method = i;
+
+	rec->range_set = strcmp(fields[9], "-") != 0;
+	rec->length = 0;
+	rec->range_bytes = 0;
+
+	strs[0] = fields[6];
+	strs[1] = strcmp(fields[7], "-") ? fields[7] : "";
+	strs[2] = strcmp(fields[8], "-") ? fields[8] : "";
+	return FCA_OK;
+}
+
+static int sim_parse_binary(fca_trace_record_t *t, sim_record_t *rec,
+		char **strs)
+{
+	static char uri[2 + HASH_ID_LEN * 2];
+	int i;
+
+	rec->time = t->time_us / 1000000;
+	rec->method = t->method < FCA_HTTP_METHOD_INVALID
+		? t->method : FCA_HTTP_METHOD_INVALID;
+	rec->length = t->length;
+	rec->range_set = t->range_start >= 0;
+	rec->range_bytes = rec->range_set && t->range_end >= t->range_start
+		? t->range_end - t->range_start + 1 : 0;
+
+	/* the key is lost, so make one from its hash id */
+	uri[0] = '/';
+	for (i = 0; i < HASH_ID_LEN; i++) {
+		sprintf(uri + 1 + i * 2, "%02x", t->hash_id[i]);
+	}
+	strs[0] = uri;
+	strs[1] = "";
+	strs[2] = "";
+	return FCA_OK;
+}
+
+static void sim_usage(void)
+{
+	fputs("Usage: fcache-sim [options] -t TRACE CONF...\n"
+		"\t-t TRACE      access log, or binary trace by -b; '-' for stdin\n"
+		"\t-b            TRACE is a binary trace\n"
+		"\t-i SECONDS    print statistics at this interval of the trace [3600]\n"
+		"\t-m            PUT after each GET miss\n"
+		"\t-z SIZE       item size if unknown in the trace [32K]\n"
+		"\t-p PORT       simulate the server of PORT [the first]\n"
+		"\t-e FILE       error log of the simulation [/dev/null]\n", stderr);
+}
+
+int main(int argc, char **argv)
+{
+	FILE *trace, *pipes[SIM_CONFS_LIMIT], *outs[SIM_CONFS_LIMIT];
+	pid_t pids[SIM_CONFS_LIMIT];
+	int fds[SIM_CONFS_LIMIT][2];
+	char *trace_file = NULL, *strs[3], *line = NULL;
+	size_t lens[3];
+	fca_trace_header_t header;
+	fca_trace_record_t t;
+	sim_record_t rec;
+	size_t line_size = 0;
+	long bad = 0;
+	int conf_nr, i, j, k, opt, status, ret = 0;
+
+	while ((opt = getopt(argc, argv, "t:bi:mz:p:e:")) != -1) {
+		switch (opt) {
+		case 't': trace_file = optarg; break;
+		case 'b': sim_binary = 1; break;
+		case 'i': sim_interval = atol(optarg); break;
+		case 'm': sim_put_on_miss = 1; break;
+		case 'z': sim_default_size = sim_parse_size(optarg); break;
+		case 'p': sim_port = atoi(optarg); break;
+		case 'e': sim_error_log = optarg; break;
+		default: sim_usage(); return 1;
+		}
+	}
+	conf_nr = argc - optind;
+	if (trace_file == NULL || conf_nr < 1 || conf_nr > SIM_CONFS_LIMIT
+			|| sim_interval <= 0 || (long)sim_default_size <= 0) {
+		sim_usage();
+		return 1;
+	}
+
+	trace = strcmp(trace_file, "-") ? fopen(trace_file, "r") : stdin;
+	if (trace == NULL) {
+		perror("error in open trace");
+		return 1;
+	}
+	if (sim_binary) {
+		if (fread(&header, sizeof(header), 1, trace) != 1
+				|| memcmp(header.magic, TRACE_MAGIC, 8) != 0
+				|| header.version != TRACE_VERSION
+				|| header.record_size != sizeof(fca_trace_record_t)) {
+			fprintf(stderr, "invalid binary trace\n");
+			return 1;
+		}
+	}
+
+	/* a child for each configure, which prints into @outs, and
+	 * the parent prints them in order at last */
+	signal(SIGPIPE, SIG_IGN);
+	for (i = 0; i < conf_nr; i++) {
+		outs[i] = tmpfile();
+		if (outs[i] == NULL || pipe(fds[i]) < 0) {
+			perror("error in create pipe");
+			return 1;
+		}
+
+		pids[i] = fork();
+		if (pids[i] < 0) {
+			perror("error in fork");
+			return 1;
+		}
+		if (pids[i] == 0) {
+			for (j = 0; j <= i; j++) {
+				close(fds[j][1]);
+			}
+			trace = fdopen(fds[i][0], "r");
+			setvbuf(trace, NULL, _IOFBF, SIM_PIPE_BUFFER);
+			ret = sim_child(argv[optind + i], trace, outs[i]);
+			fflush(outs[i]);
+			_exit(ret);
+		}
+
+		close(fds[i][0]);
+		pipes[i] = fdopen(fds[i][1], "w");
+		setvbuf(pipes[i], NULL, _IOFBF, SIM_PIPE_BUFFER);
+	}
+
+	while (1) {
+		if (sim_binary) {
+			if (fread(&t, sizeof(t), 1, trace) != 1) {
+				break;
+			}
+			sim_parse_binary(&t, &rec, strs);
+		} else {
+			if (getline(&line, &line_size, trace) < 0) {
+				break;
+			}
+			if (sim_parse_log(line, &rec, strs) != FCA_OK) {
+				bad++;
+				continue;
+			}
+		}
+
+		/* the key must fit in server_request_hash_id() */
+		for (k = 0; k < 3; k++) {
+			lens[k] = strlen(strs[k]);
+		}
+		if (lens[0] == 0 || lens[0] + lens[1] + lens[2] >= REQ_BUF_SIZE / 2) {
+			bad++;
+			continue;
+		}
+		rec.uri_len = lens[0];
+		rec.host_len = lens[1];
+		rec.key_len = lens[2];
+
+		for (i = 0; i < conf_nr; i++) {
+			if (pipes[i] == NULL) {
+				continue;
+			}
+			if (fwrite(&rec, sizeof(rec), 1, pipes[i]) != 1
+					|| fwrite(strs[0], 1, lens[0], pipes[i]) != lens[0]
+					|| fwrite(strs[1], 1, lens[1], pipes[i]) != lens[1]
+					|| fwrite(strs[2], 1, lens[2], pipes[i]) != lens[2]) {
+				/* the child quits */
+				fclose(pipes[i]);
+				pipes[i] = NULL;
+			}
+		}
+	}
+	if (bad) {
+		fprintf(stderr, "%ld invalid requests skipped\n", bad);
+	}
+
+	for (i = 0; i < conf_nr; i++) {
+		if (pipes[i] != NULL) {
+			fclose(pipes[i]);
+		}
+	}
+
+	printf("# config time requests gets hit_ratio byte_hit_ratio ram_hit_ratio"
+			" puts stores passby_stores store_fails deletes evicts"
+			" items consumed internal_frag external_frag\n");
+	for (i = 0; i < conf_nr; i++) {
+		waitpid(pids[i], &status, 0);
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			fprintf(stderr, "simulation of %s fails\n", argv[optind + i]);
+			ret = 1;
+			continue;
+		}
+		rewind(outs[i]);
+		while (getline(&line, &line_size, outs[i]) > 0) {
+			fputs(line, stdout);
+		}
+	}
+	return ret;
+}
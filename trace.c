@@ -0,0 +1,310 @@
+/*
+ * Binary access trace of requests, see trace.h.
+ *
+ * Author: Wu Bingzheng
+ *
+ */
+
+#include "trace.h"
+
+/* the trace thread writes the buffers at this interval */
+#define TRACE_FLUSH_USEC	10000
+
+/* closed traces are freed after this, when masters do not put
+ * records into them any more */
+#define TRACE_CLOSE_DELAY	2
+
+_Static_assert(sizeof(fca_trace_record_t) == 56, "fca_trace_record_t grows");
+
+static LIST_HEAD(traces);
+static pthread_mutex_t traces_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t trace_tid;
+static int trace_running = 0;
+static int trace_quit = 0;
+
+static void trace_free(fca_trace_t *t)
+{
+	int i;
+
+	if (t->fd >= 0) {
+		close(t->fd);
+	}
+	for (i = 0; i < MASTERS_LIMIT; i++) {
+		free(t->buffers[i]);
+	}
+	free(t);
+}
+
+/* cut the @partial bytes of a record at the end of file, written by
+ * a short write, or else all the records after would be misaligned.
+ * If it fails, stop writing till the trace is replaced by reload. */
+static void trace_cut_partial(fca_trace_t *t, size_t partial)
+{
+	off_t end;
+
+	if (partial == 0) {
+		return;
+	}
+	end = lseek(t->fd, 0, SEEK_END);
+	if (end < 0 || ftruncate(t->fd, end - partial) < 0) {
+		log_error_run(errno, "truncate trace %s, stop it", t->path);
+		t->stopped = 1;
+	}
+}
+
+/* write the records in @b into the file */
+static void trace_flush_buffer(fca_trace_t *t, fca_trace_buffer_t *b)
+{
+	unsigned long head = b->head;
+	unsigned long tail = __atomic_load_n(&b->tail, __ATOMIC_ACQUIRE);
+	unsigned long begin, n, whole;
+	ssize_t len, done;
+
+	while (head != tail) {
+		/* till the end of the buffer, at most */
+		begin = head & (TRACE_BUFFER_RECORDS - 1);
+		n = tail - head;
+		if (n > TRACE_BUFFER_RECORDS - begin) {
+			n = TRACE_BUFFER_RECORDS - begin;
+		}
+
+		len = sizeof(fca_trace_record_t) * n;
+		done = t->stopped ? -1 : write(t->fd, &b->records[begin], len);
+		if (done == len) {
+			t->records += n;
+		} else {
+			if (t->write_errors == 0 && !t->stopped) {
+				log_error_run(errno, "write trace %s", t->path);
+			}
+			if (done > 0) {
+				whole = done / sizeof(fca_trace_record_t);
+				t->records += whole;
+				t->write_errors += n - whole;
+				trace_cut_partial(t, done % sizeof(fca_trace_record_t));
+			} else {
+				t->write_errors += n;
+			}
+		}
+		head += n;
+	}
+
+	__atomic_store_n(&b->head, head, __ATOMIC_RELEASE);
+}
+
+/* The records are written out of @traces_lock, which the masters
+ * take, so a slow disk does not stall them. Only this thread deletes
+ * traces from the list, so @t is kept while being written. */
+static void trace_round(int final)
+{
+	struct list_head *p;
+	fca_trace_t *t;
+	time_t now = time(NULL), closed;
+	int i;
+
+	pthread_mutex_lock(&traces_lock);
+	p = traces.next;
+	pthread_mutex_unlock(&traces_lock);
+
+	while (p != &traces) {
+		t = list_entry(p, fca_trace_t, tnode);
+
+		for (i = 0; i < master_nr; i++) {
+			trace_flush_buffer(t, t->buffers[i]);
+		}
+
+		pthread_mutex_lock(&traces_lock);
+		p = p->next;
+		closed = t->closed;
+		if (closed != 0 && (final || now - closed >= TRACE_CLOSE_DELAY)) {
+			list_del(&t->tnode);
+		} else {
+			closed = 0;
+		}
+		pthread_mutex_unlock(&traces_lock);
+
+		if (closed != 0) {
+			trace_free(t);
+		}
+	}
+}
+
+static void *trace_thread(void *data)
+{
+	fca_timer_t timer;
+
+	timer_init(&timer);
+	thread_timer = &timer;
+
+	while (!__atomic_load_n(&trace_quit, __ATOMIC_ACQUIRE)) {
+		usleep(TRACE_FLUSH_USEC);
+		timer_refresh(&timer);
+		trace_round(0);
+	}
+	return NULL;
+}
+
+/* open the trace file, and write the header if it's new. The trace
+ * thread is started at the first time. */
+fca_trace_t *trace_open(const char *path)
+{
+	fca_trace_header_t header;
+	fca_trace_t *t;
+	struct stat st;
+	int i, err;
+
+	t = calloc(1, sizeof(fca_trace_t));
+	if (t == NULL) {
+		return NULL;
+	}
+	INIT_LIST_HEAD(&t->tnode);
+	strcpy(t->path, path);
+
+	t->fd = open(path, O_WRONLY | O_APPEND | O_CREAT, 0644);
+	if (t->fd < 0 || fstat(t->fd, &st) < 0) {
+		goto fail;
+	}
+	if (st.st_size == 0) {
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+		header.version = TRACE_VERSION;
+		header.record_size = sizeof(fca_trace_record_t);
+		if (write(t->fd, &header, sizeof(header)) != sizeof(header)) {
+			goto fail;
+		}
+	}
+
+	for (i = 0; i < master_nr; i++) {
+		t->buffers[i] = malloc(sizeof(fca_trace_buffer_t));
+		if (t->buffers[i] == NULL) {
+			goto fail;
+		}
+		t->buffers[i]->head = 0;
+		t->buffers[i]->tail = 0;
+		t->buffers[i]->drops = 0;
+	}
+
+	if (!trace_running) {
+		if (pthread_create(&trace_tid, NULL, trace_thread, NULL) != 0) {
+			goto fail;
+		}
+		trace_running = 1;
+	}
+
+	pthread_mutex_lock(&traces_lock);
+	list_add_tail(&t->tnode, &traces);
+	pthread_mutex_unlock(&traces_lock);
+	return t;
+
+fail:
+	err = errno;
+	trace_free(t);
+	errno = err;
+	return NULL;
+}
+
+/* the trace thread writes the remaining records, and frees it later */
+void trace_close(fca_trace_t *t)
+{
+	pthread_mutex_lock(&traces_lock);
+	if (list_empty(&t->tnode)) {
+		pthread_mutex_unlock(&traces_lock);
+		trace_free(t);
+		return;
+	}
+	t->closed = time(NULL);
+	pthread_mutex_unlock(&traces_lock);
+}
+
+/* put a record of @r into the master's buffer, or drop it if full.
+ * Called in master threads, before the item is released. */
+void trace_request(fca_trace_t *t, fca_request_t *r, time_t now)
+{
+	fca_trace_buffer_t *b = t->buffers[master_index];
+	fca_trace_record_t *rec;
+	unsigned long tail = b->tail;
+	int sample = r->server->trace_log_sample;
+	struct timespec ts;
+	time_t latency;
+
+	/* requests without key, e.g. bad ones, are useless for replay */
+	if (!r->hash_set) {
+		return;
+	}
+
+	/* by the key, so all requests of a sampled key are traced */
+	if (sample > 1 && *(uint64_t *)r->hash_id % sample != 0) {
+		return;
+	}
+
+	if (tail - __atomic_load_n(&b->head, __ATOMIC_ACQUIRE) >= TRACE_BUFFER_RECORDS) {
+		b->drops++;
+		return;
+	}
+	rec = &b->records[tail & (TRACE_BUFFER_RECORDS - 1)];
+
+	latency = r->start_time ? now - r->start_time : 0;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	rec->time_us = ts.tv_sec * 1000000L + ts.tv_nsec / 1000 - latency;
+	memcpy(rec->hash_id, r->hash_id, sizeof(rec->hash_id));
+	rec->method = r->method;
+	rec->_pad = 0;
+	rec->status = r->http_code;
+	rec->latency_us = latency < UINT32_MAX ? latency : UINT32_MAX;
+
+	if (r->item != NULL) {
+		rec->length = r->item->length;
+	} else if ((r->method == FCA_HTTP_METHOD_PUT || r->method == FCA_HTTP_METHOD_POST)
+			&& r->content_length > 0) {
+		rec->length = r->content_length + r->put_header_length;
+	} else {
+		rec->length = 0;
+	}
+
+	if (r->range_set) {
+		rec->range_start = r->range_start;
+		rec->range_end = r->range_end;
+	} else {
+		rec->range_start = -1;
+		rec->range_end = -1;
+	}
+
+	__atomic_store_n(&b->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+/* stop the thread, and write the remaining records */
+void trace_stop(void)
+{
+	if (!trace_running) {
+		return;
+	}
+	__atomic_store_n(&trace_quit, 1, __ATOMIC_RELEASE);
+	pthread_join(trace_tid, NULL);
+	trace_running = 0;
+
+	trace_round(1);
+}
+
+void trace_status(FILE *filp)
+{
+	struct list_head *p;
+	fca_trace_t *t;
+	long drops;
+	int i;
+
+	fputs("\n* trace records drops write_errors\n", filp);
+
+	pthread_mutex_lock(&traces_lock);
+	list_for_each(p, &traces) {
+		t = list_entry(p, fca_trace_t, tnode);
+		if (t->closed != 0) {
+			continue;
+		}
+		drops = 0;
+		for (i = 0; i < master_nr; i++) {
+			drops += t->buffers[i]->drops;
+		}
+		fprintf(filp, "** %s %ld %ld %ld\n", t->path, t->records,
+				drops, t->write_errors);
+	}
+	pthread_mutex_unlock(&traces_lock);
+}
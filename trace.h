@@ -0,0 +1,81 @@
+/*
+ * Binary access trace: a header, and then fixed-size records, one
+ * for each request with a key. It's much smaller and faster to
+ * parse than the access log, and carries the item length which the
+ * access log does not, so fcache-sim replays it more exactly.
+ *
+ * Master threads put records into their own lock-free buffers, and
+ * a background thread writes them into the trace file. Records are
+ * dropped if the buffer is full, but never block the masters.
+ *
+ * Author: Wu Bingzheng
+ *
+ */
+
+#ifndef _FCA_TRACE_H_
+#define _FCA_TRACE_H_
+
+#include "fcache.h"
+
+#define TRACE_MAGIC		"FCATRACE"
+#define TRACE_VERSION		1
+
+typedef struct {
+	char		magic[8];	/* TRACE_MAGIC, without '\0' */
+	uint32_t	version;
+	uint32_t	record_size;	/* sizeof(fca_trace_record_t) */
+} fca_trace_header_t;
+
+typedef struct {
+	uint64_t	time_us;	/* wall clock of the request */
+	unsigned char	hash_id[16];	/* of the key, HASH_ID_LEN used */
+	uint8_t		method;		/* FCA_HTTP_METHOD_xxx */
+	uint8_t		_pad;
+	uint16_t	status;		/* HTTP code */
+	uint32_t	latency_us;
+	uint64_t	length;		/* of the item, 0 if unknown */
+	int64_t		range_start;	/* -1 if not Range request */
+	int64_t		range_end;
+} fca_trace_record_t;
+
+/* records of each master thread, a power of 2 */
+#define TRACE_BUFFER_RECORDS	(64 * 1024)
+
+/* for one master thread to put, and the trace thread to write */
+typedef struct {
+	/* trace thread side */
+	unsigned long		head;
+	char			_pad1[RING_CACHE_LINE - sizeof(unsigned long)];
+
+	/* master thread side */
+	unsigned long		tail;
+	long			drops;
+	char			_pad2[RING_CACHE_LINE - 2 * sizeof(unsigned long)];
+
+	fca_trace_record_t	records[TRACE_BUFFER_RECORDS];
+} fca_trace_buffer_t;
+
+struct fca_trace_s {
+	struct list_head	tnode;
+	int			fd;
+	char			path[PATH_LENGTH];
+
+	/* freed by the trace thread a while after closed, since
+	 * masters may be still putting records */
+	time_t			closed;
+
+	/* by the trace thread */
+	long			records;
+	long			write_errors;
+	int			stopped;	/* by a partial record left */
+
+	fca_trace_buffer_t	*buffers[MASTERS_LIMIT];
+};
+
+fca_trace_t *trace_open(const char *path);
+void trace_close(fca_trace_t *t);
+void trace_request(fca_trace_t *t, fca_request_t *r, time_t now);
+void trace_stop(void);
+void trace_status(FILE *filp);
+
+#endif
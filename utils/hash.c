@@ -1,5 +1,16 @@
 /*
- * Linear dynamic hashing
+ * Open addressing hashing, with cache-line-sized buckets.
+ *
+ * Nodes are objects in a fca_pool_t, and each bucket holds 12 node
+ * handles, and 12 one-byte tags from the hash id, which are compared
+ * at once by SSE2. So a lookup reads one cache line usually, and
+ * dereferences only the candidates.
+ * Buckets are probed linearly. Each bucket counts the items which
+ * pass by it because it was full, and a lookup stops at a bucket
+ * whose count is 0.
+ *
+ * The table doubles or halves incrementally: after a resize, each
+ * operation migrates a few buckets from the previous table.
  *
  * MurmurHash3 x64-versoin is used to calculate string into hash-key.
  * MurmurHash3 was written by Austin Appleby, and is placed in the public
@@ -12,8 +23,10 @@
 #include <stdint.h>
 #include <string.h>
 #include <stdlib.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "hash.h"
-#include "list.h"
 
 /* == MurmurHash3 begins == */
 
@@ -111,37 +124,186 @@ static void MurmurHash3_x64_128(const void * key, const int len, void *out)
 
 /* == hash begins == */
 
-typedef int hindex_t;
+typedef long hindex_t;
 
 /* hash bucket size range from 2^4 to 2^28*/
 #define HASH_BUCKET_SIZE_BEGIN	(1<<4)
 #define HASH_BUCKET_SIZE_MAX	(1<<28)
 
+#define HASH_SLOTS		12
+#define HASH_SLOTS_MASK		((1 << HASH_SLOTS) - 1)
+#define HASH_OVERFLOW_MAX	255
+
+/* buckets migrated in each operation, in resize process */
+#define HASH_MIGRATE_STEP	2
+
+typedef struct {
+	uint8_t			tags[HASH_SLOTS]; /* 0 for empty slot */
+	uint8_t			overflow;
+	uint8_t			_pad[3];
+	fca_handle_t		nodes[HASH_SLOTS];
+} fca_hash_bucket_t;
+
 struct fca_hash_s {
-	struct hlist_head	*buckets;
+	fca_pool_t		*pool;
+
+	fca_hash_bucket_t	*buckets;
 	hindex_t		bucket_size;
 	long			items;
 
-	/* previous buckets, in split process */
-	struct hlist_head	*prev_buckets;
-	/* split pointer in linear hashing */
-	hindex_t		split;
+	/* previous buckets, in resize process */
+	fca_hash_bucket_t	*prev_buckets;
+	hindex_t		prev_bucket_size;
+	/* the next previous bucket to migrate */
+	hindex_t		migrate;
 };
 
 inline static int key_equal(unsigned char *id1, unsigned char *id2)
 {
 	uint64_t *p = (uint64_t *)id1;
 	uint64_t *q = (uint64_t *)id2;
-	return (*p == *q) && (*(p+1) == *(q+1));
+	return (*p == *q) && (*(uint32_t *)(p+1) == *(uint32_t *)(q+1));
 }
 
-inline static hindex_t hash_index(fca_hash_t *hash, unsigned char *id)
+/* the lower bits of the first 64 bits are used as index, and the
+ * highest 8 bits as tag. The last 32 bits are used by shards. */
+inline static hindex_t hash_index(hindex_t bucket_size, unsigned char *id)
 {
 	uint64_t *p = (uint64_t *)id;
-	return (*p) & (hash->bucket_size - 1);
+	return (*p) & (bucket_size - 1);
+}
+
+inline static uint8_t hash_tag(unsigned char *id)
+{
+	uint8_t tag = ((uint64_t *)id)[0] >> 56;
+	return tag ? tag : 1;
+}
+
+/* return bitmap of slots whose tag is @tag */
+inline static unsigned bucket_match(fca_hash_bucket_t *b, uint8_t tag)
+{
+#ifdef __SSE2__
+	__m128i tags = _mm_load_si128((__m128i *)b->tags);
+	__m128i eq = _mm_cmpeq_epi8(tags, _mm_set1_epi8(tag));
+	return _mm_movemask_epi8(eq) & HASH_SLOTS_MASK;
+#else
+	unsigned mask = 0;
+	int i;
+	for (i = 0; i < HASH_SLOTS; i++) {
+		if (b->tags[i] == tag) {
+			mask |= 1 << i;
+		}
+	}
+	return mask;
+#endif
+}
+
+static fca_hash_bucket_t *buckets_alloc(hindex_t bucket_size)
+{
+	void *buckets;
+	size_t size = bucket_size * sizeof(fca_hash_bucket_t);
+
+	if (posix_memalign(&buckets, sizeof(fca_hash_bucket_t), size) != 0) {
+		return NULL;
+	}
+	memset(buckets, 0, size);
+	return buckets;
+}
+
+static int buckets_insert(fca_hash_bucket_t *buckets, hindex_t bucket_size,
+		fca_hash_node_t *hnode, fca_handle_t h)
+{
+	hindex_t index = hash_index(bucket_size, hnode->id);
+	fca_hash_bucket_t *b;
+	unsigned empty;
+	hindex_t i;
+	int slot;
+
+	for (i = 0; i < bucket_size; i++) {
+		b = &buckets[(index + i) & (bucket_size - 1)];
+
+		empty = bucket_match(b, 0);
+		if (empty) {
+			slot = __builtin_ctz(empty);
+			b->tags[slot] = hash_tag(hnode->id);
+			b->nodes[slot] = h;
+			return 0;
+		}
+
+		if (b->overflow < HASH_OVERFLOW_MAX) {
+			b->overflow++;
+		}
+	}
+	return -1;
+}
+
+static fca_hash_node_t *buckets_search(fca_pool_t *pool,
+		fca_hash_bucket_t *buckets, hindex_t bucket_size, unsigned char *id)
+{
+	hindex_t index = hash_index(bucket_size, id);
+	uint8_t tag = hash_tag(id);
+	fca_hash_bucket_t *b;
+	fca_hash_node_t *hnode;
+	unsigned match;
+	hindex_t i;
+
+	for (i = 0; i < bucket_size; i++) {
+		b = &buckets[(index + i) & (bucket_size - 1)];
+
+		for (match = bucket_match(b, tag); match; match &= match - 1) {
+			hnode = pool_ptr(pool, b->nodes[__builtin_ctz(match)]);
+			if (key_equal(hnode->id, id)) {
+				return hnode;
+			}
+		}
+
+		if (b->overflow == 0) {
+			break;
+		}
+	}
+	return NULL;
 }
 
-fca_hash_t *hash_init(void)
+static int buckets_remove(fca_hash_bucket_t *buckets, hindex_t bucket_size,
+		fca_hash_node_t *hnode, fca_handle_t h)
+{
+	hindex_t index = hash_index(bucket_size, hnode->id);
+	uint8_t tag = hash_tag(hnode->id);
+	fca_hash_bucket_t *b;
+	unsigned match;
+	hindex_t i, j;
+	int slot;
+
+	for (i = 0; i < bucket_size; i++) {
+		b = &buckets[(index + i) & (bucket_size - 1)];
+
+		for (match = bucket_match(b, tag); match; match &= match - 1) {
+			slot = __builtin_ctz(match);
+			if (b->nodes[slot] != h) {
+				continue;
+			}
+
+			b->tags[slot] = 0;
+			b->nodes[slot] = 0;
+
+			/* the buckets passed by in insertion */
+			for (j = 0; j < i; j++) {
+				b = &buckets[(index + j) & (bucket_size - 1)];
+				if (b->overflow < HASH_OVERFLOW_MAX) {
+					b->overflow--;
+				}
+			}
+			return 0;
+		}
+
+		if (b->overflow == 0) {
+			break;
+		}
+	}
+	return -1;
+}
+
+fca_hash_t *hash_init(fca_pool_t *pool)
 {
 	fca_hash_t *hash;
 
@@ -150,13 +312,14 @@ fca_hash_t *hash_init(void)
 		return NULL;
 	}
 
+	hash->pool = pool;
 	hash->items = 0;
-	hash->split = 0;
+	hash->migrate = 0;
 	hash->prev_buckets = NULL;
+	hash->prev_bucket_size = 0;
 	hash->bucket_size = HASH_BUCKET_SIZE_BEGIN;
 
-	/* @calloc do the same thing with INIT_HLIST_HEAD. */
-	hash->buckets = calloc(hash->bucket_size, sizeof(struct hlist_head));
+	hash->buckets = buckets_alloc(hash->bucket_size);
 	if (hash->buckets == NULL) {
 		free(hash);
 		return NULL;
@@ -174,102 +337,127 @@ void hash_destroy(fca_hash_t *hash)
 	free(hash);
 }
 
-/* expansion: double the hash buckets */
-static void hash_expansion(fca_hash_t *hash)
+/* move nodes in @n previous buckets into current buckets */
+static void hash_migrate(fca_hash_t *hash, hindex_t n)
 {
+	fca_hash_bucket_t *b;
 	fca_hash_node_t *hnode;
-	struct hlist_node *p, *safe;
-	void *newb;
+	fca_handle_t h;
+	unsigned used;
+
+	while (n-- > 0 && hash->migrate < hash->prev_bucket_size) {
+		b = &hash->prev_buckets[hash->migrate];
+
+		for (used = ~bucket_match(b, 0) & HASH_SLOTS_MASK; used;
+				used &= used - 1) {
+			h = b->nodes[__builtin_ctz(used)];
+			hnode = pool_ptr(hash->pool, h);
+
+			/* keep it in the previous buckets if fails, and
+			 * try again later */
+			if (buckets_insert(hash->buckets, hash->bucket_size,
+						hnode, h) != 0) {
+				return;
+			}
+			buckets_remove(hash->prev_buckets, hash->prev_bucket_size, hnode, h);
+		}
 
-#define HASH_COLLISIONS 10
-	/* expansion */
-	if (hash->items / hash->bucket_size >= HASH_COLLISIONS
-			&& hash->prev_buckets == NULL
-			&& hash->bucket_size < HASH_BUCKET_SIZE_MAX) {
+		hash->migrate++;
+	}
 
-		newb = calloc(hash->bucket_size * 2, sizeof(struct hlist_head));
-		if (newb == NULL) {
-			/* if calloc fails, do nothing */
-			return;
-		}
-		hash->bucket_size *= 2;
-		hash->prev_buckets = hash->buckets;
-		hash->buckets = newb;
-		hash->split = 0;
+	if (hash->migrate == hash->prev_bucket_size) {
+		/* resize finish */
+		free(hash->prev_buckets);
+		hash->prev_buckets = NULL;
+		hash->prev_bucket_size = 0;
 	}
+}
+
+/* double the buckets if too full, or halve if too empty */
+static void hash_resize(fca_hash_t *hash)
+{
+	long capacity = hash->bucket_size * HASH_SLOTS;
+	hindex_t new_size;
+	fca_hash_bucket_t *newb;
 
-	/* split a bucket */
 	if (hash->prev_buckets != NULL) {
+		hash_migrate(hash, HASH_MIGRATE_STEP);
+		return;
+	}
 
-		for (p = hash->prev_buckets[hash->split].first; p; p = safe) {
-			safe = p->next;
-			hlist_del(p);
+	if (hash->items * 8 >= capacity * 7
+			&& hash->bucket_size < HASH_BUCKET_SIZE_MAX) {
+		new_size = hash->bucket_size * 2;
 
-			hnode = list_entry(p, fca_hash_node_t, node);
-			hlist_add_head(p, &hash->buckets[hash_index(hash, hnode->id)]);
-		}
+	} else if (hash->items * 8 < capacity
+			&& hash->bucket_size > HASH_BUCKET_SIZE_BEGIN) {
+		new_size = hash->bucket_size / 2;
 
-		hash->split++;
-		if (hash->split == hash->bucket_size / 2) {
-			/* expansion finish */
-			free(hash->prev_buckets);
-			hash->prev_buckets = NULL;
-		}
+	} else {
+		return;
 	}
+
+	newb = buckets_alloc(new_size);
+	if (newb == NULL) {
+		/* if alloc fails, do nothing */
+		return;
+	}
+	hash->prev_buckets = hash->buckets;
+	hash->prev_bucket_size = hash->bucket_size;
+	hash->buckets = newb;
+	hash->bucket_size = new_size;
+	hash->migrate = 0;
 }
 
-void hash_add(fca_hash_t *hash, fca_hash_node_t *hnode, unsigned char *str, int len)
+/* return -1 if the table is full, and resize fails */
+int hash_add(fca_hash_t *hash, fca_hash_node_t *hnode, unsigned char *str, int len)
 {
+	unsigned char id[16];
+
 	if (str) {
-		MurmurHash3_x64_128(str, len, hnode->id);
+		hash_make_id(str, len, id);
+		memcpy(hnode->id, id, HASH_ID_LEN);
 	}
 
-	hlist_add_head(&hnode->node, &hash->buckets[hash_index(hash, hnode->id)]);
+	hash_resize(hash);
 
+	if (buckets_insert(hash->buckets, hash->bucket_size, hnode,
+				pool_handle(hash->pool, hnode)) != 0) {
+		return -1;
+	}
 	hash->items++;
-	hash_expansion(hash);
+	return 0;
 }
 
-static fca_hash_node_t *hash_search(struct hlist_head *slot, unsigned char *id)
+/* only the first HASH_ID_LEN bytes are used, and the rest are zeroed */
+void hash_make_id(unsigned char *str, int len, unsigned char *hash_id)
 {
-	struct hlist_node *p;
-	fca_hash_node_t *hnode;
-
-	hlist_for_each(p, slot) {
-		hnode = list_entry(p, fca_hash_node_t, node);
-		if (key_equal(hnode->id, id)) {
-			return hnode;
-		}
-	}
-
-	return NULL;
+	MurmurHash3_x64_128(str, len, hash_id);
+	memset(hash_id + HASH_ID_LEN, 0, 16 - HASH_ID_LEN);
 }
 
+/* if @str is NULL, @hash_id is the input, made by hash_make_id() */
 fca_hash_node_t *hash_get(fca_hash_t *hash, unsigned char *str, int len, unsigned char *hash_id)
 {
 	unsigned char id_buf[16];
 	unsigned char *id;
-	hindex_t index;
-	hindex_t pbsize;
 	fca_hash_node_t *ret;
 
-	hash_expansion(hash);
+	hash_resize(hash);
 
 	id = hash_id ? hash_id : id_buf;
-	MurmurHash3_x64_128(str, len, id);
-	index = hash_index(hash, id);
+	if (str) {
+		hash_make_id(str, len, id);
+	}
 
-	ret = hash_search(&hash->buckets[index], id);
+	ret = buckets_search(hash->pool, hash->buckets, hash->bucket_size, id);
 	if (ret != NULL) {
 		return ret;
 	}
 
 	if (hash->prev_buckets != NULL) {
-		pbsize = hash->bucket_size / 2;
-		if (index >= pbsize) {
-			index -= pbsize;
-		}
-		return hash_search(&hash->prev_buckets[index], id);
+		return buckets_search(hash->pool, hash->prev_buckets,
+				hash->prev_bucket_size, id);
 	}
 
 	return NULL;
@@ -277,6 +465,22 @@ fca_hash_node_t *hash_get(fca_hash_t *hash, unsigned char *str, int len, unsigne
 
 void hash_del(fca_hash_t *hash, fca_hash_node_t *hnode)
 {
-	hlist_del(&hnode->node);
+	fca_handle_t h = pool_handle(hash->pool, hnode);
+
+	if (buckets_remove(hash->buckets, hash->bucket_size, hnode, h) != 0
+			&& (hash->prev_buckets == NULL
+				|| buckets_remove(hash->prev_buckets,
+					hash->prev_bucket_size, hnode, h) != 0)) {
+		return;
+	}
+
 	hash->items--;
+	hash_resize(hash);
+}
+
+/* memory of the buckets */
+size_t hash_memory(fca_hash_t *hash)
+{
+	return (hash->bucket_size + hash->prev_bucket_size)
+		* sizeof(fca_hash_bucket_t) + sizeof(fca_hash_t);
 }
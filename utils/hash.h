@@ -1,5 +1,5 @@
 /*
- * Linear dynamic hashing
+ * Open addressing hashing, with cache-line-sized buckets
  *
  * Author: Wu Bingzheng
  *
@@ -8,20 +8,27 @@
 #ifndef _HASH_H_
 #define _HASH_H_
 
-#include "list.h"
+#include <stddef.h>
+#include "pool.h"
 
 typedef struct fca_hash_s fca_hash_t;
 
+/* 96 bits are enough to identify an item */
+#define HASH_ID_LEN	12
+
+/* the table keeps handles of nodes, so no link in node.
+ * The node must be at the beginning of an object in the pool. */
 typedef struct {
-	unsigned char		id[16];
-	struct hlist_node	node;
+	unsigned char		id[HASH_ID_LEN];
 } fca_hash_node_t;
 
-fca_hash_t *hash_init();
+fca_hash_t *hash_init(fca_pool_t *pool);
 void hash_destroy(fca_hash_t *hash);
 
-void hash_add(fca_hash_t *hash, fca_hash_node_t *hnode, unsigned char *str, int len);
+void hash_make_id(unsigned char *str, int len, unsigned char *hash_id);
+int hash_add(fca_hash_t *hash, fca_hash_node_t *hnode, unsigned char *str, int len);
 fca_hash_node_t *hash_get(fca_hash_t *hash, unsigned char *str, int len, unsigned char *hash_id);
 void hash_del(fca_hash_t *hash, fca_hash_node_t *hnode);
+size_t hash_memory(fca_hash_t *hash);
 
 #endif
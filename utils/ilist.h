@@ -0,0 +1,119 @@
+/*
+ * Doubly linked list of objects in a fca_pool_t, linked by 32-bit
+ * handles instead of pointers. It is not circular, and 0 is the end.
+ *
+ * The list functions take @offset, the place of fca_ilist_node_t in
+ * the object.
+ *
+ * Author: Wu Bingzheng
+ *
+ */
+
+#ifndef _FCA_ILIST_H_
+#define _FCA_ILIST_H_
+
+#include "pool.h"
+
+typedef struct {
+	fca_handle_t	prev;
+	fca_handle_t	next;
+} fca_ilist_node_t;
+
+typedef struct {
+	fca_handle_t	first;
+	fca_handle_t	last;
+} fca_ilist_head_t;
+
+static inline void INIT_ILIST_HEAD(fca_ilist_head_t *head)
+{
+	head->first = head->last = 0;
+}
+
+static inline int ilist_empty(fca_ilist_head_t *head)
+{
+	return head->first == 0;
+}
+
+static inline fca_ilist_node_t *ilist_node(fca_pool_t *pool,
+		size_t offset, fca_handle_t h)
+{
+	return (fca_ilist_node_t *)((char *)pool_ptr(pool, h) + offset);
+}
+
+static inline fca_handle_t ilist_next(fca_pool_t *pool, size_t offset,
+		fca_handle_t h)
+{
+	return ilist_node(pool, offset, h)->next;
+}
+
+static inline fca_handle_t ilist_prev(fca_pool_t *pool, size_t offset,
+		fca_handle_t h)
+{
+	return ilist_node(pool, offset, h)->prev;
+}
+
+/**
+ * ilist_insert - insert @h between @prev and @next, which are adjacent.
+ * 0 @prev or @next means the beginning or the end.
+ */
+static inline void ilist_insert(fca_pool_t *pool, size_t offset,
+		fca_ilist_head_t *head, fca_handle_t h,
+		fca_handle_t prev, fca_handle_t next)
+{
+	fca_ilist_node_t *node = ilist_node(pool, offset, h);
+
+	node->prev = prev;
+	node->next = next;
+
+	if (prev != 0) {
+		ilist_node(pool, offset, prev)->next = h;
+	} else {
+		head->first = h;
+	}
+	if (next != 0) {
+		ilist_node(pool, offset, next)->prev = h;
+	} else {
+		head->last = h;
+	}
+}
+
+/* insert @h at the beginning */
+static inline void ilist_add(fca_pool_t *pool, size_t offset,
+		fca_ilist_head_t *head, fca_handle_t h)
+{
+	ilist_insert(pool, offset, head, h, 0, head->first);
+}
+
+/* insert @h at the end */
+static inline void ilist_add_tail(fca_pool_t *pool, size_t offset,
+		fca_ilist_head_t *head, fca_handle_t h)
+{
+	ilist_insert(pool, offset, head, h, head->last, 0);
+}
+
+/* insert @h after @pos */
+static inline void ilist_add_after(fca_pool_t *pool, size_t offset,
+		fca_ilist_head_t *head, fca_handle_t h, fca_handle_t pos)
+{
+	ilist_insert(pool, offset, head, h, pos,
+			ilist_next(pool, offset, pos));
+}
+
+static inline void ilist_del(fca_pool_t *pool, size_t offset,
+		fca_ilist_head_t *head, fca_handle_t h)
+{
+	fca_ilist_node_t *node = ilist_node(pool, offset, h);
+
+	if (node->prev != 0) {
+		ilist_node(pool, offset, node->prev)->next = node->next;
+	} else {
+		head->first = node->next;
+	}
+	if (node->next != 0) {
+		ilist_node(pool, offset, node->next)->prev = node->prev;
+	} else {
+		head->last = node->prev;
+	}
+}
+
+#endif
@@ -0,0 +1,125 @@
+/*
+ * Objects of the same size, in big chunks, addressed by 32-bit
+ * handles instead of pointers, in order to save memory.
+ *
+ * Each chunk holds POOL_CHUNK_OBJS objects, after a header which
+ * records the chunk's index. Chunks are aligned by their size, so
+ * the handle of an object can be calculated from its address.
+ * Chunks are mapped, and pages are touched only when used. Chunks
+ * are never freed.
+ *
+ * Author: Wu Bingzheng
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "pool.h"
+
+void pool_init(fca_pool_t *pool, unsigned obj_size)
+{
+	size_t need = POOL_CHUNK_HEADER + (size_t)obj_size * POOL_CHUNK_OBJS;
+
+	pool->obj_size = obj_size;
+	pool->chunk_size = 1;
+	while (pool->chunk_size < need) {
+		pool->chunk_size <<= 1;
+	}
+	pool->chunks = NULL;
+	pool->chunk_nr = 0;
+	pool->chunk_alloc = 0;
+	pool->bump = POOL_CHUNK_OBJS;
+	pool->free_head = 0;
+	pool->obj_nr = 0;
+}
+
+/* map @size bytes aligned by @size */
+static void *pool_map_aligned(size_t size)
+{
+	char *p, *aligned;
+
+	p = mmap(NULL, size * 2, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED) {
+		return NULL;
+	}
+
+	aligned = (char *)(((uintptr_t)p + size - 1) & ~(size - 1));
+	if (aligned != p) {
+		munmap(p, aligned - p);
+	}
+	munmap(aligned + size, p + size - aligned);
+	return aligned;
+}
+
+static int pool_chunk_new(fca_pool_t *pool)
+{
+	char *chunk, **chunks;
+
+	if (pool->chunk_nr == POOL_CHUNKS_MAX) {
+		return -1;
+	}
+
+	if (pool->chunk_nr == pool->chunk_alloc) {
+		int n = pool->chunk_alloc ? pool->chunk_alloc * 2 : 16;
+		chunks = realloc(pool->chunks, sizeof(char *) * n);
+		if (chunks == NULL) {
+			return -1;
+		}
+		pool->chunks = chunks;
+		pool->chunk_alloc = n;
+	}
+
+	chunk = pool_map_aligned(pool->chunk_size);
+	if (chunk == NULL) {
+		return -1;
+	}
+	*(uint32_t *)chunk = pool->chunk_nr;
+
+	pool->chunks[pool->chunk_nr++] = chunk + POOL_CHUNK_HEADER;
+	pool->bump = 0;
+
+	/* handle 0 is NULL, so skip the first object */
+	if (pool->chunk_nr == 1) {
+		pool->bump = 1;
+	}
+	return 0;
+}
+
+void *pool_alloc(fca_pool_t *pool)
+{
+	void *obj;
+
+	if (pool->free_head != 0) {
+		obj = pool_ptr(pool, pool->free_head);
+		pool->free_head = *(fca_handle_t *)obj;
+
+	} else {
+		if (pool->bump == POOL_CHUNK_OBJS && pool_chunk_new(pool) < 0) {
+			return NULL;
+		}
+		obj = pool->chunks[pool->chunk_nr - 1] + pool->bump * pool->obj_size;
+		pool->bump++;
+	}
+
+	pool->obj_nr++;
+	return obj;
+}
+
+void pool_free(fca_pool_t *pool, void *obj)
+{
+	*(fca_handle_t *)obj = pool->free_head;
+	pool->free_head = pool_handle(pool, obj);
+	pool->obj_nr--;
+}
+
+/* memory of touched objects */
+size_t pool_memory(fca_pool_t *pool)
+{
+	if (pool->chunk_nr == 0) {
+		return 0;
+	}
+	return ((size_t)(pool->chunk_nr - 1) * POOL_CHUNK_OBJS + pool->bump)
+		* pool->obj_size + pool->chunk_nr * POOL_CHUNK_HEADER;
+}
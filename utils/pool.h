@@ -0,0 +1,60 @@
+/*
+ * Objects of the same size, in big chunks, addressed by 32-bit
+ * handles instead of pointers, in order to save memory.
+ *
+ * Author: Wu Bingzheng
+ *
+ */
+
+#ifndef _FCA_POOL_H_
+#define _FCA_POOL_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* 0 is the NULL handle */
+typedef uint32_t fca_handle_t;
+
+#define POOL_CHUNK_BITS		16
+#define POOL_CHUNK_OBJS		(1 << POOL_CHUNK_BITS)
+#define POOL_CHUNK_HEADER	64
+#define POOL_CHUNKS_MAX		(1 << (32 - POOL_CHUNK_BITS))
+
+typedef struct {
+	unsigned	obj_size;
+	size_t		chunk_size; /* power of 2, chunks are aligned by it */
+
+	char		**chunks;   /* first object of each chunk */
+	int		chunk_nr;
+	int		chunk_alloc;
+
+	/* objects in the last chunk, which have been handed out */
+	int		bump;
+
+	/* freed objects, linked by the first 4 bytes */
+	fca_handle_t	free_head;
+
+	long		obj_nr;
+} fca_pool_t;
+
+void pool_init(fca_pool_t *pool, unsigned obj_size);
+void *pool_alloc(fca_pool_t *pool);
+void pool_free(fca_pool_t *pool, void *obj);
+size_t pool_memory(fca_pool_t *pool);
+
+static inline void *pool_ptr(fca_pool_t *pool, fca_handle_t h)
+{
+	return pool->chunks[h >> POOL_CHUNK_BITS]
+		+ (h & (POOL_CHUNK_OBJS - 1)) * pool->obj_size;
+}
+
+/* the chunk header holds the chunk's index */
+static inline fca_handle_t pool_handle(fca_pool_t *pool, void *obj)
+{
+	uintptr_t base = (uintptr_t)obj & ~(pool->chunk_size - 1);
+	uint32_t chunk = *(uint32_t *)base;
+	uint32_t i = ((uintptr_t)obj - base - POOL_CHUNK_HEADER) / pool->obj_size;
+	return (chunk << POOL_CHUNK_BITS) | i;
+}
+
+#endif
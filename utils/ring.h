@@ -0,0 +1,86 @@
+/*
+ * Bounded lock-free ring of pointers, for one producer thread
+ * and one consumer thread.
+ *
+ * Author: Wu Bingzheng
+ *
+ */
+
+#ifndef _FCA_RING_H_
+#define _FCA_RING_H_
+
+#include <stdlib.h>
+
+#define RING_CACHE_LINE 64
+
+typedef struct {
+	/* consumer side */
+	unsigned long	head;
+	char		_pad1[RING_CACHE_LINE - sizeof(unsigned long)];
+
+	/* producer side */
+	unsigned long	tail;
+	unsigned long	head_cache; /* producer's last view of @head */
+	char		_pad2[RING_CACHE_LINE - 2 * sizeof(unsigned long)];
+
+	unsigned long	mask;
+	void		*slots[];
+} fca_ring_t;
+
+/* @size must be power of 2 */
+static inline fca_ring_t *ring_create(unsigned long size)
+{
+	fca_ring_t *ring = malloc(sizeof(fca_ring_t) + sizeof(void *) * size);
+	if (ring == NULL) {
+		return NULL;
+	}
+	ring->head = ring->tail = ring->head_cache = 0;
+	ring->mask = size - 1;
+	return ring;
+}
+
+static inline void ring_destroy(fca_ring_t *ring)
+{
+	free(ring);
+}
+
+/* producer calls. return 0 if full. */
+static inline int ring_push(fca_ring_t *ring, void *ptr)
+{
+	unsigned long tail = ring->tail;
+
+	if (tail - ring->head_cache > ring->mask) {
+		ring->head_cache = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		if (tail - ring->head_cache > ring->mask) {
+			return 0;
+		}
+	}
+
+	ring->slots[tail & ring->mask] = ptr;
+	__atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+/* consumer calls. return NULL if empty. */
+static inline void *ring_pop(fca_ring_t *ring)
+{
+	unsigned long head = ring->head;
+	void *ptr;
+
+	if (head == __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)) {
+		return NULL;
+	}
+
+	ptr = ring->slots[head & ring->mask];
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+	return ptr;
+}
+
+/* any thread calls, approximately */
+static inline unsigned long ring_count(fca_ring_t *ring)
+{
+	unsigned long head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	return __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) - head;
+}
+
+#endif
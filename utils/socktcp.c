@@ -21,7 +21,7 @@
 
 #include "socktcp.h"
 
-static int idle_fd = -1;
+static __thread int idle_fd = -1;
 
 static int get_tcp_rmem(int *s)
 {
@@ -104,7 +104,8 @@ int set_nonblock(int fd)
 	return fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
 }
 
-int tcp_bind(unsigned short port)
+/* set @reuseport if more than one socket listen on @port */
+int tcp_bind(unsigned short port, int reuseport)
 {
 	int fd, val;
 	struct sockaddr_in servaddr;  
@@ -122,6 +123,9 @@ int tcp_bind(unsigned short port)
 	if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &val, sizeof(int)) < 0) {
 		return -1;
 	}
+	if (reuseport && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &val, sizeof(int)) < 0) {
+		return -1;
+	}
 
 	if (set_defer_accept(fd, 60) < 0) {
 		return -1;
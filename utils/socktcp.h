@@ -8,7 +8,7 @@
 #ifndef _FCA_SOCKTCP_H_
 #define _FCA_SOCKTCP_H_
 
-int tcp_bind(unsigned short port);
+int tcp_bind(unsigned short port, int reuseport);
 int tcp_listen(int fd);
 int tcp_accept(int fd, struct sockaddr_in *client);
 
@@ -56,4 +56,12 @@ static inline time_t timer_now_ms(fca_timer_t *timer)
 	return timer->now_ms;
 }
 
+/* monotonic clock in microseconds, for measuring durations */
+static inline time_t timer_clock_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
 #endif
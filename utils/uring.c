@@ -0,0 +1,145 @@
+/*
+ * Minimal io_uring wrapper, by raw system calls.
+ *
+ * Author: Wu Bingzheng
+ *
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "uring.h"
+
+int uring_init(fca_uring_t *u, unsigned entries)
+{
+	struct io_uring_params p;
+
+	memset(&p, 0, sizeof(p));
+	u->fd = syscall(__NR_io_uring_setup, entries, &p);
+	if (u->fd < 0) {
+		return -1;
+	}
+
+	u->entries = p.sq_entries;
+	u->inflight = 0;
+	u->queued = 0;
+
+	u->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	u->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	u->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+
+	u->sq_ptr = mmap(NULL, u->sq_len, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+	if (u->sq_ptr == MAP_FAILED) {
+		goto fail1;
+	}
+
+	u->cq_ptr = mmap(NULL, u->cq_len, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+	if (u->cq_ptr == MAP_FAILED) {
+		goto fail2;
+	}
+
+	u->sqes = mmap(NULL, u->sqes_len, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+	if (u->sqes == MAP_FAILED) {
+		goto fail3;
+	}
+
+	u->sq_head = (unsigned *)((char *)u->sq_ptr + p.sq_off.head);
+	u->sq_tail = (unsigned *)((char *)u->sq_ptr + p.sq_off.tail);
+	u->sq_mask = (unsigned *)((char *)u->sq_ptr + p.sq_off.ring_mask);
+	u->sq_array = (unsigned *)((char *)u->sq_ptr + p.sq_off.array);
+
+	u->cq_head = (unsigned *)((char *)u->cq_ptr + p.cq_off.head);
+	u->cq_tail = (unsigned *)((char *)u->cq_ptr + p.cq_off.tail);
+	u->cq_mask = (unsigned *)((char *)u->cq_ptr + p.cq_off.ring_mask);
+	u->cqes = (struct io_uring_cqe *)((char *)u->cq_ptr + p.cq_off.cqes);
+	return 0;
+
+fail3:
+	munmap(u->cq_ptr, u->cq_len);
+fail2:
+	munmap(u->sq_ptr, u->sq_len);
+fail1:
+	close(u->fd);
+	return -1;
+}
+
+void uring_destroy(fca_uring_t *u)
+{
+	munmap(u->sqes, u->sqes_len);
+	munmap(u->cq_ptr, u->cq_len);
+	munmap(u->sq_ptr, u->sq_len);
+	close(u->fd);
+}
+
+int uring_prep_write(fca_uring_t *u, int fd, const void *buf,
+		unsigned len, off_t offset, void *data)
+{
+	struct io_uring_sqe *sqe;
+	unsigned tail, index;
+
+	/* CQ has 2*@entries slots, so it never overflows */
+	if (u->inflight >= u->entries) {
+		return -1;
+	}
+
+	tail = *u->sq_tail;
+	index = tail & *u->sq_mask;
+
+	sqe = &u->sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = IORING_OP_WRITE;
+	sqe->fd = fd;
+	sqe->addr = (unsigned long)buf;
+	sqe->len = len;
+	sqe->off = offset;
+	sqe->user_data = (unsigned long)data;
+
+	u->sq_array[index] = index;
+	__atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+	u->inflight++;
+	u->queued++;
+	return 0;
+}
+
+int uring_submit(fca_uring_t *u)
+{
+	int rc;
+
+	if (u->queued == 0) {
+		return 0;
+	}
+
+	do {
+		rc = syscall(__NR_io_uring_enter, u->fd, u->queued, 0, 0, NULL, 0);
+	} while (rc < 0 && errno == EINTR);
+
+	if (rc > 0) {
+		u->queued -= rc;
+	}
+	return rc;
+}
+
+int uring_reap(fca_uring_t *u, void **data, int *res)
+{
+	struct io_uring_cqe *cqe;
+	unsigned head = *u->cq_head;
+
+	if (head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE)) {
+		return 0;
+	}
+
+	cqe = &u->cqes[head & *u->cq_mask];
+	*data = (void *)(unsigned long)cqe->user_data;
+	*res = cqe->res;
+	__atomic_store_n(u->cq_head, head + 1, __ATOMIC_RELEASE);
+
+	u->inflight--;
+	return 1;
+}
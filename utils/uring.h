@@ -0,0 +1,51 @@
+/*
+ * Minimal io_uring wrapper, by raw system calls.
+ *
+ * Author: Wu Bingzheng
+ *
+ */
+
+#ifndef _FCA_URING_H_
+#define _FCA_URING_H_
+
+#include <sys/types.h>
+#include <linux/io_uring.h>
+
+typedef struct {
+	int		fd;
+	unsigned	entries;
+	unsigned	inflight;	/* submitted or queued, not completed */
+	unsigned	queued;		/* queued, not submitted */
+
+	/* submission queue */
+	unsigned	*sq_head;
+	unsigned	*sq_tail;
+	unsigned	*sq_mask;
+	unsigned	*sq_array;
+	struct io_uring_sqe	*sqes;
+
+	/* completion queue */
+	unsigned	*cq_head;
+	unsigned	*cq_tail;
+	unsigned	*cq_mask;
+	struct io_uring_cqe	*cqes;
+
+	void		*sq_ptr;
+	size_t		sq_len;
+	void		*cq_ptr;
+	size_t		cq_len;
+	size_t		sqes_len;
+} fca_uring_t;
+
+int uring_init(fca_uring_t *u, unsigned entries);
+void uring_destroy(fca_uring_t *u);
+
+/* queue a write, return -1 if @entries operations are in flight */
+int uring_prep_write(fca_uring_t *u, int fd, const void *buf,
+		unsigned len, off_t offset, void *data);
+int uring_submit(fca_uring_t *u);
+
+/* return 0 if no completion, otherwise 1 and set @data and @res */
+int uring_reap(fca_uring_t *u, void **data, int *res);
+
+#endif
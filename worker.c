@@ -5,16 +5,41 @@
  *
  */
 
+#define _GNU_SOURCE /* for F_SETPIPE_SZ */
 #include "worker.h"
 
+/* tags the batches in io_uring completions, while requests not */
+#define WORKER_COMBINE_TAG	1UL
+
+/* masters that have dispatched requests in this loop */
+static __thread struct list_head worker_wake_list;
+
+static void worker_channels_close(fca_worker_t *worker, int n)
+{
+	fca_worker_channel_t *ch;
+	int i;
+	for (i = 0; i < n; i++) {
+		ch = &worker->channels[i];
+		epoll_del(master_epoll_fds[i], ch->recycle_fd);
+		close(ch->recycle_fd);
+		ring_destroy(ch->dispatch);
+		ring_destroy(ch->recycle);
+	}
+}
+
 static void worker_destory(fca_worker_t *worker)
 {
+	if (worker->uring != NULL) {
+		epoll_del(worker->epoll_fd, worker->uring->fd);
+		uring_destroy(worker->uring);
+		free(worker->uring);
+	}
+	worker_splice_pipe_close(worker);
+	free(worker->combine);
+	free(worker->combine_spare);
 	epoll_del(worker->epoll_fd, worker->receive_fd);
-	epoll_del(master_epoll_fd, worker->recycle_fd);
+	worker_channels_close(worker, master_nr);
 	close(worker->receive_fd);
-	close(worker->dispatch_fd);
-	close(worker->recycle_fd);
-	close(worker->return_fd);
 	close(worker->epoll_fd);
 	timer_destroy(&worker->timer);
 	free(worker);
@@ -28,6 +53,159 @@ static int worker_check_quit(fca_worker_t *worker)
 	return worker->request_nr == 0;
 }
 
+static void worker_eventfd_write(int fd)
+{
+	uint64_t one = 1;
+	if (write(fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+		log_error_run(errno, "worker_eventfd_write");
+	}
+}
+
+static void worker_eventfd_read(int fd)
+{
+	uint64_t count;
+	if (read(fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+		log_error_run(errno, "worker_eventfd_read");
+	}
+}
+
+/* push @r into the recycle ring of its master */
+static int worker_do_request_return(fca_worker_t *worker, fca_request_t *r)
+{
+	int index = r->master_index;
+
+	r->worker_thread = NULL;
+	if (!ring_push(worker->channels[index].recycle, r)) {
+		r->worker_thread = worker;
+		return FCA_ERROR;
+	}
+
+	/* @r may be owned by the master now */
+	worker->recycle_pending |= 1UL << index;
+	return FCA_OK;
+}
+
+/* retry the requests blocked by full recycle rings */
+static void worker_request_unblock(fca_worker_t *worker)
+{
+	struct list_head *p, *safe;
+	fca_request_t *r;
+	list_for_each_safe(p, safe, &worker->blocked_requests) {
+		r = list_entry(p, fca_request_t, rnode);
+		list_del(&r->rnode);
+		if (worker_do_request_return(worker, r) == FCA_ERROR) {
+			list_add_tail(&r->rnode, safe);
+		}
+	}
+}
+
+/* wake up the masters, which we returned requests to in this loop */
+static void worker_recycle_wakeup(fca_worker_t *worker)
+{
+	uint64_t pending = worker->recycle_pending;
+	int i;
+
+	worker->recycle_pending = 0;
+	while (pending != 0) {
+		i = __builtin_ctzll(pending);
+		pending &= pending - 1;
+
+		worker_eventfd_write(worker->channels[i].recycle_fd);
+		worker->recycle_wakeups++;
+	}
+}
+
+static void worker_combine_done(fca_worker_t *worker,
+		fca_worker_combine_t *c, ssize_t rc, int err)
+{
+	fca_request_t *r;
+	int i;
+
+	if (rc != (ssize_t)c->len) {
+		log_error_run(err, "write combined, off:%ld, len:%ld, ret:%ld",
+				c->offset, c->len, rc);
+	}
+
+	for (i = 0; i < c->request_nr; i++) {
+		r = c->requests[i];
+		if (rc != (ssize_t)c->len && !r->disk_error) {
+			r->http_code = 500;
+			r->disk_error = 1;
+			r->error_reason = "WriteDiskError";
+			r->error_number = err;
+		}
+		if (--r->combine_pending == 0 && r->combine_waiting) {
+			r->combine_waiting = 0;
+			r->event_handler(r);
+		}
+	}
+
+	if (worker->combine_spare == NULL) {
+		worker->combine_spare = c;
+	} else {
+		free(c);
+	}
+}
+
+static int worker_uring_create(fca_worker_t *worker);
+
+static int worker_uring_ready(fca_worker_t *worker)
+{
+	if (!device_io_uring || worker->uring_failed) {
+		return 0;
+	}
+	if (worker->uring == NULL && worker_uring_create(worker) != FCA_OK) {
+		worker->uring_failed = 1;
+		return 0;
+	}
+	return 1;
+}
+
+/* write the batch into device, by io_uring if possible */
+static void worker_combine_flush(fca_worker_t *worker)
+{
+	fca_worker_combine_t *c = worker->combine;
+	ssize_t rc;
+
+	if (c == NULL || c->len == 0) {
+		return;
+	}
+
+	worker->combine = NULL;
+	worker->combine_flushes++;
+
+	if (worker_uring_ready(worker) && uring_prep_write(worker->uring,
+				c->fd, c->buf, c->len, c->offset,
+				(void *)((uintptr_t)c | WORKER_COMBINE_TAG)) == 0) {
+		return;
+	}
+
+	rc = pwrite(c->fd, c->buf, c->len, c->offset);
+	worker_combine_done(worker, c, rc, errno);
+}
+
+/* reap completed disk writes */
+static void worker_disk_complete(fca_worker_t *worker)
+{
+	fca_request_t *r;
+	void *data;
+	int res;
+
+	while (uring_reap(worker->uring, &data, &res)) {
+		if ((uintptr_t)data & WORKER_COMBINE_TAG) {
+			worker_combine_done(worker, (fca_worker_combine_t *)
+					((uintptr_t)data & ~WORKER_COMBINE_TAG),
+					res, res < 0 ? -res : 0);
+			continue;
+		}
+
+		r = data;
+		r->disk_writing = 0;
+		r->io_result = res;
+		r->event_handler(r);
+	}
+}
+
 static void *worker_entry(void *data)
 {
 #define MAX_EVENTS 512
@@ -40,16 +218,19 @@ static void *worker_entry(void *data)
 	void *ptr;
 
 	pthread_detach(pthread_self());
+	thread_timer = &worker->timer;
 
 	while (worker->quit_time == 0 || !worker_check_quit(worker)) {
 
-		rc = epoll_wait(worker->epoll_fd, events, MAX_EVENTS, 1000);
+		/* wait shortly if any blocked requests */
+		rc = epoll_wait(worker->epoll_fd, events, MAX_EVENTS,
+				list_empty(&worker->blocked_requests) ? 1000 : 1);
 		if (rc == -1) {
 			log_error_run(errno, "worker epoll_wait");
 		}
 
-		/* try return_fd, if any blocked requests */
-		request_clean(&worker->blocked_requests, 0);
+		/* try recycle rings, if any blocked requests */
+		worker_request_unblock(worker);
 
 		/* ready events */
 		timer_refresh(&worker->timer);
@@ -60,9 +241,13 @@ static void *worker_entry(void *data)
 			ptr = (void *)(((uintptr_t)ptr) & ~EVENT_TYPE_MASK);
 
 			/* @receive_fd is ready */
-			if (type == EVENT_TYPE_PIPE) {
+			if (type == EVENT_TYPE_PIPE && ptr == NULL) {
 				worker_request_receive(worker);
 
+			/* disk writes are completed */
+			} else if (type == EVENT_TYPE_PIPE) {
+				worker_disk_complete(worker);
+
 			/* ready requests */
 			} else {
 				r = ptr;
@@ -79,6 +264,16 @@ static void *worker_entry(void *data)
 			/* request_timeout_handler() will delete @p from @expires */
 			request_timeout_handler(r);
 		}
+
+		advise_expire(&worker->advise, timer_now(&worker->timer));
+
+		/* the batch is flushed before the requests in it finish */
+		worker_combine_flush(worker);
+
+		if (worker->uring != NULL && uring_submit(worker->uring) < 0) {
+			log_error_run(errno, "io_uring_enter");
+		}
+		worker_recycle_wakeup(worker);
 	}
 
 	worker_destory(worker);
@@ -88,45 +283,50 @@ static void *worker_entry(void *data)
 fca_worker_t *worker_create(void)
 {
 	fca_worker_t *worker;
-	int fd[2];
+	fca_worker_channel_t *ch;
+	int i = 0;
 
 	worker = malloc(sizeof(fca_worker_t));
 	if (worker == NULL) {
 		goto fail0;
 	}
 
-	/* 2 pipes. */
-	if (pipe(fd) < 0) {
+	/* eventfd for masters to wake the worker up */
+	worker->receive_fd = eventfd(0, EFD_NONBLOCK);
+	if (worker->receive_fd < 0) {
 		goto fail1;
 	}
-	worker->receive_fd = fd[0];
-	worker->dispatch_fd = fd[1];
-	if (set_nonblock(fd[0]) < 0 || set_nonblock(fd[1]) < 0) {
-		goto fail2;
-	}
-
-	if (pipe(fd) < 0) {
-		goto fail2;
-	}
-	worker->recycle_fd = fd[0];
-	worker->return_fd = fd[1];
-	if (set_nonblock(fd[0]) < 0 || set_nonblock(fd[1]) < 0) {
-		goto fail3;
-	}
 
-	/* create epoll, and add recycle_fd */
+	/* create epoll, and add receive_fd */
 	worker->epoll_fd = epoll_create(100);
 	if (worker->epoll_fd < 0) {
-		goto fail3;
+		goto fail2;
 	}
 
 	if (epoll_add_read(worker->epoll_fd, worker->receive_fd,
 			(void *)EVENT_TYPE_PIPE) < 0) {
-		goto fail4;
+		goto fail3;
 	}
-	if (epoll_add_read(master_epoll_fd, worker->recycle_fd,
-			(void *)((uintptr_t)worker | EVENT_TYPE_PIPE))) {
-		goto fail5;
+
+	/* channels, one for each master */
+	for (i = 0; i < master_nr; i++) {
+		ch = &worker->channels[i];
+		ch->dispatch = ring_create(WORKER_RING_SIZE);
+		ch->recycle = ring_create(WORKER_RING_SIZE);
+		ch->recycle_fd = eventfd(0, EFD_NONBLOCK);
+		if (ch->dispatch == NULL || ch->recycle == NULL
+				|| ch->recycle_fd < 0
+				|| epoll_add_read(master_epoll_fds[i], ch->recycle_fd,
+					(void *)((uintptr_t)worker | EVENT_TYPE_PIPE)) < 0) {
+			if (ch->recycle_fd >= 0) {
+				close(ch->recycle_fd);
+			}
+			ring_destroy(ch->dispatch);
+			ring_destroy(ch->recycle);
+			goto fail4;
+		}
+		ch->worker = worker;
+		ch->wake_pending = 0;
 	}
 
 	/* each worker thread has its own timer */
@@ -134,29 +334,36 @@ fca_worker_t *worker_create(void)
 
 	worker->quit_time = 0;
 	worker->request_nr = 0;
+	worker->recycle_pending = 0;
+	worker->uring = NULL;
+	worker->uring_failed = 0;
+	worker->splice_fds[0] = worker->splice_fds[1] = -1;
+	worker->combine = NULL;
+	worker->combine_spare = NULL;
+	bzero(&worker->advise, sizeof(fca_advise_t));
+	worker->wakeups = 0;
+	worker->recycle_wakeups = 0;
+	worker->combine_writes = 0;
+	worker->combine_flushes = 0;
 	INIT_LIST_HEAD(&worker->working_requests);
 	INIT_LIST_HEAD(&worker->blocked_requests);
 
 	/* create thread */
 	if (pthread_create(&worker->tid, NULL, worker_entry, worker) != 0) {
-		goto fail6;
+		goto fail5;
 	}
 
 	return worker;;
 
-fail6:
-	timer_destroy(&worker->timer);
-	epoll_del(master_epoll_fd, worker->recycle_fd);
 fail5:
-	epoll_del(worker->epoll_fd, worker->receive_fd);
+	timer_destroy(&worker->timer);
 fail4:
-	close(worker->epoll_fd);
+	worker_channels_close(worker, i);
+	epoll_del(worker->epoll_fd, worker->receive_fd);
 fail3:
-	close(worker->recycle_fd);
-	close(worker->return_fd);
+	close(worker->epoll_fd);
 fail2:
 	close(worker->receive_fd);
-	close(worker->dispatch_fd);
 fail1:
 	free(worker);
 fail0:
@@ -168,104 +375,282 @@ void worker_delete(fca_worker_t *worker, time_t quit_time)
 	worker->quit_time = quit_time ? quit_time : BIG_TIME;
 }
 
-/* worker_request_dispatch() and worker_request_return() call this, to
- * send @r into @target thread. */
-static int worker_do_request_write(fca_request_t *r, req_handler_f *handler, fca_worker_t *target)
+/* master call this to dispatch a request to some worker */
+int worker_request_dispatch(fca_request_t *r, req_handler_f *handler)
 {
-	fca_worker_t *old = r->worker_thread;
-	int fd = target ? target->dispatch_fd : old->return_fd;
-	int rc;
+	if (r->item == NULL) {
+		/* no item, so no device, no worker thread,
+		 * so cannot dispatch to a worker */
+		handler(r);
+		return FCA_OK;
+	}
+
+	fca_worker_t *target = device_worker_pick(device_of_item(r->item));
+	fca_worker_channel_t *ch = &target->channels[master_index];
+
+	r->dispatch_time = timer_clock_us();
 
 	event_del(r);
 	r->event_handler = handler;
-
 	r->worker_thread = target;
 	list_del(&r->rnode);
+	__sync_fetch_and_add(&target->request_nr, 1);
 
-	rc = write(fd, &r, sizeof(fca_request_t *));
-	if (rc < 0) {
-		r->worker_thread = old;
-		list_add(&r->rnode, old ? &old->blocked_requests : &master_requests);
-		log_error_run(errno, "worker_do_request_write (%p)", target);
+	if (!ring_push(ch->dispatch, r)) {
+		__sync_fetch_and_sub(&target->request_nr, 1);
+		r->worker_thread = NULL;
+		list_add(&r->rnode, &master_requests);
+		errno = EAGAIN;
 		return FCA_ERROR;
 	}
 
-	if (rc != sizeof(fca_request_t *)) {
-		log_error_run(0, "!!! worker_do_request_write (%p) %d", target, rc);
-		exit(1);
+	/* wake the worker up at the end of this loop */
+	if (!ch->wake_pending) {
+		ch->wake_pending = 1;
+		list_add(&ch->wake_node, &worker_wake_list);
 	}
-
 	return FCA_OK;
 }
 
-/* master call this to dispatch a request to some worker */
-int worker_request_dispatch(fca_request_t *r, req_handler_f *handler)
+/* master call this when the thread starts */
+void worker_master_init(void)
 {
-	if (r->item == NULL) {
-		/* no item, so no device, no worker thread,
-		 * so cannot dispatch to a worker */
-		handler(r);
-		return FCA_OK;
-	}
+	INIT_LIST_HEAD(&worker_wake_list);
+}
 
-	fca_worker_t *target = device_of_item(r->item)->worker;
-	int rc = worker_do_request_write(r, handler, target);
-	if (rc == FCA_OK) {
-		target->request_nr++;
-	}
+/* master call this at the end of each loop, to wake up the workers
+ * which we dispatched requests to in this loop */
+void worker_wakeup_flush(void)
+{
+	fca_worker_channel_t *ch;
 
-	return rc;
+	while (!list_empty(&worker_wake_list)) {
+		ch = list_entry(worker_wake_list.next, fca_worker_channel_t, wake_node);
+		list_del(&ch->wake_node);
+		ch->wake_pending = 0;
+
+		worker_eventfd_write(ch->worker->receive_fd);
+		__sync_fetch_and_add(&ch->worker->wakeups, 1);
+	}
 }
 
 /* worker call this to return a finished request to master */
 int worker_request_return(fca_request_t *r, req_handler_f *handler)
 {
-	return worker_do_request_write(r, handler, NULL);
+	fca_worker_t *worker = r->worker_thread;
+
+	event_del(r);
+	r->event_handler = handler;
+	list_del(&r->rnode);
+
+	/* the recycle ring is full, retry in next loop */
+	if (worker_do_request_return(worker, r) == FCA_ERROR) {
+		list_add(&r->rnode, &worker->blocked_requests);
+	}
+	return FCA_OK;
 }
 
+static int worker_uring_create(fca_worker_t *worker)
+{
+	fca_uring_t *u = malloc(sizeof(fca_uring_t));
+	if (u == NULL) {
+		return FCA_ERROR;
+	}
+	if (uring_init(u, WORKER_URING_DEPTH) < 0) {
+		log_error_run(errno, "io_uring_setup");
+		free(u);
+		return FCA_ERROR;
+	}
+	if (epoll_add_read(worker->epoll_fd, u->fd,
+			(void *)((uintptr_t)u | EVENT_TYPE_PIPE)) < 0) {
+		uring_destroy(u);
+		free(u);
+		return FCA_ERROR;
+	}
+
+	worker->uring = u;
+	return FCA_OK;
+}
 
-/* worker_request_recycle() and worker_request_receive() call this, to
- * read requests from @fd, and add it @target. */
-static int worker_do_request_read(int fd, struct list_head *target)
+/* worker call this to write @buf into device asynchronously, and
+ * @handler will be called with @r->io_result set after completion.
+ * @buf must be kept until then.
+ * Return FCA_DECLINE if io_uring is not used, or too many writes
+ * are in flight, and the caller should write synchronously. */
+int worker_disk_write(fca_request_t *r, int fd, void *buf, size_t len,
+		off_t offset, req_handler_f *handler)
 {
-	fca_request_t *reqs[50], *r;
-	int rc, i, count = 0;
-
-	do {
-		rc = read(fd, reqs, sizeof(reqs));
-		if (rc < 0) {
-			if (errno != EAGAIN) {
-				log_error_run(errno, "worker_do_request_read (%p)", target);
-			}
-			break;
-		}
+	fca_worker_t *worker = r->worker_thread;
 
-		if (rc & (sizeof(fca_request_t *) - 1)) {
-			log_error_run(0, "!!! worker_do_request_read (%p) %d", target, rc);
-			exit(1);
+	if (!worker_uring_ready(worker)) {
+		return FCA_DECLINE;
+	}
+
+	if (uring_prep_write(worker->uring, fd, buf, len, offset, r) < 0) {
+		return FCA_DECLINE;
+	}
+
+	/* no socket event or timeout while writing */
+	event_del(r);
+	r->event_handler = handler;
+	r->io_length = len;
+	r->disk_writing = 1;
+	return FCA_OK;
+}
+
+/* worker call this to copy @buf into the batch of combined writes,
+ * which is flushed at the end of this loop, or before a write not
+ * adjacent to it. @r must wait for the flush before it finishes, by
+ * worker_disk_combine_wait().
+ * Return FCA_DECLINE if write-combining is off, or @len is too big,
+ * and the caller should write by itself. */
+int worker_disk_combine(fca_request_t *r, int fd, void *buf, size_t len,
+		off_t offset)
+{
+	fca_worker_t *worker = r->worker_thread;
+	fca_worker_combine_t *c = worker->combine;
+
+	if (!device_write_combine || len > WORKER_COMBINE_SIZE / 4) {
+		return FCA_DECLINE;
+	}
+
+	if (c != NULL && (c->fd != fd || c->offset + c->len != (size_t)offset
+				|| c->len + len > WORKER_COMBINE_SIZE
+				|| c->request_nr == WORKER_COMBINE_REQUESTS)) {
+		worker_combine_flush(worker);
+		c = NULL;
+	}
+
+	if (c == NULL) {
+		c = worker->combine_spare;
+		worker->combine_spare = NULL;
+		if (c == NULL && (c = malloc(sizeof(fca_worker_combine_t))) == NULL) {
+			return FCA_DECLINE;
 		}
+		c->fd = fd;
+		c->offset = offset;
+		c->len = 0;
+		c->request_nr = 0;
+		worker->combine = c;
+	}
 
-		for (i = 0; i < rc / sizeof(fca_request_t *); i++) {
-			r = reqs[i];
-			list_add(&r->rnode, target);
-			r->event_handler(r);
-			count++;
+	memcpy(c->buf + c->len, buf, len);
+	c->len += len;
+	if (c->request_nr == 0 || c->requests[c->request_nr - 1] != r) {
+		c->requests[c->request_nr++] = r;
+		r->combine_pending++;
+	}
+	worker->combine_writes++;
+	return FCA_OK;
+}
+
+/* worker call this before finishing @r. If any batch holding its
+ * writes is not flushed yet, @handler will be called after that.
+ * Return FCA_DECLINE if no need to wait. */
+int worker_disk_combine_wait(fca_request_t *r, req_handler_f *handler)
+{
+	if (r->combine_pending == 0) {
+		return FCA_DECLINE;
+	}
+
+	/* no socket event or timeout while waiting */
+	event_del(r);
+	r->event_handler = handler;
+	r->combine_waiting = 1;
+	return FCA_OK;
+}
+
+/* worker call this to get the pipe for splice */
+int *worker_splice_pipe(fca_worker_t *worker)
+{
+	if (worker->splice_fds[0] == -1) {
+		if (pipe(worker->splice_fds) < 0) {
+			log_error_run(errno, "create splice pipe");
+			worker->splice_fds[0] = worker->splice_fds[1] = -1;
+			return NULL;
 		}
 
-	} while (rc == sizeof(reqs));
+		/* a larger pipe moves more in each splice() */
+		fcntl(worker->splice_fds[1], F_SETPIPE_SZ, WORKER_SPLICE_PIPE_SIZE);
+	}
+	return worker->splice_fds;
+}
 
-	return count;
+/* worker call this to drop the pipe, if some data is left in it */
+void worker_splice_pipe_close(fca_worker_t *worker)
+{
+	if (worker->splice_fds[0] != -1) {
+		close(worker->splice_fds[0]);
+		close(worker->splice_fds[1]);
+		worker->splice_fds[0] = worker->splice_fds[1] = -1;
+	}
 }
 
-/* master call this to recycle a finished request from worker */
+/* master call this to recycle finished requests from worker */
 void worker_request_recycle(fca_worker_t *worker)
 {
-	int count = worker_do_request_read(worker->recycle_fd, &master_requests);
-	worker->request_nr -= count;
+	fca_ring_t *ring = worker->channels[master_index].recycle;
+	fca_request_t *r;
+	int count = 0;
+
+	worker_eventfd_read(worker->channels[master_index].recycle_fd);
+
+	while ((r = ring_pop(ring)) != NULL) {
+		list_add(&r->rnode, &master_requests);
+		r->event_handler(r);
+		count++;
+	}
+
+	__sync_fetch_and_sub(&worker->request_nr, count);
 }
 
-/* worker call this to receive a request from master */
+/* worker call this to receive requests from masters */
 void worker_request_receive(fca_worker_t *worker)
 {
-	worker_do_request_read(worker->receive_fd, &worker->working_requests);
+	fca_request_t *r;
+	int i;
+
+	worker_eventfd_read(worker->receive_fd);
+
+	for (i = 0; i < master_nr; i++) {
+		while ((r = ring_pop(worker->channels[i].dispatch)) != NULL) {
+			r->pickup_time = timer_clock_us();
+			list_add(&r->rnode, &worker->working_requests);
+			r->event_handler(r);
+		}
+	}
+}
+
+/* the requests of each thread as "3/0/1", and the sums of others */
+void worker_status(FILE *filp, fca_worker_t **workers, int n)
+{
+	unsigned long dispatch_depth = 0, recycle_depth = 0;
+	unsigned long wakeups = 0, recycle_wakeups = 0;
+	unsigned long combine_writes = 0, combine_flushes = 0;
+	unsigned long dontneed_bytes = 0, willneed_bytes = 0, sequentials = 0;
+	fca_worker_t *worker;
+	int i, j;
+
+	fprintf(filp, "%d ", n);
+	for (j = 0; j < n; j++) {
+		worker = workers[j];
+		fprintf(filp, j == 0 ? "%d" : "/%d", worker->request_nr);
+
+		for (i = 0; i < master_nr; i++) {
+			dispatch_depth += ring_count(worker->channels[i].dispatch);
+			recycle_depth += ring_count(worker->channels[i].recycle);
+		}
+		wakeups += worker->wakeups;
+		recycle_wakeups += worker->recycle_wakeups;
+		combine_writes += worker->combine_writes;
+		combine_flushes += worker->combine_flushes;
+		dontneed_bytes += worker->advise.dontneed_bytes;
+		willneed_bytes += worker->advise.willneed_bytes;
+		sequentials += worker->advise.sequentials;
+	}
+
+	fprintf(filp, " %lu %lu %lu %lu %lu %lu %lu %lu %lu",
+			dispatch_depth, recycle_depth, wakeups, recycle_wakeups,
+			combine_writes, combine_flushes, dontneed_bytes,
+			willneed_bytes, sequentials);
 }
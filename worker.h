@@ -10,6 +10,37 @@
 
 #include "fcache.h"
 
+#define WORKER_RING_SIZE	4096
+#define WORKER_URING_DEPTH	64
+#define WORKER_SPLICE_PIPE_SIZE	(1024*1024)
+#define WORKER_COMBINE_SIZE	(1024*1024)
+#define WORKER_COMBINE_REQUESTS	256
+
+/* adjacent PUT writes gathered in memory, and flushed by one write */
+typedef struct {
+	int		fd;
+	off_t		offset;
+	size_t		len;
+	int		request_nr;
+	fca_request_t	*requests[WORKER_COMBINE_REQUESTS];
+	char		buf[WORKER_COMBINE_SIZE];
+} fca_worker_combine_t;
+
+/* one channel between each master and the worker */
+typedef struct {
+	fca_ring_t		*dispatch;	/* master -> worker */
+	fca_ring_t		*recycle;	/* worker -> master */
+
+	/* eventfd in master's epoll, worker writes it to wake master up */
+	int			recycle_fd;
+
+	/* master has dispatched requests in this loop, and will wake
+	 * the worker up at the end of the loop. */
+	struct list_head	wake_node;
+	int			wake_pending;
+	fca_worker_t		*worker;
+} fca_worker_channel_t;
+
 struct fca_worker_s {
 	struct list_head	working_requests;
 	struct list_head	blocked_requests;
@@ -19,32 +50,61 @@ struct fca_worker_s {
 	pthread_t	tid;
 	int		epoll_fd;
 
-	/* only master update this, and worker check this. */
+	/* only masters update this (atomically), and worker check this. */
 	int		request_nr;
 
 	/**
-	 * two pipes.
-	 * 1. master write request into @dispatch_fd, worker read
-	 *    @receive_fd to receive request;
-	 * 2. worker write the finished requests into @return_fd,
-	 *    and master receive the requests from @receive_fd.
+	 * 1. masters push requests into channels[master_index].dispatch,
+	 *    and write @receive_fd to wake the worker up;
+	 * 2. worker pushes the finished requests into @recycle of the
+	 *    request's master channel, and writes its @recycle_fd.
+	 * Wake-ups are coalesced, at most one per loop for each channel.
 	 **/
-	int		recycle_fd;
-	int		dispatch_fd;
-	int		receive_fd;
-	int		return_fd;
+	int			receive_fd;
+	uint64_t		recycle_pending; /* bitmap of masters to wake */
+	fca_worker_channel_t	channels[MASTERS_LIMIT];
+
+	/* for asynchronous disk writes, created when used firstly */
+	fca_uring_t	*uring;
+	int		uring_failed;
+
+	/* for splicing PUT bodies into device, created when used firstly */
+	int		splice_fds[2];
+
+	/* the batch of combined writes being filled, and a spare one to
+	 * reuse, created when used firstly */
+	fca_worker_combine_t	*combine;
+	fca_worker_combine_t	*combine_spare;
+
+	/* page cache advice of the device */
+	fca_advise_t	advise;
 
+	/* statistics */
+	unsigned long	wakeups;	/* masters wake worker */
+	unsigned long	recycle_wakeups; /* worker wakes masters */
+	unsigned long	combine_writes;	/* writes into batches */
+	unsigned long	combine_flushes; /* batches written into device */
 };
 
 fca_worker_t *worker_create(void);
 void worker_delete(fca_worker_t *worker, time_t quit_time);
 
 /* master calls */
+void worker_master_init(void);
 int worker_request_dispatch(fca_request_t *r, req_handler_f *handler);
 void worker_request_recycle(fca_worker_t *worker);
+void worker_wakeup_flush(void);
+void worker_status(FILE *filp, fca_worker_t **workers, int n);
 
 /* worker calls */
 int worker_request_return(fca_request_t *r, req_handler_f *handler);
+int worker_disk_write(fca_request_t *r, int fd, void *buf, size_t len,
+		off_t offset, req_handler_f *handler);
+int worker_disk_combine(fca_request_t *r, int fd, void *buf, size_t len,
+		off_t offset);
+int worker_disk_combine_wait(fca_request_t *r, req_handler_f *handler);
+int *worker_splice_pipe(fca_worker_t *worker);
+void worker_splice_pipe_close(fca_worker_t *worker);
 void worker_request_receive(fca_worker_t *worker);
 
 #endif